@@ -42,6 +42,7 @@
 #include <sys/mount.h>
 #include <sys/types.h>
 #include <sys/sysctl.h>
+#include <stdbool.h>
 
 #include "enums.h"
 #include "structs.h"
@@ -50,8 +51,6 @@
 #include "bless_private.h"
 #include "protos.h"
 
-struct clarg actargs[klast];
-
 /*
  * To add an option, allocate an enum in enums.h, add a getopt_long entry here,
  * add to main(), add to usage and man page
@@ -110,52 +109,54 @@ static struct option longopts[] = {
 { "verbose",        no_argument,            0,              kverbose },
 { "version",        no_argument,            0,              kversion },
 { "snapshot",       required_argument,      0,              ksnapshot },
+{ "scanimages",     required_argument,      0,              kscanimages },
+{ "jobs",           required_argument,      0,              kjobs },
+{ "trace",          required_argument,      0,              ktrace },
+{ "timing",         no_argument,            0,              ktiming },
+{ "container",      required_argument,      0,              kcontainer },
+{ "batch",          required_argument,      0,              kbatch },
+{ "stop-on-error",  no_argument,            0,              kstoponerror },
+{ "serve",          required_argument,      0,              kserve },
 { 0,            0,                      0,              0 }
 };
 
 extern char *optarg;
 extern int optind;
+extern int optreset;
+extern double blessVersionNumber;
 
-int main (int argc, char * argv[])
+/*
+ * Fill actargs from argv. Returns 0, or 1 after a warning for a bad or
+ * repeated option. Batch lines can't ask for help or the version, and a
+ * bad batch line never exits. *nextArg is where the operands start.
+ */
+int parseArguments(int argc, char * argv[], struct clarg actargs[klast], struct blesscon *bcon,
+                   bool batch, int *nextArg)
 {
-
     int ch, longindex;
-    BLContext context;
-    struct blesscon bcon;
-    extern double blessVersionNumber;
-
-    bcon.quiet = 0;
-    bcon.verbose = 0;
-
-    context.version = 0;
-    context.logstring = blesslog;
-    context.logrefcon = &bcon;
-
-    if(argc == 1) {
-        usage_short();
-    }
-    
-    if(getenv("BL_PRINT_ARGUMENTS")) {
-        int i;
-        for(i=0; i < argc; i++) {
-            fprintf(stderr, "argv[%d] = '%s'\n", i, argv[i]);
-        }
-    }
-    
 
-    
+    optreset = 1;
+    optind = 1;
     while ((ch = getopt_long_only(argc, argv, "", longopts, &longindex)) != -1) {
         
         switch(ch) {
             case khelp:
+                if(batch) {
+                    warnx("Option \"help\" can't be used in a batch");
+                    return 1;
+                }
                 usage();
                 break;
             case kquiet:
                 break;
             case kverbose:
-                bcon.verbose = 1;
+                bcon->verbose = 1;
                 break;
             case kversion:
+                if(batch) {
+                    warnx("Option \"version\" can't be used in a batch");
+                    return 1;
+                }
                 printf("%.1f\n", blessVersionNumber);
                 exit(0);
                 break;
@@ -166,12 +167,12 @@ int main (int argc, char * argv[])
                 // ignore, this is now always saved as alternateos
                 break;
 			case kbootblockfile:
-				errx(1, "The bootblockfile option is now obsolete.");
-				break;
+				warnx("The bootblockfile option is now obsolete.");
+				if(!batch) exit(1);
+				return 1;
             case '?':
             case ':':
-                usage_short();
-                break;
+                return 1;
             default:
                 // common handling for all other options
             {
@@ -180,8 +181,7 @@ int main (int argc, char * argv[])
                 
                 if(actargs[ch].present) {
                     warnx("Option \"%s\" already specified", opt->name);
-                    usage_short();
-                    break;
+                    return 1;
                 } else {
                     actargs[ch].present = 1;
                 }
@@ -208,38 +208,198 @@ int main (int argc, char * argv[])
         }
     }
 
-    argc -= optind;
-    argc += optind;
-    
-    /* There are 5 public modes of execution: info, device, folder, netboot, unbless
-     * There is 1 private mode: firmware
-     * These are all one-way function jumps.
-     */
+    *nextArg = optind;
+    return 0;
+}
+
+/* There are 7 public modes of execution: info, device, folder, netboot, unbless, scanimages, container
+ * There is 1 private mode: firmware
+ * Exactly one of them runs. --batch runs this once per line.
+ */
+int runMode(BLContextPtr context, struct clarg actargs[klast], int argc, char * argv[])
+{
+    int ret;
 
     /* If it was requested, print out the Finder Info words */
     if(actargs[kinfo].present || actargs[kgetboot].present) {
-        return modeInfo(&context, actargs);
+        ret = modeInfo(context, actargs);
+    } else if(actargs[kdevice].present) {
+        ret = modeDevice(context, actargs);
+    } else if(actargs[kfirmware].present) {
+		ret = modeFirmware(context, actargs);
+	} else if(actargs[knetboot].present) {
+		ret = modeNetboot(context, actargs);
+	} else if (actargs[kunbless].present) {
+		ret = modeUnbless(context, actargs);
+	} else if (actargs[kscanimages].present) {
+		ret = modeScanImages(context, actargs, argc, argv);
+	} else if (actargs[kcontainer].present) {
+		ret = modeContainer(context, actargs);
+	} else {
+		/* default */
+		if(actargs[ktiming].present) {
+			context->timing = BLTimingCountersCreate();
+			if(!context->timing) {
+				errx(1, "Can't allocate timing counters");
+			}
+		}
+		ret = modeFolder(context, actargs);
+	}
+	return ret;
+}
+
+int main (int argc, char * argv[])
+{
+
+    int ret, nextArg;
+    uint64_t span;
+    BLContext context;
+    struct blesscon bcon;
+    struct clarg actargs[klast];
+
+    memset(actargs, 0, sizeof actargs);
+    bcon.quiet = 0;
+    bcon.verbose = 0;
+
+    context.version = kBLContextVersion9;
+    context.logstring = blesslog;
+    context.logrefcon = &bcon;
+    context.loglevels = blessloglevels(&bcon);
+    context.tracebuffer = NULL;
+    context.timing = NULL;
+    context.syncbatch = NULL;
+    context.mounttable = NULL;
+    context.topology = NULL;
+    context.mountleases = NULL;
+    context.nvramcache = NULL;
+    context.diskdescriptions = NULL;
+
+    if(argc == 1) {
+        usage_short();
+    }
+    
+    if(getenv("BL_PRINT_ARGUMENTS")) {
+        int i;
+        for(i=0; i < argc; i++) {
+            fprintf(stderr, "argv[%d] = '%s'\n", i, argv[i]);
+        }
     }
+    
+
+    
+    if(parseArguments(argc, argv, actargs, &bcon, false, &nextArg)) {
+        usage_short();
+    }
+    
+    context.loglevels = blessloglevels(&bcon);
+    
+    if(actargs[ktrace].present) {
+        context.tracebuffer = BLTraceBufferCreate(kBLTraceDefaultCapacity);
+        if(!context.tracebuffer) {
+            errx(1, "Can't allocate trace buffer");
+        }
+    }
+    
+    span = BLTraceBegin(&context);
 
-    if(actargs[kdevice].present) {
-        return modeDevice(&context, actargs);
+    /* Files written by any mode are synced to disk together at the end */
+    context.syncbatch = BLSyncBatchCreate();
+    if(!context.syncbatch) {
+        errx(1, "Can't allocate sync batch");
     }
 
-	if(actargs[kfirmware].present) {
-		return modeFirmware(&context, actargs);
-	}
+    /* Every mode looks up where volumes are mounted, often more than once */
+    context.mounttable = BLMountTableCreate();
+    if(!context.mounttable) {
+        errx(1, "Can't create mount table");
+    }
+
+    /* ...and how its disks fit together. Read from the registry on first use */
+    if(getenv("BL_TOPOLOGY_SNAPSHOT")) {
+        if(BLTopologyCreateFromSnapshot(&context, getenv("BL_TOPOLOGY_SNAPSHOT"), &context.topology)) {
+            errx(1, "Can't read disk topology from %s", getenv("BL_TOPOLOGY_SNAPSHOT"));
+        }
+    } else {
+        context.topology = BLTopologyCreate();
+    }
+    if(!context.topology) {
+        errx(1, "Can't create disk topology");
+    }
+
+    /*
+     * NVRAM variables are read once and kept until bless writes NVRAM
+     * itself. A service can't see other writers, so it only trusts them
+     * for a moment
+     */
+    if(getenv("BL_NVRAM_FILE")) {
+        if(BLNVRAMCacheCreateWithFile(&context, getenv("BL_NVRAM_FILE"), &context.nvramcache)) {
+            errx(1, "Can't read NVRAM variables from %s", getenv("BL_NVRAM_FILE"));
+        }
+    } else {
+        context.nvramcache = BLNVRAMCacheCreate(actargs[kserve].present ? kServeNVRAMMaxAgeMillis : 0);
+        if(!context.nvramcache) {
+            errx(1, "Can't allocate NVRAM cache");
+        }
+    }
+
+    /* DiskArbitration is asked over one session, once per disk */
+    if(getenv("BL_DISK_DESCRIPTIONS")) {
+        if(BLDiskDescriptionsCreateWithFile(&context, getenv("BL_DISK_DESCRIPTIONS"), &context.diskdescriptions)) {
+            errx(1, "Can't read disk descriptions from %s", getenv("BL_DISK_DESCRIPTIONS"));
+        }
+    } else {
+        context.diskdescriptions = BLDiskDescriptionsCreate();
+        if(!context.diskdescriptions) {
+            errx(1, "Can't allocate disk descriptions");
+        }
+    }
+
+    /* Preboot, the system volume and snapshots are mounted once and shared until the end */
+    context.mountleases = BLMountLeasesCreate(kBLMountLeasesKeepMounted);
+    if(!context.mountleases) {
+        errx(1, "Can't allocate mount leases");
+    }
+
+    /* A batch shares all of the above across its operations, a service across its requests */
+    if(actargs[kbatch].present) {
+        ret = modeBatch(&context, actargs, &bcon);
+    } else if(actargs[kserve].present) {
+        ret = modeServe(&context, actargs, &bcon);
+    } else {
+        ret = runMode(&context, actargs, argc - nextArg, argv + nextArg);
+    }
 	
-	if(actargs[knetboot].present) {
-		return modeNetboot(&context, actargs);
+	// Make every file replaced above durable in one go
+	if(context.syncbatch) {
+		if(BLSyncBatchCommit(&context, context.syncbatch) && ret == 0) {
+			ret = 1;
+		}
+		BLSyncBatchRelease(context.syncbatch);
+		context.syncbatch = NULL;
 	}
-	
-	if (actargs[kunbless].present) {
-		return modeUnbless(&context, actargs);
+	// ...then unmount what was mounted along the way
+	BLMountLeasesRelease(&context, context.mountleases);
+	context.mountleases = NULL;
+	BLMountTableRelease(context.mounttable);
+	context.mounttable = NULL;
+	BLTopologyRelease(context.topology);
+	context.topology = NULL;
+	BLNVRAMCacheRelease(context.nvramcache);
+	context.nvramcache = NULL;
+	BLDiskDescriptionsRelease(context.diskdescriptions);
+	context.diskdescriptions = NULL;
+
+	BLTraceEnd(&context, span, "bless", NULL);
+	if(context.tracebuffer) {
+		BLTraceBufferWriteChromeTrace(&context, context.tracebuffer, actargs[ktrace].argument);
+		BLTraceBufferRelease(context.tracebuffer);
+	}
+	if(context.timing) {
+		printTiming(&context, context.timing, actargs[kplist].present);
+		BLTimingCountersRelease(context.timing);
 	}
 	
-    /* default */
-    return modeFolder(&context, actargs);
-
+	return ret;
 }
 
 
@@ -247,19 +407,11 @@ int main (int argc, char * argv[])
 // note that libbless has its own (similar) contextprintf()
 int blesscontextprintf(BLContextPtr context, int loglevel, char const *fmt, ...) {
     int ret;
-    char *out;
     va_list ap;
 
     va_start(ap, fmt);
-    ret = vasprintf(&out, fmt, ap);  
+    ret = contextvprintf(context, loglevel, fmt, ap);
     va_end(ap);
-    
-    if((ret == -1) || (out == NULL)) {
-        return context->logstring(context->logrefcon, loglevel, "Memory error, log entry not available");
-    }
-
-    ret = context->logstring(context->logrefcon, loglevel, out);
-    free(out);
     return ret;
 }
 
@@ -37,15 +37,13 @@ enum {
 static int DeleteHierarchy(char *path, int pathMax);
 static int DeleteFileWithPrejudice(const char *path, struct stat *sb);
 static int CopyKernelCollectionFiles(BLContextPtr context, const char *systemKCPath, const char *prebootKCPath);
-static int GetFilesInDirWithPrefix(const char *directory, const char *prefix, char ***outFileList, int *outNumFiles);
-static void FreeFileList(char **list, int num);
-static int StringCompare(const void *a, const void *b);
-static int CopyKCFile(BLContextPtr context, const char *from, const char *to);
-static bool StringHasSuffix(const char *str, const char *suffix);
+static int WritePrebootLabelFile(BLContextPtr context, struct prebootpass *pass, const char *path,
+								 CFDataRef labelData, int scale);
 
 
-int BlessPrebootVolume(BLContextPtr context, const char *rootBSD, const char *bootEFISourceLocation,
-					   CFDataRef labelData, CFDataRef labelData2, struct clarg actargs[klast])
+static int _BlessPrebootVolume(BLContextPtr context, const char *rootBSD, const char *bootEFISourceLocation,
+					   CFDataRef labelData, CFDataRef labelData2, struct clarg actargs[klast],
+					   struct prebootpass *pass)
 {
     int             ret;
     io_service_t    rootMedia = IO_OBJECT_NULL;
@@ -53,9 +51,6 @@ int BlessPrebootVolume(BLContextPtr context, const char *rootBSD, const char *bo
     CFStringRef     bootUUID = NULL;
     CFDictionaryRef booterDict = NULL;
     char            prebootBSD[MAXPATHLEN];
-    int             mntsize;
-    int             i;
-    struct statfs   *mnts;
     char            systemPath[MAXPATHLEN];
     char            rootHashPath[MAXPATHLEN];
     char            snapshotRootPath[MAXPATHLEN];
@@ -67,7 +62,9 @@ int BlessPrebootVolume(BLContextPtr context, const char *rootBSD, const char *bo
     char            prebootKCPath[MAXPATHLEN];
     bool            mustUnmount = false;
     uint64_t        blessIDs[2];
-    CFDataRef       booterData;
+    CFDataRef       booterData = NULL;
+    bool            booterUnchanged = false;
+    bool            booterCloned = false;
     struct stat     existingStat;
     uint16_t        role;
 	struct statfs	sfs;
@@ -75,19 +72,21 @@ int BlessPrebootVolume(BLContextPtr context, const char *rootBSD, const char *bo
 	char			bridgeDstVersionPath[MAXPATHLEN];
     char            prebootDirPath[MAXPATHLEN];
 	CFDataRef		versionData = NULL;
+	bool			versionUnchanged;
 	char			*pathEnd;
     char            *pathEnd2;
 	bool 			unmountSnapshot = false;
     CFStringRef     bsdCF;
     char            systemDev[64] = _PATH_DEV;
     bool            mustUnmountSystem = false;
-    bool            setIDs = (actargs[knextonly].present == 0);
+    bool            setIDs = (actargs[knextonly].present == 0) && !pass;
     bool            createSnapshot = (actargs[kcreatesnapshot].present != 0);
     bool            copyBootEFI = (actargs[kbootefi].hasArg == 1);
     bool            sealedSnapshot = (actargs[klastsealedsnapshot].present != 0);
     bool            isARV;
     int             vol_fd = -1;
     bool            untagRootSnapshot = false;
+    BLTimingSample  phase;
     
     // Is this already a preboot or recovery volume?
     if (APFSVolumeRole(rootBSD, &role, NULL)) {
@@ -120,25 +119,18 @@ int BlessPrebootVolume(BLContextPtr context, const char *rootBSD, const char *bo
 	}
 
     // Now let's get the BSD name of the preboot volume.
+    BLTimingPhaseBegin(context, &phase);
     ret = GetPrebootBSDForVolumeBSD(context, rootBSD, prebootBSD, sizeof prebootBSD);
     if (ret) {
         blesscontextprintf(context, kBLLogLevelVerbose, "Could not find preboot BSD for : %s\n", rootBSD);
         goto exit;
     }
     
-    ret = GetMountForBSD(context, prebootBSD, prebootMountPoint, sizeof prebootMountPoint);
+    ret = BLAcquireMount(context, prebootBSD, NULL, false, prebootMountPoint, sizeof prebootMountPoint, &mustUnmount);
     if (ret) {
-        blesscontextprintf(context, kBLLogLevelError, "Error looking up mount points\n");
+        blesscontextprintf(context, kBLLogLevelError, "Couldn't mount preboot volume %s\n", prebootBSD);
         goto exit;
     }
-    if (!prebootMountPoint[0]) {
-        // The preboot volume isn't mounted right now.  We'll have to mount it.
-        ret = BLMountContainerVolume(context, prebootBSD, prebootMountPoint, sizeof prebootMountPoint, false);
-        if (ret) {
-           goto exit;
-        }
-        mustUnmount = true;
-    }
     
     // Find the appropriate UUID folder
 	// We look for a volume UUID folder first.  If that's present, use it.
@@ -149,9 +141,11 @@ int BlessPrebootVolume(BLContextPtr context, const char *rootBSD, const char *bo
         blesscontextprintf(context, kBLLogLevelError, "Error looking up UUID folder in preboot\n");
         goto exit;
     }
+    BLTimingPhaseEnd(context, &phase, kBLTimingPhasePrebootMount);
     
     // Save away the preboot path for later use
     strlcpy(prebootDirPath, prebootFolderPath, sizeof prebootDirPath);
+    if (pass) strlcpy(pass->folder, prebootDirPath, sizeof pass->folder);
     
     strlcpy(prebootKCPath, prebootFolderPath, sizeof prebootKCPath);
     strlcat(prebootKCPath, "/boot" kBL_PATH_KERNELCOLLECTIONS, sizeof prebootKCPath);
@@ -163,9 +157,10 @@ int BlessPrebootVolume(BLContextPtr context, const char *rootBSD, const char *bo
 	pathEnd = prebootFolderPath + strlen(prebootFolderPath);
 	
 	// Label files?
+	BLTimingPhaseBegin(context, &phase);
 	if (labelData) {
 		strlcpy(pathEnd, "/.disk_label", prebootFolderPath + sizeof prebootFolderPath - pathEnd);
-		ret = WriteLabelFile(context, prebootFolderPath, labelData, 0, kBitmapScale_1x);
+		ret = WritePrebootLabelFile(context, pass, prebootFolderPath, labelData, kBitmapScale_1x);
 		if (ret) {
 			blesscontextprintf(context, kBLLogLevelError, "Couldn't write label file \"%s\"", prebootFolderPath);
 			ret = 6;
@@ -175,7 +170,7 @@ int BlessPrebootVolume(BLContextPtr context, const char *rootBSD, const char *bo
 	}
 	if (labelData2) {
 		strlcpy(pathEnd, "/.disk_label_2x", prebootFolderPath + sizeof prebootFolderPath - pathEnd);
-		ret = WriteLabelFile(context, prebootFolderPath, labelData2, 0, kBitmapScale_2x);
+		ret = WritePrebootLabelFile(context, pass, prebootFolderPath, labelData2, kBitmapScale_2x);
 		if (ret) {
 			blesscontextprintf(context, kBLLogLevelError, "Couldn't write label file \"%s\"", prebootFolderPath);
 			ret = 6;
@@ -183,6 +178,7 @@ int BlessPrebootVolume(BLContextPtr context, const char *rootBSD, const char *bo
 		}
 		*pathEnd = '\0';
 	}
+	BLTimingPhaseEnd(context, &phase, kBLTimingPhaseLabel);
 	
     if (setIDs) {
         ret = BLGetAPFSInodeNum(context, prebootFolderPath, &blessIDs[1]);
@@ -214,6 +210,7 @@ int BlessPrebootVolume(BLContextPtr context, const char *rootBSD, const char *bo
         snprintf(rootHashPath, sizeof rootHashPath, "%s/usr/standalone/OS.dmg.root_hash", prebootDirPath);
         
         // if the rootmedia is a snapshot root, mount the corresponding system volume
+        BLTimingPhaseBegin(context, &phase);
         if (IOObjectConformsTo(rootMedia, "AppleAPFSSnapshot")) {
             contextprintf(context, kBLLogLevelVerbose, "Volume %s is mounted from a snapshot.\n", systemPath);
             bsdCF = IORegistryEntryCreateCFProperty(systemMedia, CFSTR(kIOBSDNameKey), kCFAllocatorDefault, 0);
@@ -223,25 +220,11 @@ int BlessPrebootVolume(BLContextPtr context, const char *rootBSD, const char *bo
                 goto exit;
             }
             CFStringGetCString(bsdCF, systemDev + strlen(_PATH_DEV), sizeof systemDev - strlen(_PATH_DEV), kCFStringEncodingUTF8);
-            mntsize = getmntinfo(&mnts, MNT_NOWAIT);
-            if (!mntsize) {
-                ret = 5;
+            ret = BLAcquireMount(context, systemDev + strlen(_PATH_DEV), NULL, false, systemPath, sizeof systemPath, &mustUnmountSystem);
+            if (ret) {
+                contextprintf(context, kBLLogLevelError, "Couldn't mount system volume from %s\n", systemDev);
                 goto exit;
             }
-            for (i = 0; i < mntsize; i++) {
-                if (strcmp(mnts[i].f_mntfromname, systemDev) == 0) break;
-            }
-            if (i < mntsize) {
-                strlcpy(systemPath, mnts[i].f_mntonname, sizeof systemPath);
-            } else {
-                // The system volume isn't mounted right now.  We'll have to mount it.
-                ret = BLMountContainerVolume(context, systemDev + strlen(_PATH_DEV), systemPath, sizeof systemPath, false);
-                if (ret) {
-                    contextprintf(context, kBLLogLevelError, "Couldn't mount system volume from %s\n", systemDev);
-                    goto exit;
-                }
-                mustUnmountSystem = true;
-            }
             rootBSD = systemDev + strlen(_PATH_DEV);
         }
 		
@@ -268,9 +251,8 @@ int BlessPrebootVolume(BLContextPtr context, const char *rootBSD, const char *bo
                 goto exit;
             }
             if (!snapshotRootPath[0]) {
-                ret = BLMountSnapshot(context, rootBSD, snapshotName, snapshotRootPath, sizeof snapshotRootPath);
+                ret = BLAcquireMount(context, rootBSD, snapshotName, true, snapshotRootPath, sizeof snapshotRootPath, &unmountSnapshot);
                 if (ret) goto exit;
-                unmountSnapshot = true;
             }
             blesscontextprintf(context, kBLLogLevelVerbose, "snapshot is mounted at %s\n", snapshotRootPath);
             snprintf(kcPath, sizeof kcPath, "%s", snapshotRootPath);
@@ -286,9 +268,8 @@ int BlessPrebootVolume(BLContextPtr context, const char *rootBSD, const char *bo
                     goto exit;
                 }
                 if (!snapshotRootPath[0]) {
-                    ret = BLMountSnapshot(context, rootBSD, snapshotName, snapshotRootPath, sizeof snapshotRootPath);
+                    ret = BLAcquireMount(context, rootBSD, snapshotName, true, snapshotRootPath, sizeof snapshotRootPath, &unmountSnapshot);
                     if (ret) goto exit;
-                    unmountSnapshot = true;
                 }
                 blesscontextprintf(context, kBLLogLevelVerbose, "snapshot is mounted at %s\n", snapshotRootPath);
                 snprintf(kcPath, sizeof kcPath, "%s", snapshotRootPath);
@@ -298,6 +279,7 @@ int BlessPrebootVolume(BLContextPtr context, const char *rootBSD, const char *bo
                 snprintf(kcPath, sizeof kcPath, "%s", systemPath);
             }
         }
+        BLTimingPhaseEnd(context, &phase, kBLTimingPhaseSnapshot);
 
         
         if (kcPath[0]) {
@@ -310,10 +292,12 @@ int BlessPrebootVolume(BLContextPtr context, const char *rootBSD, const char *bo
             
             // Let's copy kernel collections
             strlcat(kcPath, kBL_PATH_KERNELCOLLECTIONS, sizeof kcPath);
+            BLTimingPhaseBegin(context, &phase);
             ret = CopyKernelCollectionFiles(context, kcPath, prebootKCPath);
             if (ret) {
                 goto exit;
             }
+            BLTimingPhaseEnd(context, &phase, kBLTimingPhaseKernelCollections);
         }
         
 		if (true == copyBootEFI)
@@ -321,24 +305,30 @@ int BlessPrebootVolume(BLContextPtr context, const char *rootBSD, const char *bo
             blesscontextprintf(context, kBLLogLevelVerbose, "booter path %s\n", bootEFIloc);
 		
             // The booter got written.  We'll have to rewrite it to the preboot volume.
-            ret = BLLoadFile(context, bootEFIloc, 0, &booterData);
-            if (ret) {
-                blesscontextprintf(context, kBLLogLevelVerbose,  "Could not load booter data from %s\n",
-							   bootEFIloc);
+            BLTimingPhaseBegin(context, &phase);
+            // check to see if needed
+            ret = BLFilesAreIdentical(context, bootEFIloc, prebootFolderPath, &booterUnchanged);
+            if (ret || !booterUnchanged) {
+                booterUnchanged = false;
+                if (pass) {
+                    SharePrebootFile(context, pass, bootEFIloc, NULL, prebootFolderPath, &booterCloned);
+                }
+                if (!booterCloned) {
+                    ret = BLLoadFile(context, bootEFIloc, 0, &booterData);
+                    if (ret) {
+                        blesscontextprintf(context, kBLLogLevelVerbose,  "Could not load booter data from %s\n",
+                                           bootEFIloc);
+                    }
+                }
             }
         
-            if (booterData) {
-                // check to see if needed
-                CFDataRef oldEFIdata = NULL;
-            
-                ret = lstat(prebootFolderPath, &existingStat);
-            
-                if (ret == 0 && S_ISREG(existingStat.st_mode)) {
-                ret = BLLoadFile(context, prebootFolderPath, 0, &oldEFIdata);
-                }
-                if ((ret == 0) && oldEFIdata && CFEqual(oldEFIdata, booterData)) {
+            if (booterUnchanged || booterCloned || booterData) {
+                if (booterUnchanged) {
                     blesscontextprintf(context, kBLLogLevelVerbose,  "boot.efi unchanged at %s. Skipping update...\n",
                                        prebootFolderPath);
+                    if (pass) pass->unchanged++;
+                } else if (booterCloned) {
+                    blesscontextprintf(context, kBLLogLevelVerbose,  "boot.efi cloned to %s\n", prebootFolderPath);
                 } else {
                     ret = BLCreateFileWithOptions(context, booterData, prebootFolderPath, 0, 0, 0, kTryPreallocate);
                     if (ret) {
@@ -348,16 +338,25 @@ int BlessPrebootVolume(BLContextPtr context, const char *rootBSD, const char *bo
                     } else {
                         blesscontextprintf(context, kBLLogLevelVerbose,  "boot.efi created successfully at %s\n",
                                        prebootFolderPath);
+                        if (pass) pass->written++;
                     }
                 }
-                if (oldEFIdata) CFRelease(oldEFIdata);
-                ret = CopyManifests(context, prebootFolderPath, bootEFIloc, systemPath);
+                if (pass) RememberPrebootFile(pass, prebootFolderPath, NULL);
+                BLTimingPhaseEnd(context, &phase, kBLTimingPhaseBooter);
+                
+                BLTimingPhaseBegin(context, &phase);
+                ret = CopyManifests(context, prebootFolderPath, bootEFIloc, systemPath, pass);
                 if (ret) {
                     blesscontextprintf(context, kBLLogLevelError, "Couldn't copy img4 manifests for file %s\n", bootEFIloc);
                 }
+                BLTimingPhaseEnd(context, &phase, kBLTimingPhaseManifests);
             } else {
+                BLTimingPhaseEnd(context, &phase, kBLTimingPhaseBooter);
                 blesscontextprintf(context, kBLLogLevelVerbose,  "Could not create boot.efi, no X folder specified\n" );
             }
+            
+            // The bridge version files go with the booter
+            BLTimingPhaseBegin(context, &phase);
             ret = statfs(bootEFIloc, &sfs);
             if (ret) {
                 blesscontextprintf(context, kBLLogLevelError, "Could not get filesystem information for file %s\n", bootEFIloc);
@@ -369,8 +368,14 @@ int BlessPrebootVolume(BLContextPtr context, const char *rootBSD, const char *bo
             pathEnd = bridgeSrcVersionPath + strlen(bridgeSrcVersionPath);
             pathEnd2 = bridgeDstVersionPath + strlen(bridgeDstVersionPath);
             strlcpy(pathEnd, kBL_PATH_BRIDGE_VERSION_BIN, bridgeSrcVersionPath + sizeof bridgeSrcVersionPath - pathEnd);
+            strlcpy(pathEnd2, basename(kBL_PATH_BRIDGE_VERSION_BIN), bridgeDstVersionPath + sizeof bridgeDstVersionPath - pathEnd2);
             if (access(bridgeSrcVersionPath, R_OK) < 0) {
                 ret = ENOENT;
+            } else if (BLFilesAreIdentical(context, bridgeSrcVersionPath, bridgeDstVersionPath, &versionUnchanged) == 0 &&
+                       versionUnchanged) {
+                blesscontextprintf(context, kBLLogLevelVerbose,  "%s unchanged. Skipping update...\n",
+                                   bridgeDstVersionPath);
+                ret = 0;
             } else {
                 ret = BLLoadFile(context, bridgeSrcVersionPath, 0, &versionData);
             }
@@ -380,17 +385,23 @@ int BlessPrebootVolume(BLContextPtr context, const char *rootBSD, const char *bo
                 ret = 0;
             }
             if (versionData) {
-                strlcpy(pathEnd2, basename(kBL_PATH_BRIDGE_VERSION_BIN), bridgeDstVersionPath + sizeof bridgeDstVersionPath - pathEnd2);
                 ret = BLCreateFileWithOptions(context, versionData, bridgeDstVersionPath, 0, 0, 0, 0);
                 CFRelease(versionData);
+                versionData = NULL;
                 if (ret) {
                     blesscontextprintf(context, kBLLogLevelError, "Couldn't create file at %s\n", bridgeDstVersionPath);
                     goto exit;
                 }
             }
             strlcpy(pathEnd, kBL_PATH_BRIDGE_VERSION_PLIST, bridgeSrcVersionPath + sizeof bridgeSrcVersionPath - pathEnd);
+            strlcpy(pathEnd2, basename(kBL_PATH_BRIDGE_VERSION_PLIST), bridgeDstVersionPath + sizeof bridgeDstVersionPath - pathEnd2);
             if (access(bridgeSrcVersionPath, R_OK) < 0) {
                 ret = ENOENT;
+            } else if (BLFilesAreIdentical(context, bridgeSrcVersionPath, bridgeDstVersionPath, &versionUnchanged) == 0 &&
+                       versionUnchanged) {
+                blesscontextprintf(context, kBLLogLevelVerbose,  "%s unchanged. Skipping update...\n",
+                                   bridgeDstVersionPath);
+                ret = 0;
             } else {
                 ret = BLLoadFile(context, bridgeSrcVersionPath, 0, &versionData);
             }
@@ -400,17 +411,19 @@ int BlessPrebootVolume(BLContextPtr context, const char *rootBSD, const char *bo
                 ret = 0;
             }
             if (versionData) {
-                strlcpy(pathEnd2, basename(kBL_PATH_BRIDGE_VERSION_PLIST), bridgeDstVersionPath + sizeof bridgeDstVersionPath - pathEnd2);
                 ret = BLCreateFileWithOptions(context, versionData, bridgeDstVersionPath, 0, 0, 0, 0);
                 CFRelease(versionData);
+                versionData = NULL;
                 if (ret) {
                     blesscontextprintf(context, kBLLogLevelError, "Couldn't create file at %s\n", bridgeDstVersionPath);
                     goto exit;
                 }
             }
+            BLTimingPhaseEnd(context, &phase, kBLTimingPhaseBooter);
             
             if (true == untagRootSnapshot)
             {
+                BLTimingPhaseBegin(context, &phase);
                 if ((vol_fd = open(systemPath, O_RDONLY)) < 0) {
                     ret = errno;
                     blesscontextprintf(context, kBLLogLevelError, "Couldn't open volume %s: %s\n", systemPath, strerror(ret));
@@ -422,6 +435,7 @@ int BlessPrebootVolume(BLContextPtr context, const char *rootBSD, const char *bo
                     blesscontextprintf(context, kBLLogLevelError, "Coulnd't revert current boot snapshot on volume %s: %s\n", systemPath, strerror(ret));
                     goto exit;
                 }
+                BLTimingPhaseEnd(context, &phase, kBLTimingPhaseSnapshot);
             }
         }
     } else {
@@ -452,19 +466,120 @@ exit:
     if (systemMedia) IOObjectRelease(systemMedia);
     if (bootUUID) CFRelease(bootUUID);
     if (booterDict) CFRelease(booterDict);
+    if (booterData) CFRelease(booterData);
     if (mustUnmount) {
-        BLUnmountContainerVolume(context, prebootMountPoint);
+        BLReleaseMount(context, prebootMountPoint);
     }
     if (unmountSnapshot) {
-        BLUnmountContainerVolume(context, snapshotRootPath);
+        BLReleaseMount(context, snapshotRootPath);
     }
     if (mustUnmountSystem) {
-        BLUnmountContainerVolume(context, systemPath);
+        BLReleaseMount(context, systemPath);
     }
     if (vol_fd >= 0) close(vol_fd);
     return ret;
 }
 
+int BlessPrebootVolume(BLContextPtr context, const char *rootBSD, const char *bootEFISourceLocation,
+					   CFDataRef labelData, CFDataRef labelData2, struct clarg actargs[klast],
+					   struct prebootpass *pass)
+{
+	uint64_t	span = BLTraceBegin(context);
+	int			ret = _BlessPrebootVolume(context, rootBSD, bootEFISourceLocation, labelData, labelData2, actargs, pass);
+	
+	BLTraceEnd(context, span, "BlessPrebootVolume", rootBSD);
+	return ret;
+}
+
+
+
+// Replace dest with a clone of a file written earlier in the pass, if one has
+// the same name and contents.  Hardlinks won't do: the booter and label writers
+// update files in place, which would change every volume's copy at once.
+int SharePrebootFile(BLContextPtr context, struct prebootpass *pass, const char *srcPath, CFDataRef data,
+					 const char *dest, bool *shared)
+{
+	const char	*name = strrchr(dest, '/');
+	const char	*earlierName;
+	struct stat	sb;
+	bool		identical;
+	uint32_t	i;
+	int			ret;
+	
+	*shared = false;
+	name = name ? name + 1 : dest;
+	for (i = 0; i < pass->count; i++) {
+		earlierName = strrchr(pass->files[i].dest, '/');
+		earlierName = earlierName ? earlierName + 1 : pass->files[i].dest;
+		if (strcmp(name, earlierName) != 0 || strcmp(dest, pass->files[i].dest) == 0) continue;
+		if (data) {
+			if (!pass->files[i].data || !CFEqual(data, pass->files[i].data)) continue;
+		} else {
+			if (BLFilesAreIdentical(context, srcPath, pass->files[i].dest, &identical) || !identical) continue;
+		}
+		ret = BLCloneFile(context, pass->files[i].dest, dest);
+		if (ret) return ret;
+		*shared = true;
+		pass->cloned++;
+		if (stat(dest, &sb) == 0) pass->clonedBytes += sb.st_size;
+		return 0;
+	}
+	return 0;
+}
+
+
+
+int RememberPrebootFile(struct prebootpass *pass, const char *dest, CFDataRef data)
+{
+	struct prebootfile	*grown;
+	
+	if (pass->count == pass->capacity) {
+		grown = realloc(pass->files, (pass->capacity ? pass->capacity * 2 : 16) * sizeof(*grown));
+		if (!grown) return ENOMEM;
+		pass->files = grown;
+		pass->capacity = pass->capacity ? pass->capacity * 2 : 16;
+	}
+	strlcpy(pass->files[pass->count].dest, dest, sizeof pass->files[pass->count].dest);
+	pass->files[pass->count].data = data ? CFRetain(data) : NULL;
+	pass->count++;
+	return 0;
+}
+
+
+
+void FreePrebootPass(struct prebootpass *pass)
+{
+	uint32_t	i;
+	
+	for (i = 0; i < pass->count; i++) {
+		if (pass->files[i].data) CFRelease(pass->files[i].data);
+	}
+	free(pass->files);
+	pass->files = NULL;
+	pass->count = pass->capacity = 0;
+}
+
+
+
+static int WritePrebootLabelFile(BLContextPtr context, struct prebootpass *pass, const char *path,
+								 CFDataRef labelData, int scale)
+{
+	bool	shared = false;
+	int		ret;
+	
+	if (!pass) return WriteLabelFile(context, path, labelData, 0, scale);
+	SharePrebootFile(context, pass, NULL, labelData, path, &shared);
+	if (shared) {
+		// The clone has its own Finder info, so make sure it's hidden
+		ret = BLSetFinderFlag(context, path, kIsInvisible, 1);
+	} else {
+		ret = WriteLabelFile(context, path, labelData, 0, scale);
+		if (!ret) pass->written++;
+	}
+	if (!ret) RememberPrebootFile(pass, path, labelData);
+	return ret;
+}
+
 
 int GetVolumeUUIDs(BLContextPtr context, const char *volBSD, CFStringRef *volUUID, CFStringRef *groupUUID)
 {
@@ -539,9 +654,6 @@ exit:
 
 int GetMountForSnapshot(BLContextPtr context, const char *snapshotName, const char *bsd, char *mountPoint, int mountPointLen)
 {
-	struct statfs	*mnts;
-	int             mntsize;
-	int             i;
 	char mountname[MAXPATHLEN];
 	struct statfs				sfs;
 	char rootDev[MAXPATHLEN];
@@ -549,18 +661,13 @@ int GetMountForSnapshot(BLContextPtr context, const char *snapshotName, const ch
     int ret = 0;
 
 
-	mntsize = getmntinfo(&mnts, MNT_NOWAIT);
-	if (!mntsize) {
-		return errno;
-	}
 	snprintf(mountname, sizeof mountname, "%s@/dev/%s", snapshotName, bsd);
 	blesscontextprintf(context, kBLLogLevelVerbose,  "is mounted %s\n", mountname);
-	for (i = 0; i < mntsize; i++) {
-		if (strcmp(mnts[i].f_mntfromname, mountname) == 0) break;
+	ret = BLGetMountPointForDevice(context, mountname, mountPoint, mountPointLen);
+	if (ret) {
+		return ret;
 	}
-	if (i < mntsize) {
-		strlcpy(mountPoint, mnts[i].f_mntonname, mountPointLen);
-	} else {
+	if (!*mountPoint) {
 		
 		if (statfs("/", &sfs) < 0) {
 			ret = errno;
@@ -723,272 +830,20 @@ static int DeleteFileWithPrejudice(const char *path, struct stat *sb)
 
 
 
-// We have two tasks: copy any appropriate files from the system location,
-// and delete any files in the target location that aren't getting copied.
-// We'll first make lists of the files in each location that meet our criteria.
-// We'll just delete all the files in the target location, then unconditionally
-// copy all the files in the system location.
-static int CopyKernelCollectionFiles(BLContextPtr context, const char *systemKCPath, const char *prebootKCPath)
-{
-	int		ret;
-	char	**systemList = NULL;
-	int		numSysFiles;
-	char	**prebootList = NULL;
-	int		numPrebootFiles;
-	int		i;
-	char	systemFullPath[MAXPATHLEN];
-	char	*systemPathEnd;
-	char	prebootFullPath[MAXPATHLEN];
-	char	*prebootPathEnd;
-	
-    // First get a list of the relevant files in each location
-	ret = GetFilesInDirWithPrefix(systemKCPath, kBL_NAME_BOOTKERNELEXTENSIONS, &systemList, &numSysFiles);
-	if (ret && ret != ENOENT) {
-		blesscontextprintf(context, kBLLogLevelError, "Couldn't get system kernel collection files - %s\n", strerror(ret));
-		goto exit;
-	}
-	if (ret) {
-		// No kernel collection directory in system.  Just fake up an empty list of files.
-		blesscontextprintf(context, kBLLogLevelVerbose, "No KernelCollections directory in system volume\n");
-		systemList = malloc(sizeof(char *));
-		numSysFiles = 0;
-		ret = 0;
-	}
-	
-	ret = GetFilesInDirWithPrefix(prebootKCPath, kBL_NAME_BOOTKERNELEXTENSIONS, &prebootList, &numPrebootFiles);
-	if (ret && ret != ENOENT) {
-		blesscontextprintf(context, kBLLogLevelError, "Couldn't get preboot kernel collection files - %s\n", strerror(ret));
-		goto exit;
-	}
-	if (ret) {
-		// No kernel collection directory in preboot.  Create one if necessary, and fake up an emptry list of files.
-		blesscontextprintf(context, kBLLogLevelVerbose, "No KernelCollections directory in preboot volume\n");
-		prebootList = malloc(sizeof(char *));
-		numPrebootFiles = 0;
-		if (numSysFiles > 0) {
-			if (mkdir(prebootKCPath, 0755) < 0) {
-				ret = errno;
-				blesscontextprintf(context, kBLLogLevelError, "Couldn't create kernel collections directory in preboot - %s", strerror(ret));
-				goto exit;
-			}
-		}
-		ret = 0;
-	} else {
-		// We don't want to delete any manifests!  Let's remove them from this list.
-		for (i = 0; i < numPrebootFiles; i++) {
-			if (StringHasSuffix(prebootList[i], ".im4m")) {
-				free(prebootList[i]);
-				memmove(prebootList + i, prebootList + i + 1, (numPrebootFiles - i - 1) * sizeof *prebootList);
-				numPrebootFiles--;
-				i--;
-			}
-		}
-	}
-	
-	// Delete all the files in the target location
-	strlcpy(prebootFullPath, prebootKCPath, sizeof prebootFullPath);
-	strlcat(prebootFullPath, "/", sizeof prebootFullPath);
-	prebootPathEnd = prebootFullPath + strlen(prebootFullPath);
-	for (i = 0; i < numPrebootFiles; i++) {
-		strlcpy(prebootPathEnd, prebootList[i], prebootFullPath + sizeof prebootFullPath - prebootPathEnd);
-		if (unlink(prebootFullPath) < 0) {
-			ret = errno;
-			blesscontextprintf(context, kBLLogLevelError, "Couldn't delete file %s - %s\n", prebootFullPath, strerror(ret));
-			goto exit;
-		}
-		blesscontextprintf(context, kBLLogLevelVerbose, "Deleted KC file %s\n", prebootFullPath);
-	}
-	
-	// Copy all the files in the source location
-	strlcpy(systemFullPath, systemKCPath, sizeof systemFullPath);
-	strlcat(systemFullPath, "/", sizeof systemFullPath);
-	systemPathEnd = systemFullPath + strlen(systemFullPath);
-	for (i = 0; i < numSysFiles; i++) {
-		strlcpy(systemPathEnd, systemList[i], systemFullPath + sizeof systemFullPath - systemPathEnd);
-		strlcpy(prebootPathEnd, systemList[i], prebootFullPath + sizeof prebootFullPath - prebootPathEnd);
-		ret = CopyKCFile(context, systemFullPath, prebootFullPath);
-		if (ret) {
-			blesscontextprintf(context, kBLLogLevelError, "Error %d copying KC file %s\n", ret, systemFullPath);
-			goto exit;
-		}
-		blesscontextprintf(context, kBLLogLevelVerbose, "Copied KC file %s to preboot\n", systemFullPath);
-	}
-
-	
-exit:
-	if (systemList) FreeFileList(systemList, numSysFiles);
-	if (prebootList) FreeFileList(prebootList, numPrebootFiles);
-	return ret;
-}
-
-
-
-static int GetFilesInDirWithPrefix(const char *directory, const char *prefix, char ***outFileList, int *outNumFiles)
+// Only new or changed kernel collections are copied, and only stale ones
+// deleted; see BLSyncKernelCollections().
+static int _CopyKernelCollectionFiles(BLContextPtr context, const char *systemKCPath, const char *prebootKCPath)
 {
-	int				ret = 0;
-	DIR				*dp = NULL;
-	struct dirent	*dirent;
-	struct stat		sb;
-	char			path[MAXPATHLEN];
-	int				endIdx;
-	int				prefixLen = strlen(prefix);
-	char			**list = NULL;
-	int				numFiles = 0;
-	int				listSize = 10;
-
-	list = malloc(listSize * sizeof(char *));
-	if (!list) {
-		ret = errno;
-		goto exit;
-	}
-	dp = opendir(directory);
-	if (!dp) {
-		ret = errno;
-		goto exit;
-	}
-	readdir(dp); readdir(dp);
-	strlcpy(path, directory, sizeof path);
-	if (path[strlen(path)-1] != '/') strlcat(path, "/", sizeof path);
-	endIdx = strlen(path);
-	while ((dirent = readdir(dp)) != NULL) {
-		if (strncmp(dirent->d_name, prefix, prefixLen) != 0) continue;
-		if (endIdx + dirent->d_namlen >= sizeof path) continue;
-		strlcpy(path + endIdx, dirent->d_name, sizeof path - endIdx);
-		if (stat(path, &sb) < 0) {
-			ret = errno;
-			goto exit;
-		}
-		if (!S_ISREG(sb.st_mode)) continue;
-		if (numFiles == listSize) {
-			listSize *= 2;
-			list = realloc(list, listSize * sizeof(char *));
-			if (!list) {
-				ret = errno;
-				goto exit;
-			}
-		}
-		list[numFiles++] = strdup(dirent->d_name);
-	}
-	qsort(list, numFiles, sizeof list[0], StringCompare);
-	*outFileList = list;
-	*outNumFiles = numFiles;
+	BLKernelCollectionSyncStats	stats;
 	
-exit:
-	if (dp) closedir(dp);
-	if (ret && list) {
-		FreeFileList(list, numFiles);
-	}
-	return ret;
+	return BLSyncKernelCollections(context, systemKCPath, prebootKCPath, 0, &stats);
 }
 
-
-
-static void FreeFileList(char **list, int num)
-{
-	int i;
-	
-	for (i = 0; i < num; i++) {
-		free(list[i]);
-	}
-	free(list);
-}
-
-
-
-static int StringCompare(const void *a, const void *b)
-{
-	const char * const *s1 = a;
-	const char * const *s2 = b;
-	
-	return strcmp(*s1, *s2);
-}
-
-
-
-static int CopyKCFile(BLContextPtr context, const char *from, const char *to)
+static int CopyKernelCollectionFiles(BLContextPtr context, const char *systemKCPath, const char *prebootKCPath)
 {
-	int			ret = 0;
-	char		*buffer = NULL;
-	int			fdFrom = -1;
-	int			fdTo = -1;
-	off_t		fileSize;
-	int			bytes;
-	fstore_t	preall;
+	uint64_t	span = BLTraceBegin(context);
+	int			ret = _CopyKernelCollectionFiles(context, systemKCPath, prebootKCPath);
 	
-	buffer = malloc(0x100000);	// 1 MiB
-	if (!buffer) {
-		ret = errno;
-		blesscontextprintf(context, kBLLogLevelError, "%s\n", strerror(ret));
-		goto exit;
-	}
-	fdFrom = open(from, O_RDONLY);
-	if (fdFrom < 0) {
-		ret = errno;
-		blesscontextprintf(context, kBLLogLevelError, "Couldn't open KC file %s: %s\n", from, strerror(ret));
-		goto exit;
-	}
-	fileSize = lseek(fdFrom, 0, SEEK_END);
-	if (fileSize < 0) {
-		ret = errno;
-		blesscontextprintf(context, kBLLogLevelError, "Couldn't get size of file %s: %s\n", from, strerror(ret));
-		goto exit;
-	}
-	fdTo = open(to, O_WRONLY|O_CREAT|O_TRUNC, 0644);
-	if (fdTo < 0) {
-		ret = errno;
-		blesscontextprintf(context, kBLLogLevelError, "Couldn't create KC file %s: %s\n", to, strerror(ret));
-		goto exit;
-	}
-	preall.fst_length = fileSize;
-	preall.fst_offset = 0;
-	preall.fst_flags = F_ALLOCATECONTIG;
-	preall.fst_posmode = F_PEOFPOSMODE;
-	if (fcntl(fdTo, F_PREALLOCATE, &preall) < 0) {
-		if (errno == ENOTSUP) {
-			blesscontextprintf(context, kBLLogLevelVerbose, "Preallocation not supported on this filesystem for %s\n", to);
-		} else {
-			ret = errno;
-			blesscontextprintf(context, kBLLogLevelError, "Preallocation of %s failed: %s\n", to, strerror(ret));
-			goto exit;
-		}
-	} else {
-		blesscontextprintf(context, kBLLogLevelVerbose, "0x%08X bytes preallocated for %s\n",
-						   (unsigned int)preall.fst_bytesalloc, to);
-	}
-	lseek(fdFrom, 0, SEEK_SET);
-	while (fileSize > 0) {
-		bytes = MIN(fileSize, 0x100000);
-		if ((bytes = read(fdFrom, buffer, bytes)) < 0) {
-			ret = errno;
-			blesscontextprintf(context, kBLLogLevelError, "Error reading from %s: %s\n", from, strerror(ret));
-			goto exit;
-		}
-		if (write(fdTo, buffer, bytes) < 0) {
-			ret = errno;
-			blesscontextprintf(context, kBLLogLevelError, "Error writing to %s: %s\n", to, strerror(ret));
-			goto exit;
-		}
-		fileSize -= bytes;
-	}
-	
-exit:
-	if (buffer) free(buffer);
-	if (fdFrom >= 0) close(fdFrom);
-	if (fdTo >= 0) close(fdTo);
+	BLTraceEnd(context, span, "CopyKernelCollectionFiles", prebootKCPath);
 	return ret;
 }
-
-
-
-static bool StringHasSuffix(const char *str, const char *suffix)
-{
-	const char *cmp;
-	int strLength;
-	int suffixLength;
-
-	strLength = strlen(str);
-	suffixLength = strlen(suffix);
-	if (strLength < suffixLength) return false;
-	cmp = str + strLength - suffixLength;
-	return strcmp(cmp, suffix) == 0;
-}
@@ -83,6 +83,14 @@ enum {
     kversion,
     ksnapshot,
     knoapfsdriver,
+    kscanimages,
+    kjobs,
+    ktrace,
+    ktiming,
+    kcontainer,
+    kbatch,
+    kstoponerror,
+    kserve,
     klast
 };
 
@@ -119,7 +119,7 @@ int modeDevice(BLContextPtr context, struct clarg actargs[klast]) {
     if (IOObjectConformsTo(devMediaObj, APFS_VOLUME_OBJECT)) {
         // This is an APFS volume.  We need to mess with the preboot volume.
         ret = BlessPrebootVolume(context, actargs[kdevice].argument + strlen(_PATH_DEV), NULL, NULL, NULL,
-                                 actargs);
+                                 actargs, NULL);
     }
     IOObjectRelease(devMediaObj);
     if (ret) {
@@ -75,6 +75,7 @@ int modeFolder(BLContextPtr context, struct clarg actargs[klast]) {
     bool     isARV = false;
     BLPreBootEnvType	preboot;
 	bool				useFullPath = false;
+	BLTimingSample		phase;
 	
 	ret = BLGetPreBootEnvironmentType(context, &preboot);
 	if(ret) {
@@ -82,6 +83,7 @@ int modeFolder(BLContextPtr context, struct clarg actargs[klast]) {
 		return 1;
 	}
 	
+    BLTimingPhaseBegin(context, &phase);
     if(actargs[kmount].present) {
 		ret = BLGetCommonMountPoint(context, actargs[kmount].argument, "", actargs[kmount].argument);
 		if(ret) {
@@ -131,6 +133,7 @@ int modeFolder(BLContextPtr context, struct clarg actargs[klast]) {
 		blesscontextprintf(context, kBLLogLevelError, "No volume specified\n" );
 		return 1;
     }
+    BLTimingPhaseEnd(context, &phase, kBLTimingPhaseMountPoint);
 	
 	/*
 	 * actargs[kmount].argument will always be filled in as the volume we are
@@ -160,6 +163,7 @@ int modeFolder(BLContextPtr context, struct clarg actargs[klast]) {
     }
     
     /* If user gave options that require BootX creation, do it now. */
+    BLTimingPhaseBegin(context, &phase);
     if(actargs[kbootinfo].present) {
         char bootxpath[MAXPATHLEN];
         
@@ -175,17 +179,12 @@ int modeFolder(BLContextPtr context, struct clarg actargs[klast]) {
 		
         if(actargs[kfolder].present && bootXdata) {            
             // check to see if needed
-            CFDataRef oldBootXdata = NULL;
-            struct stat oldPresence;
+            bool same = false;
 
             snprintf(bootxpath, sizeof(bootxpath), "%s/BootX", actargs[kfolder].argument);            
             
-            ret = lstat(bootxpath, &oldPresence);
-            
-            if(ret == 0 && S_ISREG(oldPresence.st_mode)) {
-                ret = BLLoadFile(context, bootxpath, 0, &oldBootXdata);            
-            }
-            if((ret == 0) && oldBootXdata && CFEqual(oldBootXdata, bootXdata)) {
+            ret = BLFilesAreIdentical(context, actargs[kbootinfo].argument, bootxpath, &same);
+            if((ret == 0) && same) {
 				blesscontextprintf(context, kBLLogLevelVerbose,  "BootX unchanged at %s. Skipping update...\n",
                     bootxpath );
             } else {
@@ -198,14 +197,13 @@ int modeFolder(BLContextPtr context, struct clarg actargs[klast]) {
                     bootxpath );
                 }                
             }
-            
-            if (oldBootXdata) CFRelease(oldBootXdata);
         } else {
             blesscontextprintf(context, kBLLogLevelVerbose,  "Could not create BootX, no X folder specified\n" );
         }
     } else {
         blesscontextprintf(context, kBLLogLevelVerbose,  "No BootX creation requested\n" );
     }
+    BLTimingPhaseEnd(context, &phase, kBLTimingPhaseBooter);
 
     ret = BLIsMountHFS(context, actargs[kmount].argument, &isHFS);
     if (ret) {
@@ -285,24 +283,24 @@ int modeFolder(BLContextPtr context, struct clarg actargs[klast]) {
 		
 		if (!isAPFS || !(sb.f_flags & MNT_RDONLY)) {
 		
-			ret = BLLoadFile(context, actargs[kbootefi].argument, 0, &bootEFIdata);
-			if (ret) {
-				blesscontextprintf(context, kBLLogLevelVerbose,  "Could not load boot.efi data from %s\n",
-								   actargs[kbootefi].argument);
-			}
+			bool bootEFIUnchanged = false;
 			
-			if (actargs[kfile].present && bootEFIdata) {
-				
+			BLTimingPhaseBegin(context, &phase);
+			if (actargs[kfile].present) {
 				// check to see if needed
-				CFDataRef oldEFIdata = NULL;
-				struct stat oldPresence;
-				
-				ret = lstat(actargs[kfile].argument, &oldPresence);
-				
-				if (ret == 0 && S_ISREG(oldPresence.st_mode)) {
-					ret = BLLoadFile(context, actargs[kfile].argument, 0, &oldEFIdata);
+				ret = BLFilesAreIdentical(context, actargs[kbootefi].argument, actargs[kfile].argument, &bootEFIUnchanged);
+				if (ret) bootEFIUnchanged = false;
+			}
+			if (!bootEFIUnchanged) {
+				ret = BLLoadFile(context, actargs[kbootefi].argument, 0, &bootEFIdata);
+				if (ret) {
+					blesscontextprintf(context, kBLLogLevelVerbose,  "Could not load boot.efi data from %s\n",
+									   actargs[kbootefi].argument);
 				}
-				if ((ret == 0) && oldEFIdata && CFEqual(oldEFIdata, bootEFIdata)) {
+			}
+			
+			if (actargs[kfile].present && (bootEFIUnchanged || bootEFIdata)) {
+				if (bootEFIUnchanged) {
 					blesscontextprintf(context, kBLLogLevelVerbose,  "boot.efi unchanged at %s. Skipping update...\n",
 									   actargs[kfile].argument );
 				} else {
@@ -315,14 +313,17 @@ int modeFolder(BLContextPtr context, struct clarg actargs[klast]) {
 										   actargs[kfile].argument );
 					}
 				}
+				BLTimingPhaseEnd(context, &phase, kBLTimingPhaseBooter);
 				
-				if (oldEFIdata) CFRelease(oldEFIdata);
-				ret = CopyManifests(context, actargs[kfile].argument, actargs[kbootefi].argument, actargs[kbootefi].argument);
+				BLTimingPhaseBegin(context, &phase);
+				ret = CopyManifests(context, actargs[kfile].argument, actargs[kbootefi].argument, actargs[kbootefi].argument, NULL);
 				if (ret) {
 					blesscontextprintf(context, kBLLogLevelError, "Can't copy img4 manifests for file %s\n", actargs[kfile].argument);
 					return 3;
 				}
+				BLTimingPhaseEnd(context, &phase, kBLTimingPhaseManifests);
 			} else {
+				BLTimingPhaseEnd(context, &phase, kBLTimingPhaseBooter);
 				blesscontextprintf(context, kBLLogLevelVerbose,  "Could not create boot.efi, no X folder specified\n" );
 			}
 		}
@@ -342,6 +343,7 @@ int modeFolder(BLContextPtr context, struct clarg actargs[klast]) {
         bool        attemptLoad = false;
         
         // We need to embed the APFS driver in the container.
+        BLTimingPhaseBegin(context, &phase);
         sscanf(sb.f_mntfromname + 5, "disk%d", &unit);
         snprintf(wholeDiskBSD, sizeof wholeDiskBSD, "disk%d", unit);
         if (!actargs[kapfsdriver].present) {
@@ -368,12 +370,14 @@ int modeFolder(BLContextPtr context, struct clarg actargs[klast]) {
             }
             CFRelease(apfsDriverData);
         }
+        BLTimingPhaseEnd(context, &phase, kBLTimingPhaseBooter);
     }
 	
 	
 	if (!isAPFSDataRolePreSSVToSSVThusDontWriteToVol && (actargs[klabel].present || actargs[klabelfile].present)) {
 		int isLabel = 0;
 		
+		BLTimingPhaseBegin(context, &phase);
 		if(actargs[klabelfile].present) {
 			ret = BLLoadFile(context, actargs[klabelfile].argument, 0, &labeldata);
 			if(ret) {
@@ -413,6 +417,7 @@ int modeFolder(BLContextPtr context, struct clarg actargs[klast]) {
 				if (ret) return 1;
 			}
 		}
+		BLTimingPhaseEnd(context, &phase, kBLTimingPhaseLabel);
 	}
 	
 
@@ -735,9 +740,10 @@ int modeFolder(BLContextPtr context, struct clarg actargs[klast]) {
                     CFStringRef bsd;
                     char c_bsd[64] = _PATH_DEV;
                     uuid_string_t vol_uuid;
-                    struct statfs *mnts;
-                    int livefs, i, mntsize = 0;
+                    char mntpoint[MAXPATHLEN];
+                    int livefs;
 
+                    BLTimingPhaseBegin(context, &phase);
                     bsd = BLGetAPFSBlessedVolumeBSDName(context, actargs[kmount].argument, actargs[kfolder].argument, vol_uuid);
                     if (!bsd) {
                         blesscontextprintf(context, kBLLogLevelError, "Couldn't find a valid volume UUID in the boot path: %s\n",
@@ -749,14 +755,13 @@ int modeFolder(BLContextPtr context, struct clarg actargs[klast]) {
                                         sizeof c_bsd - strlen(_PATH_DEV),
                                         kCFStringEncodingUTF8);
 
-                    mntsize = getmntinfo(&mnts, MNT_NOWAIT);
-                    for (i = 0; i < mntsize; i++) {
-                        if (strcmp(mnts[i].f_mntfromname, c_bsd) == 0) break;
+                    if (BLGetMountPointForDevice(context, c_bsd, mntpoint, sizeof mntpoint)) {
+                        *mntpoint = '\0';
                     }
 
-                    if (i < mntsize) {
+                    if (*mntpoint) {
                         livefs = (!strlen(actargs[ksnapshot].argument));
-                        ret = BLSetAPFSSnapshotBlessData(context, mnts[i].f_mntonname, actargs[ksnapshot].argument);
+                        ret = BLSetAPFSSnapshotBlessData(context, mntpoint, actargs[ksnapshot].argument);
                         if (ret) {
                             blesscontextprintf(context, kBLLogLevelError,  "Can't set bless data for APFS snapshot %s: %s\n",
                                                livefs ? "live file system" : actargs[ksnapshot].argument, strerror(errno));
@@ -771,6 +776,7 @@ int modeFolder(BLContextPtr context, struct clarg actargs[klast]) {
                     }
 
                     CFRelease(bsd);
+                    BLTimingPhaseEnd(context, &phase, kBLTimingPhaseSnapshot);
                 }
             }
 
@@ -782,7 +788,7 @@ int modeFolder(BLContextPtr context, struct clarg actargs[klast]) {
                 bootEFISource = bootEFISource + strlen(actargs[kmount].argument);
             }
             ret = BlessPrebootVolume(context, sb.f_mntfromname + 5, bootEFISource, labeldata, labeldata2,
-                                     actargs);
+                                     actargs, NULL);
             if (ret) {
                 blesscontextprintf(context, kBLLogLevelError,  "Couldn't bless the APFS preboot volume for volume mounted at %s: %s\n",
                                    actargs[kmount].argument, strerror(errno));
@@ -792,11 +798,13 @@ int modeFolder(BLContextPtr context, struct clarg actargs[klast]) {
 			if (actargs[kcreatesnapshot].present) {
 				char snapshotName[64];
 				
+				BLTimingPhaseBegin(context, &phase);
 				ret = BLCreateAndSetSnapshotBoot(context, sb.f_mntonname, snapshotName, sizeof snapshotName);
 				if (!ret) {
 					blesscontextprintf(context, kBLLogLevelVerbose, "Volume %s will boot from snapshot %s",
 									   sb.f_mntonname, snapshotName);
 				}
+				BLTimingPhaseEnd(context, &phase, kBLTimingPhaseSnapshot);
 			}
 			
         }
@@ -813,6 +821,7 @@ int modeFolder(BLContextPtr context, struct clarg actargs[klast]) {
 
     /* Set Open Firmware to boot off the specified volume*/
     if(actargs[ksetboot].present) {
+        BLTimingPhaseBegin(context, &phase);
         if(preboot == kBLPreBootEnvType_EFI) {
 			// if you blessed the volume, then just point EFI at the volume.
 			// only if you didn't bless, but you have something interesting
@@ -849,6 +858,7 @@ int modeFolder(BLContextPtr context, struct clarg actargs[klast]) {
                 return 3;
             }
         }		
+        BLTimingPhaseEnd(context, &phase, kBLTimingPhaseNVRAM);
     }
 	
 	if (bootXdata) CFRelease(bootXdata);
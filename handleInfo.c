@@ -126,8 +126,6 @@ int modeInfo(BLContextPtr context, struct clarg actargs[klast]) {
 	char					*volToCheck;
 	io_service_t			service = IO_OBJECT_NULL;
 	CFStringRef				newBSDName;
-	int             		mntsize;
-	struct statfs   		*mnts;
 	char            		realMountPoint[MAXPATHLEN];
 	char					prebootMountPoint[MAXPATHLEN];
     UInt16                  role;
@@ -144,23 +142,29 @@ int modeInfo(BLContextPtr context, struct clarg actargs[klast]) {
         
         if (preboot == kBLPreBootEnvType_EFI) {
             CFStringRef     efibootdev = NULL;
+            struct BLNVRAMSnapshot *snapshot = NULL;
             
-            ret = BLCopyEFINVRAMVariableAsString(context,
-                                                 CFSTR("efi-boot-device"),
-                                                 &efibootdev);
+            // One read of NVRAM for the boot device and everything validating it needs
+            ret = BLCopyNVRAMSnapshot(context, &snapshot);
+            if(ret == 0) {
+                efibootdev = BLNVRAMSnapshotGetString(context, snapshot, CFSTR("efi-boot-device"));
+            }
             
             if(ret || efibootdev == NULL) {
+                BLNVRAMSnapshotRelease(snapshot);
                 blesscontextprintf(context, kBLLogLevelError,
                                    "Can't access \"efi-boot-device\" NVRAM variable\n");
                 return 1;
             }
+            CFRetain(efibootdev);
 
             blesscontextprintf(context, kBLLogLevelVerbose,  "Current EFI boot device string is: '%s'\n",
                                BLGetCStringDescription(efibootdev));                    
 
-            ret = BLValidateXMLBootOption(context,
-                                          CFSTR("efi-boot-device"),
-                                          CFSTR("efi-boot-device-data"));
+            ret = BLValidateXMLBootOptionInSnapshot(context, snapshot,
+                                                    CFSTR("efi-boot-device"),
+                                                    CFSTR("efi-boot-device-data"));
+            BLNVRAMSnapshotRelease(snapshot);
             if(ret) {
                 CFRelease(efibootdev);
                 blesscontextprintf(context, kBLLogLevelError,
@@ -181,10 +185,15 @@ int modeInfo(BLContextPtr context, struct clarg actargs[klast]) {
         } else if (preboot == kBLPreBootEnvType_iBoot) {
             CFStringRef     bootvolume = NULL;
             CFArrayRef      uuidArr;
+            struct BLNVRAMSnapshot *snapshot = NULL;
             
-            ret = BLCopyEFINVRAMVariableAsString(context,
-                                                 CFSTR("40A0DDD2-77F8-4392-B4A3-1E7304206516:boot-volume"),
-                                                 &bootvolume);
+            ret = BLCopyNVRAMSnapshot(context, &snapshot);
+            if(ret == 0) {
+                bootvolume = BLNVRAMSnapshotGetString(context, snapshot,
+                                                      CFSTR("40A0DDD2-77F8-4392-B4A3-1E7304206516:boot-volume"));
+                if(bootvolume) CFRetain(bootvolume);
+                BLNVRAMSnapshotRelease(snapshot);
+            }
             
             if(ret || bootvolume == NULL) {
                 blesscontextprintf(context, kBLLogLevelError,
@@ -278,25 +287,15 @@ int modeInfo(BLContextPtr context, struct clarg actargs[klast]) {
                             if (!slash) {
                                 // Either there was no path in NVRAM or it didn't have the right form.
                                 // Let's try to get the path from the volume bless information.
-                                // Check if the preboot volume is mounted.
+                                // Use the preboot volume where it is mounted, or mount it.
                                 bool            mustUnmount = false;
                                 uint64_t        blessWords[2];
                                 
-                                mntsize = getmntinfo(&mnts, MNT_NOWAIT);
-                                for (i = 0; i < mntsize; i++) {
-                                    if (strcmp(mnts[i].f_mntfromname, currentDev) == 0) break;
-                                }
-                                if (i < mntsize) {
-                                    strlcpy(prebootMountPoint, mnts[i].f_mntonname, sizeof prebootMountPoint);
-                                } else {
-                                    // The preboot volume isn't mounted right now.  We'll have to mount it.
-                                    ret = BLMountContainerVolume(context, currentDev + strlen("/dev/"), prebootMountPoint,
-															 sizeof prebootMountPoint, true);
-                                    if (ret) {
-                                        blesscontextprintf(context, kBLLogLevelError, "Couldn't mount preboot volume %s\n", currentDev);
-                                        return 3;
-                                    }
-                                    mustUnmount = true;
+                                ret = BLAcquireMount(context, currentDev + strlen("/dev/"), NULL, true, prebootMountPoint,
+                                                     sizeof prebootMountPoint, &mustUnmount);
+                                if (ret) {
+                                    blesscontextprintf(context, kBLLogLevelError, "Couldn't mount preboot volume %s\n", currentDev);
+                                    return 3;
                                 }
                                 ret = BLGetAPFSBlessData(context, prebootMountPoint, blessWords);
                                 if (ret) {
@@ -310,12 +309,12 @@ int modeInfo(BLContextPtr context, struct clarg actargs[klast]) {
                                                            (long long)blessWords[0]);
                                     }
                                 }
-                                if (mustUnmount) BLUnmountContainerVolume(context, prebootMountPoint);
+                                realpath(prebootMountPoint, realMountPoint);
+                                if (mustUnmount) BLReleaseMount(context, prebootMountPoint);
                                 if (ret) {
                                     CFRelease(booterDict);
                                     return 4;
                                 }
-                                realpath(prebootMountPoint, realMountPoint);
                             }
 
                             newBSDName = BLGetAPFSBlessedVolumeBSDName(context, slash ? "" : realMountPoint, currentPath, uuid);
@@ -521,22 +520,11 @@ int modeInfo(BLContextPtr context, struct clarg actargs[klast]) {
                     prebootDev = CFArrayGetValueAtIndex(prebootBSDs, 0);
                     CFStringGetCString(prebootDev, prebootNode, sizeof prebootNode, kCFStringEncodingUTF8);
                     
-                    mntsize = getmntinfo(&mnts, MNT_NOWAIT);
-                    for (i = 0; i < mntsize; i++) {
-                        if (strcmp(mnts[i].f_mntfromname + strlen(_PATH_DEV), prebootNode) == 0) break;
-                    }
-                    if (i < mntsize) {
-                        strlcpy(prebootMountPoint, mnts[i].f_mntonname, sizeof prebootMountPoint);
-                    } else {
-                        // The preboot volume isn't mounted right now.  We'll have to mount it.
-                        ret = BLMountContainerVolume(context, prebootNode, prebootMountPoint, sizeof prebootMountPoint, true);
-                        if (ret) {
-                            blesscontextprintf(context, kBLLogLevelError, "Couldn't mount preboot volume /dev/%s\n", prebootNode);
-                            noAccessToPreboot = true;
-                            ret = 0;
-                        } else {
-                            mustUnmount = true;
-                        }
+                    ret = BLAcquireMount(context, prebootNode, NULL, true, prebootMountPoint, sizeof prebootMountPoint, &mustUnmount);
+                    if (ret) {
+                        blesscontextprintf(context, kBLLogLevelError, "Couldn't mount preboot volume /dev/%s\n", prebootNode);
+                        noAccessToPreboot = true;
+                        ret = 0;
                     }
                     volToCheck = prebootMountPoint;
                 } else {
@@ -547,7 +535,7 @@ int modeInfo(BLContextPtr context, struct clarg actargs[klast]) {
                     allInfo = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
                 } else {
                     ret = BLCreateAPFSVolumeInformationDictionary(context, volToCheck, (void *)&allInfo);
-                    if (mustUnmount) BLUnmountContainerVolume(context, prebootMountPoint);
+                    if (mustUnmount) BLReleaseMount(context, prebootMountPoint);
                     if (ret) {
                         blesscontextprintf(context, kBLLogLevelError, "Couldn't get bless data from preboot volume.\n");
                         return 4;
@@ -578,7 +566,23 @@ int modeInfo(BLContextPtr context, struct clarg actargs[klast]) {
     
     if(actargs[kplist].present) {
         CFDataRef		tempData = NULL;
-        
+        BLPreBootEnvType	preboot;
+
+        // The whole boot menu, decoded from the same NVRAM read as the boot device
+        if(BLGetPreBootEnvironmentType(context, &preboot) == 0 && preboot == kBLPreBootEnvType_EFI) {
+            struct BLNVRAMSnapshot *snapshot = NULL;
+            CFArrayRef      bootMenu = NULL;
+
+            if(BLCopyNVRAMSnapshot(context, &snapshot) == 0) {
+                bootMenu = BLCreateEFIBootMenu(context, snapshot);
+                BLNVRAMSnapshotRelease(snapshot);
+            }
+            if(bootMenu) {
+                CFDictionarySetValue(allInfo, CFSTR("Boot Options"), bootMenu);
+                CFRelease(bootMenu);
+            }
+        }
+
 		tempData = CFPropertyListCreateData(kCFAllocatorDefault, dict, kCFPropertyListXMLFormat_v1_0, 0, NULL);
         
         write(fileno(stdout), CFDataGetBytePtr(tempData), CFDataGetLength(tempData));
@@ -661,7 +665,7 @@ int modeInfo(BLContextPtr context, struct clarg actargs[klast]) {
 				
 				if (CFStringGetLength(path) > 0 && j == 1) {
 					char		bsd[64] = _PATH_DEV;
-					int			i;
+					char		blessedMountPoint[MAXPATHLEN];
                     uuid_string_t uuid;
 					
 					if (strcmp(volToCheck, kPrebootIndicator) != 0) {
@@ -682,23 +686,22 @@ int modeInfo(BLContextPtr context, struct clarg actargs[klast]) {
                     if (newBSDName) {
                         CFStringGetCString(newBSDName, bsd + strlen(_PATH_DEV), sizeof bsd - strlen(_PATH_DEV),
                                            kCFStringEncodingUTF8);
-                        mntsize = getmntinfo(&mnts, MNT_NOWAIT);
-                        for (i = 0; i < mntsize; i++) {
-                            if (strcmp(mnts[i].f_mntfromname, bsd) == 0) break;
+                        if (BLGetMountPointForDevice(context, bsd, blessedMountPoint, sizeof blessedMountPoint)) {
+                            *blessedMountPoint = '\0';
                         }
-                        if (i < mntsize) {
+                        if (*blessedMountPoint) {
                             if (explicitPreboot || explicitRecovery) {
                                 blesscontextprintf(context, kBLLogLevelNormal, "These paths are associated with the volume \"%s\".\n",
-                                                    mnts[i].f_mntonname);
+                                                    blessedMountPoint);
                             } else {
                                 blesscontextprintf(context, kBLLogLevelNormal, "The blessed volume in this APFS container is \"%s\".\n",
-                                                    mnts[i].f_mntonname);
+                                                    blessedMountPoint);
                             }
 
                             // check for a blessed APFS snapshot
-                            if (BLGetAPFSSnapshotBlessData(context, mnts[i].f_mntonname, snap_uuid)) {
+                            if (BLGetAPFSSnapshotBlessData(context, blessedMountPoint, snap_uuid)) {
                                 blesscontextprintf(context, kBLLogLevelError, "Could not lookup blessed APFS snapshot for %s - %s\n",
-                                                   mnts[i].f_mntonname, strerror(errno));
+                                                   blessedMountPoint, strerror(errno));
                             } else if (snap_uuid[0]) {
                                 blesscontextprintf(context, kBLLogLevelNormal, "The blessed APFS snapshot for this volume is \"%s\".\n",
                                                    snap_uuid);
@@ -974,6 +977,13 @@ GetSystemBSDForVolumeGroupUUID(BLContextPtr context, CFStringRef uuid, char *cur
     io_service_t               volume = IO_OBJECT_NULL;
     char                       bsd_name[MAXPATHLEN];
     
+    if (BLContextTopology(context) &&
+        CFStringGetCString(uuid, bsd_name, sizeof bsd_name, kCFStringEncodingUTF8)) {
+        ret = BLTopologyGetSystemVolumeForGroup(context, BLContextTopology(context), bsd_name, currentDev, len);
+        if (ret != ENOTSUP) return ret;
+        ret = 0;
+    }
+
     // Create a matching dictionary for all system volumes
     match_dict = IOServiceMatching(APFS_VOLUME_OBJECT);
     if (!match_dict) {
@@ -241,7 +241,7 @@ badHierarchy:
 
 
 
-int BLMountContainerVolume(BLContextPtr context, const char *bsdName, char *mntPoint, int mntPtStrSize, bool readOnly)
+static int _BLMountContainerVolume(BLContextPtr context, const char *bsdName, char *mntPoint, int mntPtStrSize, bool readOnly)
 {
     int		ret;
     char    vartmpLoc[MAXPATHLEN];
@@ -314,9 +314,19 @@ int BLMountContainerVolume(BLContextPtr context, const char *bsdName, char *mntP
     return 0;
 }
 
+int BLMountContainerVolume(BLContextPtr context, const char *bsdName, char *mntPoint, int mntPtStrSize, bool readOnly)
+{
+	uint64_t	span = BLTraceBegin(context);
+	int			ret = _BLMountContainerVolume(context, bsdName, mntPoint, mntPtStrSize, readOnly);
+	
+	BLMountTableInvalidate(context);
+	BLTraceEnd(context, span, "BLMountContainerVolume", bsdName);
+	return ret;
+}
 
 
-int BLUnmountContainerVolume(BLContextPtr context, char *mntPoint)
+
+static int _BLUnmountContainerVolume(BLContextPtr context, char *mntPoint)
 {
     int				err;
     char			*newargv[3];
@@ -363,8 +373,67 @@ int BLUnmountContainerVolume(BLContextPtr context, char *mntPoint)
     return 0;
 }
 
+int BLUnmountContainerVolume(BLContextPtr context, char *mntPoint)
+{
+	uint64_t	span = BLTraceBegin(context);
+	int			ret = _BLUnmountContainerVolume(context, mntPoint);
+	
+	BLMountTableInvalidate(context);
+	BLTraceEnd(context, span, "BLUnmountContainerVolume", mntPoint);
+	return ret;
+}
 
-int BLMountSnapshot(BLContextPtr context, const char *bsdName, const char *snapName, char *mntPoint, int mntPtStrSize)
+
+static int _BLRemountContainerVolume(BLContextPtr context, const char *mntPoint, bool readOnly)
+{
+    int     ret;
+    char    mntPointLoc[MAXPATHLEN];
+    char    *newargv[5];
+
+    strlcpy(mntPointLoc, mntPoint, sizeof mntPointLoc);
+    newargv[0] = "/sbin/mount";
+    newargv[1] = "-u";
+    newargv[2] = readOnly ? "-r" : "-w";
+    newargv[3] = mntPointLoc;
+    newargv[4] = NULL;
+
+    contextprintf(context, kBLLogLevelVerbose, "Executing \"%s\"\n", "/sbin/mount");
+
+    pid_t p = fork();
+    if (p == 0) {
+        setuid(geteuid());
+        ret = execv("/sbin/mount", newargv);
+        if (ret == -1) {
+            contextprintf(context, kBLLogLevelError,  "Could not exec %s\n", "/sbin/mount");
+        }
+        _exit(1);
+    }
+
+    do {
+        p = wait(&ret);
+    } while (p == -1 && errno == EINTR);
+
+    contextprintf(context, kBLLogLevelVerbose, "Returned %d\n", ret);
+    if (p == -1 || ret) {
+        contextprintf(context, kBLLogLevelError,  "%s returned non-0 exit status\n", "/sbin/mount");
+        return 3;
+    }
+
+    return 0;
+}
+
+int BLRemountContainerVolume(BLContextPtr context, const char *mntPoint, bool readOnly)
+{
+	uint64_t	span = BLTraceBegin(context);
+	int			ret = _BLRemountContainerVolume(context, mntPoint, readOnly);
+	
+	BLMountTableInvalidate(context);
+	BLTraceEnd(context, span, "BLRemountContainerVolume", mntPoint);
+	return ret;
+}
+
+
+static int _BLMountSnapshot(BLContextPtr context, const char *bsdName, const char *snapName, char *mntPoint, int mntPtStrSize)
 {
     int        ret;
     char    vartmpLoc[MAXPATHLEN];
@@ -438,6 +507,37 @@ int BLMountSnapshot(BLContextPtr context, const char *bsdName, const char *snapN
     return 0;
 }
 
+int BLMountSnapshot(BLContextPtr context, const char *bsdName, const char *snapName, char *mntPoint, int mntPtStrSize)
+{
+	uint64_t	span = BLTraceBegin(context);
+	int			ret = _BLMountSnapshot(context, bsdName, snapName, mntPoint, mntPtStrSize);
+	
+	BLMountTableInvalidate(context);
+	BLTraceEnd(context, span, "BLMountSnapshot", snapName);
+	return ret;
+}
+
+
+
+static int leaseMount(BLContextPtr context, void *refcon, const char *bsdName, const char *snapName, bool readOnly,
+					  char *mntPoint, int mntPtStrSize)
+{
+	if (snapName) return BLMountSnapshot(context, bsdName, snapName, mntPoint, mntPtStrSize);
+	return BLMountContainerVolume(context, bsdName, mntPoint, mntPtStrSize, readOnly);
+}
+
+static int leaseUpdate(BLContextPtr context, void *refcon, const char *mntPoint, bool readOnly)
+{
+	return BLRemountContainerVolume(context, mntPoint, readOnly);
+}
+
+static int leaseUnmount(BLContextPtr context, void *refcon, const char *mntPoint)
+{
+	return BLUnmountContainerVolume(context, (char *)mntPoint);
+}
+
+const BLMountLeaseOps BLDefaultMountLeaseOps = { leaseMount, leaseUpdate, leaseUnmount };
+
 
 
 int BLEnsureSpecialAPFSVolumeUUIDPath(BLContextPtr context, const char *volumeDev, int specialRole, bool useGroupUUID, char *subjectPath, int subjectLen, bool *didMount)
@@ -445,8 +545,6 @@ int BLEnsureSpecialAPFSVolumeUUIDPath(BLContextPtr context, const char *volumeDe
     int             ret;
     char            specialDevPath[64];
     char            containerDev[MAXPATHLEN];
-    struct statfs   *mnts;
-    int             mntsize;
     int             i;
     io_service_t    service = IO_OBJECT_NULL;
     CFStringRef     uuidKey = NULL;
@@ -470,24 +568,9 @@ int BLEnsureSpecialAPFSVolumeUUIDPath(BLContextPtr context, const char *volumeDe
                                                   sizeof specialDevPath - strlen(_PATH_DEV));
     if (ret) goto exit;
 
-    // Check if the given volume is mounted.
-    mntsize = getmntinfo(&mnts, MNT_NOWAIT);
-    if (!mntsize) {
-        ret = 5;
-        goto exit;
-    }
-    for (i = 0; i < mntsize; i++) {
-        if (strcmp(mnts[i].f_mntfromname, specialDevPath) == 0) break;
-    }
-    if (i < mntsize) {
-        strlcpy(subjectPath, mnts[i].f_mntonname, subjectLen);
-        *didMount = false;
-    } else {
-        // The preboot volume isn't mounted right now.  We'll have to mount it.
-        ret = BLMountContainerVolume(context, specialDevPath + strlen(_PATH_DEV), subjectPath, subjectLen, false);
-        if (ret) goto exit;
-        *didMount = true;
-    }
+    // Use the volume where it is mounted, or mount it.
+    ret = BLAcquireMount(context, specialDevPath + strlen(_PATH_DEV), NULL, false, subjectPath, subjectLen, didMount);
+    if (ret) goto exit;
     ret = BLGetIOServiceForDeviceName(context, volumeDev + strlen(_PATH_DEV), &service);
     if (ret) goto exit;
     uuidKey = useGroupUUID ? CFSTR(kAPFSVolGroupUUIDKey) : CFSTR(kIOMediaUUIDKey);
@@ -640,19 +723,12 @@ int BLIsVolumeARV(BLContextPtr context, const char *mountPoint, const char *volB
             goto exit;
         }
     
-        ret = GetMountForBSD(context, prebootBSD, prebootMountPoint, sizeof prebootMountPoint);
+        // Read-write, as Preboot was mounted here before mount leases
+        ret = BLAcquireMount(context, prebootBSD, NULL, false, prebootMountPoint, sizeof prebootMountPoint, &mustUnmount);
         if (ret) {
-            contextprintf(context, kBLLogLevelError, "Error looking up mount points\n");
+            contextprintf(context, kBLLogLevelError, "Couldn't mount preboot volume %s\n", prebootBSD);
             goto exit;
         }
-        if (!prebootMountPoint[0]) {
-            // The preboot volume isn't mounted right now.  We'll have to mount it.
-            ret = BLMountContainerVolume(context, prebootBSD, prebootMountPoint, sizeof prebootMountPoint, false);
-            if (ret) {
-                goto exit;
-            }
-            mustUnmount = true;
-        }
         
         ret = GetUUIDFolderPathInPreboot(context, prebootMountPoint, volBSD, prebootFolderPath, sizeof prebootFolderPath);
         if (ret) {
@@ -668,7 +744,7 @@ int BLIsVolumeARV(BLContextPtr context, const char *mountPoint, const char *volB
 exit:
 	*arv = isARV;
     if (mustUnmount) {
-       BLUnmountContainerVolume(context, prebootMountPoint);
+       BLReleaseMount(context, prebootMountPoint);
     }
 	return ret;
 }
@@ -782,111 +858,317 @@ exit:
 
 static uint16_t RoleNameToValue(CFStringRef roleName)
 {
-	if (CFEqual(roleName, CFSTR(kAPFSVolumeRoleNone))) {
-		return APFS_VOL_ROLE_NONE;
-	} else if (CFEqual(roleName, CFSTR(kAPFSVolumeRoleSystem))) {
-		return APFS_VOL_ROLE_SYSTEM;
-	} else if (CFEqual(roleName, CFSTR(kAPFSVolumeRoleUser))) {
-		return APFS_VOL_ROLE_USER;
-	} else if (CFEqual(roleName, CFSTR(kAPFSVolumeRoleRecovery))) {
-		return APFS_VOL_ROLE_RECOVERY;
-	} else if (CFEqual(roleName, CFSTR(kAPFSVolumeRoleVM))) {
-		return APFS_VOL_ROLE_VM;
-	} else if (CFEqual(roleName, CFSTR(kAPFSVolumeRolePreBoot))) {
-		return APFS_VOL_ROLE_PREBOOT;
-	} else if (CFEqual(roleName, CFSTR(kAPFSVolumeRoleInstaller))) {
-		return APFS_VOL_ROLE_INSTALLER;
-	} else if (CFEqual(roleName, CFSTR(kAPFSVolumeRoleData))) {
-		return APFS_VOL_ROLE_DATA;
-	} else if (CFEqual(roleName, CFSTR(kAPFSVolumeRoleBaseband))) {
-		return APFS_VOL_ROLE_BASEBAND;
-	} else if (CFEqual(roleName, CFSTR(kAPFSVolumeRoleXART))) {
-		return APFS_VOL_ROLE_XART;
-	} else if (CFEqual(roleName, CFSTR(kAPFSVolumeRoleInternal))) {
-		return APFS_VOL_ROLE_INTERNAL;
-	} else if (CFEqual(roleName, CFSTR(kAPFSVolumeRoleBackup))) {
-		return APFS_VOL_ROLE_BACKUP;
-	} else if (CFEqual(roleName, CFSTR(kAPFSVolumeRoleUpdate))) {
-		return APFS_VOL_ROLE_UPDATE;
-	} else if (CFEqual(roleName, CFSTR(kAPFSVolumeRoleHardware))) {
-		return APFS_VOL_ROLE_HARDWARE;
-	} else if (CFEqual(roleName, CFSTR(kAPFSVolumeRoleSideCar))) {
-		return APFS_VOL_ROLE_SIDECAR;
-	} else if (CFEqual(roleName, CFSTR(kAPFSVolumeRoleEnterprise))) {
-		return APFS_VOL_ROLE_ENTERPRISE;
-	} else if (CFEqual(roleName, CFSTR(kAPFSVolumeRoleIDiags))) {
-		return APFS_VOL_ROLE_IDIAGS;
+	char name[32];
+
+	if (!CFStringGetCString(roleName, name, sizeof name, kCFStringEncodingUTF8)) {
+		return -1U;
 	}
-	return -1U;
+	return BLAPFSRoleForName(name);
 }
 
-int GetPrebootBSDForVolumeBSD(BLContextPtr context, const char *volBSD, char *prebootBSD, int prebootBSDLen)
+// The BSD name of the first volume in container with role as its only role; "" if there isn't one
+static void GetRoledVolumeBSDInContainer(io_registry_entry_t container, CFStringRef role, char *bsd, int len)
 {
-    int                ret;
-    CFDictionaryRef    booterDict;
-    CFArrayRef        prebootVols;
-    CFStringRef        prebootVol;
-    
-    ret = BLCreateBooterInformationDictionary(context, volBSD, &booterDict);
-    if (ret) {
-       contextprintf(context, kBLLogLevelError, "Could not get boot information for device %s\n", volBSD);
+    io_iterator_t   volIter;
+    io_service_t    volIOMedia;
+    CFArrayRef      volRoles;
+    CFStringRef     volBSDName;
+
+    *bsd = '\0';
+    if (IORegistryEntryGetChildIterator(container, kIOServicePlane, &volIter) != KERN_SUCCESS) return;
+    while (!*bsd && IO_OBJECT_NULL != (volIOMedia = IOIteratorNext(volIter))) {
+        if (IOObjectConformsTo(volIOMedia, APFS_VOLUME_OBJECT)) {
+            volRoles = IORegistryEntryCreateCFProperty(volIOMedia, CFSTR(kAPFSRoleKey), kCFAllocatorDefault, 0);
+            if (volRoles && CFGetTypeID(volRoles) == CFArrayGetTypeID() && CFArrayGetCount(volRoles) == 1 &&
+                CFEqual(CFArrayGetValueAtIndex(volRoles, 0), role)) {
+                volBSDName = IORegistryEntryCreateCFProperty(volIOMedia, CFSTR(kIOBSDNameKey), kCFAllocatorDefault, 0);
+                if (volBSDName) {
+                    CFStringGetCString(volBSDName, bsd, len, kCFStringEncodingUTF8);
+                    CFRelease(volBSDName);
+                }
+            }
+            if (volRoles) CFRelease(volRoles);
+        }
+        IOObjectRelease(volIOMedia);
+    }
+    IOObjectRelease(volIter);
+}
+
+// The APFS container that media is, is in, or is the physical store for
+static io_registry_entry_t CopyContainerForMedia(io_service_t media)
+{
+    io_registry_entry_t     entry, parent;
+    io_iterator_t           iter;
+
+    if (IOObjectConformsTo(media, APFS_MEDIA_OBJECT)) {
+        IOObjectRetain(media);
+        return media;
+    }
+    if (IOObjectConformsTo(media, APFS_VOLUME_OBJECT) || IOObjectConformsTo(media, "AppleAPFSSnapshot")) {
+        entry = media;
+        IOObjectRetain(entry);
+        while (!IOObjectConformsTo(entry, APFS_MEDIA_OBJECT)) {
+            if (IORegistryEntryGetParentEntry(entry, kIOServicePlane, &parent) != KERN_SUCCESS) {
+                IOObjectRelease(entry);
+                return IO_OBJECT_NULL;
+            }
+            IOObjectRelease(entry);
+            entry = parent;
+        }
+        return entry;
+    }
+    if (IORegistryEntryCreateIterator(media, kIOServicePlane, kIORegistryIterateRecursively, &iter) != KERN_SUCCESS) {
+        return IO_OBJECT_NULL;
+    }
+    while (IO_OBJECT_NULL != (entry = IOIteratorNext(iter))) {
+        if (IOObjectConformsTo(entry, APFS_MEDIA_OBJECT)) break;
+        IOObjectRelease(entry);
+    }
+    IOObjectRelease(iter);
+    return entry;
+}
+
+int BLAPFSCreateVolumeBSDsWithRole(BLContextPtr context, const char *bsd, uint16_t role, CFArrayRef *volBSDs)
+{
+    struct BLTopology       *topology = BLContextTopology(context);
+    struct BLTopologyModel  *model;
+    BLTopologyList          list;
+    CFMutableArrayRef       bsds;
+    CFStringRef             name;
+    CFArrayRef              volRoles;
+    io_service_t            media = IO_OBJECT_NULL;
+    io_registry_entry_t     container = IO_OBJECT_NULL;
+    io_iterator_t           volIter = IO_OBJECT_NULL;
+    io_service_t            volIOMedia;
+    uint32_t                i;
+    int                     ret = 0;
+
+    *volBSDs = NULL;
+    if (strncmp(bsd, _PATH_DEV, strlen(_PATH_DEV)) == 0) bsd += strlen(_PATH_DEV);
+    bsds = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
+    if (!bsds) return ENOMEM;
+
+    if (topology) {
+        ret = BLTopologyCopyModel(context, topology, &model);
+        if (ret == 0) {
+            ret = BLTopologyGetContainerVolumes(context, model, bsd, role, &list);
+            if (ret == 0) {
+                for (i = 0; i < list.count; i++) {
+                    name = CFStringCreateWithCString(kCFAllocatorDefault, BLTopologyGetNode(model, list.nodes[i])->bsd,
+                                                     kCFStringEncodingUTF8);
+                    if (name) {
+                        CFArrayAppendValue(bsds, name);
+                        CFRelease(name);
+                    }
+                }
+                free(list.nodes);
+            }
+            BLTopologyModelRelease(model);
+            if (ret == 0) goto exit;
+        }
+        if (ret != ENOENT && ret != ENOTSUP) goto exit;
+        ret = 0;
+    }
+
+    media = IOServiceGetMatchingService(kIOMasterPortDefault, IOBSDNameMatching(kIOMasterPortDefault, 0, bsd));
+    if (media == IO_OBJECT_NULL) {
+        contextprintf(context, kBLLogLevelError, "Could not get IOService for %s\n", bsd);
+        ret = 2;
         goto exit;
     }
-    prebootVols = CFDictionaryGetValue(booterDict, kBLAPFSPrebootVolumesKey);
-    if (!prebootVols || !CFArrayGetCount(prebootVols)) {
-     contextprintf(context, kBLLogLevelError, "No preboot volume associated with device %s\n", volBSD);
-        ret = EINVAL;
+    container = CopyContainerForMedia(media);
+    if (container == IO_OBJECT_NULL) {
+        contextprintf(context, kBLLogLevelError, "%s is not in an APFS container\n", bsd);
+        ret = 6;
         goto exit;
     }
-    prebootVol = CFArrayGetValueAtIndex(prebootVols, 0);
-    if (CFGetTypeID(prebootVol) != CFStringGetTypeID()) {
-     contextprintf(context, kBLLogLevelError, "Badly formed registry entry for preboot volume\n");
-        ret = EILSEQ;
+    if (IORegistryEntryGetChildIterator(container, kIOServicePlane, &volIter) != KERN_SUCCESS) {
+        contextprintf(context, kBLLogLevelError, "Could not get iterator for volumes\n");
+        ret = 2;
         goto exit;
     }
-    CFStringGetCString(prebootVol, prebootBSD, prebootBSDLen, kCFStringEncodingUTF8);
-    
+    while (IO_OBJECT_NULL != (volIOMedia = IOIteratorNext(volIter))) {
+        if (IOObjectConformsTo(volIOMedia, APFS_VOLUME_OBJECT)) {
+            volRoles = IORegistryEntryCreateCFProperty(volIOMedia, CFSTR(kAPFSRoleKey), kCFAllocatorDefault, 0);
+            if (volRoles && CFGetTypeID(volRoles) == CFArrayGetTypeID() && CFArrayGetCount(volRoles) == 1 &&
+                RoleNameToValue(CFArrayGetValueAtIndex(volRoles, 0)) == role) {
+                name = IORegistryEntryCreateCFProperty(volIOMedia, CFSTR(kIOBSDNameKey), kCFAllocatorDefault, 0);
+                if (name) {
+                    CFArrayAppendValue(bsds, name);
+                    CFRelease(name);
+                }
+            }
+            if (volRoles) CFRelease(volRoles);
+        }
+        IOObjectRelease(volIOMedia);
+    }
+
 exit:
+    if (volIter) IOObjectRelease(volIter);
+    if (container) IOObjectRelease(container);
+    if (media) IOObjectRelease(media);
+    if (ret) {
+        CFRelease(bsds);
+    } else {
+        *volBSDs = bsds;
+    }
     return ret;
 }
 
-int GetMountForBSD(BLContextPtr context, const char *bsd, char *mountPoint, int mountPointLen)
+// model, if there is one, keeps the answer for the container
+static int _GetPrebootAndRecoveryBSDForVolumeBSD(BLContextPtr context, struct BLTopologyModel *model, const char *volBSD,
+                                                 BLTopologyPrebootEntry *entry)
 {
-    struct statfs    *mnts;
-    int             mntsize;
-    int             i;
+    io_service_t            volIOMedia;
+    io_registry_entry_t     container, parent;
+    CFTypeRef               prebootData = NULL;
+    CFStringRef             component = NULL;
+    CFStringRef             containerPath, fullPath;
+    io_registry_entry_t     prebootMedia;
+    CFStringRef             prebootBSD;
+    int                     ret = 0;
 
-    mntsize = getmntinfo(&mnts, MNT_NOWAIT);
-    if (!mntsize) {
-        return errno;
+    memset(entry, 0, sizeof(*entry));
+    volIOMedia = IOServiceGetMatchingService(kIOMasterPortDefault, IOBSDNameMatching(kIOMasterPortDefault, 0, volBSD));
+    if (volIOMedia == IO_OBJECT_NULL) {
+        contextprintf(context, kBLLogLevelError, "Could not get IOService for %s\n", volBSD);
+        return ENOENT;
     }
-    for (i = 0; i < mntsize; i++) {
-        if (strcmp(mnts[i].f_mntfromname + strlen(_PATH_DEV), bsd) == 0) break;
+
+    // Up to the AppleAPFSContainer, past the volume if volBSD is a snapshot
+    container = volIOMedia;
+    while (IORegistryEntryGetParentEntry(container, kIOServicePlane, &parent) == KERN_SUCCESS) {
+        IOObjectRelease(container);
+        container = parent;
+        prebootData = IORegistryEntryCreateCFProperty(container, CFSTR("IOAPFSPreBootDevice"), kCFAllocatorDefault, 0);
+        if (prebootData) break;
     }
-    if (i < mntsize) {
-        strlcpy(mountPoint, mnts[i].f_mntonname, mountPointLen);
-    } else {
-        *mountPoint = '\0';
+    if (!prebootData) {
+        contextprintf(context, kBLLogLevelError, "No preboot volume associated with device %s\n", volBSD);
+        IOObjectRelease(container);
+        return EINVAL;
     }
-    return 0;
+
+    // A container without a recovery volume is looked at again, in case one has been added since
+    if (model && IORegistryEntryGetRegistryEntryID(container, &entry->containerID) == KERN_SUCCESS &&
+        BLTopologyModelGetPrebootEntry(model, entry->containerID, entry) && entry->recovery[0]) {
+        goto exit;
+    }
+
+    // The property holds the final path component of the preboot volume below
+    // the container, or an array of them (there should be only one)
+    if (CFGetTypeID(prebootData) == CFStringGetTypeID()) {
+        component = prebootData;
+    } else if (CFGetTypeID(prebootData) == CFArrayGetTypeID() && CFArrayGetCount(prebootData) > 0) {
+        component = CFArrayGetValueAtIndex(prebootData, 0);
+    }
+    if (!component || CFGetTypeID(component) != CFStringGetTypeID()) {
+        contextprintf(context, kBLLogLevelError, "Invalid APFS preboot data for %s\n", volBSD);
+        ret = 5;
+        goto exit;
+    }
+    if (!entry->preboot[0]) {
+        containerPath = IORegistryEntryCopyPath(container, kIOServicePlane);
+        if (!containerPath) {
+            ret = 2;
+            goto exit;
+        }
+        fullPath = CFStringCreateWithFormat(kCFAllocatorDefault, NULL, CFSTR("%@/%@"), containerPath, component);
+        CFRelease(containerPath);
+        prebootMedia = IORegistryEntryCopyFromPath(kIOMasterPortDefault, fullPath);
+        CFRelease(fullPath);
+        if (!prebootMedia) {
+            ret = 3;
+            goto exit;
+        }
+        prebootBSD = IORegistryEntryCreateCFProperty(prebootMedia, CFSTR(kIOBSDNameKey), kCFAllocatorDefault, 0);
+        IOObjectRelease(prebootMedia);
+        if (!prebootBSD) {
+            ret = 4;
+            goto exit;
+        }
+        CFStringGetCString(prebootBSD, entry->preboot, sizeof entry->preboot, kCFStringEncodingUTF8);
+        CFRelease(prebootBSD);
+    }
+    GetRoledVolumeBSDInContainer(container, CFSTR(kAPFSVolumeRoleRecovery), entry->recovery, sizeof entry->recovery);
+    if (model && entry->containerID) BLTopologyModelSetPrebootEntry(model, entry);
+
+exit:
+    CFRelease(prebootData);
+    IOObjectRelease(container);
+    return ret;
 }
 
-int GetUUIDFolderPathInPreboot(BLContextPtr context, const char *prebootMountPoint, const char *rootBSD, char *prebootDirPath, int len)
+int GetPrebootAndRecoveryBSDForVolumeBSD(BLContextPtr context, const char *volBSD, char *prebootBSD, int prebootBSDLen,
+                                         char *recoveryBSD, int recoveryBSDLen)
 {
-    char            prebootFolderPath[MAXPATHLEN];
-    char            *pathEnd;
-    size_t          pathFreeSpace;
-    int             ret = 0;
-    CFStringRef     bootUUID = NULL;
-    struct stat     existingStat;
-    io_service_t    rootMedia = IO_OBJECT_NULL;
-    io_service_t    systemMedia = IO_OBJECT_NULL;
-    
+    uint64_t                span = BLTraceBegin(context);
+    struct BLTopologyModel  *model = NULL;
+    BLTopologyPrebootEntry  entry;
+    int                     ret = ENOTSUP;
+
+    if (BLContextTopology(context)) {
+        ret = BLTopologyGetPrebootVolumes(context, BLContextTopology(context), volBSD,
+                                          prebootBSD, prebootBSDLen, recoveryBSD, recoveryBSDLen);
+    }
+    if (ret == ENOENT || ret == ENOTSUP) {
+        if (BLContextTopology(context)) BLTopologyCopyModel(context, BLContextTopology(context), &model);
+        ret = _GetPrebootAndRecoveryBSDForVolumeBSD(context, model, volBSD, &entry);
+        BLTopologyModelRelease(model);
+        if (!ret) {
+            strlcpy(prebootBSD, entry.preboot, prebootBSDLen);
+            if (recoveryBSD) strlcpy(recoveryBSD, entry.recovery, recoveryBSDLen);
+        }
+    }
+    BLTraceEnd(context, span, "GetPrebootAndRecoveryBSDForVolumeBSD", volBSD);
+    return ret;
+}
+
+int GetPrebootBSDForVolumeBSD(BLContextPtr context, const char *volBSD, char *prebootBSD, int prebootBSDLen)
+{
+    return GetPrebootAndRecoveryBSDForVolumeBSD(context, volBSD, prebootBSD, prebootBSDLen, NULL, 0);
+}
+
+int GetMountForBSD(BLContextPtr context, const char *bsd, char *mountPoint, int mountPointLen)
+{
+    char            device[MAXPATHLEN];
+
+    snprintf(device, sizeof device, "%s%s", _PATH_DEV, bsd);
+    return BLGetMountPointForDevice(context, device, mountPoint, mountPointLen);
+}
+
+// The volume and group UUIDs of a volume, or of the volume a snapshot is of
+static int CopyVolumeUUIDs(BLContextPtr context, const char *rootBSD, char *volumeUUID, char *groupUUID, int len)
+{
+    struct BLTopologyModel  *model;
+    const BLTopologyNode    *node;
+    io_service_t            rootMedia = IO_OBJECT_NULL;
+    io_service_t            systemMedia = IO_OBJECT_NULL;
+    CFStringRef             uuid;
+    int                     ret;
+
+    volumeUUID[0] = groupUUID[0] = '\0';
+    if (BLContextTopology(context)) {
+        ret = BLTopologyCopyModel(context, BLContextTopology(context), &model);
+        if (!ret) {
+            ret = BLTopologyLookup(model, rootBSD, &node);
+            if (!ret && node->kind == kBLTopologySnapshot) {
+                node = BLTopologyGetVolume(model, node);
+                if (!node) ret = ENOENT;
+            }
+            if (!ret) {
+                strlcpy(volumeUUID, node->uuid, len);
+                strlcpy(groupUUID, node->groupUUID, len);
+            }
+            BLTopologyModelRelease(model);
+            if (!ret) return 0;
+        }
+    }
+
     // Let's get the IOMedia for this device.
     rootMedia = IOServiceGetMatchingService(kIOMasterPortDefault, IOBSDNameMatching(kIOMasterPortDefault, 0, rootBSD));
     if (!rootMedia) {
-        ret = 1;
-        goto exit;
+        return 1;
     }
 
     if (IOObjectConformsTo(rootMedia, "AppleAPFSSnapshot")) {
@@ -894,12 +1176,39 @@ int GetUUIDFolderPathInPreboot(BLContextPtr context, const char *prebootMountPoi
         ret = BLAPFSSnapshotToVolume(context, rootMedia, &systemMedia);
         if (ret) {
             contextprintf(context, kBLLogLevelError, "Could not resolve snapshot at %s to volume\n", rootBSD);
-            goto exit;
+            IOObjectRelease(rootMedia);
+            return ret;
         }
     } else {
         systemMedia = rootMedia;
         IOObjectRetain(systemMedia);
     }
+    uuid = IORegistryEntryCreateCFProperty(systemMedia, CFSTR(kIOMediaUUIDKey), kCFAllocatorDefault, 0);
+    if (uuid) {
+        CFStringGetCString(uuid, volumeUUID, len, kCFStringEncodingUTF8);
+        CFRelease(uuid);
+    }
+    uuid = IORegistryEntryCreateCFProperty(systemMedia, CFSTR(kAPFSVolGroupUUIDKey), kCFAllocatorDefault, 0);
+    if (uuid) {
+        CFStringGetCString(uuid, groupUUID, len, kCFStringEncodingUTF8);
+        CFRelease(uuid);
+    }
+    IOObjectRelease(rootMedia);
+    IOObjectRelease(systemMedia);
+    return 0;
+}
+
+int GetUUIDFolderPathInPreboot(BLContextPtr context, const char *prebootMountPoint, const char *rootBSD, char *prebootDirPath, int len)
+{
+    char            prebootFolderPath[MAXPATHLEN];
+    char            volumeUUID[64], groupUUID[64];
+    char            *pathEnd;
+    size_t          pathFreeSpace;
+    int             ret = 0;
+    struct stat     existingStat;
+    
+    ret = CopyVolumeUUIDs(context, rootBSD, volumeUUID, groupUUID, sizeof volumeUUID);
+    if (ret) goto exit;
 
     // Find the appropriate UUID folder
     // We look for a volume UUID folder first.  If that's present, use it.
@@ -908,23 +1217,17 @@ int GetUUIDFolderPathInPreboot(BLContextPtr context, const char *prebootMountPoi
     snprintf(prebootFolderPath, sizeof prebootFolderPath, "%s/", prebootMountPoint);
     pathEnd = prebootFolderPath + strlen(prebootFolderPath);
     pathFreeSpace = sizeof prebootFolderPath - strlen(prebootFolderPath);
-    bootUUID = IORegistryEntryCreateCFProperty(systemMedia, CFSTR(kIOMediaUUIDKey), kCFAllocatorDefault, 0);
-    if (!bootUUID) {
+    if (!volumeUUID[0]) {
         contextprintf(context, kBLLogLevelError, "No valid volume UUID for device %s\n", rootBSD);
         ret = 2;
         goto exit;
     }
-    CFStringGetCString(bootUUID, pathEnd, pathFreeSpace, kCFStringEncodingUTF8);
-    if (stat(prebootFolderPath, &existingStat) < 0 || !S_ISDIR(existingStat.st_mode)) {
-        CFRelease(bootUUID);
-        bootUUID = NULL;
-    } else {
+    strlcpy(pathEnd, volumeUUID, pathFreeSpace);
+    if (stat(prebootFolderPath, &existingStat) == 0 && S_ISDIR(existingStat.st_mode)) {
         contextprintf(context, kBLLogLevelVerbose, "Found system volume UUID path in preboot for %s\n", rootBSD);
-    }
-    if (!bootUUID) {
-        bootUUID = IORegistryEntryCreateCFProperty(systemMedia, CFSTR(kAPFSVolGroupUUIDKey), kCFAllocatorDefault, 0);
-        if (bootUUID) CFStringGetCString(bootUUID, pathEnd, pathFreeSpace, kCFStringEncodingUTF8);
-        if (!bootUUID || stat(prebootFolderPath, &existingStat) < 0 || !S_ISDIR(existingStat.st_mode)) {
+    } else {
+        strlcpy(pathEnd, groupUUID, pathFreeSpace);
+        if (!groupUUID[0] || stat(prebootFolderPath, &existingStat) < 0 || !S_ISDIR(existingStat.st_mode)) {
             contextprintf(context, kBLLogLevelError, "No valid group or volume UUID folder for %s\n", rootBSD);
             ret = 2;
             goto exit;
@@ -936,8 +1239,5 @@ exit:
     if (0 == ret) {
         snprintf(prebootDirPath, len, "%s", prebootFolderPath);
     }
-    if (rootMedia) IOObjectRelease(rootMedia);
-    if (systemMedia) IOObjectRelease(systemMedia);
-    if (bootUUID) CFRelease(bootUUID);
     return ret;
 }
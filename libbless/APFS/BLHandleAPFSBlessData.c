@@ -158,9 +158,6 @@ int BLCreateAndSetSnapshotBoot(BLContextPtr context, const char *mountpoint, cha
 	CFStringRef		bsdCF;
 	char			systemDev[64] = _PATH_DEV;
 	char			systemMount[MAXPATHLEN];
-	int				mntsize;
-	struct statfs   *mnts;
-	int				i;
 	bool			mustUnmountSystem = false;
 	
 	if (statfs(mountpoint, &sfs) < 0) {
@@ -190,25 +187,11 @@ int BLCreateAndSetSnapshotBoot(BLContextPtr context, const char *mountpoint, cha
 			goto exit;
 		}
 		CFStringGetCString(bsdCF, systemDev + strlen(_PATH_DEV), sizeof systemDev - strlen(_PATH_DEV), kCFStringEncodingUTF8);
-		mntsize = getmntinfo(&mnts, MNT_NOWAIT);
-		if (!mntsize) {
-			ret = 5;
+		ret = BLAcquireMount(context, systemDev + strlen(_PATH_DEV), NULL, false, systemMount, sizeof systemMount, &mustUnmountSystem);
+		if (ret) {
+			contextprintf(context, kBLLogLevelError, "Couldn't mount system volume from %s\n", systemDev);
 			goto exit;
 		}
-		for (i = 0; i < mntsize; i++) {
-			if (strcmp(mnts[i].f_mntfromname, systemDev) == 0) break;
-		}
-		if (i < mntsize) {
-			strlcpy(systemMount, mnts[i].f_mntonname, sizeof systemMount);
-		} else {
-			// The preboot volume isn't mounted right now.  We'll have to mount it.
-			ret = BLMountContainerVolume(context, systemDev + strlen(_PATH_DEV), systemMount, sizeof systemMount, false);
-			if (ret) {
-				contextprintf(context, kBLLogLevelError, "Couldn't mount system volume from %s\n", systemDev);
-				goto exit;
-			}
-			mustUnmountSystem = true;
-		}
 		mountpoint = systemMount;
 	}
 	
@@ -239,7 +222,7 @@ exit:
 	if (volMedia) IOObjectRelease(volMedia);
 	if (systemMedia) IOObjectRelease(systemMedia);
 	if (mustUnmountSystem) {
-		BLUnmountContainerVolume(context, systemMount);
+		BLReleaseMount(context, systemMount);
 	}
 	return ret;
 }
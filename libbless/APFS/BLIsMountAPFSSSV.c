@@ -32,6 +32,7 @@
 #include <sys/param.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <errno.h>
 #include <APFS/APFS.h>
 
 #include "bless.h"
@@ -82,6 +83,12 @@ static int GetIfGroupOfVolumeDevContainsCompatibleSystemRoleVolume(BLContextPtr
     sscanf (volumeDev, "/dev/%s", targetVolBSD);
     /* this does not exhaustively catch all param input errors like NULL or super-long */
    
+    if (BLContextTopology(context)) {
+        ret = BLTopologyGroupHasOnlineSystemVolume(context, BLContextTopology(context), targetVolBSD, result);
+        if (ret != ENOENT && ret != ENOTSUP) goto exit;
+        ret = 0;
+    }
+
     targetVolIOMedia = IOServiceGetMatchingService(kIOMasterPortDefault, IOBSDNameMatching(kIOMasterPortDefault, 0, targetVolBSD));
     if (targetVolIOMedia == IO_OBJECT_NULL) {
         contextprintf(context, kBLLogLevelError, "Could not get IOService for %s\n", volumeDev);
@@ -270,7 +277,7 @@ int BLIsMountAPFSDataRolePreSSVToSSV(BLContextPtr context, const char * mountpt,
     
 exit:;
     if (mustUnmountPreboot) {
-        BLUnmountContainerVolume(context, specialMountPointPath);
+        BLReleaseMount(context, specialMountPointPath);
     }
     contextprintf(context, kBLLogLevelVerbose, "This is%s an APFS Data-Volume-Parameter-Driven Pre-SSV to SSV case\n",
                   *isPreSSVToSSV ? "" : " not");
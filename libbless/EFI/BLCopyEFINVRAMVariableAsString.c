@@ -40,50 +40,58 @@ int BLCopyEFINVRAMVariableAsString(BLContextPtr context,
                                    CFStringRef *value)
 {
     
-    io_registry_entry_t optionsNode = 0;
-    char            cStr[1024];
     CFTypeRef       valRef;
-    CFStringRef     stringRef;
+    int             ret;
     
     *value = NULL;
     
-    optionsNode = IORegistryEntryFromPath(kIOMasterPortDefault, kIODeviceTreePlane ":/options");
-    
-    if(IO_OBJECT_NULL == optionsNode) {
-        contextprintf(context, kBLLogLevelError,  "Could not find " kIODeviceTreePlane ":/options\n");
+    // From the context's NVRAM cache, if it has one
+    if(BLCopyNVRAMVariable(context, name, &valRef)) {
         return 1;
     }
     
-    valRef = IORegistryEntryCreateCFProperty(optionsNode, name, kCFAllocatorDefault, 0);
-    IOObjectRelease(optionsNode);
-    
     if(valRef == NULL)
         return 0;
     
+    ret = BLCreateStringFromNVRAMValue(context, valRef, value);
+    CFRelease(valRef);
+    
+    return ret;
+}
+
+int BLCreateStringFromNVRAMValue(BLContextPtr context, CFTypeRef valRef, CFStringRef *value)
+{
+    CFStringRef     stringRef;
+    
+    *value = NULL;
+    
+    // Whole values, however long: the boot device XML can run past any fixed buffer
     if(CFGetTypeID(valRef) == CFStringGetTypeID()) {
-        if(!CFStringGetCString(valRef, cStr, sizeof(cStr), kCFStringEncodingUTF8)) {
+        CFRange range = CFRangeMake(0, CFStringGetLength(valRef));
+        
+        if(CFStringGetBytes(valRef, range, kCFStringEncodingUTF8, 0, false, NULL, 0, NULL) != range.length) {
             contextprintf(context, kBLLogLevelVerbose,
                                "Could not interpret NVRAM variable as UTF-8 string. Ignoring...\n");
-            cStr[0] = '\0';
+            stringRef = CFStringCreateWithCString(kCFAllocatorDefault, "", kCFStringEncodingUTF8);
+        } else {
+            stringRef = CFRetain(valRef);
         }
     } else if(CFGetTypeID(valRef) == CFDataGetTypeID()) {
         const UInt8 *ptr = CFDataGetBytePtr(valRef);
         CFIndex len = CFDataGetLength(valRef);
+        const UInt8 *nul = len ? memchr(ptr, '\0', len) : NULL;
         
-        if(len > sizeof(cStr)-1)
-            len = sizeof(cStr)-1;
+        // up to the first NUL, as when it was a C string
+        if(nul)
+            len = nul - ptr;
         
-        memcpy(cStr, (char *)ptr, len);
-        cStr[len] = '\0';
+        stringRef = CFStringCreateWithBytes(kCFAllocatorDefault, ptr, len, kCFStringEncodingUTF8, false);
         
     } else {
         contextprintf(context, kBLLogLevelError,  "Could not interpret NVRAM variable. Ignoring...\n");
-        cStr[0] = '\0';
+        stringRef = CFStringCreateWithCString(kCFAllocatorDefault, "", kCFStringEncodingUTF8);
     }
     
-    CFRelease(valRef);
-    
-    stringRef = CFStringCreateWithCString(kCFAllocatorDefault, cStr, kCFStringEncodingUTF8);
     if(stringRef == NULL) {
         return 2;
     }
@@ -61,14 +61,9 @@ int BLCreateEFIXMLRepresentationForDevice(BLContextPtr context,
     mach_port_t masterPort;
     kern_return_t kret;
     
-    CFDataRef xmlData;
     CFMutableDictionaryRef dict;
     CFMutableArrayRef array;
     
-    const UInt8 *xmlBuffer;
-    UInt8 *outBuffer;
-    CFIndex count;
-    
     kret = IOMasterPort(MACH_PORT_NULL, &masterPort);
     if(kret) return 1;
     
@@ -100,25 +95,9 @@ int BLCreateEFIXMLRepresentationForDevice(BLContextPtr context,
         CFRelease(optString);
     }
     
-    xmlData = IOCFSerialize(array, 0);
+    ret = BLCreateEFIXMLStringFromArray(context, array, xmlString);
     CFRelease(array);
     
-    if(xmlData == NULL) {
-        contextprintf(context, kBLLogLevelError, "Can't create XML representation\n");
-        return 2;
-    }
-    
-    count = CFDataGetLength(xmlData);
-    xmlBuffer = CFDataGetBytePtr(xmlData);
-    outBuffer = calloc(count+1, sizeof(char)); // terminate
-    
-    memcpy(outBuffer, xmlBuffer, count);
-    CFRelease(xmlData);
-    
-    *xmlString = CFStringCreateWithCString(kCFAllocatorDefault, (const char *)outBuffer, kCFStringEncodingUTF8);
-    
-    free(outBuffer);
-    
-    return 0;
+    return ret;
 }
 
@@ -60,6 +60,7 @@ static bool appendIOMedia (BLContextPtr inContext, const char* inBSDName, CFMuta
     // can use some other type of matching instead of registry entry ID match?
     
     kr = IORegistryEntryGetRegistryEntryID (media, &entryID);
+    IOObjectRelease (media);
     if (kr != KERN_SUCCESS)
     {
         contextprintf (inContext, kBLLogLevelVerbose, "IODVDMedia get registry ID failed\n");
@@ -77,6 +78,7 @@ static bool appendIOMedia (BLContextPtr inContext, const char* inBSDName, CFMuta
     // Hint as to the last BSD name. EFI shouldn't care; it is only a hint for programmers
     string = CFStringCreateWithCString (kCFAllocatorDefault, inBSDName, kCFStringEncodingUTF8);
     CFDictionaryAddValue (dict, CFSTR("BLLastBSDName"), string);
+    CFRelease (string);
     
     CFArrayAppendValue (inoutArray, dict);
     CFRelease (dict);
@@ -94,30 +96,14 @@ static bool appendIOMedia (BLContextPtr inContext, const char* inBSDName, CFMuta
 //
 static void appendMediaCDROM (BLContextPtr inContext, CFMutableArrayRef inoutArray, uint32_t inBootEntry, uint32_t inMSDOSRegionOffset, uint32_t inMSDOSRegionSize)
 {
-    CFMutableDictionaryRef  dict;
-    CFNumberRef             number;
-    uint32_t                value;
-    
-    dict = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks,
-                                     &kCFTypeDictionaryValueCallBacks);
-    
-    CFDictionaryAddValue(dict, CFSTR("IOEFIDevicePathType"), CFSTR("MediaCDROM"));
-    
-    value = inBootEntry;
-    number = CFNumberCreate(kCFAllocatorDefault, kCFNumberSInt32Type, &value);
-    CFDictionaryAddValue(dict, CFSTR("BootEntry"), number);
-    CFRelease(number);
+    BLEFIDevicePathNode     node = { kBLEFIDevicePathCDROM };
+    CFDictionaryRef         dict;
     
-    value = inMSDOSRegionOffset;
-    number = CFNumberCreate(kCFAllocatorDefault, kCFNumberSInt32Type, &value);
-    CFDictionaryAddValue(dict, CFSTR("PartitionStart"), number);
-    CFRelease(number);
-    
-    value = inMSDOSRegionSize;
-    number = CFNumberCreate(kCFAllocatorDefault, kCFNumberSInt32Type, &value);
-    CFDictionaryAddValue(dict, CFSTR("PartitionSize"), number);
-    CFRelease(number);
+    node.u.cdrom.bootEntry = inBootEntry;
+    node.u.cdrom.partitionStart = inMSDOSRegionOffset;
+    node.u.cdrom.partitionSize = inMSDOSRegionSize;
     
+    dict = BLCreateEFIDevicePathNodeDictionary (&node);
     CFArrayAppendValue(inoutArray, dict);
     CFRelease(dict);
 }
@@ -129,19 +115,12 @@ static void appendMediaCDROM (BLContextPtr inContext, CFMutableArrayRef inoutArr
 //
 static void appendMediaFilePath (BLContextPtr inContext, CFMutableArrayRef inoutArray)
 {
-    CFMutableDictionaryRef  dict;
-    CFStringRef             string;
-    const char *            filePath = "\\EFI\\BOOT\\BOOTX64.efi";
+    BLEFIDevicePathNode     node = { kBLEFIDevicePathFilePath };
+    CFDictionaryRef         dict;
     
-    dict = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks,
-                                     &kCFTypeDictionaryValueCallBacks);
-    
-    CFDictionaryAddValue(dict, CFSTR("IOEFIDevicePathType"), CFSTR("MediaFilePath"));
-    
-    string = CFStringCreateWithCString(kCFAllocatorDefault, filePath, kCFStringEncodingUTF8);
-    CFDictionaryAddValue(dict, CFSTR("Path"), string);
-    CFRelease(string);
+    node.u.filePath.path = "\\EFI\\BOOT\\BOOTX64.efi";
     
+    dict = BLCreateEFIDevicePathNodeDictionary (&node);
     CFArrayAppendValue(inoutArray, dict);
     CFRelease(dict);
 }
@@ -159,13 +138,9 @@ int BLCreateEFIXMLRepresentationForElToritoEntry(BLContextPtr   inContext,
     
     CFMutableArrayRef       arrayOfDicts = NULL;
     
-    CFDataRef               xmlData = NULL;
-    CFIndex                 count;
-    const UInt8 *           xmlBuffer = NULL;
-    UInt8 *                 outBuffer = NULL;
-    
     char                    buff [2048];
     bool                    aBool;
+    CFStringRef             desc;
     
     contextprintf(inContext, kBLLogLevelVerbose, "Creating XML representation for ElTorito entry\n");
     
@@ -173,7 +148,7 @@ int BLCreateEFIXMLRepresentationForElToritoEntry(BLContextPtr   inContext,
     arrayOfDicts = CFArrayCreateMutable (kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
     
     // Add to array: Add dict with IOMedia matching dict. Not sure why EFI cares:
-    aBool = appendIOMedia (inContext, inBSDName, arrayOfDicts);
+    aBool = (NULL == inBSDName) || appendIOMedia (inContext, inBSDName, arrayOfDicts);
     if (false == aBool)
     {
         CFRelease (arrayOfDicts);
@@ -190,36 +165,52 @@ int BLCreateEFIXMLRepresentationForElToritoEntry(BLContextPtr   inContext,
     appendMediaFilePath (inContext, arrayOfDicts);
     
     // Verbose mode print:
-    CFStringRef desc = CFCopyDescription (arrayOfDicts);
-    CFStringGetCString (desc, buff, sizeof(buff)-1, kCFStringEncodingUTF8);
-    contextprintf (inContext, kBLLogLevelVerbose, "array destined for XML then IORegistryEntrySetCFProperty() then NVRAM:\n\"\n%s\n\"\n", buff);
+    if (contextprintfenabled (inContext, kBLLogLevelVerbose))
+    {
+        desc = CFCopyDescription (arrayOfDicts);
+        CFStringGetCString (desc, buff, sizeof(buff)-1, kCFStringEncodingUTF8);
+        CFRelease (desc);
+        contextprintf (inContext, kBLLogLevelVerbose, "array destined for XML then IORegistryEntrySetCFProperty() then NVRAM:\n\"\n%s\n\"\n", buff);
+    }
     
-    // Turn the arrayOfDicts into an XML string (stored in a CFData). We no longer need the array:
-    xmlData = IOCFSerialize (arrayOfDicts, 0);
+    // Turn the arrayOfDicts into an XML string. We no longer need the array:
+    retErr = BLCreateEFIXMLStringFromArray (inContext, arrayOfDicts, outXMLString);
     CFRelease (arrayOfDicts);
+    if (retErr) goto Exit;
     
-    if (xmlData == NULL) {
-        contextprintf (inContext, kBLLogLevelVerbose, "Can't create XML representation\n");
-        retErr = 2;
-        goto Exit;
+    if (contextprintfenabled (inContext, kBLLogLevelVerbose))
+    {
+        CFStringGetCString (*outXMLString, buff, sizeof(buff), kCFStringEncodingUTF8);
+        contextprintf (inContext, kBLLogLevelVerbose, "array in XML form:\n\"\n%s\n\"\n", buff);
     }
     
-    // Allocte a buffer and copy the XML string (as CFData) into a buffer and make that buffer
-    // zero-terminated. We no longer need the CFData:
-    count = CFDataGetLength (xmlData);
-    xmlBuffer = CFDataGetBytePtr (xmlData);
-    outBuffer = calloc (count+1, sizeof(char));     // allocate one more byte for termination, also zero all bytes
-    memcpy (outBuffer, xmlBuffer, count);
-    CFRelease (xmlData);
-    contextprintf (inContext, kBLLogLevelVerbose, "array in XML form:\n\"\n%s\n\"\n", outBuffer);
-    
-    // Now make a CFString out of the zero-terminated string, and return it to the caller:
-    *outXMLString = CFStringCreateWithCString(kCFAllocatorDefault, (const char *)outBuffer, kCFStringEncodingUTF8);
-    
-    // We no longer need the zero-terminated string buffer:
-    free(outBuffer);
-    
     Exit:;
     return retErr;
 }
 
+
+
+
+//
+// Same as above, but takes the boot entry and MS-DOS region straight from an already-indexed
+// El Torito catalog (see BLCopyUEFIBootableElToritoCatalogForDVD()).
+//
+int BLCreateEFIXMLRepresentationForElToritoCatalog(BLContextPtr           inContext,
+                                                   const char *           inBSDName,
+                                                   BLElToritoCatalogRef   inCatalog,
+                                                   CFStringRef *          outXMLString)
+{
+    const BLElToritoEntry * entry;
+    uint32_t                msdosRegionOffset;
+    uint32_t                msdosRegionSize;
+    
+    entry = BLElToritoCatalogGetUEFIBootEntry (inCatalog, &msdosRegionOffset, &msdosRegionSize);
+    if (NULL == entry)
+    {
+        contextprintf (inContext, kBLLogLevelVerbose, "El Torito catalog has no bootable EFI section\n");
+        return 1;
+    }
+    
+    return BLCreateEFIXMLRepresentationForElToritoEntry (inContext, inBSDName, kBLElToritoUEFIBootEntry,
+                                                         msdosRegionOffset, msdosRegionSize, outXMLString);
+}
@@ -70,7 +70,6 @@ int BLCreateEFIXMLRepresentationForLegacyDevice(BLContextPtr context,
     kern_return_t kret;
     int ret;
     
-    CFDataRef xmlData;
     CFMutableDictionaryRef dict;
     CFMutableArrayRef array;
     CFNumberRef number;
@@ -79,10 +78,6 @@ int BLCreateEFIXMLRepresentationForLegacyDevice(BLContextPtr context,
     uint64_t    fvaddr, fvsize, fvaddrend;
     io_registry_entry_t romNode;
     
-    const UInt8 *xmlBuffer;
-    UInt8 *outBuffer;
-    CFIndex count;
-    
 	if(!BLSupportsLegacyMode(context)) {
         contextprintf(context, kBLLogLevelError, "Legacy mode not supported on this system\n");		
 		return 1;
@@ -192,26 +187,10 @@ int BLCreateEFIXMLRepresentationForLegacyDevice(BLContextPtr context,
     CFArrayAppendValue(array, dict);
     CFRelease(dict);        
             
-    xmlData = IOCFSerialize(array, 0);
+    ret = BLCreateEFIXMLStringFromArray(context, array, xmlString);
     CFRelease(array);
     
-    if(xmlData == NULL) {
-        contextprintf(context, kBLLogLevelError, "Can't create XML representation\n");
-        return 2;
-    }
-    
-    count = CFDataGetLength(xmlData);
-    xmlBuffer = CFDataGetBytePtr(xmlData);
-    outBuffer = calloc(count+1, sizeof(char)); // terminate
-    
-    memcpy(outBuffer, xmlBuffer, count);
-    CFRelease(xmlData);
-    
-    *xmlString = CFStringCreateWithCString(kCFAllocatorDefault, (const char *)outBuffer, kCFStringEncodingUTF8);
-    
-    free(outBuffer);
-    
-    return 0;
+    return ret;
 }
 
 static int addLegacyTypeForBSDName(BLContextPtr context,
@@ -247,10 +226,12 @@ static int addLegacyTypeForBSDName(BLContextPtr context,
     if(protocolCharacteristics && CFGetTypeID(protocolCharacteristics) == CFDictionaryGetTypeID()) {
         CFStringRef interconnect = CFDictionaryGetValue(protocolCharacteristics,
                                                         CFSTR(kIOPropertyPhysicalInterconnectTypeKey));
+        char desc[64];
+
         if(interconnect && CFGetTypeID(interconnect) == CFStringGetTypeID()) {
 			contextprintf(context, kBLLogLevelVerbose,
 						  "Found %s interconnect in protocol characteristics\n",
-						  BLGetCStringDescription(interconnect));        
+						  BLCopyCStringDescription(interconnect, desc, sizeof desc));        
 
             if(CFEqual(interconnect, CFSTR(kIOPropertyPhysicalInterconnectTypeUSB))) {
                 foundUSB = true;
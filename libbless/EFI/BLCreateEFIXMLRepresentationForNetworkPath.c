@@ -56,15 +56,12 @@ int BLCreateEFIXMLRepresentationForNetworkPath(BLContextPtr context,
     mach_port_t masterPort;
     kern_return_t kret;
     io_service_t iface;
+    int ret;
     
-    CFDataRef xmlData;
     CFMutableDictionaryRef dict, matchDict;
     CFMutableArrayRef array;
     CFDataRef macAddress;
-    
-    const UInt8 *xmlBuffer;
-    UInt8 *outBuffer;
-    CFIndex count;
+    char desc[256];
     
     kret = IOMasterPort(MACH_PORT_NULL, &masterPort);
     if(kret) return 1;
@@ -100,7 +97,7 @@ int BLCreateEFIXMLRepresentationForNetworkPath(BLContextPtr context,
                                                  kIORegistryIterateRecursively|kIORegistryIterateParents);
     if(macAddress) {
         contextprintf(context, kBLLogLevelVerbose, "MAC address %s found for %s\n",
-					  BLGetCStringDescription(macAddress), interface);
+					  BLCopyCStringDescription(macAddress, desc, sizeof desc), interface);
         
         CFDictionaryAddValue(dict, CFSTR("BLMACAddress"), macAddress);
         CFRelease(macAddress);
@@ -171,25 +168,9 @@ int BLCreateEFIXMLRepresentationForNetworkPath(BLContextPtr context,
         CFRelease(optString);
     }
     
-    xmlData = IOCFSerialize(array, 0);
+    ret = BLCreateEFIXMLStringFromArray(context, array, xmlString);
     CFRelease(array);
     
-    if(xmlData == NULL) {
-        contextprintf(context, kBLLogLevelError, "Can't create XML representation\n");
-        return 2;
-    }
-    
-    count = CFDataGetLength(xmlData);
-    xmlBuffer = CFDataGetBytePtr(xmlData);
-    outBuffer = calloc(count+1, sizeof(char)); // terminate
-    
-    memcpy(outBuffer, xmlBuffer, count);
-    CFRelease(xmlData);
-    
-    *xmlString = CFStringCreateWithCString(kCFAllocatorDefault, (const char *)outBuffer, kCFStringEncodingUTF8);
-    
-    free(outBuffer);
-    
-    return 0;
+    return ret;
 }
 
@@ -68,13 +68,8 @@ int BLCreateEFIXMLRepresentationForPath(BLContextPtr context,
     mach_port_t masterPort;
     kern_return_t kret;
     
-    CFDataRef xmlData;
     CFMutableDictionaryRef dict;
     CFMutableArrayRef array;
-
-    const UInt8 *xmlBuffer;
-    UInt8 *outBuffer;
-    CFIndex count;
     
     CFStringRef pathString;
     
@@ -166,26 +161,10 @@ int BLCreateEFIXMLRepresentationForPath(BLContextPtr context,
         CFRelease(optString);
     }
     
-    xmlData = IOCFSerialize(array, 0);
+    ret = BLCreateEFIXMLStringFromArray(context, array, xmlString);
     CFRelease(array);
     
-    if(xmlData == NULL) {
-        contextprintf(context, kBLLogLevelError, "Can't create XML representation\n");
-        return 2;
-    }
-    
-    count = CFDataGetLength(xmlData);
-    xmlBuffer = CFDataGetBytePtr(xmlData);
-    outBuffer = calloc(count+1, sizeof(char)); // terminate
-    
-    memcpy(outBuffer, xmlBuffer, count);
-    CFRelease(xmlData);
-    
-    *xmlString = CFStringCreateWithCString(kCFAllocatorDefault, (const char *)outBuffer, kCFStringEncodingUTF8);
-
-    free(outBuffer);
-    
-    return 0;
+    return ret;
 }
 
 
@@ -204,14 +183,9 @@ int BLCreateEFIXMLRepresentationForPartialPath(BLContextPtr context,
     size_t slen;
     char    newPath[MAXPATHLEN];
     
-    CFDataRef xmlData;
     CFMutableDictionaryRef dict;
     CFMutableArrayRef array;
     
-    const UInt8 *xmlBuffer;
-    UInt8 *outBuffer;
-    CFIndex count;
-    
     CFStringRef pathString;
     
     kret = IOMasterPort(MACH_PORT_NULL, &masterPort);
@@ -265,26 +239,10 @@ int BLCreateEFIXMLRepresentationForPartialPath(BLContextPtr context,
         CFRelease(optString);
     }
     
-    xmlData = IOCFSerialize(array, 0);
+    ret = BLCreateEFIXMLStringFromArray(context, array, xmlString);
     CFRelease(array);
     
-    if (xmlData == NULL) {
-        contextprintf(context, kBLLogLevelError, "Can't create XML representation\n");
-        return 2;
-    }
-    
-    count = CFDataGetLength(xmlData);
-    xmlBuffer = CFDataGetBytePtr(xmlData);
-    outBuffer = calloc(count+1, sizeof(char)); // terminate
-    
-    memcpy(outBuffer, xmlBuffer, count);
-    CFRelease(xmlData);
-    
-    *xmlString = CFStringCreateWithCString(kCFAllocatorDefault, (const char *)outBuffer, kCFStringEncodingUTF8);
-    
-    free(outBuffer);
-    
-    return 0;
+    return ret;
 }
 
 
@@ -302,6 +260,7 @@ int addMatchingInfoForBSDName(BLContextPtr context,
     CFMutableDictionaryRef      propDict = NULL;
     kern_return_t               kret;
     CFStringRef			lastBSDName = NULL;
+    char                        desc[64];
 
     lastBSDName = CFStringCreateWithCString(kCFAllocatorDefault,
 					    bsdName,
@@ -327,30 +286,17 @@ int addMatchingInfoForBSDName(BLContextPtr context,
 		CFStringRef     fsuuidstr = NULL;        
 		io_string_t path;
 #if USE_DISKARBITRATION
-        DASessionRef    session = NULL;
-        DADiskRef       dadisk = NULL;
+        CFDictionaryRef descrip = NULL;
 		
         contextprintf(context, kBLLogLevelVerbose, "IOMedia %s does not have a partition %s\n",
                       bsdName, kIOMediaUUIDKey);
 		
-        session = DASessionCreate(kCFAllocatorDefault);
-        if(session) {
-            dadisk = DADiskCreateFromIOMedia(kCFAllocatorDefault, session, 
-                                             media);
-            if(dadisk) {
-                CFDictionaryRef descrip = DADiskCopyDescription(dadisk);
-                if(descrip) {
-                    fsuuid = CFDictionaryGetValue(descrip, kDADiskDescriptionVolumeUUIDKey);
-                    
-                    if(fsuuid)
-                        CFRetain(fsuuid);
-                    CFRelease(descrip);
-                }
-                
-                CFRelease(dadisk);
-            }
+        if(BLCopyDiskDescription(context, bsdName, &descrip) == 0) {
+            fsuuid = CFDictionaryGetValue(descrip, kDADiskDescriptionVolumeUUIDKey);
             
-            CFRelease(session);
+            if(fsuuid)
+                CFRetain(fsuuid);
+            CFRelease(descrip);
         }
 #endif // USE_DISKARBITRATION
 		
@@ -410,7 +356,7 @@ int addMatchingInfoForBSDName(BLContextPtr context,
       CFMutableDictionaryRef propMatch;
 
         contextprintf(context, kBLLogLevelVerbose, "IOMedia %s has UUID %s\n",
-                      bsdName, BLGetCStringDescription(uuid));
+                      bsdName, BLCopyCStringDescription(uuid, desc, sizeof desc));
 
         propMatch = CFDictionaryCreateMutable(kCFAllocatorDefault, 0,
                               &kCFTypeDictionaryKeyCallBacks,
@@ -0,0 +1,621 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ *  BLEFIDevicePath.c
+ *  bless
+ *
+ *  Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ */
+
+#import <IOKit/IOCFSerialize.h>
+
+#import <CoreFoundation/CoreFoundation.h>
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "bless.h"
+#include "bless_private.h"
+
+enum {
+    kFieldNumber,           // little-endian integer
+    kFieldBytes,            // copied as is; CFData in XML
+    kFieldIPv4,             // 4 bytes; dotted quad in XML
+    kFieldPath              // UTF-8 in, NUL-terminated UTF-16LE out; the node's variable part
+};
+
+typedef struct {
+    const char *    key;        // in the XML dictionary, NULL if the field is only in the bytes
+    uint16_t        offset;     // in BLEFIDevicePathNode
+    uint8_t         size;       // in BLEFIDevicePathNode and, but for paths, in the node
+    uint8_t         wire;       // offset in the node, header included
+    uint8_t         kind;
+    CFNumberType    number;     // XML number type for kFieldNumber
+} fielddesc;
+
+typedef struct {
+    uint8_t             type;
+    uint8_t             subType;
+    uint16_t            length;     // header and fixed fields
+    const char *        name;       // IOEFIDevicePathType
+    const fielddesc *   fields;
+    uint32_t            fieldCount;
+} nodedesc;
+
+#define kHeaderSize         4
+#define kEndNodeType        0x7F
+#define kEndEntireSubType   0xFF
+
+#define FIELD(key, member, wire, kind, number) \
+    { key, offsetof(BLEFIDevicePathNode, u.member), sizeof(((BLEFIDevicePathNode *)0)->u.member), wire, kind, number }
+
+/*
+ * XML keys and number types are the ones the hand-built dictionaries used,
+ * so the XML doesn't change for callers that moved over to these.
+ */
+static const fielddesc hardDriveFields[] = {
+    FIELD("PartitionNumber",    hardDrive.partitionNumber,  4,  kFieldNumber,   kCFNumberSInt32Type),
+    FIELD("PartitionStart",     hardDrive.partitionStart,   8,  kFieldNumber,   kCFNumberSInt64Type),
+    FIELD("PartitionSize",      hardDrive.partitionSize,    16, kFieldNumber,   kCFNumberSInt64Type),
+    FIELD("Signature",          hardDrive.signature,        24, kFieldBytes,    0),
+    FIELD("MBRType",            hardDrive.mbrType,          40, kFieldNumber,   kCFNumberSInt8Type),
+    FIELD("SignatureType",      hardDrive.signatureType,    41, kFieldNumber,   kCFNumberSInt8Type),
+};
+
+static const fielddesc filePathFields[] = {
+    FIELD("Path",               filePath.path,              4,  kFieldPath,     0),
+};
+
+static const fielddesc cdromFields[] = {
+    FIELD("BootEntry",          cdrom.bootEntry,            4,  kFieldNumber,   kCFNumberSInt32Type),
+    FIELD("PartitionStart",     cdrom.partitionStart,       8,  kFieldNumber,   kCFNumberSInt32Type),
+    FIELD("PartitionSize",      cdrom.partitionSize,        16, kFieldNumber,   kCFNumberSInt32Type),
+};
+
+static const fielddesc macFields[] = {
+    FIELD("MacAddress",         mac.address,                4,  kFieldBytes,    0),
+    FIELD("IfType",             mac.ifType,                 36, kFieldNumber,   kCFNumberSInt8Type),
+};
+
+// The kernel fills in the local end of the connection from the XML form
+static const fielddesc ipv4Fields[] = {
+    FIELD(NULL,                 ipv4.localAddress,          4,  kFieldIPv4,     0),
+    FIELD("RemoteIpAddress",    ipv4.remoteAddress,         8,  kFieldIPv4,     0),
+    FIELD(NULL,                 ipv4.localPort,             12, kFieldNumber,   0),
+    FIELD(NULL,                 ipv4.remotePort,            14, kFieldNumber,   0),
+    FIELD(NULL,                 ipv4.protocol,              16, kFieldNumber,   0),
+    FIELD(NULL,                 ipv4.staticAddress,         18, kFieldNumber,   0),
+    FIELD(NULL,                 ipv4.gatewayAddress,        19, kFieldIPv4,     0),
+    FIELD(NULL,                 ipv4.subnetMask,            23, kFieldIPv4,     0),
+};
+
+static const fielddesc memoryMappedFields[] = {
+    FIELD("MemoryType",         memoryMapped.memoryType,        4,  kFieldNumber,   kCFNumberSInt64Type),
+    FIELD("StartingAddress",    memoryMapped.startingAddress,   8,  kFieldNumber,   kCFNumberSInt64Type),
+    FIELD("EndingAddress",      memoryMapped.endingAddress,     16, kFieldNumber,   kCFNumberSInt64Type),
+};
+
+#define NODE(type, subType, length, name, fields) \
+    { type, subType, length, name, fields, sizeof(fields) / sizeof(fields[0]) }
+
+static const nodedesc nodeTypes[kBLEFIDevicePathNodeTypeCount] = {
+    [kBLEFIDevicePathHardDrive]     = NODE(0x04, 0x01, 42, "MediaHardDrive",        hardDriveFields),
+    [kBLEFIDevicePathFilePath]      = NODE(0x04, 0x04, 4,  "MediaFilePath",         filePathFields),
+    [kBLEFIDevicePathCDROM]         = NODE(0x04, 0x02, 24, "MediaCDROM",            cdromFields),
+    [kBLEFIDevicePathMACAddress]    = NODE(0x03, 0x0B, 37, "MessagingMACAddress",   macFields),
+    [kBLEFIDevicePathIPv4]          = NODE(0x03, 0x0C, 27, "MessagingIPv4",         ipv4Fields),
+    [kBLEFIDevicePathMemoryMapped]  = NODE(0x01, 0x03, 24, "HardwareMemoryMapped",  memoryMappedFields),
+};
+
+static const nodedesc *describe(const BLEFIDevicePathNode *node)
+{
+    if ((unsigned)node->type >= kBLEFIDevicePathNodeTypeCount) return NULL;
+    return &nodeTypes[node->type];
+}
+
+static uint64_t getNumber(const BLEFIDevicePathNode *node, const fielddesc *field)
+{
+    const uint8_t *p = (const uint8_t *)node + field->offset;
+
+    switch (field->size) {
+        case 1: return *p;
+        case 2: return *(const uint16_t *)p;
+        case 4: return *(const uint32_t *)p;
+        default: return *(const uint64_t *)p;
+    }
+}
+
+// In the width the XML form has always used, which IOCFSerialize() keeps
+static CFNumberRef createNumber(CFNumberType type, uint64_t value)
+{
+    int8_t  v8 = (int8_t)value;
+    int16_t v16 = (int16_t)value;
+    int32_t v32 = (int32_t)value;
+    int64_t v64 = (int64_t)value;
+
+    switch (type) {
+        case kCFNumberSInt8Type:    return CFNumberCreate(kCFAllocatorDefault, type, &v8);
+        case kCFNumberSInt16Type:   return CFNumberCreate(kCFAllocatorDefault, type, &v16);
+        case kCFNumberSInt32Type:   return CFNumberCreate(kCFAllocatorDefault, type, &v32);
+        default:                    return CFNumberCreate(kCFAllocatorDefault, kCFNumberSInt64Type, &v64);
+    }
+}
+
+static const char *getPath(const BLEFIDevicePathNode *node, const fielddesc *field)
+{
+    return *(const char * const *)((const uint8_t *)node + field->offset);
+}
+
+/*
+ * UTF-16 code units in a UTF-8 string, not counting the NUL, or -1 if
+ * it isn't well-formed. Encoded by hand to leave CFString out of it.
+ */
+static ssize_t utf16Length(const char *string)
+{
+    const uint8_t   *s = (const uint8_t *)string;
+    ssize_t         units = 0;
+
+    while (*s) {
+        uint8_t c = *s;
+        int     more;
+
+        if (c < 0x80) {
+            more = 0;
+        } else if ((c & 0xE0) == 0xC0 && c >= 0xC2) {
+            more = 1;
+        } else if ((c & 0xF0) == 0xE0) {
+            more = 2;
+        } else if ((c & 0xF8) == 0xF0 && c <= 0xF4) {
+            more = 3;
+        } else {
+            return -1;
+        }
+        s++;
+        for (int i = 0; i < more; i++, s++) {
+            if ((*s & 0xC0) != 0x80) return -1;
+        }
+        units += (more == 3) ? 2 : 1;
+    }
+    return units;
+}
+
+static uint8_t *putUTF16(uint8_t *out, uint32_t unit)
+{
+    out[0] = unit & 0xFF;
+    out[1] = unit >> 8;
+    return out + 2;
+}
+
+// string has been through utf16Length()
+static uint8_t *encodeUTF16(const char *string, uint8_t *out)
+{
+    const uint8_t *s = (const uint8_t *)string;
+
+    while (*s) {
+        uint32_t c = *s++;
+
+        if (c >= 0xF0) {
+            c = ((c & 0x07) << 18) | ((s[0] & 0x3F) << 12) | ((s[1] & 0x3F) << 6) | (s[2] & 0x3F);
+            s += 3;
+            c -= 0x10000;
+            out = putUTF16(out, 0xD800 | (c >> 10));
+            out = putUTF16(out, 0xDC00 | (c & 0x3FF));
+            continue;
+        } else if (c >= 0xE0) {
+            c = ((c & 0x0F) << 12) | ((s[0] & 0x3F) << 6) | (s[1] & 0x3F);
+            s += 2;
+        } else if (c >= 0xC0) {
+            c = ((c & 0x1F) << 6) | (s[0] & 0x3F);
+            s += 1;
+        }
+        out = putUTF16(out, c);
+    }
+    return putUTF16(out, 0);
+}
+
+// Bytes for one node, 0 if it can't be encoded
+static size_t nodeSize(const BLEFIDevicePathNode *node)
+{
+    const nodedesc  *desc = describe(node);
+    size_t          size;
+
+    if (!desc) return 0;
+    size = desc->length;
+    for (uint32_t i = 0; i < desc->fieldCount; i++) {
+        const fielddesc *field = &desc->fields[i];
+        const char      *path;
+        ssize_t         units;
+
+        if (field->kind != kFieldPath) continue;
+        path = getPath(node, field);
+        if (!path || (units = utf16Length(path)) < 0) return 0;
+        size += 2 * (size_t)(units + 1);
+    }
+    // The node's length field is 16 bits
+    return size <= UINT16_MAX ? size : 0;
+}
+
+size_t BLEFIDevicePathGetSize(const BLEFIDevicePathNode *nodes, size_t count)
+{
+    size_t total = kHeaderSize;
+
+    for (size_t i = 0; i < count; i++) {
+        size_t size = nodeSize(&nodes[i]);
+
+        if (size == 0) return 0;
+        total += size;
+    }
+    return total;
+}
+
+static void encodeNode(const BLEFIDevicePathNode *node, const nodedesc *desc, uint8_t *out, size_t size)
+{
+    memset(out, 0, desc->length);
+    out[0] = desc->type;
+    out[1] = desc->subType;
+    out[2] = size & 0xFF;
+    out[3] = size >> 8;
+
+    for (uint32_t i = 0; i < desc->fieldCount; i++) {
+        const fielddesc *field = &desc->fields[i];
+        uint8_t         *p = out + field->wire;
+        uint64_t        value;
+
+        switch (field->kind) {
+            case kFieldNumber:
+                value = getNumber(node, field);
+                for (uint8_t b = 0; b < field->size; b++, value >>= 8) {
+                    p[b] = value & 0xFF;
+                }
+                break;
+            case kFieldBytes:
+            case kFieldIPv4:
+                memcpy(p, (const uint8_t *)node + field->offset, field->size);
+                break;
+            case kFieldPath:
+                encodeUTF16(getPath(node, field), p);
+                break;
+        }
+    }
+}
+
+int BLEncodeEFIDevicePath(const BLEFIDevicePathNode *nodes, size_t count, uint8_t *buffer, size_t size)
+{
+    uint8_t *out = buffer;
+
+    for (size_t i = 0; i < count; i++) {
+        size_t length = nodeSize(&nodes[i]);
+
+        if (length == 0) return EINVAL;
+        if (length + kHeaderSize > size - (out - buffer)) return ENOSPC;
+        encodeNode(&nodes[i], describe(&nodes[i]), out, length);
+        out += length;
+    }
+    if (kHeaderSize > size - (out - buffer)) return ENOSPC;
+    out[0] = kEndNodeType;
+    out[1] = kEndEntireSubType;
+    out[2] = kHeaderSize;
+    out[3] = 0;
+    return 0;
+}
+
+int BLCreateEFIDevicePath(BLContextPtr context, const BLEFIDevicePathNode *nodes, size_t count,
+                          CFDataRef *devicePath)
+{
+    CFMutableDataRef    data;
+    size_t              size;
+    int                 ret;
+    uint64_t            span = BLTraceBegin(context);
+
+    *devicePath = NULL;
+    size = BLEFIDevicePathGetSize(nodes, count);
+    if (size == 0) {
+        contextprintf(context, kBLLogLevelError, "Can't encode EFI device path\n");
+        return EINVAL;
+    }
+
+    // Sized once; the nodes are written straight into it
+    data = CFDataCreateMutable(kCFAllocatorDefault, size);
+    if (data == NULL) return ENOMEM;
+    CFDataSetLength(data, size);
+    ret = BLEncodeEFIDevicePath(nodes, count, CFDataGetMutableBytePtr(data), size);
+    if (ret) {
+        CFRelease(data);
+        return ret;
+    }
+
+    *devicePath = data;
+    BLTraceEnd(context, span, "EFIDevicePath", NULL);
+    return 0;
+}
+
+CFDictionaryRef BLCreateEFIDevicePathNodeDictionary(const BLEFIDevicePathNode *node)
+{
+    const nodedesc          *desc = describe(node);
+    CFMutableDictionaryRef  dict;
+    CFStringRef             name;
+
+    if (!desc || nodeSize(node) == 0) return NULL;
+
+    dict = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks,
+                                     &kCFTypeDictionaryValueCallBacks);
+    name = CFStringCreateWithCString(kCFAllocatorDefault, desc->name, kCFStringEncodingUTF8);
+    CFDictionaryAddValue(dict, CFSTR("IOEFIDevicePathType"), name);
+    CFRelease(name);
+
+    for (uint32_t i = 0; i < desc->fieldCount; i++) {
+        const fielddesc *field = &desc->fields[i];
+        const uint8_t   *p = (const uint8_t *)node + field->offset;
+        CFStringRef     key;
+        CFTypeRef       value = NULL;
+        char            address[16];
+
+        if (field->key == NULL) continue;
+
+        switch (field->kind) {
+            case kFieldNumber:
+                value = createNumber(field->number, getNumber(node, field));
+                break;
+            case kFieldBytes:
+                value = CFDataCreate(kCFAllocatorDefault, p, field->size);
+                break;
+            case kFieldIPv4:
+                snprintf(address, sizeof(address), "%u.%u.%u.%u", p[0], p[1], p[2], p[3]);
+                value = CFStringCreateWithCString(kCFAllocatorDefault, address, kCFStringEncodingUTF8);
+                break;
+            case kFieldPath:
+                value = CFStringCreateWithCString(kCFAllocatorDefault, getPath(node, field), kCFStringEncodingUTF8);
+                break;
+        }
+        if (value == NULL) {
+            CFRelease(dict);
+            return NULL;
+        }
+        key = CFStringCreateWithCString(kCFAllocatorDefault, field->key, kCFStringEncodingUTF8);
+        CFDictionaryAddValue(dict, key, value);
+        CFRelease(key);
+        CFRelease(value);
+    }
+    return dict;
+}
+
+int BLParseEFIDevicePath(const uint8_t *path, size_t size, BLEFIDevicePathNodeRef *nodes,
+                         uint32_t maxNodes, uint32_t *count)
+{
+    size_t      offset = 0;
+    uint32_t    found = 0;
+
+    *count = 0;
+    while (size - offset >= kHeaderSize) {
+        const uint8_t   *p = path + offset;
+        uint16_t        length = p[2] | (p[3] << 8);
+
+        if (length < kHeaderSize || length > size - offset) return EINVAL;
+        if (p[0] == kEndNodeType && p[1] == kEndEntireSubType) {
+            *count = found;
+            return 0;
+        }
+        // Instances of a multi-instance path are walked as one list
+        if (nodes && found < maxNodes) {
+            nodes[found].type = p[0];
+            nodes[found].subType = p[1];
+            nodes[found].length = length;
+            nodes[found].bytes = p;
+        }
+        found++;
+        offset += length;
+    }
+    // Ran out before the end node
+    return EINVAL;
+}
+
+static const nodedesc *describeBytes(const BLEFIDevicePathNodeRef *node)
+{
+    for (int i = 0; i < kBLEFIDevicePathNodeTypeCount; i++) {
+        if (nodeTypes[i].type == node->type && nodeTypes[i].subType == node->subType) {
+            return node->length >= nodeTypes[i].length ? &nodeTypes[i] : NULL;
+        }
+    }
+    return NULL;
+}
+
+static uint64_t readNumber(const uint8_t *p, uint8_t size)
+{
+    uint64_t value = 0;
+
+    while (size--) value = (value << 8) | p[size];
+    return value;
+}
+
+// Node types the table doesn't know, or too short to be what they claim
+static CFDictionaryRef createUnknownNodeDictionary(const BLEFIDevicePathNodeRef *node)
+{
+    CFMutableDictionaryRef  dict;
+    CFNumberRef             number;
+    CFDataRef               data;
+    int32_t                 value;
+
+    dict = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks,
+                                     &kCFTypeDictionaryValueCallBacks);
+    CFDictionaryAddValue(dict, CFSTR("IOEFIDevicePathType"), CFSTR("Unknown"));
+    value = node->type;
+    number = CFNumberCreate(kCFAllocatorDefault, kCFNumberSInt32Type, &value);
+    CFDictionaryAddValue(dict, CFSTR("Type"), number);
+    CFRelease(number);
+    value = node->subType;
+    number = CFNumberCreate(kCFAllocatorDefault, kCFNumberSInt32Type, &value);
+    CFDictionaryAddValue(dict, CFSTR("SubType"), number);
+    CFRelease(number);
+    data = CFDataCreate(kCFAllocatorDefault, node->bytes + kHeaderSize, node->length - kHeaderSize);
+    CFDictionaryAddValue(dict, CFSTR("Data"), data);
+    CFRelease(data);
+    return dict;
+}
+
+CFDictionaryRef BLCreateEFIDevicePathNodeDictionaryFromBytes(const BLEFIDevicePathNodeRef *node)
+{
+    const nodedesc          *desc = describeBytes(node);
+    CFMutableDictionaryRef  dict;
+    CFStringRef             name;
+
+    if (!desc) return createUnknownNodeDictionary(node);
+
+    dict = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks,
+                                     &kCFTypeDictionaryValueCallBacks);
+    name = CFStringCreateWithCString(kCFAllocatorDefault, desc->name, kCFStringEncodingUTF8);
+    CFDictionaryAddValue(dict, CFSTR("IOEFIDevicePathType"), name);
+    CFRelease(name);
+
+    for (uint32_t i = 0; i < desc->fieldCount; i++) {
+        const fielddesc *field = &desc->fields[i];
+        const uint8_t   *p = node->bytes + field->wire;
+        CFStringRef     key;
+        CFTypeRef       value = NULL;
+        CFIndex         units;
+        char            address[16];
+
+        if (field->key == NULL) continue;
+
+        switch (field->kind) {
+            case kFieldNumber:
+                value = createNumber(field->number, readNumber(p, field->size));
+                break;
+            case kFieldBytes:
+                value = CFDataCreate(kCFAllocatorDefault, p, field->size);
+                break;
+            case kFieldIPv4:
+                snprintf(address, sizeof(address), "%u.%u.%u.%u", p[0], p[1], p[2], p[3]);
+                value = CFStringCreateWithCString(kCFAllocatorDefault, address, kCFStringEncodingUTF8);
+                break;
+            case kFieldPath:
+                // Up to the NUL or the end of the node, whichever is first
+                units = (node->length - field->wire) / 2;
+                for (CFIndex u = 0; u < units; u++) {
+                    if (p[2 * u] == 0 && p[2 * u + 1] == 0) {
+                        units = u;
+                        break;
+                    }
+                }
+                value = CFStringCreateWithBytes(kCFAllocatorDefault, p, units * 2, kCFStringEncodingUTF16LE, false);
+                break;
+        }
+        if (value == NULL) {
+            CFRelease(dict);
+            return createUnknownNodeDictionary(node);
+        }
+        key = CFStringCreateWithCString(kCFAllocatorDefault, field->key, kCFStringEncodingUTF8);
+        CFDictionaryAddValue(dict, key, value);
+        CFRelease(key);
+        CFRelease(value);
+    }
+    return dict;
+}
+
+CFArrayRef BLCreateEFIDevicePathArray(const uint8_t *path, size_t size)
+{
+    BLEFIDevicePathNodeRef  stack[16], *nodes = stack;
+    CFMutableArrayRef       array = NULL;
+    uint32_t                count;
+
+    if (BLParseEFIDevicePath(path, size, NULL, 0, &count)) return NULL;
+    if (count > sizeof(stack) / sizeof(stack[0])) {
+        nodes = malloc(count * sizeof(*nodes));
+        if (!nodes) return NULL;
+    }
+    BLParseEFIDevicePath(path, size, nodes, count, &count);
+
+    array = CFArrayCreateMutable(kCFAllocatorDefault, count, &kCFTypeArrayCallBacks);
+    for (uint32_t i = 0; i < count; i++) {
+        CFDictionaryRef dict = BLCreateEFIDevicePathNodeDictionaryFromBytes(&nodes[i]);
+
+        CFArrayAppendValue(array, dict);
+        CFRelease(dict);
+    }
+    if (nodes != stack) free(nodes);
+    return array;
+}
+
+int BLCreateEFIXMLRepresentationForDevicePath(BLContextPtr context, const BLEFIDevicePathNode *nodes,
+                                              size_t count, const char *optionalData, CFStringRef *xmlString)
+{
+    CFMutableArrayRef       array;
+    CFMutableDictionaryRef  dict;
+    CFDictionaryRef         node;
+    int                     ret;
+
+    array = CFArrayCreateMutable(kCFAllocatorDefault, count + 1, &kCFTypeArrayCallBacks);
+
+    for (size_t i = 0; i < count; i++) {
+        node = BLCreateEFIDevicePathNodeDictionary(&nodes[i]);
+        if (node == NULL) {
+            contextprintf(context, kBLLogLevelError, "Can't describe EFI device path node %zu\n", i);
+            CFRelease(array);
+            return 1;
+        }
+        CFArrayAppendValue(array, node);
+        CFRelease(node);
+    }
+
+    if (optionalData) {
+        CFStringRef optString = CFStringCreateWithCString(kCFAllocatorDefault, optionalData, kCFStringEncodingUTF8);
+
+        dict = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks,
+                                         &kCFTypeDictionaryValueCallBacks);
+        CFDictionaryAddValue(dict, CFSTR("IOEFIBootOption"), optString);
+        CFArrayAppendValue(array, dict);
+        CFRelease(dict);
+        CFRelease(optString);
+    }
+
+    ret = BLCreateEFIXMLStringFromArray(context, array, xmlString);
+    CFRelease(array);
+    return ret;
+}
+
+int BLCreateEFIXMLStringFromArray(BLContextPtr context, CFArrayRef array, CFStringRef *xmlString)
+{
+    CFDataRef   xmlData;
+    CFIndex     count;
+    const UInt8 *xmlBuffer;
+
+    xmlData = IOCFSerialize(array, 0);
+    if (xmlData == NULL) {
+        contextprintf(context, kBLLogLevelError, "Can't create XML representation\n");
+        return 2;
+    }
+
+    // The string is made from the serialized bytes themselves, less any NUL
+    // at the end, instead of from a terminated copy of them
+    count = CFDataGetLength(xmlData);
+    xmlBuffer = CFDataGetBytePtr(xmlData);
+    while (count > 0 && xmlBuffer[count - 1] == '\0') count--;
+    *xmlString = CFStringCreateWithBytes(kCFAllocatorDefault, xmlBuffer, count, kCFStringEncodingUTF8, false);
+    CFRelease(xmlData);
+
+    return *xmlString ? 0 : 2;
+}
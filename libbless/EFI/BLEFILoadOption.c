@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ *  BLEFILoadOption.c
+ *  bless
+ *
+ *  Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ */
+
+#import <CoreFoundation/CoreFoundation.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "bless.h"
+#include "bless_private.h"
+
+/*
+ * EFI_LOAD_OPTION, from the UEFI spec:
+ *
+ *   UINT32     Attributes;
+ *   UINT16     FilePathListLength;
+ *   CHAR16     Description[];          NUL-terminated
+ *   EFI_DEVICE_PATH_PROTOCOL FilePathList[];   FilePathListLength bytes
+ *   UINT8      OptionalData[];         the rest
+ *
+ * Nothing in it is aligned, so every field is read a byte at a time.
+ */
+#define kFixedSize      6
+
+int BLParseEFILoadOption(const uint8_t *bytes, size_t size, BLEFILoadOption *option)
+{
+    uint16_t    number = option->number;
+    size_t      offset = kFixedSize, units;
+    uint32_t    pathLength;
+
+    memset(option, 0, sizeof(*option));
+    option->number = number;
+    option->status = EINVAL;
+    if (size < kFixedSize) return EINVAL;
+
+    option->attributes = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+    pathLength = bytes[4] | (bytes[5] << 8);
+
+    for (units = 0; ; units++) {
+        if (size - offset < 2 * units + 2) return EINVAL;
+        if (bytes[offset + 2 * units] == 0 && bytes[offset + 2 * units + 1] == 0) break;
+    }
+    option->description = bytes + offset;
+    option->descriptionLength = (uint32_t)units;
+    offset += 2 * (units + 1);
+
+    if (pathLength > size - offset) return EINVAL;
+    option->devicePath = bytes + offset;
+    option->devicePathSize = pathLength;
+    // Only the first path in the list has to be there; it's the one booted
+    if (BLParseEFIDevicePath(option->devicePath, pathLength, NULL, 0, &option->nodeCount)) return EINVAL;
+    offset += pathLength;
+
+    if (offset < size) {
+        option->optionalData = bytes + offset;
+        option->optionalDataSize = (uint32_t)(size - offset);
+    }
+    option->status = 0;
+    return 0;
+}
+
+int BLCopyEFIBootOptions(BLContextPtr context, struct BLNVRAMSnapshot *snapshot,
+                         BLEFILoadOption **options, uint32_t *count)
+{
+    const uint16_t      *order;
+    size_t              orderCount;
+    BLEFILoadOption     *list;
+    char                name[64];
+    uint64_t            span = BLTraceBegin(context);
+
+    *options = NULL;
+    *count = 0;
+
+    order = BLNVRAMSnapshotGetUTF16(snapshot, CFSTR(kBLEFIGlobalVariableGUID ":BootOrder"), &orderCount);
+    if (order == NULL) {
+        contextprintf(context, kBLLogLevelVerbose, "No BootOrder\n");
+        return ENOENT;
+    }
+
+    // The one allocation: everything else points into the snapshot
+    list = calloc(orderCount ? orderCount : 1, sizeof(*list));
+    if (list == NULL) return ENOMEM;
+
+    for (size_t i = 0; i < orderCount; i++) {
+        CFStringRef key;
+        CFDataRef   data;
+
+        list[i].number = CFSwapInt16LittleToHost(order[i]);
+        // Upper-case hex, as the spec names them
+        snprintf(name, sizeof(name), "%s:Boot%04X", kBLEFIGlobalVariableGUID, list[i].number);
+        key = CFStringCreateWithCString(kCFAllocatorDefault, name, kCFStringEncodingUTF8);
+        data = key ? BLNVRAMSnapshotGetData(snapshot, key) : NULL;
+        if (key) CFRelease(key);
+
+        if (data == NULL) {
+            list[i].status = ENOENT;
+            contextprintf(context, kBLLogLevelVerbose, "Boot%04X is in BootOrder but not set\n", list[i].number);
+        } else if (BLParseEFILoadOption(CFDataGetBytePtr(data), CFDataGetLength(data), &list[i])) {
+            contextprintf(context, kBLLogLevelVerbose, "Boot%04X is malformed\n", list[i].number);
+        }
+    }
+
+    *options = list;
+    *count = (uint32_t)orderCount;
+    BLTraceEnd(context, span, "EFIBootOptions", NULL);
+    return 0;
+}
+
+static void addNumber(CFMutableDictionaryRef dict, CFStringRef key, int64_t value)
+{
+    CFNumberRef number = CFNumberCreate(kCFAllocatorDefault, kCFNumberSInt64Type, &value);
+
+    CFDictionaryAddValue(dict, key, number);
+    CFRelease(number);
+}
+
+CFDictionaryRef BLCreateEFILoadOptionDictionary(const BLEFILoadOption *option)
+{
+    CFMutableDictionaryRef  dict;
+    CFStringRef             string;
+    CFTypeRef               value;
+    char                    name[16];
+
+    dict = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks,
+                                     &kCFTypeDictionaryValueCallBacks);
+    addNumber(dict, CFSTR("Number"), option->number);
+    snprintf(name, sizeof(name), "Boot%04X", option->number);
+    string = CFStringCreateWithCString(kCFAllocatorDefault, name, kCFStringEncodingUTF8);
+    CFDictionaryAddValue(dict, CFSTR("Name"), string);
+    CFRelease(string);
+
+    if (option->status) {
+        string = CFStringCreateWithCString(kCFAllocatorDefault,
+                                           option->status == ENOENT ? "Not set" : "Malformed",
+                                           kCFStringEncodingUTF8);
+        CFDictionaryAddValue(dict, CFSTR("Error"), string);
+        CFRelease(string);
+        return dict;
+    }
+
+    addNumber(dict, CFSTR("Attributes"), option->attributes);
+    CFDictionaryAddValue(dict, CFSTR("Active"),
+                         (option->attributes & kBLEFILoadOptionActive) ? kCFBooleanTrue : kCFBooleanFalse);
+
+    string = CFStringCreateWithBytes(kCFAllocatorDefault, option->description, option->descriptionLength * 2,
+                                     kCFStringEncodingUTF16LE, false);
+    if (string) {
+        CFDictionaryAddValue(dict, CFSTR("Description"), string);
+        CFRelease(string);
+    }
+
+    value = BLCreateEFIDevicePathArray(option->devicePath, option->devicePathSize);
+    if (value) {
+        CFDictionaryAddValue(dict, CFSTR("Device Path"), value);
+        CFRelease(value);
+    }
+
+    if (option->optionalDataSize) {
+        value = CFDataCreate(kCFAllocatorDefault, option->optionalData, option->optionalDataSize);
+        CFDictionaryAddValue(dict, CFSTR("Optional Data"), value);
+        CFRelease(value);
+    }
+    return dict;
+}
+
+CFArrayRef BLCreateEFIBootMenu(BLContextPtr context, struct BLNVRAMSnapshot *snapshot)
+{
+    BLEFILoadOption     *options;
+    uint32_t            count;
+    CFMutableArrayRef   menu;
+
+    if (BLCopyEFIBootOptions(context, snapshot, &options, &count)) return NULL;
+
+    menu = CFArrayCreateMutable(kCFAllocatorDefault, count, &kCFTypeArrayCallBacks);
+    for (uint32_t i = 0; i < count; i++) {
+        CFDictionaryRef dict = BLCreateEFILoadOptionDictionary(&options[i]);
+
+        CFArrayAppendValue(menu, dict);
+        CFRelease(dict);
+    }
+    free(options);
+    return menu;
+}
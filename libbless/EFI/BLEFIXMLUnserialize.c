@@ -0,0 +1,751 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ *  BLEFIXMLUnserialize.c
+ *  bless
+ *
+ *  Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ */
+
+#import <CoreFoundation/CoreFoundation.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bless.h"
+#include "bless_private.h"
+
+/*
+ * The XML IOCFSerialize() writes and the efi-boot-device variables hold:
+ * array, set, dict with key, string, integer with a size attribute, data
+ * in base64, true and false, and ID/IDREF attributes for objects that
+ * appear more than once. Objects are made as each element closes, straight
+ * from the bytes; everything else (child lists, decoded text, the ID table)
+ * comes from an arena that is freed in one go when the parse is done. Most
+ * boot strings fit in the arena's first block, on the stack.
+ */
+#define kFirstBlockSize     2048
+#define kMaxDepth           32
+
+typedef struct arenablock {
+    struct arenablock   *next;
+    uint64_t            bytes[];
+} arenablock;
+
+typedef struct {
+    uint8_t         *cursor;
+    uint8_t         *limit;
+    arenablock      *blocks;        // from the heap, newest first
+    size_t          nextSize;
+    BLEFIXMLParseStatistics *stats;
+    uint64_t        first[kFirstBlockSize / sizeof(uint64_t)];
+} arena;
+
+typedef struct idref {
+    struct idref    *next;
+    uint32_t        id;
+    CFTypeRef       object;
+} idref;
+
+typedef struct cell {
+    struct cell     *next;
+    CFTypeRef       key;            // for dict members
+    CFTypeRef       value;
+} cell;
+
+typedef struct {
+    arena           *arena;
+    CFAllocatorRef  allocator;
+    const char      *start;
+    const char      *p;
+    const char      *end;
+    idref           *ids;
+    const char      *error;
+    const char      *errorAt;
+} parser;
+
+typedef struct {
+    const char      *name;
+    size_t          nameLength;
+    bool            closing;
+    bool            empty;          // <name/>
+    bool            hasID;
+    bool            hasIDREF;
+    uint32_t        id;
+    uint32_t        idref;
+    uint32_t        size;           // integer width, 64 if not given
+} tag;
+
+static void arenaInit(arena *a, BLEFIXMLParseStatistics *stats)
+{
+    a->cursor = (uint8_t *)a->first;
+    a->limit = a->cursor + sizeof(a->first);
+    a->blocks = NULL;
+    a->nextSize = 2 * kFirstBlockSize;
+    a->stats = stats;
+}
+
+static void *arenaAlloc(arena *a, size_t size)
+{
+    void    *p;
+
+    size = (size + 7) & ~(size_t)7;
+    if (size < 8) size = 8;
+    if (size > (size_t)(a->limit - a->cursor)) {
+        arenablock  *block;
+        size_t      blockSize = a->nextSize;
+
+        if (size > SIZE_MAX / 2) return NULL;
+        while (blockSize < size) blockSize *= 2;
+        block = malloc(sizeof(*block) + blockSize);
+        if (block == NULL) return NULL;
+        block->next = a->blocks;
+        a->blocks = block;
+        a->cursor = (uint8_t *)block->bytes;
+        a->limit = a->cursor + blockSize;
+        a->nextSize = 2 * blockSize;
+        if (a->stats) a->stats->arenaBlocks++;
+    }
+    p = a->cursor;
+    a->cursor += size;
+    if (a->stats) a->stats->arenaBytes += size;
+    return p;
+}
+
+static void arenaFree(arena *a)
+{
+    while (a->blocks) {
+        arenablock *next = a->blocks->next;
+
+        free(a->blocks);
+        a->blocks = next;
+    }
+}
+
+static CFTypeRef fail(parser *ps, const char *error)
+{
+    if (ps->error == NULL) {
+        ps->error = error;
+        ps->errorAt = ps->p;
+    }
+    return NULL;
+}
+
+static CFTypeRef made(parser *ps, CFTypeRef object)
+{
+    if (object == NULL) return fail(ps, "out of memory");
+    if (ps->arena->stats) ps->arena->stats->objects++;
+    return object;
+}
+
+static bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static void skipSpace(parser *ps)
+{
+    for (;;) {
+        while (ps->p < ps->end && isSpace(*ps->p)) ps->p++;
+        // IOCFSerialize doesn't write comments, but a hand-edited string might have them
+        if (ps->end - ps->p >= 4 && memcmp(ps->p, "<!--", 4) == 0) {
+            const char *q;
+
+            for (q = ps->p + 4; ps->end - q >= 3; q++) {
+                if (memcmp(q, "-->", 3) == 0) break;
+            }
+            if (ps->end - q < 3) return;
+            ps->p = q + 3;
+            continue;
+        }
+        return;
+    }
+}
+
+static bool tagIs(const tag *t, const char *name)
+{
+    return t->nameLength == strlen(name) && memcmp(t->name, name, t->nameLength) == 0;
+}
+
+static bool parseUnsigned(const char *p, const char *end, uint32_t *value)
+{
+    uint64_t    v = 0;
+
+    if (p == end) return false;
+    for (; p < end; p++) {
+        if (*p < '0' || *p > '9') return false;
+        v = v * 10 + (*p - '0');
+        if (v > UINT32_MAX) return false;
+    }
+    *value = (uint32_t)v;
+    return true;
+}
+
+// At '<': the element name and the attributes IOCFSerialize writes
+static bool readTag(parser *ps, tag *t)
+{
+    memset(t, 0, sizeof(*t));
+    t->size = 64;
+    if (ps->p >= ps->end || *ps->p != '<') return fail(ps, "expected an element"), false;
+    ps->p++;
+    if (ps->p < ps->end && *ps->p == '/') {
+        t->closing = true;
+        ps->p++;
+    }
+    t->name = ps->p;
+    while (ps->p < ps->end && ((*ps->p >= 'a' && *ps->p <= 'z') || (*ps->p >= 'A' && *ps->p <= 'Z'))) ps->p++;
+    t->nameLength = ps->p - t->name;
+    if (t->nameLength == 0) return fail(ps, "bad element name"), false;
+
+    for (;;) {
+        const char  *name, *value;
+        size_t      nameLength;
+
+        skipSpace(ps);
+        if (ps->p >= ps->end) return fail(ps, "unterminated element"), false;
+        if (*ps->p == '>') {
+            ps->p++;
+            return true;
+        }
+        if (*ps->p == '/' && !t->closing) {
+            if (ps->end - ps->p < 2 || ps->p[1] != '>') return fail(ps, "bad empty element"), false;
+            t->empty = true;
+            ps->p += 2;
+            return true;
+        }
+        if (t->closing) return fail(ps, "attribute on a closing element"), false;
+
+        name = ps->p;
+        while (ps->p < ps->end && *ps->p != '=' && *ps->p != '>' && *ps->p != '/' && !isSpace(*ps->p)) ps->p++;
+        nameLength = ps->p - name;
+        if (nameLength == 0 || ps->end - ps->p < 2 || ps->p[0] != '=' || ps->p[1] != '"') {
+            return fail(ps, "bad attribute"), false;
+        }
+        ps->p += 2;
+        value = ps->p;
+        while (ps->p < ps->end && *ps->p != '"') ps->p++;
+        if (ps->p >= ps->end) return fail(ps, "unterminated attribute"), false;
+
+        if (nameLength == 2 && memcmp(name, "ID", 2) == 0) {
+            t->hasID = parseUnsigned(value, ps->p, &t->id);
+            if (!t->hasID) return fail(ps, "bad ID"), false;
+        } else if (nameLength == 5 && memcmp(name, "IDREF", 5) == 0) {
+            t->hasIDREF = parseUnsigned(value, ps->p, &t->idref);
+            if (!t->hasIDREF) return fail(ps, "bad IDREF"), false;
+        } else if (nameLength == 4 && memcmp(name, "size", 4) == 0) {
+            if (!parseUnsigned(value, ps->p, &t->size)) return fail(ps, "bad integer size"), false;
+        }
+        // anything else is ignored, as IOCFUnserialize does
+        ps->p++;
+    }
+}
+
+static bool expectClose(parser *ps, const tag *open)
+{
+    tag close;
+
+    if (!readTag(ps, &close)) return false;
+    if (!close.closing || close.nameLength != open->nameLength
+        || memcmp(close.name, open->name, open->nameLength) != 0) {
+        return fail(ps, "mismatched closing element"), false;
+    }
+    return true;
+}
+
+static int appendUTF8(char *out, uint32_t c)
+{
+    if (c < 0x80) {
+        out[0] = (char)c;
+        return 1;
+    } else if (c < 0x800) {
+        out[0] = (char)(0xC0 | (c >> 6));
+        out[1] = (char)(0x80 | (c & 0x3F));
+        return 2;
+    } else if (c < 0x10000) {
+        out[0] = (char)(0xE0 | (c >> 12));
+        out[1] = (char)(0x80 | ((c >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (c & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (c >> 18));
+    out[1] = (char)(0x80 | ((c >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((c >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (c & 0x3F));
+    return 4;
+}
+
+// One entity, just past the '&'
+static bool decodeEntity(const char **pp, const char *end, char *out, int *length)
+{
+    static const struct { const char *name; char c; } named[] = {
+        { "lt;", '<' }, { "gt;", '>' }, { "amp;", '&' }, { "quot;", '"' }, { "apos;", '\'' },
+    };
+    const char  *p = *pp;
+    uint32_t    c = 0;
+    size_t      i;
+
+    for (i = 0; i < sizeof(named) / sizeof(named[0]); i++) {
+        size_t n = strlen(named[i].name);
+
+        if ((size_t)(end - p) >= n && memcmp(p, named[i].name, n) == 0) {
+            out[0] = named[i].c;
+            *length = 1;
+            *pp = p + n;
+            return true;
+        }
+    }
+    if (p >= end || *p != '#') return false;
+    p++;
+    if (p < end && (*p == 'x' || *p == 'X')) {
+        for (p++; p < end && *p != ';'; p++) {
+            int digit = (*p >= '0' && *p <= '9') ? *p - '0'
+                      : (*p >= 'a' && *p <= 'f') ? *p - 'a' + 10
+                      : (*p >= 'A' && *p <= 'F') ? *p - 'A' + 10 : -1;
+
+            if (digit < 0 || c > 0x10FFFF) return false;
+            c = c * 16 + digit;
+        }
+    } else {
+        for (; p < end && *p != ';'; p++) {
+            if (*p < '0' || *p > '9' || c > 0x10FFFF) return false;
+            c = c * 10 + (*p - '0');
+        }
+    }
+    if (p >= end || c == 0 || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF)) return false;
+    *length = appendUTF8(out, c);
+    *pp = p + 1;
+    return true;
+}
+
+// The text up to the next element; decoded into the arena only if it has entities
+static bool readText(parser *ps, const char **text, size_t *length)
+{
+    const char  *start = ps->p, *p;
+    bool        entities = false;
+    char        *out;
+
+    while (ps->p < ps->end && *ps->p != '<') {
+        if (*ps->p == '&') entities = true;
+        ps->p++;
+    }
+    if (ps->p >= ps->end) return fail(ps, "unterminated text"), false;
+    if (!entities) {
+        *text = start;
+        *length = ps->p - start;
+        return true;
+    }
+
+    // Entities never decode to more bytes than they take
+    out = arenaAlloc(ps->arena, ps->p - start);
+    if (out == NULL) return fail(ps, "out of memory"), false;
+    *text = out;
+    for (p = start; p < ps->p; ) {
+        if (*p == '&') {
+            int n;
+
+            p++;
+            if (!decodeEntity(&p, ps->p, out, &n)) {
+                ps->p = p;
+                return fail(ps, "bad entity"), false;
+            }
+            out += n;
+        } else {
+            *out++ = *p++;
+        }
+    }
+    *length = out - *text;
+    return true;
+}
+
+static CFTypeRef createString(parser *ps, const tag *t)
+{
+    const char  *text = "";
+    size_t      length = 0;
+    CFStringRef string;
+
+    if (!t->empty) {
+        if (!readText(ps, &text, &length) || !expectClose(ps, t)) return NULL;
+    }
+    string = CFStringCreateWithBytes(ps->allocator, (const UInt8 *)text, length, kCFStringEncodingUTF8, false);
+    if (string == NULL) return fail(ps, "string isn't UTF-8");
+    return made(ps, string);
+}
+
+// As strtoull() with base 0 takes it, which is what IOCFUnserialize uses
+static CFTypeRef createInteger(parser *ps, const tag *t)
+{
+    const char  *text, *p, *end;
+    size_t      length;
+    uint64_t    value = 0;
+    bool        negative = false;
+    unsigned    base = 10;
+    CFNumberRef number;
+
+    if (t->empty) return fail(ps, "empty integer");
+    if (!readText(ps, &text, &length) || !expectClose(ps, t)) return NULL;
+    p = text;
+    end = text + length;
+    while (p < end && isSpace(*p)) p++;
+    while (end > p && isSpace(end[-1])) end--;
+    if (p < end && (*p == '-' || *p == '+')) negative = (*p++ == '-');
+    if (end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+        base = 16;
+        p += 2;
+    } else if (end - p > 1 && p[0] == '0') {
+        base = 8;
+        p++;
+    }
+    if (p == end) return fail(ps, "bad integer");
+    for (; p < end; p++) {
+        unsigned digit = (*p >= '0' && *p <= '9') ? (unsigned)(*p - '0')
+                       : (*p >= 'a' && *p <= 'f') ? (unsigned)(*p - 'a' + 10)
+                       : (*p >= 'A' && *p <= 'F') ? (unsigned)(*p - 'A' + 10) : 16;
+
+        if (digit >= base) return fail(ps, "bad integer");
+        value = value * base + digit;
+    }
+    if (negative) value = -value;
+
+    switch (t->size) {
+        case 8: {
+            int8_t v = (int8_t)value;
+            number = CFNumberCreate(ps->allocator, kCFNumberSInt8Type, &v);
+            break;
+        }
+        case 16: {
+            int16_t v = (int16_t)value;
+            number = CFNumberCreate(ps->allocator, kCFNumberSInt16Type, &v);
+            break;
+        }
+        case 32: {
+            int32_t v = (int32_t)value;
+            number = CFNumberCreate(ps->allocator, kCFNumberSInt32Type, &v);
+            break;
+        }
+        default: {
+            int64_t v = (int64_t)value;
+            number = CFNumberCreate(ps->allocator, kCFNumberSInt64Type, &v);
+            break;
+        }
+    }
+    return made(ps, number);
+}
+
+static CFTypeRef createData(parser *ps, const tag *t)
+{
+    const char  *text = "", *p;
+    size_t      length = 0, n = 0;
+    uint8_t     *bytes;
+    uint32_t    bits = 0;
+    int         have = 0, padding = 0;
+
+    if (!t->empty) {
+        if (!readText(ps, &text, &length) || !expectClose(ps, t)) return NULL;
+    }
+    bytes = arenaAlloc(ps->arena, length / 4 * 3 + 3);
+    if (bytes == NULL) return fail(ps, "out of memory");
+
+    for (p = text; p < text + length; p++) {
+        char        c = *p;
+        uint32_t    v;
+
+        if (isSpace(c)) continue;
+        if (c == '=') {
+            padding++;
+            continue;
+        }
+        if (padding) return fail(ps, "bad base64");
+        if (c >= 'A' && c <= 'Z') v = c - 'A';
+        else if (c >= 'a' && c <= 'z') v = c - 'a' + 26;
+        else if (c >= '0' && c <= '9') v = c - '0' + 52;
+        else if (c == '+') v = 62;
+        else if (c == '/') v = 63;
+        else return fail(ps, "bad base64");
+
+        bits = (bits << 6) | v;
+        if (++have == 4) {
+            bytes[n++] = (bits >> 16) & 0xFF;
+            bytes[n++] = (bits >> 8) & 0xFF;
+            bytes[n++] = bits & 0xFF;
+            bits = 0;
+            have = 0;
+        }
+    }
+    if (have == 1 || padding > 2) return fail(ps, "bad base64");
+    if (have == 2) {
+        bytes[n++] = (bits >> 4) & 0xFF;
+    } else if (have == 3) {
+        bytes[n++] = (bits >> 10) & 0xFF;
+        bytes[n++] = (bits >> 2) & 0xFF;
+    }
+    return made(ps, CFDataCreate(ps->allocator, bytes, n));
+}
+
+static void releaseCells(cell *c)
+{
+    for (; c; c = c->next) {
+        if (c->key) CFRelease(c->key);
+        if (c->value) CFRelease(c->value);
+    }
+}
+
+static CFTypeRef parseObject(parser *ps, int depth);
+
+// array, set and dict: members go on an arena list and into the object when it closes
+static CFTypeRef createCollection(parser *ps, const tag *t, int depth)
+{
+    bool        isDict = tagIs(t, "dict"), isSet = tagIs(t, "set");
+    cell        *head = NULL, **tail = &head;
+    CFIndex     count = 0, i;
+    const void  **keys = NULL, **values;
+    CFTypeRef   object;
+
+    if (depth >= kMaxDepth) return fail(ps, "nested too deeply");
+
+    while (!t->empty) {
+        const char  *at;
+        cell        *c;
+
+        skipSpace(ps);
+        at = ps->p;
+        if (ps->end - ps->p >= 2 && ps->p[0] == '<' && ps->p[1] == '/') {
+            if (!expectClose(ps, t)) goto error;
+            break;
+        }
+
+        c = arenaAlloc(ps->arena, sizeof(*c));
+        if (c == NULL) {
+            fail(ps, "out of memory");
+            goto error;
+        }
+        c->next = NULL;
+        c->key = NULL;
+        c->value = NULL;
+        *tail = c;
+        tail = &c->next;
+
+        if (isDict) {
+            tag key;
+
+            if (!readTag(ps, &key)) goto error;
+            if (!tagIs(&key, "key") || key.closing) {
+                ps->p = at;
+                fail(ps, "expected a key");
+                goto error;
+            }
+            c->key = createString(ps, &key);
+            if (c->key == NULL) goto error;
+        }
+        c->value = parseObject(ps, depth + 1);
+        if (c->value == NULL) goto error;
+        count++;
+    }
+
+    values = arenaAlloc(ps->arena, (count ? count : 1) * sizeof(*values));
+    if (isDict) keys = arenaAlloc(ps->arena, (count ? count : 1) * sizeof(*keys));
+    if (values == NULL || (isDict && keys == NULL)) {
+        fail(ps, "out of memory");
+        goto error;
+    }
+    i = 0;
+    for (cell *c = head; c; c = c->next, i++) {
+        values[i] = c->value;
+        if (keys) keys[i] = c->key;
+    }
+
+    if (isDict) {
+        object = CFDictionaryCreate(ps->allocator, keys, values, count,
+                                    &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    } else if (isSet) {
+        object = CFSetCreate(ps->allocator, values, count, &kCFTypeSetCallBacks);
+    } else {
+        object = CFArrayCreate(ps->allocator, values, count, &kCFTypeArrayCallBacks);
+    }
+    for (i = 0; i < count; i++) {
+        if (keys) CFRelease(keys[i]);
+        CFRelease(values[i]);
+    }
+    return made(ps, object);
+
+error:
+    releaseCells(head);
+    return NULL;
+}
+
+static CFTypeRef parseObject(parser *ps, int depth)
+{
+    tag         t;
+    CFTypeRef   object;
+
+    skipSpace(ps);
+    if (!readTag(ps, &t)) return NULL;
+    if (t.closing) return fail(ps, "unexpected closing element");
+
+    if (t.hasIDREF) {
+        idref *r;
+
+        for (r = ps->ids; r; r = r->next) {
+            if (r->id == t.idref) break;
+        }
+        if (r == NULL) return fail(ps, "IDREF to an unknown ID");
+        if (!t.empty && !expectClose(ps, &t)) return NULL;
+        return CFRetain(r->object);
+    }
+
+    if (tagIs(&t, "array") || tagIs(&t, "set") || tagIs(&t, "dict")) {
+        object = createCollection(ps, &t, depth);
+    } else if (tagIs(&t, "string")) {
+        object = createString(ps, &t);
+    } else if (tagIs(&t, "integer")) {
+        object = createInteger(ps, &t);
+    } else if (tagIs(&t, "data")) {
+        object = createData(ps, &t);
+    } else if (tagIs(&t, "true") || tagIs(&t, "false")) {
+        if (!t.empty && !expectClose(ps, &t)) return NULL;
+        object = CFRetain(tagIs(&t, "true") ? kCFBooleanTrue : kCFBooleanFalse);
+    } else {
+        return fail(ps, "unknown element");
+    }
+    if (object == NULL) return NULL;
+
+    if (t.hasID) {
+        idref *r = arenaAlloc(ps->arena, sizeof(*r));
+
+        if (r == NULL) {
+            CFRelease(object);
+            return fail(ps, "out of memory");
+        }
+        // A container may drop it (a duplicate dict key or set member), so
+        // the table keeps its own reference until the parse is over
+        r->id = t.id;
+        r->object = CFRetain(object);
+        r->next = ps->ids;
+        ps->ids = r;
+    }
+    return object;
+}
+
+static CFTypeRef parseDocument(arena *a, CFAllocatorRef allocator, const char *bytes, size_t length,
+                               CFStringRef *errorString)
+{
+    parser      ps = { a, allocator, bytes, bytes, bytes + length, NULL, NULL, NULL };
+    CFTypeRef   object;
+    idref       *r;
+
+    object = parseObject(&ps, 0);
+    if (object) {
+        skipSpace(&ps);
+        // What a string read from NVRAM data may have left after the XML
+        while (ps.p < ps.end && *ps.p == '\0') ps.p++;
+        if (ps.p < ps.end) {
+            CFRelease(object);
+            object = fail(&ps, "text after the object");
+        }
+    }
+    // The table's entries live in the arena, but the objects they hold don't
+    for (r = ps.ids; r; r = r->next) {
+        CFRelease(r->object);
+    }
+    if (object == NULL && errorString) {
+        *errorString = CFStringCreateWithFormat(kCFAllocatorDefault, NULL, CFSTR("%s at offset %ld"),
+                                                ps.error ? ps.error : "syntax error",
+                                                (long)((ps.errorAt ? ps.errorAt : ps.p) - ps.start));
+    }
+    return object;
+}
+
+CFTypeRef BLCreateObjectFromEFIXML(CFAllocatorRef allocator, const char *bytes, size_t length,
+                                   BLEFIXMLParseStatistics *stats, CFStringRef *errorString)
+{
+    arena       a;
+    CFTypeRef   object;
+
+    if (errorString) *errorString = NULL;
+    arenaInit(&a, stats);
+    object = parseDocument(&a, allocator, bytes, length, errorString);
+    arenaFree(&a);
+    return object;
+}
+
+int BLCreateEFIXMLArray(BLContextPtr context, CFStringRef xmlString, CFArrayRef *array)
+{
+    uint64_t    span = BLTraceBegin(context);
+    arena       a;
+    const char  *bytes;
+    CFIndex     length, converted;
+    CFStringRef errorString = NULL;
+    CFTypeRef   object;
+    int         ret = 0;
+
+    *array = NULL;
+    arenaInit(&a, NULL);
+
+    // Straight from the string's storage when it has UTF-8 to hand, else converted into the arena
+    bytes = CFStringGetCStringPtr(xmlString, kCFStringEncodingUTF8);
+    if (bytes) {
+        length = strlen(bytes);
+    } else {
+        CFRange range = CFRangeMake(0, CFStringGetLength(xmlString));
+        char    *buffer;
+
+        converted = CFStringGetBytes(xmlString, range, kCFStringEncodingUTF8, 0, false, NULL, 0, &length);
+        buffer = (converted == range.length) ? arenaAlloc(&a, length ? length : 1) : NULL;
+        if (buffer == NULL) {
+            contextprintf(context, kBLLogLevelError, "Could not interpret XML string as UTF-8\n");
+            ret = 1;
+            goto exit;
+        }
+        CFStringGetBytes(xmlString, range, kCFStringEncodingUTF8, 0, false, (UInt8 *)buffer, length, NULL);
+        bytes = buffer;
+    }
+
+    object = parseDocument(&a, kCFAllocatorDefault, bytes, length, &errorString);
+    if (object == NULL) {
+        contextprintf(context, kBLLogLevelError, "Could not unserialize string\n");
+        if (errorString) {
+            char errorStr[256];
+
+            contextprintf(context, kBLLogLevelVerbose, "%s\n",
+                          BLCopyCStringDescription(errorString, errorStr, sizeof errorStr));
+            CFRelease(errorString);
+        }
+        ret = 2;
+        goto exit;
+    }
+
+    if (CFGetTypeID(object) != CFArrayGetTypeID()) {
+        CFRelease(object);
+        contextprintf(context, kBLLogLevelError, "Bad type in XML string\n");
+        ret = 2;
+        goto exit;
+    }
+    *array = object;
+
+exit:
+    arenaFree(&a);
+    BLTraceEnd(context, span, "EFIXMLParse", NULL);
+    return ret;
+}
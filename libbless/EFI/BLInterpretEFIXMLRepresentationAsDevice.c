@@ -30,7 +30,6 @@
  */
 
 #include <IOKit/IOKitLib.h>
-#include <IOKit/IOCFUnserialize.h>
 #include <IOKit/storage/IOMedia.h>
 #include <IOKit/IOBSD.h>
 
@@ -57,26 +56,12 @@ int BLInterpretEFIXMLRepresentationAsDevice(BLContextPtr context,
 {
 	CFArrayRef  efiArray = NULL;
     CFIndex     count, i;
-    char        buffer[1024];
+	int			ret;
 	int			foundDevice = 0;
 	
-    if(!CFStringGetCString(xmlString, buffer, sizeof(buffer), kCFStringEncodingUTF8)) {
-        return 1;
-    }
-    
-    efiArray = IOCFUnserialize(buffer,
-                               kCFAllocatorDefault,
-                               0,
-                               NULL);
-    if(efiArray == NULL) {
-        contextprintf(context, kBLLogLevelError, "Could not unserialize string\n");
-        return 2;
-    }
-    
-    if(CFGetTypeID(efiArray) != CFArrayGetTypeID()) {
-        CFRelease(efiArray);
-        contextprintf(context, kBLLogLevelError, "Bad type in XML string\n");
-        return 2;        
+    ret = BLCreateEFIXMLArray(context, xmlString, &efiArray);
+    if(ret) {
+        return ret;
     }
     
     // for each entry, see if there's a volume UUID, or if IOMatch works
@@ -116,27 +101,13 @@ int BLInterpretEFIXMLRepresentationAsDeviceWithPath(BLContextPtr context,
 {
     CFArrayRef  efiArray = NULL;
     CFIndex     count, i;
-    char        buffer[1024];
+    int         ret;
     int			foundDevice = 0;
     int         foundPath = 0;
     
-    if(!CFStringGetCString(xmlString, buffer, sizeof(buffer), kCFStringEncodingUTF8)) {
-        return 1;
-    }
-    
-    efiArray = IOCFUnserialize(buffer,
-                               kCFAllocatorDefault,
-                               0,
-                               NULL);
-    if(efiArray == NULL) {
-        contextprintf(context, kBLLogLevelError, "Could not unserialize string\n");
-        return 2;
-    }
-    
-    if(CFGetTypeID(efiArray) != CFArrayGetTypeID()) {
-        CFRelease(efiArray);
-        contextprintf(context, kBLLogLevelError, "Bad type in XML string\n");
-        return 2;
+    ret = BLCreateEFIXMLArray(context, xmlString, &efiArray);
+    if(ret) {
+        return ret;
     }
     
     // for each entry, see if there's a volume UUID, or if IOMatch works
@@ -316,31 +287,18 @@ static CFUUIDRef    copyVolUUIDFromDiskArb(BLContextPtr context,
 {
     CFUUIDRef       dauuid = NULL;
 #if USE_DISKARBITRATION
-    DASessionRef    session = NULL;
-    DADiskRef       dadisk = NULL;
+    CFDictionaryRef descrip = NULL;
     char			lastBSDNameCString[MNAMELEN];
     
     CFStringGetCString(bsdName, lastBSDNameCString, 
                        sizeof(lastBSDNameCString),kCFStringEncodingUTF8);
     
-    session = DASessionCreate(kCFAllocatorDefault);
-    if(session) {
-        dadisk = DADiskCreateFromBSDName(kCFAllocatorDefault, session, 
-                                         lastBSDNameCString);
-        if(dadisk) {
-            CFDictionaryRef descrip = DADiskCopyDescription(dadisk);
-            if(descrip) {
-                dauuid = CFDictionaryGetValue(descrip, kDADiskDescriptionVolumeUUIDKey);
-                
-                if(dauuid)
-                    CFRetain(dauuid);
-                CFRelease(descrip);
-            }
-            
-            CFRelease(dadisk);
-        }
+    if(BLCopyDiskDescription(context, lastBSDNameCString, &descrip) == 0) {
+        dauuid = CFDictionaryGetValue(descrip, kDADiskDescriptionVolumeUUIDKey);
         
-        CFRelease(session);
+        if(dauuid)
+            CFRetain(dauuid);
+        CFRelease(descrip);
     }
 #endif // USE_DISKARBITRATION
     return dauuid;
@@ -32,7 +32,6 @@
 #include <IOKit/IOKitLib.h>
 #include <IOKit/IOKitKeys.h>
 #include <IOKit/IOBSD.h>
-#include <IOKit/IOCFUnserialize.h>
 #include <IOKit/network/IONetworkInterface.h>
 #include <IOKit/network/IONetworkController.h>
 
@@ -56,30 +55,16 @@ int BLInterpretEFIXMLRepresentationAsNetworkPath(BLContextPtr context,
     CFIndex     count, i, foundinterfaceindex, foundserverindex;
     int         foundmac = 0, foundinterface = 0, foundserver = 0, foundPXE = 0;
     CFDataRef   macAddress = 0;
-    char        buffer[1024];
+    int         ret;
         
     io_iterator_t   iter;
     io_service_t    service;
     kern_return_t   kret;
     
     
-    if(!CFStringGetCString(xmlString, buffer, sizeof(buffer), kCFStringEncodingUTF8)) {
-        return 1;
-    }
-    
-    efiArray = IOCFUnserialize(buffer,
-                               kCFAllocatorDefault,
-                               0,
-                               NULL);
-    if(efiArray == NULL) {
-        contextprintf(context, kBLLogLevelError, "Could not unserialize string\n");
-        return 2;
-    }
-    
-    if(CFGetTypeID(efiArray) != CFArrayGetTypeID()) {
-        CFRelease(efiArray);
-        contextprintf(context, kBLLogLevelError, "Bad type in XML string\n");
-        return 2;        
+    ret = BLCreateEFIXMLArray(context, xmlString, &efiArray);
+    if(ret) {
+        return ret;
     }
     
     // we do a first pass to validate types, and check for the BLMacAddress hint
@@ -22,6 +22,7 @@
  */
 
 #include <dlfcn.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <CoreFoundation/CoreFoundation.h>
 #include <IOKit/IOKitLib.h>
@@ -74,18 +75,77 @@ BLSetEFIBootFileOnce(BLContextPtr context, char *path)
  */
 
 // one static helper (defined at the bottom of this file)
-static int setefibootargs(BLContextPtr context, mach_port_t masterPort);
+static int setefibootargs(BLContextPtr context, struct BLNVRAMTransaction *txn);
 
-int setefidevice(BLContextPtr context, const char * bsdname, int bootNext,
+/*
+ * NVRAM is one store for the whole machine, and setting a boot device is
+ * several variable writes that have to land together. Threads with their
+ * own contexts take turns here. Recursive, so an entry point holding it
+ * can call the others.
+ */
+static pthread_once_t   nvramLockOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t  nvramLock;
+
+static void initNVRAMLock(void)
+{
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&nvramLock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+void BLLockNVRAM(void)
+{
+    pthread_once(&nvramLockOnce, initNVRAMLock);
+    pthread_mutex_lock(&nvramLock);
+}
+
+void BLUnlockNVRAM(void)
+{
+    pthread_mutex_unlock(&nvramLock);
+}
+
+/*
+ * Stage one of setit()'s writes: bootvar = value, or for
+ * kIONVRAMDeletePropertyKey, delete the variable named by value.
+ */
+static int stageit(struct BLNVRAMTransaction *txn, const char *bootvar, CFStringRef value)
+{
+    CFStringRef bootName;
+    int ret;
+
+    if (0 == strcmp(bootvar, kIONVRAMDeletePropertyKey)) {
+        return BLNVRAMTransactionDeleteValue(txn, value);
+    }
+    bootName = CFStringCreateWithCString(kCFAllocatorDefault, bootvar, kCFStringEncodingUTF8);
+    if (bootName == NULL) return 2;
+    ret = BLNVRAMTransactionSetValue(txn, bootName, value);
+    CFRelease(bootName);
+    return ret;
+}
+
+/*
+ * Finish a transaction: write what was staged if staging succeeded
+ * (ret is 0), and none of it if it didn't.
+ */
+static int commitOrAbort(struct BLNVRAMTransaction *txn, int ret)
+{
+    if (ret) {
+        BLNVRAMTransactionAbort(txn);
+        return ret;
+    }
+    return BLNVRAMTransactionCommit(txn, NULL);
+}
+
+static int _setefidevice(BLContextPtr context, struct BLNVRAMTransaction *txn, const char * bsdname, int bootNext,
 				 int bootLegacy, const char *legacyHint, const char *optionalData, bool shortForm)
 {
     int ret;
     
     CFStringRef xmlString = NULL;
     const char *bootString = NULL;
-    struct statfs   *mnts;
-    int             mntsize;
-	int				i;
 	struct stat		st;
 
 	if(bootLegacy) {
@@ -100,13 +160,16 @@ int setefidevice(BLContextPtr context, const char * bsdname, int bootNext,
                 return 1;
             }
             
-            ret = setit(context, kIOMasterPortDefault, "efi-legacy-drive-hint", xmlString);    
+            ret = stageit(txn, "efi-legacy-drive-hint", xmlString);    
+            CFRelease(xmlString);
             if(ret) return ret;
 
-            ret = _forwardNVRAM(context, CFSTR("efi-legacy-drive-hint-data"), CFSTR("BootCampHD"));
+            // Writes the hint now; a failure past here leaves the hint and
+            // BootCampHD set, though the boot device is not
+            ret = BLNVRAMTransactionForward(txn, CFSTR("efi-legacy-drive-hint-data"), CFSTR("BootCampHD"));
             if(ret) return ret;     
             
-            ret = setit(context, kIOMasterPortDefault, kIONVRAMDeletePropertyKey, CFSTR("efi-legacy-drive-hint"));    
+            ret = stageit(txn, kIONVRAMDeletePropertyKey, CFSTR("efi-legacy-drive-hint"));    
             if(ret) return ret;
        
         }
@@ -122,9 +185,7 @@ int setefidevice(BLContextPtr context, const char * bsdname, int bootNext,
         
         CFStringRef firstBooter = NULL;
         CFStringRef firstData = NULL;
-        int         uefiDiscBootEntry = 0;
-        int         uefiDiscPartitionStart = 0;
-        int         uefiDiscPartitionSize = 0;
+        BLElToritoCatalogRef uefiDiscCatalog = NULL;
 		CFStringRef firstVolume = NULL;
 		char        prebootBSD[64];
 		char		prebootPath[MAXPATHLEN];
@@ -139,7 +200,7 @@ int setefidevice(BLContextPtr context, const char * bsdname, int bootNext,
         // first check to see if we are dealing with a disk that has the following properties:
         // is optical AND is DVD AND has an El Torito Boot Catalog AND has an UEFI-bootable entry.
         // get yes/no on that, and if yes, also get some facts about where on disc it is.
-        bool isUEFIDisc = isDVDWithElToritoWithUEFIBootableOS(context, newBSDName, &uefiDiscBootEntry, &uefiDiscPartitionStart, &uefiDiscPartitionSize);
+        bool isUEFIDisc = BLCopyUEFIBootableElToritoCatalogForDVD(context, newBSDName, &uefiDiscCatalog);
         
         if (isUEFIDisc) {
             contextprintf(context, kBLLogLevelVerbose, "Disk is DVD disc with BootCatalog with UEFIBootableOS\n");
@@ -184,20 +245,9 @@ int setefidevice(BLContextPtr context, const char * bsdname, int bootNext,
 					CFStringGetCString(firstVolume, prebootBSD, sizeof prebootBSD, kCFStringEncodingUTF8);
 					
 					// We need to mount the preboot volume so we know which UUID to use in the path.
-					// Check if the preboot volume is mounted.
-					mntsize = getmntinfo(&mnts, MNT_NOWAIT);
-					if (!mntsize) return 3;
-					for (i = 0; i < mntsize; i++) {
-						if (strcmp(mnts[i].f_mntfromname + 5, prebootBSD) == 0) break;
-					}
-					if (i < mntsize) {
-						strlcpy(prebootMountPoint, mnts[i].f_mntonname, sizeof prebootMountPoint);
-					} else {
-						// The preboot volume isn't mounted right now.  We'll have to mount it.
-						ret = BLMountContainerVolume(context, prebootBSD, prebootMountPoint, sizeof prebootMountPoint, true);
-						if (ret) return 4;
-						mustUnmount = true;
-					}
+					// Use it where it is already mounted, or mount it read-only.
+					ret = BLAcquireMount(context, prebootBSD, NULL, true, prebootMountPoint, sizeof prebootMountPoint, &mustUnmount);
+					if (ret) return 4;
 					snprintf(prebootPath, sizeof prebootPath, "%s/", prebootMountPoint);
 					pathEnd = prebootPath + strlen(prebootPath);
 					pathFreeSpace = sizeof prebootPath - strlen(prebootPath);
@@ -205,7 +255,7 @@ int setefidevice(BLContextPtr context, const char * bsdname, int bootNext,
 					rootMedia = IOServiceGetMatchingService(kIOMasterPortDefault, IOBSDNameMatching(kIOMasterPortDefault, 0, newBSDName));
 					if (!rootMedia) {
 						CFRelease(dict);
-						if (mustUnmount) BLUnmountContainerVolume(context, prebootMountPoint);
+						if (mustUnmount) BLReleaseMount(context, prebootMountPoint);
 						return 2;
 					}
 					if (IOObjectConformsTo(rootMedia, "AppleAPFSSnapshot")) {
@@ -216,7 +266,7 @@ int setefidevice(BLContextPtr context, const char * bsdname, int bootNext,
 						if (ret) {
 							contextprintf(context, kBLLogLevelError, "Could not resolve snapshot at %s to a volume\n", newBSDName);
 							IOObjectRelease(rootMedia);
-							if (mustUnmount) BLUnmountContainerVolume(context, prebootMountPoint);
+							if (mustUnmount) BLReleaseMount(context, prebootMountPoint);
 							return ret;
 						}
 						IOObjectRelease(rootMedia);
@@ -227,7 +277,7 @@ int setefidevice(BLContextPtr context, const char * bsdname, int bootNext,
 					if (!rootUUID) {
 						contextprintf(context, kBLLogLevelError, "No valid volume UUID for device %s\n", newBSDName);
 						IOObjectRelease(rootMedia);
-						if (mustUnmount) BLUnmountContainerVolume(context, prebootMountPoint);
+						if (mustUnmount) BLReleaseMount(context, prebootMountPoint);
 						return 2;
 					}
 					CFStringGetCString(rootUUID, pathEnd, pathFreeSpace, kCFStringEncodingUTF8);
@@ -244,7 +294,7 @@ int setefidevice(BLContextPtr context, const char * bsdname, int bootNext,
 							contextprintf(context, kBLLogLevelError, "No valid group or volume UUID folder for %s\n", newBSDName);
 							IOObjectRelease(rootMedia);
 							CFRelease(rootUUID);
-							if (mustUnmount) BLUnmountContainerVolume(context, prebootMountPoint);
+							if (mustUnmount) BLReleaseMount(context, prebootMountPoint);
 							return 2;
 						} else {
 							contextprintf(context, kBLLogLevelVerbose, "Found volume group UUID path in preboot for %s\n", newBSDName);
@@ -252,7 +302,7 @@ int setefidevice(BLContextPtr context, const char * bsdname, int bootNext,
 					}
 					IOObjectRelease(rootMedia);
 					CFRelease(rootUUID);
-					if (mustUnmount) BLUnmountContainerVolume(context, prebootMountPoint);
+					if (mustUnmount) BLReleaseMount(context, prebootMountPoint);
 					contextprintf(context, kBLLogLevelVerbose, "Substituting preboot volume %s\n", prebootBSD);
 					strlcat(prebootPath, kBL_PATH_CORESERVICES "/boot.efi", sizeof prebootPath);
 					partialPath = pathEnd - 1;
@@ -308,12 +358,11 @@ int setefidevice(BLContextPtr context, const char * bsdname, int bootNext,
 															 &xmlString,
 															 shortForm);
 		} else if (isUEFIDisc) {
-			ret = BLCreateEFIXMLRepresentationForElToritoEntry(context,
-															   newBSDName,
-															   uefiDiscBootEntry,
-															   uefiDiscPartitionStart,
-															   uefiDiscPartitionSize,
-															   &xmlString);
+			ret = BLCreateEFIXMLRepresentationForElToritoCatalog(context,
+																 newBSDName,
+																 uefiDiscCatalog,
+																 &xmlString);
+			BLElToritoCatalogRelease(uefiDiscCatalog);
         } else {
 			ret = BLCreateEFIXMLRepresentationForDevice(context,
 														newBSDName,
@@ -337,26 +386,40 @@ int setefidevice(BLContextPtr context, const char * bsdname, int bootNext,
         bootString = "efi-boot-device";
     }    
     
-    ret = setit(context, kIOMasterPortDefault, bootString, xmlString);    
+    ret = stageit(txn, bootString, xmlString);    
     CFRelease(xmlString);
     if(ret) return ret;
 
-	ret = efinvramcleanup(context);
+	ret = stageefinvramcleanup(context, txn);
 	if(ret) return ret;
         
     return ret;
 }
 
-int setefifilepath(BLContextPtr context, const char *path, int bootNext,
+int setefidevice(BLContextPtr context, const char * bsdname, int bootNext,
+				 int bootLegacy, const char *legacyHint, const char *optionalData, bool shortForm)
+{
+    uint64_t span = BLTraceBegin(context);
+    struct BLNVRAMTransaction *txn;
+    int ret;
+
+    ret = BLNVRAMTransactionBegin(context, &txn);
+    if (ret == 0) {
+        ret = commitOrAbort(txn, _setefidevice(context, txn, bsdname, bootNext, bootLegacy, legacyHint,
+                                               optionalData, shortForm));
+    }
+
+    BLTraceEnd(context, span, "setefidevice", bsdname);
+    return ret;
+}
+
+static int _setefifilepath(BLContextPtr context, struct BLNVRAMTransaction *txn, const char *path, int bootNext,
 				   const char *optionalData, bool shortForm)
 {
     CFStringRef xmlString = NULL;
     const char *bootString = NULL;
     int ret;
     struct statfs sb;
-    struct statfs   *mnts;
-    int             mntsize;
-	int				i;
 	struct stat		st;
 
 	if(0 != blsustatfs(path, &sb)) {
@@ -377,9 +440,7 @@ int setefifilepath(BLContextPtr context, const char *path, int bootNext,
     CFStringRef firstVolume = NULL;
 	char        prebootBSD[64];
 	char        *partialPath;
-    int         uefiDiscBootEntry = 0;
-    int         uefiDiscPartitionStart = 0;
-    int         uefiDiscPartitionSize = 0;
+    BLElToritoCatalogRef uefiDiscCatalog = NULL;
 	char		prebootPath[MAXPATHLEN];
 	char		prebootMountPoint[MAXPATHLEN];
 	bool        mustUnmount = false;
@@ -391,7 +452,7 @@ int setefifilepath(BLContextPtr context, const char *path, int bootNext,
     // first check to see if we are dealing with a disk that has the following properties:
     // is optical AND is DVD AND has an El Torito Boot Catalog AND has an UEFI-bootable entry.
     // get yes/no on that, and if yes, also get some facts about where on disc it is.
-    bool isUEFIDisc = isDVDWithElToritoWithUEFIBootableOS(context, newBSDName, &uefiDiscBootEntry, &uefiDiscPartitionStart, &uefiDiscPartitionSize);
+    bool isUEFIDisc = BLCopyUEFIBootableElToritoCatalogForDVD(context, newBSDName, &uefiDiscCatalog);
     
     if (isUEFIDisc) {
         contextprintf(context, kBLLogLevelVerbose, "Disk is DVD disc with BootCatalog with UEFIBootableOS\n");
@@ -436,20 +497,9 @@ int setefifilepath(BLContextPtr context, const char *path, int bootNext,
                 CFStringGetCString(firstVolume, prebootBSD, sizeof prebootBSD, kCFStringEncodingUTF8);
                 
 				// We need to mount the preboot volume so we know which UUID to use in the path.
-				// Check if the preboot volume is mounted.
-				mntsize = getmntinfo(&mnts, MNT_NOWAIT);
-				if (!mntsize) return 3;
-				for (i = 0; i < mntsize; i++) {
-					if (strcmp(mnts[i].f_mntfromname + 5, prebootBSD) == 0) break;
-				}
-				if (i < mntsize) {
-					strlcpy(prebootMountPoint, mnts[i].f_mntonname, sizeof prebootMountPoint);
-				} else {
-					// The preboot volume isn't mounted right now.  We'll have to mount it.
-					ret = BLMountContainerVolume(context, prebootBSD, prebootMountPoint, sizeof prebootMountPoint, true);
-					if (ret) return 4;
-					mustUnmount = true;
-				}
+				// Use it where it is already mounted, or mount it read-only.
+				ret = BLAcquireMount(context, prebootBSD, NULL, true, prebootMountPoint, sizeof prebootMountPoint, &mustUnmount);
+				if (ret) return 4;
 				snprintf(prebootPath, sizeof prebootPath, "%s/", prebootMountPoint);
 				pathEnd = prebootPath + strlen(prebootPath);
 				pathFreeSpace = sizeof prebootPath - strlen(prebootPath);
@@ -457,7 +507,7 @@ int setefifilepath(BLContextPtr context, const char *path, int bootNext,
 				rootMedia = IOServiceGetMatchingService(kIOMasterPortDefault, IOBSDNameMatching(kIOMasterPortDefault, 0, newBSDName));
 				if (!rootMedia) {
 					CFRelease(dict);
-					if (mustUnmount) BLUnmountContainerVolume(context, prebootMountPoint);
+					if (mustUnmount) BLReleaseMount(context, prebootMountPoint);
 					return 2;
 				}
 				
@@ -469,7 +519,7 @@ int setefifilepath(BLContextPtr context, const char *path, int bootNext,
 					if (ret) {
 						contextprintf(context, kBLLogLevelError, "Could not resolve snapshot at %s to a volume\n", newBSDName);
 						IOObjectRelease(rootMedia);
-						if (mustUnmount) BLUnmountContainerVolume(context, prebootMountPoint);
+						if (mustUnmount) BLReleaseMount(context, prebootMountPoint);
 						return ret;
 					}
 					IOObjectRelease(rootMedia);
@@ -480,7 +530,7 @@ int setefifilepath(BLContextPtr context, const char *path, int bootNext,
 				if (!rootUUID) {
 					contextprintf(context, kBLLogLevelError, "No valid volume UUID for device %s\n", newBSDName);
 					IOObjectRelease(rootMedia);
-					if (mustUnmount) BLUnmountContainerVolume(context, prebootMountPoint);
+					if (mustUnmount) BLReleaseMount(context, prebootMountPoint);
 					return 2;
 				}
 				CFStringGetCString(rootUUID, pathEnd, pathFreeSpace, kCFStringEncodingUTF8);
@@ -497,7 +547,7 @@ int setefifilepath(BLContextPtr context, const char *path, int bootNext,
 						contextprintf(context, kBLLogLevelError, "No valid group or volume UUID folder for %s\n", newBSDName);
 						IOObjectRelease(rootMedia);
 						CFRelease(rootUUID);
-						if (mustUnmount) BLUnmountContainerVolume(context, prebootMountPoint);
+						if (mustUnmount) BLReleaseMount(context, prebootMountPoint);
 						return 2;
 					} else {
 						contextprintf(context, kBLLogLevelVerbose, "Found volume group UUID path in preboot for %s\n", newBSDName);
@@ -505,7 +555,7 @@ int setefifilepath(BLContextPtr context, const char *path, int bootNext,
 				}
 				IOObjectRelease(rootMedia);
 				CFRelease(rootUUID);
-				if (mustUnmount) BLUnmountContainerVolume(context, prebootMountPoint);
+				if (mustUnmount) BLReleaseMount(context, prebootMountPoint);
                 contextprintf(context, kBLLogLevelVerbose, "Substituting preboot volume %s\n", prebootBSD);
 				strlcat(prebootPath, kBL_PATH_CORESERVICES "/boot.efi", sizeof prebootPath);
 				partialPath = pathEnd - 1;
@@ -565,12 +615,10 @@ int setefifilepath(BLContextPtr context, const char *path, int bootNext,
                                                     &xmlString,
                                                     shortForm);
     } else if (isUEFIDisc) {
-        ret = BLCreateEFIXMLRepresentationForElToritoEntry(context,
-                                                           newBSDName,
-                                                           uefiDiscBootEntry,
-                                                           uefiDiscPartitionStart,
-                                                           uefiDiscPartitionSize,
-                                                           &xmlString);
+        ret = BLCreateEFIXMLRepresentationForElToritoCatalog(context,
+                                                             newBSDName,
+                                                             uefiDiscCatalog,
+                                                             &xmlString);
     } else if (firstVolume) {
         ret = BLCreateEFIXMLRepresentationForPartialPath(context,
                                                          prebootBSD,
@@ -588,6 +636,8 @@ int setefifilepath(BLContextPtr context, const char *path, int bootNext,
     
     if (dict)
         CFRelease (dict);
+    if (uefiDiscCatalog)
+        BLElToritoCatalogRelease(uefiDiscCatalog);
     
     if(ret) {
         return 1;
@@ -599,20 +649,35 @@ int setefifilepath(BLContextPtr context, const char *path, int bootNext,
         bootString = "efi-boot-device";
     }
     
-    ret = setit(context, kIOMasterPortDefault, bootString, xmlString);
+    ret = stageit(txn, bootString, xmlString);
     CFRelease(xmlString);
     if(ret) {
         return 2;
     }        
     
-	ret = efinvramcleanup(context);
+	ret = stageefinvramcleanup(context, txn);
 	if(ret) return ret;
         
     return 0;
 }
 
-// no BLSet...() wrapper yet
-int setefinetworkpath(BLContextPtr context, CFStringRef booterXML,
+int setefifilepath(BLContextPtr context, const char *path, int bootNext,
+				   const char *optionalData, bool shortForm)
+{
+    uint64_t span = BLTraceBegin(context);
+    struct BLNVRAMTransaction *txn;
+    int ret;
+
+    ret = BLNVRAMTransactionBegin(context, &txn);
+    if (ret == 0) {
+        ret = commitOrAbort(txn, _setefifilepath(context, txn, path, bootNext, optionalData, shortForm));
+    }
+
+    BLTraceEnd(context, span, "setefifilepath", path);
+    return ret;
+}
+
+static int _setefinetworkpath(BLContextPtr context, struct BLNVRAMTransaction *txn, CFStringRef booterXML,
 					  CFStringRef kernelXML, CFStringRef mkextXML,
 					  CFStringRef kernelcacheXML, int bootNext)
 {
@@ -625,166 +690,150 @@ int setefinetworkpath(BLContextPtr context, CFStringRef booterXML,
         bootString = "efi-boot-device";
     }
     
-    ret = setit(context, kIOMasterPortDefault, bootString, booterXML);
+    ret = stageit(txn, bootString, booterXML);
     if(ret) return ret;
     
 	if(kernelXML) {
-		ret = setit(context, kIOMasterPortDefault, "efi-boot-file", kernelXML);
+		ret = stageit(txn, "efi-boot-file", kernelXML);
 	} else {
-		ret = setit(context, kIOMasterPortDefault, kIONVRAMDeletePropertyKey, CFSTR("efi-boot-file"));
+		ret = stageit(txn, kIONVRAMDeletePropertyKey, CFSTR("efi-boot-file"));
 	}
     if(ret) return ret;
 
 	if(mkextXML) {
-		ret = setit(context, kIOMasterPortDefault, "efi-boot-mkext", mkextXML);
+		ret = stageit(txn, "efi-boot-mkext", mkextXML);
 	} else {
-		ret = setit(context, kIOMasterPortDefault, kIONVRAMDeletePropertyKey, CFSTR("efi-boot-mkext"));
+		ret = stageit(txn, kIONVRAMDeletePropertyKey, CFSTR("efi-boot-mkext"));
 	}
     if(ret) return ret;
 
     if(kernelcacheXML) {
-		ret = setit(context, kIOMasterPortDefault, "efi-boot-kernelcache", kernelcacheXML);
+		ret = stageit(txn, "efi-boot-kernelcache", kernelcacheXML);
 	} else {
-		ret = setit(context, kIOMasterPortDefault, kIONVRAMDeletePropertyKey, CFSTR("efi-boot-kernelcache"));
+		ret = stageit(txn, kIONVRAMDeletePropertyKey, CFSTR("efi-boot-kernelcache"));
 	}
     if(ret) return ret;
 	
     
-    ret = setefibootargs(context, kIOMasterPortDefault);
+    ret = setefibootargs(context, txn);
     if(ret) return ret;
     
     return 0;
 }
 
-int efinvramcleanup(BLContextPtr context)
+// no BLSet...() wrapper yet
+int setefinetworkpath(BLContextPtr context, CFStringRef booterXML,
+					  CFStringRef kernelXML, CFStringRef mkextXML,
+					  CFStringRef kernelcacheXML, int bootNext)
+{
+    struct BLNVRAMTransaction *txn;
+    int ret;
+
+    ret = BLNVRAMTransactionBegin(context, &txn);
+    if (ret) return ret;
+    return commitOrAbort(txn, _setefinetworkpath(context, txn, booterXML, kernelXML, mkextXML, kernelcacheXML, bootNext));
+}
+
+int stageefinvramcleanup(BLContextPtr context, struct BLNVRAMTransaction *txn)
 {
 	int ret;
 
-	ret = setit(context, kIOMasterPortDefault, kIONVRAMDeletePropertyKey, CFSTR("efi-boot-file"));    
+	ret = stageit(txn, kIONVRAMDeletePropertyKey, CFSTR("efi-boot-file"));    
     if(ret) return ret;
     
-    ret = setit(context, kIOMasterPortDefault, kIONVRAMDeletePropertyKey, CFSTR("efi-boot-mkext"));    
+    ret = stageit(txn, kIONVRAMDeletePropertyKey, CFSTR("efi-boot-mkext"));    
     if(ret) return ret;
     
-    ret = setit(context, kIOMasterPortDefault, kIONVRAMDeletePropertyKey, CFSTR("efi-boot-kernelcache"));    
+    ret = stageit(txn, kIONVRAMDeletePropertyKey, CFSTR("efi-boot-kernelcache"));    
     if(ret) return ret;
     
-    ret = setefibootargs(context, kIOMasterPortDefault);
+    ret = setefibootargs(context, txn);
     if(ret) return ret;
     
     return 0;	
 }
 
+int efinvramcleanup(BLContextPtr context)
+{
+	struct BLNVRAMTransaction *txn;
+	int ret;
+
+	ret = BLNVRAMTransactionBegin(context, &txn);
+	if (ret) return ret;
+	return commitOrAbort(txn, stageefinvramcleanup(context, txn));
+}
+
 
 // shared helpers (used by setboot.c)
 
 int _forwardNVRAM(BLContextPtr context, CFStringRef from, CFStringRef to)
 {
-    
-    io_registry_entry_t optionsNode = 0;
-    CFTypeRef       valRef;
-    kern_return_t   kret;
-    
-    optionsNode = IORegistryEntryFromPath(kIOMasterPortDefault, kIODeviceTreePlane ":/options");
-    
-    if(IO_OBJECT_NULL == optionsNode) {
-        contextprintf(context, kBLLogLevelError,  "Could not find " kIODeviceTreePlane ":/options\n");
-        return 1;
-    }
-    
-    valRef = IORegistryEntryCreateCFProperty(optionsNode, from, kCFAllocatorDefault, 0);
-    
-    if(valRef == NULL) {
-        contextprintf(context, kBLLogLevelError,  "Could not find variable '%s'\n",
-                                                    BLGetCStringDescription(from));
-        return 2;
-    }
-    
-    contextprintf(context, kBLLogLevelVerbose,  "Setting EFI NVRAM:\n" );
-    contextprintf(context, kBLLogLevelVerbose,  "\t%s='...'\n", BLGetCStringDescription(to) );
-
-    kret = IORegistryEntrySetCFProperty(optionsNode, to, valRef);
-    if(kret) {
-        CFRelease(valRef);
-        IOObjectRelease(optionsNode);
-        contextprintf(context, kBLLogLevelError,  "Could not set boot property '%s': %#x\n",
-                                                        BLGetCStringDescription(to),
-                                                        kret);
-        return 3;        
-    }
-
-    CFRelease(valRef);    
-    IOObjectRelease(optionsNode);
+    struct BLNVRAMTransaction *txn;
+    int ret;
 
-    return 0;
+    ret = BLNVRAMTransactionBegin(context, &txn);
+    if (ret) return ret;
+    return commitOrAbort(txn, BLNVRAMTransactionForward(txn, from, to));
 }
 
 int setit(BLContextPtr context, mach_port_t masterPort, const char *bootvar, CFStringRef xmlstring)
 {
-    
-    io_registry_entry_t optionsNode = 0;
-    CFStringRef bootName = NULL;
-    kern_return_t kret;
-    char    cStr[1024];
+    uint64_t span = BLTraceBegin(context);
+    struct BLNVRAMTransaction *txn;
+    int ret;
 
-    optionsNode = IORegistryEntryFromPath(masterPort, kIODeviceTreePlane ":/options");
-    
-    if(IO_OBJECT_NULL == optionsNode) {
-        contextprintf(context, kBLLogLevelError,  "Could not find " kIODeviceTreePlane ":/options\n");
-        return 1;
-    }
-    
-    bootName = CFStringCreateWithCString(kCFAllocatorDefault, bootvar, kCFStringEncodingUTF8);
-    if(bootName == NULL) {
-        IOObjectRelease(optionsNode);
-        return 2;
-    }
-    
-    CFStringGetCString(xmlstring, cStr, sizeof(cStr), kCFStringEncodingUTF8);
-    
-    contextprintf(context, kBLLogLevelVerbose,  "Setting EFI NVRAM:\n" );
-    contextprintf(context, kBLLogLevelVerbose,  "\t%s='%s'\n", bootvar, cStr );
-
-    kret = IORegistryEntrySetCFProperty(optionsNode, bootName, xmlstring);
-    if(kret) {
-        CFRelease(bootName);
-        IOObjectRelease(optionsNode);
-        contextprintf(context, kBLLogLevelError,  "Could not set boot device property: %#x\n", kret);
-        return 2;        
+    // One variable is a transaction of its own; masterPort is always the default
+    ret = BLNVRAMTransactionBegin(context, &txn);
+    if (ret == 0) {
+        ret = commitOrAbort(txn, stageit(txn, bootvar, xmlstring));
     }
-    
-    CFRelease(bootName);
-    IOObjectRelease(optionsNode);
-        
-    return 0;
+
+    BLTraceEnd(context, span, "setit", bootvar);
+    return ret;
+}
+
+// As much of the string as fits, whole characters only
+static bool truncatedCString(CFStringRef string, char *buffer, size_t size)
+{
+    CFIndex used = 0;
+    CFIndex length = CFStringGetLength(string);
+    CFIndex converted;
+
+    converted = CFStringGetBytes(string, CFRangeMake(0, length), kCFStringEncodingUTF8, 0, false,
+                                 (UInt8 *)buffer, size - 1, &used);
+    buffer[used] = '\0';
+    return converted > 0 || length == 0;
 }
 
 // truly private helper?
-// fetch old args. If set, filter them and reset
-static int setefibootargs(BLContextPtr context, mach_port_t masterPort)
+// fetch old args. If set, filter them and stage the result.
+// The transaction holds the NVRAM lock, so nobody writes boot-args in between.
+static int setefibootargs(BLContextPtr context, struct BLNVRAMTransaction *txn)
 {
     
     int             ret;
     char        cStr[1024], newArgs[1024];
     bool            didChange = false;
     CFStringRef     newString;
+    CFTypeRef       valRef;
     
-    ret = BLCopyEFINVRAMVariableAsString(context,
-                                   CFSTR("boot-args"),
-                                   &newString);
-    
-    if(ret) {
-        contextprintf(context, kBLLogLevelError,  "Error getting NVRAM variable \"boot-args\"\n");        
-        return 1;
-    }
+    BLNVRAMTransactionCopyValue(txn, CFSTR("boot-args"), &valRef);
     
-    if(newString == NULL) {
+    if(valRef == NULL) {
         // nothing set. that's OK
         contextprintf(context, kBLLogLevelVerbose,  "NVRAM variable \"boot-args\" not set.\n");        
         return 0;        
     }
+    
+    ret = BLCreateStringFromNVRAMValue(context, valRef, &newString);
+    CFRelease(valRef);
+    if(ret) {
+        contextprintf(context, kBLLogLevelError,  "Error getting NVRAM variable \"boot-args\"\n");        
+        return 1;
+    }
         
-    if(!CFStringGetCString(newString, cStr, sizeof(cStr), kCFStringEncodingUTF8)) {
+    // boot-args are cut to the kernel's 1024 bytes, so they're kept to that here too
+    if(!truncatedCString(newString, cStr, sizeof(cStr))) {
         contextprintf(context, kBLLogLevelError,  "Could not interpret boot-args as string. Ignoring...\n");
         cStr[0] = '\0';
         // since we truncate boot-args, act like everything was filtered
@@ -811,7 +860,7 @@ static int setefibootargs(BLContextPtr context, mach_port_t masterPort)
         return 2;
     }
 
-    ret = setit(context, masterPort, "boot-args", newString);
+    ret = stageit(txn, "boot-args", newString);
     CFRelease(newString);
     if(ret)
         return ret;
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ *  BLCompareFiles.c
+ *  bless
+ *
+ *  Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "bless.h"
+#include "bless_private.h"
+
+#define kCompareWindowSize  0x800000    // 8 MiB mapped from each file at a time
+#define kCompareBlockSize   0x10000     // 64 KiB compared at a time within a window
+#define kCompareBufferSize  0x40000     // 256 KiB read at a time when mapping fails
+
+static bool sameBytes(const uint8_t *a, const uint8_t *b, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i += kCompareBlockSize) {
+		if (memcmp(a + i, b + i, MIN((size_t)kCompareBlockSize, len - i)) != 0) return false;
+	}
+	return true;
+}
+
+static ssize_t readFully(int fd, uint8_t *buffer, size_t len, off_t offset)
+{
+	size_t done = 0;
+
+	while (done < len) {
+		ssize_t n = pread(fd, buffer + done, len - done, offset + (off_t)done);
+
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		if (n == 0) break;
+		done += (size_t)n;
+	}
+	return (ssize_t)done;
+}
+
+//
+// For file systems that won't map a file
+//
+static int compareByReading(int fd1, int fd2, off_t offset, off_t size, bool *identical, uint64_t *bytesRead)
+{
+	uint8_t *   buf1 = malloc(kCompareBufferSize);
+	uint8_t *   buf2 = malloc(kCompareBufferSize);
+	int         ret = 0;
+
+	*identical = true;
+	if (!buf1 || !buf2) {
+		ret = ENOMEM;
+		goto exit;
+	}
+	while (offset < size) {
+		size_t len = (size_t)MIN((off_t)kCompareBufferSize, size - offset);
+
+		if (readFully(fd1, buf1, len, offset) != (ssize_t)len || readFully(fd2, buf2, len, offset) != (ssize_t)len) {
+			ret = errno ? errno : EIO;
+			goto exit;
+		}
+		*bytesRead += 2 * len;
+		if (memcmp(buf1, buf2, len) != 0) {
+			*identical = false;
+			break;
+		}
+		offset += (off_t)len;
+	}
+
+exit:
+	free(buf1);
+	free(buf2);
+	return ret;
+}
+
+static int _BLFilesAreIdentical(BLContextPtr context, const char *source, const char *dest, bool *identical)
+{
+	struct stat sb1, sb2;
+	uint64_t    bytesRead = 0;
+	off_t       offset;
+	int         fd1 = -1;
+	int         fd2 = -1;
+	int         ret = 0;
+
+	*identical = false;
+
+	fd1 = open(source, O_RDONLY);
+	if (fd1 < 0 || fstat(fd1, &sb1) < 0) {
+		ret = errno;
+		contextprintf(context, kBLLogLevelError, "Can't open %s: %s\n", source, strerror(ret));
+		goto exit;
+	}
+
+	// A missing or odd destination is just different
+	fd2 = open(dest, O_RDONLY);
+	if (fd2 < 0 || fstat(fd2, &sb2) < 0) {
+		contextprintf(context, kBLLogLevelVerbose, "Can't open %s: %s\n", dest, strerror(errno));
+		goto exit;
+	}
+	if (!S_ISREG(sb1.st_mode) || !S_ISREG(sb2.st_mode) || sb1.st_size != sb2.st_size) goto exit;
+	if (sb1.st_dev == sb2.st_dev && sb1.st_ino == sb2.st_ino) {
+		*identical = true;
+		goto exit;
+	}
+
+	// Compare a window of each file at a time, and stop at the first difference
+	*identical = true;
+	for (offset = 0; offset < sb1.st_size; offset += kCompareWindowSize) {
+		size_t  len = (size_t)MIN((off_t)kCompareWindowSize, sb1.st_size - offset);
+		void *  map1 = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd1, offset);
+		void *  map2 = map1 == MAP_FAILED ? MAP_FAILED : mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd2, offset);
+		bool    same;
+
+		if (map2 == MAP_FAILED) {
+			if (map1 != MAP_FAILED) munmap(map1, len);
+			ret = compareByReading(fd1, fd2, offset, sb1.st_size, identical, &bytesRead);
+			if (ret) {
+				contextprintf(context, kBLLogLevelError, "Can't compare %s with %s: %s\n", source, dest, strerror(ret));
+				*identical = false;
+			}
+			goto exit;
+		}
+		posix_madvise(map1, len, POSIX_MADV_SEQUENTIAL);
+		posix_madvise(map2, len, POSIX_MADV_SEQUENTIAL);
+		same = sameBytes(map1, map2, len);
+		munmap(map1, len);
+		munmap(map2, len);
+		bytesRead += 2 * len;
+		if (!same) {
+			*identical = false;
+			break;
+		}
+	}
+
+exit:
+	if (fd1 >= 0) close(fd1);
+	if (fd2 >= 0) close(fd2);
+	BLTimingAddBytesRead(context, bytesRead);
+	return ret;
+}
+
+int BLFilesAreIdentical(BLContextPtr context, const char *source, const char *dest, bool *identical)
+{
+	uint64_t    span = BLTraceBegin(context);
+	int         ret = _BLFilesAreIdentical(context, source, dest, identical);
+
+	BLTraceEnd(context, span, "BLFilesAreIdentical", dest);
+	return ret;
+}
@@ -38,35 +38,55 @@
 #include "bless.h"
 #include "bless_private.h"
  
-int contextprintf(BLContextPtr context, int loglevel, char const *fmt, ...) {
+/*
+ * Messages that fit are formatted on the stack; only longer ones
+ * go to the heap.
+ */
+#define kContextPrintBufferSize 1024
+
+bool contextprintfenabled(BLContextPtr context, int loglevel) {
+    if(!context || !context->logstring) return false;
+    if(context->version == 0) return true;
+    if(context->version >= kBLContextVersion1) return (context->loglevels & loglevel) != 0;
+    return false;
+}
+
+int contextvprintf(BLContextPtr context, int loglevel, char const *fmt, va_list ap) {
     int ret;
-    char *out;
-    va_list ap;
+    char buf[kContextPrintBufferSize];
+    char *out = buf;
+    va_list ap2;
     
-    
-    if(!context) return 0;
+    if(!contextprintfenabled(context, loglevel)) return 0;
 
-    
-    
-    if(context->version == 0 && context->logstring) {
+    va_copy(ap2, ap);
+    ret = vsnprintf(buf, sizeof(buf), fmt, ap);
 
-        va_start(ap, fmt);
+    if(ret >= (int)sizeof(buf)) {
 #if NO_VASPRINTF
-	out = malloc(1024);
-	ret = vsnprintf(out, 1024, fmt, ap);  
+        out = malloc(ret + 1);
+        if(out) vsnprintf(out, ret + 1, fmt, ap2);
 #else
-	ret = vasprintf(&out, fmt, ap);  
+        if(vasprintf(&out, fmt, ap2) == -1) out = NULL;
 #endif
-	va_end(ap);
-    
-        if((ret == -1) || (out == NULL)) {
-            return context->logstring(context->logrefcon, loglevel, "Memory error, log entry not available");
-        }
+    }
+    va_end(ap2);
 
-        ret = context->logstring(context->logrefcon, loglevel, out);
-        free(out);
-        return ret;
+    if((ret == -1) || (out == NULL)) {
+        return context->logstring(context->logrefcon, loglevel, "Memory error, log entry not available");
     }
 
-    return 0;
+    ret = context->logstring(context->logrefcon, loglevel, out);
+    if(out != buf) free(out);
+    return ret;
+}
+
+int contextprintf(BLContextPtr context, int loglevel, char const *fmt, ...) {
+    int ret;
+    va_list ap;
+
+    va_start(ap, fmt);
+    ret = contextvprintf(context, loglevel, fmt, ap);
+    va_end(ap);
+    return ret;
 }
@@ -29,26 +29,90 @@
  *
  */
 
+#if !defined(__APPLE__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE     // fallocate()
+#endif
+
 #include <CoreFoundation/CoreFoundation.h>
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/param.h>
 #include <sys/stat.h>
 #include <sys/fcntl.h>
 #include <unistd.h>
+#ifdef __APPLE__
+#include <sys/clonefile.h>
+#else
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
 
 #include "bless.h"
 #include "bless_private.h"
 
+#define kWriteChunkSize 0x100000
+
+static int preallocate(BLContextPtr context, int fdw, off_t length, const char *dest, int shouldPreallocate) {
+    int err;
+
+    if (shouldPreallocate == kNoPreallocate || length == 0) {
+		contextprintf(context, kBLLogLevelVerbose,  "No preallocation attempted for %s\n", dest );
+        return 0;
+    }
+
+#ifdef F_PREALLOCATE
+    fstore_t preall;
+
+    preall.fst_length = length;
+    preall.fst_offset = 0;
+    preall.fst_flags = F_ALLOCATECONTIG;
+    preall.fst_posmode = F_PEOFPOSMODE;
+    err = fcntl(fdw, F_PREALLOCATE, &preall) == -1 ? errno : 0;
+#else
+    // no way to ask for contiguous blocks here; reserve them at least
+    err = fallocate(fdw, 0, 0, length) == -1 ? errno : 0;
+#endif
+    if (err == ENOTSUP || err == EOPNOTSUPP) {
+		contextprintf(context, kBLLogLevelVerbose,  "preallocation not supported on this filesystem for %s\n", dest );
+    } else if (err) {
+		contextprintf(context, kBLLogLevelError,  "preallocation of %s failed\n", dest );
+        if (shouldPreallocate == kMustPreallocate) {
+            return 3;
+        }
+    } else {
+		contextprintf(context, kBLLogLevelVerbose,  "0x%08llX bytes preallocated for %s\n", (unsigned long long)length, dest );
+    }
+    return 0;
+}
+
+// write() as much as it takes, a chunk at a time
+static int writeData(BLContextPtr context, int fdw, const CFDataRef data, const char *dest) {
+    const UInt8 *bytes = data ? CFDataGetBytePtr(data) : NULL;
+    CFIndex length = data ? CFDataGetLength(data) : 0;
+    CFIndex done = 0;
+
+    while (done < length) {
+        ssize_t byteswritten = write(fdw, bytes + done, MIN(length - done, kWriteChunkSize));
+
+        if (byteswritten < 0 && errno == EINTR) continue;
+        if (byteswritten <= 0) {
+            contextprintf(context, kBLLogLevelError,  "Error while writing to %s: %s\n", dest,
+                          byteswritten < 0 ? strerror(errno) : "no progress" );
+            contextprintf(context, kBLLogLevelError,  "%ld bytes written\n", (long)done );
+            return 2;
+        }
+        done += byteswritten;
+    }
+    return 0;
+}
+
 int BLCopyFileFromCFData(BLContextPtr context, const CFDataRef data,
 						 const char * dest, int shouldPreallocate) {
 	
     int fdw;
-    CFDataRef theData = data;
-    ssize_t byteswritten;
-	
-    fstore_t preall;
     int err = 0;
 	
     fdw = open(dest, O_WRONLY|O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
@@ -59,39 +123,98 @@ int BLCopyFileFromCFData(BLContextPtr context, const CFDataRef data,
         contextprintf(context, kBLLogLevelVerbose,  "Opened dest at %s for writing\n", dest );
     }
 	
-    if (shouldPreallocate > kNoPreallocate) {
-		preall.fst_length = CFDataGetLength(theData);
-		preall.fst_offset = 0;
-		preall.fst_flags = F_ALLOCATECONTIG;
-		preall.fst_posmode = F_PEOFPOSMODE;
-		
-		err = fcntl(fdw, F_PREALLOCATE, &preall);
-		if (err == -1 && errno == ENOTSUP) {
-			contextprintf(context, kBLLogLevelVerbose,  "preallocation not supported on this filesystem for %s\n", dest );
-		} else if (err == -1) {
-			contextprintf(context, kBLLogLevelError,  "preallocation of %s failed\n", dest );
-            if (shouldPreallocate == kMustPreallocate) {
-                close(fdw);
-                return 3;
-            }
-		} else {
-			contextprintf(context, kBLLogLevelVerbose,  "0x%08X bytes preallocated for %s\n", (unsigned int)preall.fst_bytesalloc, dest );
-		}
+    err = preallocate(context, fdw, CFDataGetLength(data), dest, shouldPreallocate);
+    if (!err) err = writeData(context, fdw, data, dest);
+    close(fdw);
+	
+    return err;
+}
+
+int BLReplaceFileFromCFData(BLContextPtr context, const CFDataRef data, const char *dest,
+                            int shouldPreallocate) {
+    char tmpPath[MAXPATHLEN];
+    int fdw;
+    int err;
+
+    BLTemporaryPathFor(dest, tmpPath, sizeof tmpPath);
+    fdw = mkstemp(tmpPath);
+    if (fdw == -1) {
+        contextprintf(context, kBLLogLevelError,  "Error creating temporary file for %s: %s\n", dest, strerror(errno) );
+        return 2;
+    }
+    contextprintf(context, kBLLogLevelVerbose,  "Writing %s through %s\n", dest, tmpPath );
+
+    if (fchmod(fdw, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH) == -1) {
+        contextprintf(context, kBLLogLevelError,  "Can't set mode of %s: %s\n", tmpPath, strerror(errno) );
+        err = 2;
     } else {
-		contextprintf(context, kBLLogLevelVerbose,  "No preallocation attempted for %s\n", dest );
+        err = preallocate(context, fdw, data ? CFDataGetLength(data) : 0, dest, shouldPreallocate);
+        if (!err) err = writeData(context, fdw, data, dest);
     }
-	
-    byteswritten = write(fdw, (char *)CFDataGetBytePtr(theData), CFDataGetLength(theData));
-    if(byteswritten != CFDataGetLength(theData)) {
-		contextprintf(context, kBLLogLevelError,  "Error while writing to %s: %s\n", dest, strerror(errno) );
-		contextprintf(context, kBLLogLevelError,  "%ld bytes written\n", byteswritten );
-		close(fdw);
-		return 2;
+    if (err) {
+        close(fdw);
+        unlink(tmpPath);
+        return err;
+    }
+
+    err = BLCommitTemporaryFile(context, fdw, tmpPath, dest);
+    if (err) {
+        contextprintf(context, kBLLogLevelError,  "Can't replace %s: %s\n", dest, strerror(err) );
+        return 2;
     }
-    contextprintf(context, kBLLogLevelVerbose,  "\n" );
-	
-    close(fdw);
-	
     return 0;
 }
 
+int BLCloneFile(BLContextPtr context, const char *src, const char *dest) {
+    char tmpPath[MAXPATHLEN];
+    int fd;
+    int err;
+
+    BLTemporaryPathFor(dest, tmpPath, sizeof tmpPath);
+    fd = mkstemp(tmpPath);
+    if (fd == -1) {
+        contextprintf(context, kBLLogLevelError,  "Error creating temporary file for %s: %s\n", dest, strerror(errno) );
+        return 2;
+    }
+#ifdef __APPLE__
+    // clonefile() wants to create the file itself; reserve the name, then hand it over
+    close(fd);
+    unlink(tmpPath);
+    if (clonefile(src, tmpPath, CLONE_NOFOLLOW) == -1) {
+        err = errno;
+        contextprintf(context, kBLLogLevelVerbose,  "Can't clone %s to %s: %s\n", src, dest, strerror(err) );
+        return err;
+    }
+    fd = open(tmpPath, O_RDONLY);
+    if (fd == -1) {
+        err = errno;
+        unlink(tmpPath);
+        return err;
+    }
+#else
+    {
+        int srcfd = open(src, O_RDONLY);
+
+        err = 0;
+        if (srcfd == -1) {
+            err = errno;
+        } else {
+            if (ioctl(fd, FICLONE, srcfd) == -1 || fchmod(fd, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH) == -1) err = errno;
+            close(srcfd);
+        }
+        if (err) {
+            contextprintf(context, kBLLogLevelVerbose,  "Can't clone %s to %s: %s\n", src, dest, strerror(err) );
+            close(fd);
+            unlink(tmpPath);
+            return err;
+        }
+    }
+#endif
+    contextprintf(context, kBLLogLevelVerbose,  "Cloned %s to %s\n", src, dest );
+
+    err = BLCommitTemporaryFile(context, fd, tmpPath, dest);
+    if (err) {
+        contextprintf(context, kBLLogLevelError,  "Can't replace %s: %s\n", dest, strerror(err) );
+    }
+    return err;
+}
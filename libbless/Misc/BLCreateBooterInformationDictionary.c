@@ -31,6 +31,7 @@
 
 #include <stdlib.h>
 #include <unistd.h>
+#include <errno.h>
 #include <sys/stat.h>
 #include <sys/param.h>
 #include <sys/mount.h>
@@ -84,6 +85,86 @@ static int addAPFSPrebootInfo(BLContextPtr context, io_service_t containerMedia,
 
 
 bool isPreferredSystemPartition(BLContextPtr context, CFStringRef bsdName);
+bool isPreferredSystemPartitionService(BLContextPtr context, io_service_t service);
+
+static void logBooterInformation(BLContextPtr context, CFDictionaryRef booters)
+{
+    char desc[4096];
+
+    if (!contextprintfenabled(context, kBLLogLevelVerbose)) return;
+    contextprintf(context, kBLLogLevelVerbose, "Returning booter information dictionary:\n%s\n",
+                  BLCopyCStringDescription(booters, desc, sizeof desc));
+}
+
+static CFArrayRef createArrayFromTopologyList(struct BLTopologyModel *model, const BLTopologyList *list)
+{
+    CFMutableArrayRef   array;
+    uint32_t            i;
+
+    array = CFArrayCreateMutable(kCFAllocatorDefault, list->count, &kCFTypeArrayCallBacks);
+    if (!array) return NULL;
+    for (i = 0; i < list->count; i++) {
+        CFStringRef bsd = CFStringCreateWithCString(kCFAllocatorDefault,
+                                                    BLTopologyGetNode(model, list->nodes[i])->bsd,
+                                                    kCFStringEncodingUTF8);
+        if (!bsd) {
+            CFRelease(array);
+            return NULL;
+        }
+        CFArrayAppendValue(array, bsd);
+        CFRelease(bsd);
+    }
+    return array;
+}
+
+// The same dictionary, built from the context's disk topology
+static int createDictionaryFromTopology(BLContextPtr context, struct BLTopology *topology,
+                                        const char *bsdName, CFDictionaryRef *outDict)
+{
+    struct BLTopologyModel  *model;
+    BLTopologyBooterInfo    info;
+    CFMutableDictionaryRef  booters;
+    CFArrayRef              array;
+    const BLTopologyList    *lists[] = { &info.data, &info.auxiliary, &info.system, &info.preboot };
+    CFStringRef             keys[] = { kBLDataPartitionsKey, kBLAuxiliaryPartitionsKey,
+                                       kBLSystemPartitionsKey, kBLAPFSPrebootVolumesKey };
+    int                     i, ret;
+
+    ret = BLTopologyCopyModel(context, topology, &model);
+    if (ret) return ret;
+    ret = BLTopologyCopyBooterInfo(context, model, bsdName, &info);
+    if (ret) {
+        BLTopologyModelRelease(model);
+        return ret;
+    }
+
+    booters = CFDictionaryCreateMutable(kCFAllocatorDefault, 0,
+                                        &kCFTypeDictionaryKeyCallBacks,
+                                        &kCFTypeDictionaryValueCallBacks);
+    if (booters == NULL) {
+        BLTopologyBooterInfoFree(&info);
+        BLTopologyModelRelease(model);
+        return 1;
+    }
+    for (i = 0; i < (info.apfs ? 4 : 3); i++) {
+        array = createArrayFromTopologyList(model, lists[i]);
+        if (!array) {
+            CFRelease(booters);
+            BLTopologyBooterInfoFree(&info);
+            BLTopologyModelRelease(model);
+            return 1;
+        }
+        CFDictionaryAddValue(booters, keys[i], array);
+        CFRelease(array);
+    }
+    BLTopologyBooterInfoFree(&info);
+    BLTopologyModelRelease(model);
+
+    logBooterInformation(context, booters);
+
+    *outDict = booters;
+    return 0;
+}
 
 /*
  * For the given device, we return the set of Auxiliary Partitions and
@@ -96,7 +177,7 @@ bool isPreferredSystemPartition(BLContextPtr context, CFStringRef bsdName);
  * APs and SPs, for example a 4-member RAID mirror on GPT disks.
  */
 
-int BLCreateBooterInformationDictionary(BLContextPtr context, const char * bsdName,
+static int _BLCreateBooterInformationDictionary(BLContextPtr context, const char * bsdName,
                                         CFDictionaryRef *outDict)
 {
     CFMutableArrayRef dataPartitions = NULL;
@@ -114,7 +195,15 @@ int BLCreateBooterInformationDictionary(BLContextPtr context, const char * bsdNa
     int                     ret = 0;
     bool                    gotOne;
     io_registry_entry_t     containerMedia;
+    struct BLTopology       *topology = BLContextTopology(context);
     
+    if (topology) {
+        // Anything the model can't answer for (RAID sets, say) is looked up below
+        ret = createDictionaryFromTopology(context, topology, bsdName, outDict);
+        if (ret != ENOENT && ret != ENOTSUP) return ret;
+        ret = 0;
+    }
+
     dataPartitions = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
     if(dataPartitions == NULL)
         return 1;
@@ -407,14 +496,23 @@ gotinfo:
         CFRelease(apfsPrebootVolumes);
     }
     
-	contextprintf(context, kBLLogLevelVerbose, "Returning booter information dictionary:\n%s\n",
-				  BLGetCStringDescription(booters));
+    logBooterInformation(context, booters);
 	
     *outDict = booters;
     
     return 0;
 }
 
+int BLCreateBooterInformationDictionary(BLContextPtr context, const char * bsdName,
+                                        CFDictionaryRef *outDict)
+{
+    uint64_t span = BLTraceBegin(context);
+    int ret = _BLCreateBooterInformationDictionary(context, bsdName, outDict);
+
+    BLTraceEnd(context, span, "BLCreateBooterInformationDictionary", bsdName);
+    return ret;
+}
+
 static int addRAIDInfo(BLContextPtr context, CFDictionaryRef dict,
                        CFMutableArrayRef dataPartitions,
                        CFMutableArrayRef booterPartitions,
@@ -713,7 +811,7 @@ static int addDataPartitionSupportInfo(BLContextPtr context, io_service_t dataPa
 #define kIOPropertyPhysicalInterconnectTypePCIExpress	"PCI-Express"
 #endif
 
-static bool _isPreferredSystemPartition(BLContextPtr context, io_service_t service)
+bool isPreferredSystemPartitionService(BLContextPtr context, io_service_t service)
 {
     CFDictionaryRef         protocolCharacteristics;
     bool                    foundOne = false;
@@ -767,7 +865,7 @@ bool isPreferredSystemPartition(BLContextPtr context, CFStringRef bsdName)
         return false;
     }
         
-    ret = _isPreferredSystemPartition(context, service);
+    ret = isPreferredSystemPartitionService(context, service);
     
     IOObjectRelease(service);
     
@@ -790,6 +888,7 @@ static int addPreferredSystemPartitionInfo(BLContextPtr context,
     io_iterator_t           iter;
     io_service_t            service;
     CFStringRef             bsdName;
+    char                    desc[64];
     
     matching = IOServiceMatching(kIOMediaClass);
     CFDictionarySetValue(matching, CFSTR(kIOMediaContentKey), CFSTR("C12A7328-F81F-11D2-BA4B-00A0C93EC93B"));
@@ -801,10 +900,11 @@ static int addPreferredSystemPartitionInfo(BLContextPtr context,
     }
     
     while ((service = IOIteratorNext(iter)) != IO_OBJECT_NULL) {
-        if (_isPreferredSystemPartition(context, service)) {
+        if (isPreferredSystemPartitionService(context, service)) {
             bsdName = IORegistryEntryCreateCFProperty(service, CFSTR(kIOBSDNameKey), kCFAllocatorDefault, 0);
             if (bsdName && (CFGetTypeID(bsdName) == CFStringGetTypeID())) {
-                contextprintf(context, kBLLogLevelVerbose,  "Preferred system partition found: %s\n", BLGetCStringDescription(bsdName));
+                contextprintf(context, kBLLogLevelVerbose,  "Preferred system partition found: %s\n",
+                              BLCopyCStringDescription(bsdName, desc, sizeof desc));
                 if (CFArrayGetFirstIndexOfValue(systemPartitions, CFRangeMake(0, CFArrayGetCount(systemPartitions)), bsdName) == kCFNotFound) {
                     // this is a new preferred ESP. If there isn't already a preferred one in the array,
                     // put this one at the front.  Otherwise put it second.
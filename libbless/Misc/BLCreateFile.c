@@ -44,17 +44,19 @@
 
 #include "bless.h"
 #include "bless_private.h"
-#include "bless_private.h"
 
 
-int BLCreateFileWithOptions(BLContextPtr context, const CFDataRef data,
+static int _BLCreateFileWithOptions(BLContextPtr context, const CFDataRef data,
                             const char * file, int setImmutable,
-                            uint32_t type, uint32_t creator, int shouldPreallocate)
+                            uint32_t type, uint32_t creator, int shouldPreallocate,
+                            uint64_t *bytesWritten)
 {
     int err;
-    int mainfd;
     struct stat sb;
     const char *rsrcpath = file;
+    bool updated = false;
+    
+    *bytesWritten = 0;
     
     err = lstat(rsrcpath, &sb);
     if(err == 0) {
@@ -79,15 +81,23 @@ int BLCreateFileWithOptions(BLContextPtr context, const CFDataRef data,
             
         }
         
-        
-        contextprintf(context, kBLLogLevelVerbose, "Deleting old %s\n",
-                      rsrcpath);
-        err = unlink(rsrcpath);
-        if(err) {
-            contextprintf(context, kBLLogLevelError,
-                          "Can't delete %s: %s\n", rsrcpath,
-                          strerror(errno));
-            return 1;
+        // Unless the new file has to be laid out contiguously, write only
+        // the blocks that changed, into a clone of the old file where possible
+        if(data != NULL && shouldPreallocate != kMustPreallocate) {
+            BLDeltaUpdateStats delta;
+            
+            err = BLDeltaUpdateFileFromBytes(context, CFDataGetBytePtr(data), CFDataGetLength(data),
+                                             rsrcpath, 0, &delta);
+            if(err) {
+                contextprintf(context, kBLLogLevelError,
+                              "Can't update %s: %s\n", rsrcpath, strerror(err));
+                return 3;
+            }
+            contextprintf(context, kBLLogLevelVerbose, "Updated %s, %llu of %llu blocks changed\n",
+                          rsrcpath, (unsigned long long)delta.changedBlocks,
+                          (unsigned long long)delta.blocks);
+            *bytesWritten = delta.bytesWritten;
+            updated = true;
         }
         
     } else if(errno != ENOENT) {
@@ -98,16 +108,11 @@ int BLCreateFileWithOptions(BLContextPtr context, const CFDataRef data,
         // ENOENT is OK, we'll create the file now
     }
     
-    mainfd = open(rsrcpath, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
-    if(mainfd < 0) {
-        contextprintf(context, kBLLogLevelError,  "Could not touch %s\n", rsrcpath );
-        return 2;
-    }
-    close(mainfd);
-    
-    if(data != NULL) {
-        err = BLCopyFileFromCFData(context, data, rsrcpath, shouldPreallocate);
-        if(err) return 3;
+    if(!updated) {
+        // The old file, if any, stays put until the new one is complete
+        err = BLReplaceFileFromCFData(context, data, rsrcpath, shouldPreallocate);
+        if(err) return err;
+        if(data != NULL) *bytesWritten = CFDataGetLength(data);
     }
     
     if (type || creator) {
@@ -147,6 +152,20 @@ int BLCreateFileWithOptions(BLContextPtr context, const CFDataRef data,
     return 0;
 }
 
+int BLCreateFileWithOptions(BLContextPtr context, const CFDataRef data,
+                            const char * file, int setImmutable,
+                            uint32_t type, uint32_t creator, int shouldPreallocate)
+{
+    uint64_t span = BLTraceBegin(context);
+    uint64_t bytesWritten;
+    int err = _BLCreateFileWithOptions(context, data, file, setImmutable, type, creator, shouldPreallocate,
+                                       &bytesWritten);
+
+    if (!err) BLTimingAddBytesWritten(context, bytesWritten);
+    BLTraceEnd(context, span, "BLCreateFileWithOptions", file);
+    return err;
+}
+
 
 
 int BLCreateFile(BLContextPtr context, const CFDataRef data,
@@ -0,0 +1,414 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ *  BLDeltaUpdateFile.c
+ *  bless
+ *
+ *  Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#ifdef __APPLE__
+#include <sys/clonefile.h>
+#else
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+#include "bless.h"
+#include "bless_private.h"
+
+#define kDeltaChunkSize     0x100000    // 1 MiB, a multiple of the block size
+
+// Either an in-memory image of the new file or an open file
+typedef struct {
+	const uint8_t * bytes;
+	int             fd;
+	uint64_t        length;
+} deltaSource;
+
+typedef struct {
+	uint64_t    offset;
+	uint64_t    length;
+} deltaExtent;
+
+typedef struct {
+	deltaExtent *   extents;
+	uint32_t        count;
+	uint32_t        capacity;
+} deltaExtentList;
+
+//
+// Read exactly len bytes at offset, short only at end of file
+//
+static ssize_t preadFully(int fd, uint8_t *buffer, size_t len, uint64_t offset)
+{
+	size_t done = 0;
+
+	while (done < len) {
+		ssize_t n = pread(fd, buffer + done, len - done, (off_t)(offset + done));
+
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		if (n == 0) break;
+		done += (size_t)n;
+	}
+	return (ssize_t)done;
+}
+
+static int pwriteFully(int fd, const uint8_t *buffer, size_t len, uint64_t offset)
+{
+	while (len > 0) {
+		ssize_t n = pwrite(fd, buffer, len, (off_t)offset);
+
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return errno;
+		}
+		buffer += n;
+		offset += (uint64_t)n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+
+//
+// Bytes of the source at offset: a pointer into the image, or into buffer
+// after reading them from the file
+//
+static const uint8_t *sourceBytes(const deltaSource *src, uint64_t offset, size_t len, uint8_t *buffer,
+								  BLDeltaUpdateStats *stats)
+{
+	if (src->bytes) return src->bytes + offset;
+	if (preadFully(src->fd, buffer, len, offset) != (ssize_t)len) {
+		if (errno == 0) errno = EIO;
+		return NULL;
+	}
+	stats->bytesRead += len;
+	return buffer;
+}
+
+static int addExtent(deltaExtentList *list, uint64_t offset, uint64_t length)
+{
+	deltaExtent *last = list->count ? &list->extents[list->count - 1] : NULL;
+
+	if (last && last->offset + last->length == offset) {
+		last->length += length;
+		return 0;
+	}
+	if (list->count == list->capacity) {
+		uint32_t        capacity = list->capacity ? list->capacity * 2 : 64;
+		deltaExtent *   extents = realloc(list->extents, capacity * sizeof(*extents));
+
+		if (!extents) return ENOMEM;
+		list->extents = extents;
+		list->capacity = capacity;
+	}
+	list->extents[list->count].offset = offset;
+	list->extents[list->count].length = length;
+	list->count++;
+	return 0;
+}
+
+//
+// Compare the source with what's in the destination, block by block, and
+// list the source ranges that have to be written. Blocks past the end of
+// the destination are always written; anything past the end of the source
+// is left to the truncate.
+//
+static int diffBlocks(const deltaSource *src, int dstfd, uint64_t dstLength, uint8_t *srcBuffer,
+					  uint8_t *dstBuffer, deltaExtentList *list, BLDeltaUpdateStats *stats)
+{
+	uint64_t offset;
+	int      ret;
+
+	for (offset = 0; offset < src->length; offset += kDeltaChunkSize) {
+		size_t          len = (size_t)MIN((uint64_t)kDeltaChunkSize, src->length - offset);
+		size_t          have = 0;
+		const uint8_t * s = sourceBytes(src, offset, len, srcBuffer, stats);
+		size_t          i;
+
+		if (!s) return errno;
+		if (offset < dstLength) {
+			ssize_t n = preadFully(dstfd, dstBuffer, (size_t)MIN((uint64_t)len, dstLength - offset), offset);
+
+			if (n < 0) return errno;
+			have = (size_t)n;
+			stats->bytesRead += have;
+		}
+
+		for (i = 0; i < len; i += kBLDeltaBlockSize) {
+			size_t blockLen = MIN((size_t)kBLDeltaBlockSize, len - i);
+
+			stats->blocks++;
+			if (i + blockLen <= have && memcmp(s + i, dstBuffer + i, blockLen) == 0) continue;
+			stats->changedBlocks++;
+			ret = addExtent(list, offset + i, blockLen);
+			if (ret) return ret;
+		}
+	}
+	return 0;
+}
+
+static int writeExtents(const deltaSource *src, int fd, const deltaExtentList *list, uint8_t *buffer,
+						BLDeltaUpdateStats *stats)
+{
+	uint32_t i;
+
+	for (i = 0; i < list->count; i++) {
+		uint64_t offset = list->extents[i].offset;
+		uint64_t end = offset + list->extents[i].length;
+
+		while (offset < end) {
+			size_t          len = (size_t)MIN((uint64_t)kDeltaChunkSize, end - offset);
+			const uint8_t * s = sourceBytes(src, offset, len, buffer, stats);
+			int             ret;
+
+			if (!s) return errno;
+			ret = pwriteFully(fd, s, len, offset);
+			if (ret) return ret;
+			stats->bytesWritten += len;
+			offset += len;
+		}
+	}
+	return 0;
+}
+
+//
+// Open a copy-on-write clone of the destination under a temporary name.
+// Returns -1 if the file system can't clone.
+//
+static int openClone(const char *dest, int dstfd, char *tmpPath, size_t size)
+{
+	int fd;
+
+	BLTemporaryPathFor(dest, tmpPath, size);
+#ifdef __APPLE__
+	// clonefile() wants to create the file itself; reserve the name, then hand it over
+	fd = mkstemp(tmpPath);
+	if (fd < 0) return -1;
+	close(fd);
+	unlink(tmpPath);
+	if (clonefile(dest, tmpPath, CLONE_NOFOLLOW) < 0) return -1;
+	fd = open(tmpPath, O_RDWR);
+	if (fd < 0) unlink(tmpPath);
+	return fd;
+#else
+	fd = mkstemp(tmpPath);
+	if (fd < 0) return -1;
+	if (ioctl(fd, FICLONE, dstfd) < 0) {
+		close(fd);
+		unlink(tmpPath);
+		return -1;
+	}
+	return fd;
+#endif
+}
+
+static int finishTemp(BLContextPtr context, int fd, const char *tmpPath, const char *dest, mode_t mode,
+					  uint64_t length)
+{
+	if (ftruncate(fd, (off_t)length) < 0 || fchmod(fd, mode) < 0) {
+		int ret = errno;
+
+		close(fd);
+		unlink(tmpPath);
+		return ret;
+	}
+	return BLCommitTemporaryFile(context, fd, tmpPath, dest);
+}
+
+static int deltaUpdate(BLContextPtr context, const deltaSource *src, const char *dest,
+					   uint32_t inPlacePercent, BLDeltaUpdateStats *stats)
+{
+	deltaExtentList list = { NULL, 0, 0 };
+	uint8_t *       srcBuffer = NULL;
+	uint8_t *       dstBuffer = NULL;
+	char            tmpPath[MAXPATHLEN];
+	struct stat     sb;
+	mode_t          mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+	int             dstfd = -1;
+	int             fd = -1;
+	int             ret = 0;
+
+	bzero(stats, sizeof(*stats));
+	stats->blockSize = kBLDeltaBlockSize;
+
+	srcBuffer = malloc(kDeltaChunkSize);
+	dstBuffer = malloc(kDeltaChunkSize);
+	if (!srcBuffer || !dstBuffer) {
+		ret = ENOMEM;
+		goto exit;
+	}
+
+	dstfd = open(dest, O_RDONLY);
+	if (dstfd < 0 && errno != ENOENT) {
+		ret = errno;
+		goto exit;
+	}
+	if (dstfd >= 0) {
+		if (fstat(dstfd, &sb) < 0) {
+			ret = errno;
+			goto exit;
+		}
+		if (!S_ISREG(sb.st_mode)) {
+			ret = EINVAL;
+			goto exit;
+		}
+		mode = sb.st_mode & 07777;
+
+		ret = diffBlocks(src, dstfd, (uint64_t)sb.st_size, srcBuffer, dstBuffer, &list, stats);
+		if (ret) goto exit;
+
+		if (list.count == 0 && (uint64_t)sb.st_size == src->length) {
+			stats->method = kBLDeltaUnchanged;
+			contextprintf(context, kBLLogLevelVerbose, "%s unchanged\n", dest);
+			goto exit;
+		}
+
+		// Patch a clone and swap it in: only changed blocks are written, and a crash
+		// leaves either the old file or the new one
+		fd = openClone(dest, dstfd, tmpPath, sizeof tmpPath);
+		if (fd >= 0) {
+			ret = writeExtents(src, fd, &list, srcBuffer, stats);
+			if (ret) {
+				close(fd);
+				unlink(tmpPath);
+				goto exit;
+			}
+			ret = finishTemp(context, fd, tmpPath, dest, mode, src->length);
+			fd = -1;
+			if (ret) goto exit;
+			stats->method = kBLDeltaPatchedClone;
+			contextprintf(context, kBLLogLevelVerbose, "Patched %llu of %llu blocks of %s in a clone\n",
+						  (unsigned long long)stats->changedBlocks, (unsigned long long)stats->blocks, dest);
+			goto exit;
+		}
+
+		// No clones. A small patch goes straight into the file; a big one gets a fresh copy
+		if (inPlacePercent > 0 &&
+			(stats->blocks == 0 || stats->changedBlocks * 100 <= (uint64_t)inPlacePercent * stats->blocks)) {
+			fd = open(dest, O_WRONLY);
+			if (fd < 0) {
+				ret = errno;
+				goto exit;
+			}
+			ret = writeExtents(src, fd, &list, srcBuffer, stats);
+			if (!ret && (uint64_t)sb.st_size != src->length && ftruncate(fd, (off_t)src->length) < 0) {
+				ret = errno;
+			}
+			if (ret) {
+				close(fd);
+			} else {
+				// Not done until it's on disk; callers record the file as synced
+				ret = BLCommitFileInPlace(context, fd, dest);
+			}
+			fd = -1;
+			if (ret) goto exit;
+			stats->method = kBLDeltaPatchedInPlace;
+			contextprintf(context, kBLLogLevelVerbose, "Patched %llu of %llu blocks of %s in place\n",
+						  (unsigned long long)stats->changedBlocks, (unsigned long long)stats->blocks, dest);
+			goto exit;
+		}
+		contextprintf(context, kBLLogLevelVerbose, "%llu of %llu blocks of %s changed; rewriting it\n",
+					  (unsigned long long)stats->changedBlocks, (unsigned long long)stats->blocks, dest);
+	}
+
+	// Write the whole file under a temporary name and rename it into place
+	list.count = 0;
+	ret = addExtent(&list, 0, src->length);
+	if (ret) goto exit;
+	BLTemporaryPathFor(dest, tmpPath, sizeof tmpPath);
+	fd = mkstemp(tmpPath);
+	if (fd < 0) {
+		ret = errno;
+		goto exit;
+	}
+	ret = writeExtents(src, fd, &list, srcBuffer, stats);
+	if (ret) {
+		close(fd);
+		unlink(tmpPath);
+		goto exit;
+	}
+	ret = finishTemp(context, fd, tmpPath, dest, mode, src->length);
+	fd = -1;
+	if (ret) goto exit;
+	stats->method = kBLDeltaFullCopy;
+
+exit:
+	if (dstfd >= 0) close(dstfd);
+	free(list.extents);
+	free(srcBuffer);
+	free(dstBuffer);
+	return ret;
+}
+
+int BLDeltaUpdateFileFromBytes(BLContextPtr context, const void *bytes, uint64_t length, const char *dest,
+							   uint32_t inPlacePercent, BLDeltaUpdateStats *stats)
+{
+	deltaSource src = { bytes, -1, length };
+	uint64_t    span = BLTraceBegin(context);
+	int         ret = deltaUpdate(context, &src, dest, inPlacePercent, stats);
+
+	BLTraceEnd(context, span, "BLDeltaUpdateFile", dest);
+	return ret;
+}
+
+int BLDeltaUpdateFileFromFile(BLContextPtr context, const char *source, const char *dest,
+							  uint32_t inPlacePercent, BLDeltaUpdateStats *stats)
+{
+	deltaSource src = { NULL, -1, 0 };
+	struct stat sb;
+	uint64_t    span = BLTraceBegin(context);
+	int         ret;
+
+	src.fd = open(source, O_RDONLY);
+	if (src.fd < 0) {
+		bzero(stats, sizeof(*stats));
+		ret = errno;
+		goto exit;
+	}
+	if (fstat(src.fd, &sb) < 0) {
+		bzero(stats, sizeof(*stats));
+		ret = errno;
+		goto exit;
+	}
+	src.length = (uint64_t)sb.st_size;
+	ret = deltaUpdate(context, &src, dest, inPlacePercent, stats);
+
+exit:
+	if (src.fd >= 0) close(src.fd);
+	BLTraceEnd(context, span, "BLDeltaUpdateFile", dest);
+	return ret;
+}
@@ -0,0 +1,370 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ *  BLDiskDescriptions.c
+ *  bless
+ *
+ *  Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "bless.h"
+#include "bless_private.h"
+
+#if USE_DISKARBITRATION
+#include <dispatch/dispatch.h>
+#include <DiskArbitration/DiskArbitration.h>
+#endif
+
+struct BLDiskDescriptions {
+	pthread_mutex_t				lock;
+	CFMutableDictionaryRef		descriptions;	// BSD name -> description
+	BLDiskDescriptionOps		ops;			// no copyDescription: DiskArbitration
+	void *						refcon;
+	char *						path;			// a plist standing in for DiskArbitration, or NULL
+	CFDictionaryRef				file;
+#if USE_DISKARBITRATION
+	DASessionRef				session;
+	dispatch_queue_t			queue;
+#endif
+	uint32_t					sessions;
+	uint32_t					lookups;
+	uint32_t					hits;
+	uint32_t					invalidations;
+};
+
+struct BLDiskDescriptions *BLDiskDescriptionsCreateWithOps(const BLDiskDescriptionOps *ops, void *refcon)
+{
+	struct BLDiskDescriptions *cache = calloc(1, sizeof(*cache));
+
+	if (!cache) return NULL;
+	cache->descriptions = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks,
+													&kCFTypeDictionaryValueCallBacks);
+	if (!cache->descriptions) {
+		free(cache);
+		return NULL;
+	}
+	pthread_mutex_init(&cache->lock, NULL);
+	if (ops) cache->ops = *ops;
+	cache->refcon = refcon;
+	return cache;
+}
+
+struct BLDiskDescriptions *BLDiskDescriptionsCreate(void)
+{
+	return BLDiskDescriptionsCreateWithOps(NULL, NULL);
+}
+
+static int loadFile(BLContextPtr context, struct BLDiskDescriptions *cache);
+
+int BLDiskDescriptionsCreateWithFile(BLContextPtr context, const char *path, struct BLDiskDescriptions **outCache)
+{
+	struct BLDiskDescriptions *	cache;
+	int							ret;
+
+	*outCache = NULL;
+	cache = BLDiskDescriptionsCreateWithOps(NULL, NULL);
+	if (!cache) return ENOMEM;
+	cache->path = strdup(path);
+	ret = cache->path ? 0 : ENOMEM;
+	if (!ret) ret = loadFile(context, cache);
+	if (ret) {
+		BLDiskDescriptionsRelease(cache);
+		return ret;
+	}
+	*outCache = cache;
+	return 0;
+}
+
+#if USE_DISKARBITRATION
+static void drained(void *unused)
+{
+}
+#endif
+
+void BLDiskDescriptionsRelease(struct BLDiskDescriptions *cache)
+{
+	if (!cache) return;
+#if USE_DISKARBITRATION
+	if (cache->session) {
+		DASessionSetDispatchQueue(cache->session, NULL);
+		CFRelease(cache->session);
+	}
+	if (cache->queue) {
+		// Let a callback already under way finish before the cache goes
+		dispatch_sync_f(cache->queue, NULL, drained);
+		dispatch_release(cache->queue);
+	}
+#endif
+	CFRelease(cache->descriptions);
+	if (cache->file) CFRelease(cache->file);
+	free(cache->path);
+	pthread_mutex_destroy(&cache->lock);
+	free(cache);
+}
+
+void BLDiskDescriptionsInvalidate(struct BLDiskDescriptions *cache, const char *bsdName)
+{
+	CFStringRef name;
+
+	if (!cache) return;
+	pthread_mutex_lock(&cache->lock);
+	if (bsdName) {
+		name = CFStringCreateWithCString(kCFAllocatorDefault, bsdName, kCFStringEncodingUTF8);
+		if (name) {
+			CFDictionaryRemoveValue(cache->descriptions, name);
+			CFRelease(name);
+		}
+	} else {
+		CFDictionaryRemoveAllValues(cache->descriptions);
+		// A stand-in file is read again too, in case it was rewritten
+		if (cache->file) {
+			CFRelease(cache->file);
+			cache->file = NULL;
+		}
+	}
+	cache->invalidations++;
+	pthread_mutex_unlock(&cache->lock);
+}
+
+// Only caches DiskArbitration doesn't keep current hold stand-ins
+void BLDiskDescriptionsInvalidateStandIns(struct BLDiskDescriptions *cache)
+{
+	if (!cache || (!cache->ops.copyDescription && !cache->path)) return;
+	BLDiskDescriptionsInvalidate(cache, NULL);
+}
+
+void BLDiskDescriptionsGetStatistics(struct BLDiskDescriptions *cache, uint32_t *sessions, uint32_t *lookups,
+									 uint32_t *hits, uint32_t *invalidations)
+{
+	pthread_mutex_lock(&cache->lock);
+	if (sessions) *sessions = cache->sessions;
+	if (lookups) *lookups = cache->lookups;
+	if (hits) *hits = cache->hits;
+	if (invalidations) *invalidations = cache->invalidations;
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/*
+ * DiskArbitration hands back UUIDs as CFUUIDs, which a plist can't hold,
+ * so the stand-in file spells them as strings under keys ending in "UUID"
+ */
+static CFDictionaryRef copyWithUUIDs(CFDictionaryRef description)
+{
+	CFMutableDictionaryRef	copy;
+	CFIndex					i, count = CFDictionaryGetCount(description);
+	const void **			keys;
+	const void **			values;
+
+	copy = CFDictionaryCreateMutableCopy(kCFAllocatorDefault, 0, description);
+	if (!copy || count == 0) return copy;
+
+	keys = calloc(count, sizeof(*keys));
+	values = calloc(count, sizeof(*values));
+	if (keys && values) {
+		CFDictionaryGetKeysAndValues(description, keys, values);
+		for (i = 0; i < count; i++) {
+			CFUUIDRef uuid;
+
+			if (CFGetTypeID(keys[i]) != CFStringGetTypeID() || CFGetTypeID(values[i]) != CFStringGetTypeID()) continue;
+			if (!CFStringHasSuffix(keys[i], CFSTR("UUID"))) continue;
+			uuid = CFUUIDCreateFromString(kCFAllocatorDefault, values[i]);
+			if (uuid) {
+				CFDictionarySetValue(copy, keys[i], uuid);
+				CFRelease(uuid);
+			}
+		}
+	}
+	free(keys);
+	free(values);
+	return copy;
+}
+
+static int loadFile(BLContextPtr context, struct BLDiskDescriptions *cache)
+{
+	CFDataRef	data = NULL;
+	CFTypeRef	plist;
+	int			ret;
+
+	ret = BLLoadFile(context, cache->path, 0, &data);
+	if (ret) return ret;
+	plist = CFPropertyListCreateWithData(kCFAllocatorDefault, data, kCFPropertyListImmutable, NULL, NULL);
+	CFRelease(data);
+	if (!plist || CFGetTypeID(plist) != CFDictionaryGetTypeID()) {
+		if (plist) CFRelease(plist);
+		contextprintf(context, kBLLogLevelError, "%s is not a dictionary of disk descriptions\n", cache->path);
+		return EINVAL;
+	}
+	cache->file = plist;
+	return 0;
+}
+
+static int copyFromFile(BLContextPtr context, struct BLDiskDescriptions *cache, CFStringRef name,
+						CFDictionaryRef *description)
+{
+	CFDictionaryRef	entry;
+	int				ret;
+
+	if (!cache->file) {
+		ret = loadFile(context, cache);
+		if (ret) return ret;
+	}
+	entry = CFDictionaryGetValue(cache->file, name);
+	if (!entry || CFGetTypeID(entry) != CFDictionaryGetTypeID()) return ENOENT;
+	*description = copyWithUUIDs(entry);
+	return *description ? 0 : ENOMEM;
+}
+
+#if USE_DISKARBITRATION
+
+static int copyFromSession(BLContextPtr context, DASessionRef session, const char *bsdName,
+						   CFDictionaryRef *description)
+{
+	DADiskRef disk;
+
+	disk = DADiskCreateFromBSDName(kCFAllocatorDefault, session, bsdName);
+	if (!disk) {
+		contextprintf(context, kBLLogLevelVerbose, "Can't create DADisk for %s\n", bsdName);
+		return ENOENT;
+	}
+	*description = DADiskCopyDescription(disk);
+	CFRelease(disk);
+	if (!*description) {
+		contextprintf(context, kBLLogLevelVerbose, "Can't get properties for %s\n", bsdName);
+		return ENOENT;
+	}
+	return 0;
+}
+
+// A disk changed or went away: forget what we know about it
+static void diskChanged(DADiskRef disk, void *refcon)
+{
+	struct BLDiskDescriptions *	cache = refcon;
+	const char *				bsdName = DADiskGetBSDName(disk);
+
+	if (bsdName) BLDiskDescriptionsInvalidate(cache, bsdName);
+}
+
+static void diskDescriptionChanged(DADiskRef disk, CFArrayRef keys, void *refcon)
+{
+	diskChanged(disk, refcon);
+}
+
+/*
+ * One session for the cache's lifetime, opened the first time it's
+ * needed. It runs on its own queue so DiskArbitration can tell us when
+ * a disk we've described changes or disappears.
+ */
+static DASessionRef cacheSession(BLContextPtr context, struct BLDiskDescriptions *cache)
+{
+	if (cache->session) return cache->session;
+
+	cache->session = DASessionCreate(kCFAllocatorDefault);
+	if (!cache->session) {
+		contextprintf(context, kBLLogLevelVerbose, "Can't connect to DiskArb\n");
+		return NULL;
+	}
+	cache->sessions++;
+	cache->queue = dispatch_queue_create("com.apple.bless.diskdescriptions", NULL);
+	if (cache->queue) {
+		DARegisterDiskDescriptionChangedCallback(cache->session, NULL, NULL, diskDescriptionChanged, cache);
+		DARegisterDiskDisappearedCallback(cache->session, NULL, diskChanged, cache);
+		DASessionSetDispatchQueue(cache->session, cache->queue);
+	}
+	return cache->session;
+}
+
+#endif // USE_DISKARBITRATION
+
+int BLCopyDiskDescription(BLContextPtr context, const char *bsdName, CFDictionaryRef *description)
+{
+	struct BLDiskDescriptions *	cache = BLContextDiskDescriptions(context);
+	CFDictionaryRef				cached;
+	CFStringRef					name = NULL;
+	uint64_t					span = BLTraceBegin(context);
+	int							ret;
+
+	*description = NULL;
+	if (strncmp(bsdName, "/dev/", 5) == 0) bsdName += 5;
+
+	if (!cache) {
+#if USE_DISKARBITRATION
+		DASessionRef session = DASessionCreate(kCFAllocatorDefault);
+
+		if (!session) {
+			contextprintf(context, kBLLogLevelVerbose, "Can't connect to DiskArb\n");
+			ret = ENOTSUP;
+		} else {
+			ret = copyFromSession(context, session, bsdName, description);
+			CFRelease(session);
+		}
+#else
+		ret = ENOTSUP;
+#endif
+		goto exit;
+	}
+
+	name = CFStringCreateWithCString(kCFAllocatorDefault, bsdName, kCFStringEncodingUTF8);
+	if (!name) {
+		ret = ENOMEM;
+		goto exit;
+	}
+
+	pthread_mutex_lock(&cache->lock);
+	cache->lookups++;
+	cached = CFDictionaryGetValue(cache->descriptions, name);
+	if (cached) {
+		cache->hits++;
+		*description = CFRetain(cached);
+		ret = 0;
+	} else {
+		if (cache->ops.copyDescription) {
+			ret = cache->ops.copyDescription(context, cache->refcon, bsdName, description);
+		} else if (cache->path) {
+			ret = copyFromFile(context, cache, name, description);
+		} else {
+#if USE_DISKARBITRATION
+			DASessionRef session = cacheSession(context, cache);
+
+			ret = session ? copyFromSession(context, session, bsdName, description) : ENOTSUP;
+#else
+			ret = ENOTSUP;
+#endif
+		}
+		// Disks that can't be described aren't remembered; they may yet appear
+		if (ret == 0 && *description) CFDictionarySetValue(cache->descriptions, name, *description);
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+exit:
+	if (name) CFRelease(name);
+	BLTraceEnd(context, span, "CopyDiskDescription", bsdName);
+	return ret;
+}
@@ -0,0 +1,629 @@
+/*
+ * Copyright (c) 2013-2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ *  BLElToritoCatalog.c
+ *  bless
+ *
+ *  Copyright (c) 2013-2020 Apple Inc. All Rights Reserved.
+ *
+ */
+
+#include <CoreFoundation/CoreFoundation.h>
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/fcntl.h>
+#include <sys/mman.h>
+
+#include "bless.h"
+#include "bless_private.h"
+
+
+
+#define kElToritoSectorSize         2048
+#define kElToritoEntrySize          32
+#define kElToritoEntriesPerSector   (kElToritoSectorSize / kElToritoEntrySize)
+#define kElToritoPVDSector          16
+
+// Upper bound on how far we will follow a boot catalog. 64 sectors is 4096 entries,
+// far more than any hybrid image we have seen, but it keeps a corrupt catalog from
+// making us walk the whole disc.
+#define kElToritoMaxCatalogSectors  64
+
+
+// ISO 9660 CD "Primary Volume Descriptor" found at 2048-Sector #16:
+//
+typedef struct
+{
+	UInt8	volume_descriptor_type;                 //  type
+	char	ident[5];                               //	characters 'CD001'
+	UInt8	volume_descriptor_version;
+	UInt8	unused1;
+	char	system_id [32];
+	char	volume_id [32];
+	UInt8	unused2 [8];
+	UInt32	volume_space_size_LE;                   //	provided in both endians
+	UInt32	volume_space_size_BE;
+	UInt8	other [1960];                           //	2048 bytes total
+
+} __attribute__((packed)) ISO9660_PRIMARY_VOLUME_DESCRIPTOR;
+
+// "El Torito" optical disc identification standard "Boot Record Volume Descriptor" found at 2048-Sector #17:
+//
+typedef struct
+{
+	UInt8	type;
+	char    ident [5];
+	UInt8   version;
+	char    system_id [32];
+	char    unused1 [32];
+	UInt32  bootcat_ptr;
+} __attribute__((packed)) EL_TORITO_BOOT_VOLUME_DESCRIPTOR;
+
+typedef struct                                      //	32 Byte El Torito Validation Entry
+{
+	UInt8	id;                                     //	Header ID				= 1
+	UInt8	arch;                                   //	Platform Architecture	= x86, ppc
+	unsigned : 16;                                  //	Reserved				= 0
+	char	creator_id [24];                        //	Creator Identity
+	UInt16	checksum;                               //	Word sum				= 0
+	UInt8	key55;                                  //	Key, must be 0x55
+	UInt8	keyAA;                                  //	Key, must be 0xaa
+} __attribute__((packed)) EL_TORITO_VALIDATION_ENTRY;
+
+typedef struct                                      //	32 Byte Section + Initial/Default Entry
+{
+	UInt8	boot_indicator;                         //	Boot Indicator 			= 0x00 | 0x88
+	UInt8	boot_media;                             //	Boot Emulation mode
+	UInt16	load_segment;                           //	Load address			= 0x0000
+	UInt8	system_type;                            //	MBR/PBR System Type		= E.G. 0xAF for Darwin_HFS
+	UInt8	: 8;                                    //	Reserved				= 0x00
+	UInt16	blockcount;                             //	Load size
+	UInt32	lba;                                    //	Virtual Disk Address
+                                                    //	Extra Section entries…
+	UInt8	: 8;                                    //	Reserved				= 0x00
+} __attribute__((packed)) EL_TORITO_INITIAL_DEFAULT_ENTRY;
+
+typedef struct
+{
+	UInt8	header_indicator;                       //	Header Indicator = 0x90 (more headers follow), 0x91 (this is last)
+	UInt8	platform_id;                            //	Platform ID	0=80x86; 1=PowerPC; 2=Mac; 0xEF=EFI
+	UInt16	sections_count;                         //	Number of sections following this section header
+	char	section_id [28];                        //	ID string; should be checkd by bios and boot software.
+} __attribute__((packed)) EL_TORITO_SECTION_HEADER_ENTRY;
+
+typedef struct
+{
+	UInt8	boot_indicator;                         //	0x88=bootable; 0x00=not bootable
+	UInt8	boot_media;                             //	b0:b3=0..f,4=hard drive; b4=0; b5=continuation entry follows; b6=ATAPI driver incl; b7=SCSI drvr
+	UInt16	load_segment;                           //	Load segment for the initial boot image
+	UInt8	system_type;                            //	Must be a copy of byte 5 from the Partition Table found in the boot image
+	UInt8	unused1;                                //	Must be 0
+	UInt16	sector_count;                           //	Number of emulated sectors the system wil store at Load Segment during boot
+	UInt32	load_rba;                               //	Start address of the virtual disk
+	UInt8	selection_criteria_type;                //	What info follows in next field: 0=none, 1=Language&Version, 2..255=reserved
+	UInt8	selection_criteria [19];                //	Vendor unique selection criteria
+} __attribute__((packed)) EL_TORITO_SECTION_SECTION_ENTRY;
+
+typedef struct
+{
+	UInt8	extension_indicator;                    //	Must be 0x44
+	UInt8	bits;                                   //	b5=ExtensionRecordFollows; other bits unused
+	UInt8	other[30];                              //	Vendor uqniue extra bytes
+} __attribute__((packed)) EL_TORITO_SECTION_EXTENSION_ENTRY;
+
+
+//
+// A window of whole 2048-byte sectors of the disc. For regular files (disc images) the
+// window is an mmap of the file and the sectors are never copied. Raw devices can't be
+// mapped, so for those we fall back to pread()ing into a buffer that grows a sector at
+// a time as the parser asks for more.
+//
+typedef struct {
+	int                 fd;
+	bool                mapped;
+	void *              base;                   // mmap base, or malloc'd buffer
+	size_t              baseLength;
+	const uint8_t *     bytes;                  // first byte of firstSector
+	uint32_t            firstSector;
+	uint32_t            sectorCount;            // sectors currently available at bytes
+	uint32_t            maxSectors;
+} SectorWindow;
+
+struct BLElToritoCatalog {
+	uint32_t            volumeSpaceSize;        // in 2048-blocks
+	uint32_t            catalogSector;
+	uint32_t            catalogSectors;         // number of 2048-sectors the catalog actually spans
+	uint32_t            entryCount;
+	uint32_t            uefiEntry;              // index of first bootable EFI section, or kBLElToritoNoEntry
+	BLElToritoEntry *   entries;
+};
+
+
+
+static void contextprintfhexdump16bytes (BLContextPtr inContext, int inLogLevel, char* inHeaderStr, const uint8_t* inBytes)
+{
+    static const char   hex[] = "0123456789abcdef";
+    char                line[16*3 + 2 + 16 + 1];
+    char *              p = line;
+    int                 i;
+
+    if (!contextprintfenabled (inContext, inLogLevel)) return;
+
+    for (i = 0;   i <= 15;   i++) {
+        *p++ = hex[inBytes[i] >> 4];
+        *p++ = hex[inBytes[i] & 0xf];
+        *p++ = ' ';
+    }
+
+    *p++ = '|';
+    *p++ = ' ';
+
+    for (i = 0;   i <= 15;   i++) {
+        *p++ = isprint(inBytes[i]) ? inBytes[i] : '.';
+    }
+    *p = '\0';
+
+    contextprintf (inContext, inLogLevel, "%s%s\n", inHeaderStr, line);
+}
+
+
+
+static int windowOpen (BLContextPtr inContext, int inFD, uint32_t inFirstSector, uint32_t inMaxSectors, SectorWindow* outWindow)
+{
+	struct stat     sb;
+	off_t           start = (off_t) inFirstSector * kElToritoSectorSize;
+	off_t           pageStart;
+	size_t          length;
+	void *          base;
+
+	bzero (outWindow, sizeof (*outWindow));
+	outWindow->fd = inFD;
+	outWindow->firstSector = inFirstSector;
+	outWindow->maxSectors = inMaxSectors;
+
+	if (0 == fstat (inFD, &sb) && S_ISREG (sb.st_mode)) {
+		if (sb.st_size <= start) {
+			contextprintf (inContext, kBLLogLevelVerbose, "image is too short to hold sector %u\n", inFirstSector);
+			return ERANGE;
+		}
+		if ((sb.st_size - start) / kElToritoSectorSize < outWindow->maxSectors) {
+			outWindow->maxSectors = (uint32_t) ((sb.st_size - start) / kElToritoSectorSize);
+		}
+		if (0 == outWindow->maxSectors) return ERANGE;
+
+		// mmap wants a page-aligned offset; sector boundaries need not be
+		pageStart = start & ~((off_t) getpagesize () - 1);
+		length = (size_t) (start - pageStart) + (size_t) outWindow->maxSectors * kElToritoSectorSize;
+		base = mmap (NULL, length, PROT_READ, MAP_SHARED, inFD, pageStart);
+		if (MAP_FAILED != base) {
+			outWindow->mapped = true;
+			outWindow->base = base;
+			outWindow->baseLength = length;
+			outWindow->bytes = (const uint8_t *) base + (start - pageStart);
+			outWindow->sectorCount = outWindow->maxSectors;
+			return 0;
+		}
+		contextprintf (inContext, kBLLogLevelVerbose, "mmap failed, errno=%d; falling back to pread\n", errno);
+	}
+
+	return 0;
+}
+
+
+
+//
+// Make sure the first inSectors sectors of the window are present. Mapped windows have
+// everything up front; pread windows grow on demand.
+//
+static bool windowEnsure (SectorWindow* inWindow, uint32_t inSectors)
+{
+	uint8_t *   buffer;
+	ssize_t     got;
+
+	if (inSectors <= inWindow->sectorCount) return true;
+	if (inWindow->mapped || inSectors > inWindow->maxSectors) return false;
+
+	buffer = realloc (inWindow->base, (size_t) inSectors * kElToritoSectorSize);
+	if (NULL == buffer) return false;
+	inWindow->base = buffer;
+	inWindow->bytes = buffer;
+
+	got = pread (inWindow->fd,
+				 buffer + (size_t) inWindow->sectorCount * kElToritoSectorSize,
+				 (size_t) (inSectors - inWindow->sectorCount) * kElToritoSectorSize,
+				 (off_t) (inWindow->firstSector + inWindow->sectorCount) * kElToritoSectorSize);
+	if (got != (ssize_t) (inSectors - inWindow->sectorCount) * kElToritoSectorSize) return false;
+
+	inWindow->sectorCount = inSectors;
+	return true;
+}
+
+
+
+static void windowClose (SectorWindow* inWindow)
+{
+	if (NULL == inWindow->base) return;
+	if (inWindow->mapped) {
+		munmap (inWindow->base, inWindow->baseLength);
+	} else {
+		free (inWindow->base);
+	}
+	inWindow->base = NULL;
+}
+
+
+
+//
+// Return the 32-byte catalog entry with the given number, pulling in the catalog sector
+// holding it if needed. Returns NULL when the entry lies past what we are willing to read.
+//
+static const uint8_t * catalogEntry (SectorWindow* inWindow, uint32_t inEntryNum)
+{
+	if (!windowEnsure (inWindow, inEntryNum / kElToritoEntriesPerSector + 1)) return NULL;
+	return inWindow->bytes + (size_t) inEntryNum * kElToritoEntrySize;
+}
+
+
+
+static int readVolumeDescriptors (BLContextPtr inContext, int inFD, uint32_t* outVolumeSpaceSize, uint32_t* outCatalogSector)
+{
+	SectorWindow        window;
+	int                 ret;
+
+	ret = windowOpen (inContext, inFD, kElToritoPVDSector, 2, &window);
+	if (ret) return ret;
+	if (!windowEnsure (&window, 2)) {
+		contextprintf (inContext, kBLLogLevelVerbose, "unable to read volume descriptors, errno=%d\n", errno);
+		windowClose (&window);
+		return EIO;
+	}
+
+	const ISO9660_PRIMARY_VOLUME_DESCRIPTOR *   vd = (const ISO9660_PRIMARY_VOLUME_DESCRIPTOR *) window.bytes;
+	const EL_TORITO_BOOT_VOLUME_DESCRIPTOR *    bvd = (const EL_TORITO_BOOT_VOLUME_DESCRIPTOR *) (window.bytes + kElToritoSectorSize);
+
+	contextprintfhexdump16bytes (inContext, kBLLogLevelVerbose, "disc[16*2048]           ", window.bytes);
+
+	// See if this is a Primary Volume Descriptor type of ISO9660 Volume Descriptor and is valid:
+	if ((0 != memcmp (vd->ident, "CD001", sizeof (vd->ident))) ||      // verify the Standard Identifer signature to be valid
+		(1 != vd->volume_descriptor_type)) {                            // verify this volume descriptor's Type to be 1=PrimaryVolumeDescriptor
+		contextprintf (inContext, kBLLogLevelVerbose, "Primary Volume Descriptor not found\n");
+		windowClose (&window);
+		return EINVAL;
+	}
+	*outVolumeSpaceSize = OSSwapLittleToHostInt32 (vd->volume_space_size_LE);
+	contextprintf (inContext, kBLLogLevelVerbose, "Primary Volume Descriptor confirmed; volumeSpaceSize=(in 2048-blocks)=0x%08x\n", *outVolumeSpaceSize);
+
+	contextprintfhexdump16bytes (inContext, kBLLogLevelVerbose, "disc[17*2048]           ", window.bytes + kElToritoSectorSize);
+
+	// See if this is an El Torito "Boot Record Volume Descriptor":
+	if ((0 != memcmp (bvd->ident, "CD001", sizeof (bvd->ident))) ||     // verify the Standard Identifer signature to be valid
+		(0 != bvd->type) ||                                             // verify this volume descriptor's Type to be 0=BootRecord
+		(0 == OSSwapLittleToHostInt32 (bvd->bootcat_ptr))) {            // verify that the boot cat ptr is something nonzero
+		contextprintf (inContext, kBLLogLevelVerbose, "Boot Record Volume Descriptor (El Torito header) not found\n");
+		windowClose (&window);
+		return EINVAL;
+	}
+	*outCatalogSector = OSSwapLittleToHostInt32 (bvd->bootcat_ptr);
+	contextprintf (inContext, kBLLogLevelVerbose, "Boot Record Volume Descriptor (El Torito header) confirmed; firstSectorOfBootCatalog=0x%08x\n", *outCatalogSector);
+
+	windowClose (&window);
+	return 0;
+}
+
+
+
+static BLElToritoEntry * appendEntry (BLElToritoCatalogRef inCatalog, uint32_t* ioCapacity, uint8_t inKind, uint32_t inEntryNum)
+{
+	BLElToritoEntry *   entry;
+
+	if (inCatalog->entryCount == *ioCapacity) {
+		uint32_t            newCapacity = *ioCapacity ? *ioCapacity * 2 : kElToritoEntriesPerSector;
+		BLElToritoEntry *   newEntries = realloc (inCatalog->entries, newCapacity * sizeof (BLElToritoEntry));
+
+		if (NULL == newEntries) return NULL;
+		inCatalog->entries = newEntries;
+		*ioCapacity = newCapacity;
+	}
+	entry = &inCatalog->entries[inCatalog->entryCount++];
+	bzero (entry, sizeof (*entry));
+	entry->kind = inKind;
+	entry->catalogIndex = inEntryNum;
+	return entry;
+}
+
+
+
+//
+// Walk the boot catalog once and index every entry in it:
+//
+//  It starts with 1 Validation Entry.
+//  Then 1 Initial/Default Entry.
+//  Then one or more of:
+//     A Section Header Entry. Then zero or more of:
+//        Its Section Entry. Then zero or more of:
+//           This Section Entry's optional Section Extension Entry.
+//
+// The catalog is not limited to one sector; we follow it across as many sectors as it
+// takes to reach the end of the final (0x91) header's sections.
+//
+static int indexCatalog (BLContextPtr inContext, SectorWindow* inWindow, BLElToritoCatalogRef ioCatalog)
+{
+	const uint8_t *     raw;
+	uint32_t            entryNum = 0;
+	uint32_t            capacity = 0;
+	uint16_t            headerIdx;
+	bool                isFinalHeader = false;
+	BLElToritoEntry *   entry;
+
+	// VALIDATION ENTRY
+	raw = catalogEntry (inWindow, entryNum);
+	if (NULL == raw) return EIO;
+	contextprintfhexdump16bytes (inContext, kBLLogLevelVerbose, "validation entry        ", raw);
+
+	const EL_TORITO_VALIDATION_ENTRY *  ve = (const EL_TORITO_VALIDATION_ENTRY *) raw;
+
+	// See if this is a good Validation Entry. We could compare a whole lot of details here,
+	// but why limit it to e.g. Microsoft? So just verify the "must be 01" and the keys.
+	if ((1 != ve->id) || (0x55 != ve->key55) || (0xaa != ve->keyAA)) {
+		contextprintf (inContext, kBLLogLevelVerbose, "Validation Entry not found\n");
+		return EINVAL;
+	}
+	entry = appendEntry (ioCatalog, &capacity, kBLElToritoEntryValidation, entryNum);
+	if (NULL == entry) return ENOMEM;
+	entry->platformID = ve->arch;
+	entryNum++;
+
+	// INITIAL/DEFAULT ENTRY
+	raw = catalogEntry (inWindow, entryNum);
+	if (NULL == raw) return EIO;
+	contextprintfhexdump16bytes (inContext, kBLLogLevelVerbose, "initial/default entry   ", raw);
+
+	const EL_TORITO_INITIAL_DEFAULT_ENTRY *     de = (const EL_TORITO_INITIAL_DEFAULT_ENTRY *) raw;
+
+	entry = appendEntry (ioCatalog, &capacity, kBLElToritoEntryDefault, entryNum);
+	if (NULL == entry) return ENOMEM;
+	entry->platformID = ve->arch;
+	entry->bootIndicator = de->boot_indicator;
+	entry->bootMedia = de->boot_media;
+	entry->systemType = de->system_type;
+	entry->sectorCount = OSSwapLittleToHostInt16 (de->blockcount);
+	entry->loadRBA = OSSwapLittleToHostInt32 (de->lba);
+	entryNum++;
+
+	// AND THEN WE KEEP GOING WITH {SECTION HEADER, SECTION, (SECTION EXTENSION)}* UNTIL WE HIT header indicator=91 (90 means more coming)
+	while (!isFinalHeader) {
+		raw = catalogEntry (inWindow, entryNum);
+		if (NULL == raw) goto Truncated;
+
+		const EL_TORITO_SECTION_HEADER_ENTRY *  he = (const EL_TORITO_SECTION_HEADER_ENTRY *) raw;
+
+		if ((he->header_indicator != 0x90) && (he->header_indicator != 0x91)) {
+			// Plenty of mastering tools don't bother with a 0x91 and just leave the rest
+			// of the sector zeroed. Treat anything else as the end of the catalog.
+			contextprintf (inContext, kBLLogLevelVerbose, "entry %u is not a Section Header (0x%02x); end of catalog\n",
+						   entryNum, he->header_indicator);
+			break;
+		}
+		isFinalHeader = (0x91 == he->header_indicator);
+
+		uint16_t    sectionsForHeader = OSSwapLittleToHostInt16 (he->sections_count);
+
+		contextprintf (inContext, kBLLogLevelVerbose, "entry %u: section header platform=0x%02x sections=%u%s\n",
+					   entryNum, he->platform_id, sectionsForHeader, isFinalHeader ? " (final)" : "");
+
+		headerIdx = ioCatalog->entryCount;
+		entry = appendEntry (ioCatalog, &capacity, kBLElToritoEntryHeader, entryNum);
+		if (NULL == entry) return ENOMEM;
+		entry->platformID = he->platform_id;
+		entry->header = headerIdx;
+		entry->sectionCount = sectionsForHeader;
+		entryNum++;
+
+		for (uint16_t section = 0; section < sectionsForHeader; section++) {
+			raw = catalogEntry (inWindow, entryNum);
+			if (NULL == raw) goto Truncated;
+
+			const EL_TORITO_SECTION_SECTION_ENTRY *     se = (const EL_TORITO_SECTION_SECTION_ENTRY *) raw;
+			bool                                        hasExtensions = (0 != (se->boot_media & 0x20));
+
+			entry = appendEntry (ioCatalog, &capacity, kBLElToritoEntrySection, entryNum);
+			if (NULL == entry) return ENOMEM;
+			entry->platformID = he->platform_id;
+			entry->header = headerIdx;
+			entry->bootIndicator = se->boot_indicator;
+			entry->bootMedia = se->boot_media;
+			entry->systemType = se->system_type;
+			entry->sectorCount = OSSwapLittleToHostInt16 (se->sector_count);
+			entry->loadRBA = OSSwapLittleToHostInt32 (se->load_rba);
+
+			contextprintf (inContext, kBLLogLevelVerbose, "entry %u: section boot_indicator=0x%02x boot_media=0x%02x load_rba=0x%08x\n",
+						   entryNum, entry->bootIndicator, entry->bootMedia, entry->loadRBA);
+
+			if ((kBLElToritoNoEntry == ioCatalog->uefiEntry) &&
+				(0xef == entry->platformID) &&
+				(0x88 == entry->bootIndicator)) {
+				ioCatalog->uefiEntry = ioCatalog->entryCount - 1;
+			}
+			entryNum++;
+
+			// OPTIONAL SECTION ENTRY EXTENSION(s) (if bit in section entry above is set)
+			while (hasExtensions) {
+				raw = catalogEntry (inWindow, entryNum);
+				if (NULL == raw) goto Truncated;
+
+				const EL_TORITO_SECTION_EXTENSION_ENTRY *   see = (const EL_TORITO_SECTION_EXTENSION_ENTRY *) raw;
+
+				if (0x44 != see->extension_indicator) {
+					contextprintf (inContext, kBLLogLevelVerbose, "entry %u: expected Section Extension, found 0x%02x; stopping\n",
+								   entryNum, see->extension_indicator);
+					goto Done;
+				}
+				entry = appendEntry (ioCatalog, &capacity, kBLElToritoEntryExtension, entryNum);
+				if (NULL == entry) return ENOMEM;
+				entry->platformID = he->platform_id;
+				entry->header = headerIdx;
+				hasExtensions = (0 != (see->bits & 0x20));
+				entryNum++;
+			}
+		}
+	}
+	goto Done;
+
+Truncated:
+	contextprintf (inContext, kBLLogLevelVerbose, "boot catalog runs past %u sectors; indexing what we have\n",
+				   inWindow->maxSectors);
+
+Done:
+	ioCatalog->catalogSectors = (entryNum + kElToritoEntriesPerSector - 1) / kElToritoEntriesPerSector;
+	contextprintf (inContext, kBLLogLevelVerbose, "indexed %u El Torito entries over %u catalog sector(s)\n",
+				   ioCatalog->entryCount, ioCatalog->catalogSectors);
+	return 0;
+}
+
+
+
+int BLElToritoCatalogCreateWithFD (BLContextPtr inContext, int inFD, BLElToritoCatalogRef* outCatalog)
+{
+	BLElToritoCatalogRef    catalog = NULL;
+	SectorWindow            window;
+	uint32_t                maxSectors = kElToritoMaxCatalogSectors;
+	int                     ret;
+
+	*outCatalog = NULL;
+	bzero (&window, sizeof (window));
+
+	catalog = calloc (1, sizeof (*catalog));
+	if (NULL == catalog) return ENOMEM;
+	catalog->uefiEntry = kBLElToritoNoEntry;
+
+	ret = readVolumeDescriptors (inContext, inFD, &catalog->volumeSpaceSize, &catalog->catalogSector);
+	if (ret) goto Exit;
+
+	if (catalog->catalogSector >= catalog->volumeSpaceSize) {
+		contextprintf (inContext, kBLLogLevelVerbose, "boot catalog sector 0x%08x lies outside the volume\n", catalog->catalogSector);
+		ret = EINVAL;
+		goto Exit;
+	}
+	if (catalog->volumeSpaceSize - catalog->catalogSector < maxSectors) {
+		maxSectors = catalog->volumeSpaceSize - catalog->catalogSector;
+	}
+
+	ret = windowOpen (inContext, inFD, catalog->catalogSector, maxSectors, &window);
+	if (ret) goto Exit;
+
+	ret = indexCatalog (inContext, &window, catalog);
+	if (ret) goto Exit;
+
+	// Give back the slack from growing the index
+	if (catalog->entryCount) {
+		BLElToritoEntry *   entries = realloc (catalog->entries, catalog->entryCount * sizeof (BLElToritoEntry));
+		if (entries) catalog->entries = entries;
+	}
+
+	*outCatalog = catalog;
+	catalog = NULL;
+
+Exit:
+	windowClose (&window);
+	if (catalog) BLElToritoCatalogRelease (catalog);
+	return ret;
+}
+
+
+
+int BLElToritoCatalogCreateWithPath (BLContextPtr inContext, const char* inPath, BLElToritoCatalogRef* outCatalog)
+{
+	int fd;
+	int ret;
+
+	*outCatalog = NULL;
+
+	fd = open (inPath, O_RDONLY | O_SHLOCK);
+	if (-1 == fd) {
+		ret = errno;
+		contextprintf (inContext, kBLLogLevelVerbose, "unable to open %s, errno=%d\n", inPath, ret);
+		return ret;
+	}
+
+	ret = BLElToritoCatalogCreateWithFD (inContext, fd, outCatalog);
+	close (fd);
+	return ret;
+}
+
+
+
+void BLElToritoCatalogRelease (BLElToritoCatalogRef inCatalog)
+{
+	if (NULL == inCatalog) return;
+	free (inCatalog->entries);
+	free (inCatalog);
+}
+
+
+
+const BLElToritoEntry * BLElToritoCatalogGetEntries (BLElToritoCatalogRef inCatalog, uint32_t* outCount)
+{
+	*outCount = inCatalog->entryCount;
+	return inCatalog->entries;
+}
+
+
+
+uint32_t BLElToritoCatalogGetVolumeSpaceSize (BLElToritoCatalogRef inCatalog)
+{
+	return inCatalog->volumeSpaceSize;
+}
+
+
+
+uint32_t BLElToritoCatalogGetSectorCount (BLElToritoCatalogRef inCatalog)
+{
+	return inCatalog->catalogSectors;
+}
+
+
+
+//
+// The first Section Entry which is set as bootable under an EFI (0xEF) platform header
+// describes the MS-DOS region we want firmware to boot. Its size runs to the end of the
+// volume (1stISORecord.VolumeSpaceSize - SectionEntry.LoadRBA).
+//
+const BLElToritoEntry * BLElToritoCatalogGetUEFIBootEntry (BLElToritoCatalogRef inCatalog, uint32_t* outOffsetBlocks, uint32_t* outSizeBlocks)
+{
+	const BLElToritoEntry *     entry;
+
+	if (kBLElToritoNoEntry == inCatalog->uefiEntry) return NULL;
+	entry = &inCatalog->entries[inCatalog->uefiEntry];
+	if (entry->loadRBA > inCatalog->volumeSpaceSize) return NULL;
+
+	if (outOffsetBlocks) *outOffsetBlocks = entry->loadRBA;
+	if (outSizeBlocks) *outSizeBlocks = inCatalog->volumeSpaceSize - entry->loadRBA;
+	return entry;
+}
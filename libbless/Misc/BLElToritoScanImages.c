@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2013-2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ *  BLElToritoScanImages.c
+ *  bless
+ *
+ *  Copyright (c) 2013-2020 Apple Inc. All Rights Reserved.
+ *
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include "bless.h"
+#include "bless_private.h"
+
+#define kElToritoScanMaxWorkers     64
+
+struct scanqueue {
+	BLContextPtr                context;
+	BLElToritoImageScanResult * results;
+	uint32_t                    count;
+	uint32_t                    next;
+	pthread_mutex_t             lock;
+};
+
+static uint64_t monotonicNanos (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static void scanImage (BLContextPtr context, BLElToritoImageScanResult *result)
+{
+	BLElToritoCatalogRef    catalog = NULL;
+	const BLElToritoEntry * entry;
+	uint64_t                start = monotonicNanos ();
+	int                     ret;
+
+	ret = BLElToritoCatalogCreateWithPath (context, result->path, &catalog);
+	if (ret) {
+		result->status = ret;
+		switch (ret) {
+			case EINVAL:
+			case ERANGE:
+				result->reason = "no El Torito boot catalog";
+				break;
+			case EIO:
+				result->reason = "read error";
+				break;
+			default:
+				// strerror() isn't safe to call from the workers; status has the errno
+				result->reason = "open failed";
+				break;
+		}
+		goto Exit;
+	}
+
+	BLElToritoCatalogGetEntries (catalog, &result->entryCount);
+	entry = BLElToritoCatalogGetUEFIBootEntry (catalog, &result->offsetBlocks, &result->sizeBlocks);
+	if (NULL == entry) {
+		result->status = ENOENT;
+		result->reason = "no bootable EFI section";
+		goto Exit;
+	}
+	result->bootEntry = kBLElToritoUEFIBootEntry;
+	result->status = 0;
+	result->reason = "bootable";
+
+Exit:
+	if (catalog) BLElToritoCatalogRelease (catalog);
+	result->elapsedNanos = monotonicNanos () - start;
+	contextprintf (context, kBLLogLevelVerbose, "%s: %s (%llu us)\n", result->path, result->reason,
+				   (unsigned long long) (result->elapsedNanos / 1000));
+}
+
+static void * scanWorker (void *arg)
+{
+	struct scanqueue *  queue = arg;
+	uint32_t            index;
+
+	for (;;) {
+		pthread_mutex_lock (&queue->lock);
+		index = queue->next < queue->count ? queue->next++ : queue->count;
+		pthread_mutex_unlock (&queue->lock);
+		if (index == queue->count) break;
+
+		scanImage (queue->context, &queue->results[index]);
+	}
+	return NULL;
+}
+
+//
+// Append a path to the result array, growing it as needed. The result
+// owns a copy of the path.
+//
+static int appendImage (BLElToritoImageScanResult **results, uint32_t *count, uint32_t *capacity, const char *path)
+{
+	BLElToritoImageScanResult * newResults;
+
+	if (*count == *capacity) {
+		uint32_t newCapacity = *capacity ? *capacity * 2 : 64;
+
+		newResults = realloc (*results, newCapacity * sizeof (**results));
+		if (NULL == newResults) return ENOMEM;
+		*results = newResults;
+		*capacity = newCapacity;
+	}
+	bzero (&(*results)[*count], sizeof (**results));
+	(*results)[*count].path = strdup (path);
+	if (NULL == (*results)[*count].path) return ENOMEM;
+	(*count)++;
+	return 0;
+}
+
+//
+// Directories are expanded one level deep to the regular files they
+// contain, in directory order; anything else is taken as an image path.
+//
+static int expandImagePaths (BLContextPtr context, const char * const *paths, uint32_t pathCount,
+							 BLElToritoImageScanResult **results, uint32_t *count)
+{
+	uint32_t        capacity = 0;
+	uint32_t        i;
+	struct stat     sb;
+	int             ret = 0;
+
+	*results = NULL;
+	*count = 0;
+
+	for (i = 0; i < pathCount && 0 == ret; i++) {
+		if (0 == stat (paths[i], &sb) && S_ISDIR (sb.st_mode)) {
+			DIR *           dir = opendir (paths[i]);
+			struct dirent * dp;
+			char            child[MAXPATHLEN];
+
+			if (NULL == dir) {
+				ret = errno;
+				contextprintf (context, kBLLogLevelError, "Can't open directory %s: %s\n", paths[i], strerror (ret));
+				break;
+			}
+			while (0 == ret && NULL != (dp = readdir (dir))) {
+				if (dp->d_name[0] == '.') continue;
+				snprintf (child, sizeof child, "%s/%s", paths[i], dp->d_name);
+				if (0 != stat (child, &sb) || !S_ISREG (sb.st_mode)) continue;
+				ret = appendImage (results, count, &capacity, child);
+			}
+			closedir (dir);
+		} else {
+			ret = appendImage (results, count, &capacity, paths[i]);
+		}
+	}
+
+	if (ret) {
+		BLElToritoImageScanResultsRelease (*results, *count);
+		*results = NULL;
+		*count = 0;
+	}
+	return ret;
+}
+
+int BLScanElToritoImages (BLContextPtr context, const char * const *paths, uint32_t pathCount, uint32_t workers,
+						  BLElToritoImageScanResult **outResults, uint32_t *outCount, BLElToritoImageScanStats *stats)
+{
+	struct scanqueue    queue;
+	pthread_t           threads[kElToritoScanMaxWorkers];
+	uint32_t            started = 0;
+	uint32_t            i;
+	uint64_t            start;
+	int                 ret;
+
+	*outResults = NULL;
+	*outCount = 0;
+	bzero (stats, sizeof (*stats));
+
+	ret = expandImagePaths (context, paths, pathCount, &queue.results, &queue.count);
+	if (ret) return ret;
+
+	if (0 == workers) {
+		long ncpu = sysconf (_SC_NPROCESSORS_ONLN);
+		workers = ncpu > 0 ? (uint32_t) ncpu : 1;
+	}
+	if (workers > kElToritoScanMaxWorkers) workers = kElToritoScanMaxWorkers;
+	if (workers > queue.count) workers = queue.count ? queue.count : 1;
+
+	queue.context = context;
+	queue.next = 0;
+	pthread_mutex_init (&queue.lock, NULL);
+
+	contextprintf (context, kBLLogLevelVerbose, "Scanning %u image(s) with %u worker(s)\n", queue.count, workers);
+
+	start = monotonicNanos ();
+
+	// The calling thread is one of the workers
+	for (i = 1; i < workers; i++) {
+		if (0 != pthread_create (&threads[started], NULL, scanWorker, &queue)) {
+			contextprintf (context, kBLLogLevelVerbose, "pthread_create failed; continuing with %u worker(s)\n", started + 1);
+			break;
+		}
+		started++;
+	}
+	scanWorker (&queue);
+	for (i = 0; i < started; i++) {
+		pthread_join (threads[i], NULL);
+	}
+
+	stats->wallNanos = monotonicNanos () - start;
+	stats->workers = started + 1;
+	pthread_mutex_destroy (&queue.lock);
+
+	stats->imageCount = queue.count;
+	for (i = 0; i < queue.count; i++) {
+		uint64_t elapsed = queue.results[i].elapsedNanos;
+
+		if (0 == queue.results[i].status) {
+			stats->bootableCount++;
+		} else {
+			stats->rejectedCount++;
+		}
+		stats->totalNanos += elapsed;
+		if (0 == i || elapsed < stats->minNanos) stats->minNanos = elapsed;
+		if (elapsed > stats->maxNanos) stats->maxNanos = elapsed;
+	}
+
+	*outResults = queue.results;
+	*outCount = queue.count;
+	return 0;
+}
+
+void BLElToritoImageScanResultsRelease (BLElToritoImageScanResult *results, uint32_t count)
+{
+	uint32_t i;
+
+	if (NULL == results) return;
+	for (i = 0; i < count; i++) {
+		free ((void *) results[i].path);
+	}
+	free (results);
+}
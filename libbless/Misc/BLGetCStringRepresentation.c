@@ -88,8 +88,17 @@ char *BLGetCStringDescription(CFTypeRef typeRef) {
 	storage = (struct stringer	*)pthread_getspecific(blcstr_key);
 	if(storage == NULL) {
 		storage = malloc(sizeof(*storage));
+		if(storage == NULL) {
+			CFRelease(desc);
+			return NULL;
+		}
 		storage->size = (size_t)strsize;
 		storage->string = malloc(storage->size);
+		if(storage->string == NULL) {
+			CFRelease(desc);
+			free(storage);
+			return NULL;
+		}
 
 		ret = pthread_setspecific(blcstr_key, storage);
 		if(ret) {
@@ -102,9 +111,13 @@ char *BLGetCStringDescription(CFTypeRef typeRef) {
 		
 	} else if(storage->size < strsize) {
 		// need more space
-		storage->size = (size_t)strsize;
 		free(storage->string);
-		storage->string = malloc(storage->size);
+		storage->string = malloc((size_t)strsize);
+		storage->size = storage->string ? (size_t)strsize : 0;
+		if(storage->string == NULL) {
+			CFRelease(desc);
+			return NULL;
+		}
 	}
 	
 	if(!CFStringGetCString(desc, storage->string, (CFIndex)storage->size, kCFStringEncodingUTF8)) {
@@ -143,3 +156,38 @@ char *BLGetCStringDescription(CFTypeRef typeRef) {
 	return NULL;
 }
 #endif
+
+/*
+ * Same, into the caller's buffer, so several can be live at once.
+ * Long descriptions are truncated.
+ */
+char *BLCopyCStringDescription(CFTypeRef typeRef, char *buffer, size_t size) {
+
+	CFStringRef desc;
+	
+	if(size == 0)
+		return NULL;
+	buffer[0] = '\0';
+	if(typeRef == NULL)
+		return buffer;
+
+	if(CFGetTypeID(typeRef) == CFStringGetTypeID()) {
+		desc = CFRetain(typeRef);
+	} else {
+		desc = CFCopyDescription(typeRef);
+	}
+	if(desc == NULL)
+		return buffer;
+
+	if(!CFStringGetCString(desc, buffer, (CFIndex)size, kCFStringEncodingUTF8)) {
+		// too long for the buffer; keep as much as fits
+		CFIndex used = 0;
+
+		CFStringGetBytes(desc, CFRangeMake(0, CFStringGetLength(desc)), kCFStringEncodingUTF8, 0, false,
+						 (UInt8 *)buffer, (CFIndex)size - 1, &used);
+		buffer[used] = '\0';
+	}
+	CFRelease(desc);
+	
+	return buffer;
+}
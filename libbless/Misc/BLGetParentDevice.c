@@ -34,6 +34,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <errno.h>
 #include <sys/stat.h>
 #include <sys/param.h>
 #include <sys/mount.h>
@@ -76,6 +77,13 @@ int BLGetParentDeviceAndPartitionType(BLContextPtr context,   const char * parti
 
     char par[MNAMELEN];
 
+    if (BLContextTopology(context)) {
+        result = BLTopologyGetParentDevice(context, BLContextTopology(context), partitionDev,
+                                           parentDev, partitionNum, partitionType);
+        if (result != ENOENT && result != ENOTSUP) return result;
+        result = 0;
+    }
+
     parentDev[0] = '\0';
 
     kret = IOServiceGetMatchingServices(kIOMasterPortDefault,
@@ -33,21 +33,100 @@
 
 #include <CoreFoundation/CoreFoundation.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <sys/paths.h>
 #include <sys/param.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "bless.h"
 #include "bless_private.h"
 
+#define kMapThreshold   0x10000     // smaller files are just read
+#define kReadChunkSize  0x10000
 
-int BLLoadFile(BLContextPtr context, const char * src, int useRsrcFork,
+static void unmapDeallocate(void *ptr, void *info)
+{
+    munmap(ptr, (size_t)(uintptr_t)info);
+}
+
+/*
+ * A data object over a read-only mapping of the file, unmapped when
+ * the data is freed. NULL if the file can't be mapped.
+ */
+static CFDataRef createMappedData(int fd, size_t length)
+{
+    CFAllocatorContext  allocContext = { 0, NULL, NULL, NULL, NULL, NULL, NULL, unmapDeallocate, NULL };
+    CFAllocatorRef      deallocator;
+    CFDataRef           output;
+    void                *map;
+
+    map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map == MAP_FAILED) {
+        return NULL;
+    }
+
+    allocContext.info = (void *)(uintptr_t)length;
+    deallocator = CFAllocatorCreate(kCFAllocatorDefault, &allocContext);
+    if(deallocator == NULL) {
+        munmap(map, length);
+        return NULL;
+    }
+    output = CFDataCreateWithBytesNoCopy(kCFAllocatorDefault, map, length, deallocator);
+    CFRelease(deallocator);
+    if(output == NULL) {
+        munmap(map, length);
+    }
+    return output;
+}
+
+/*
+ * Read to end of file, for small files, resource forks and anything
+ * else that won't map
+ */
+static CFDataRef createReadData(int fd, size_t sizeHint)
+{
+    CFMutableDataRef    output;
+    CFIndex             capacity = sizeHint ? (CFIndex)sizeHint + 1 : kReadChunkSize;
+    CFIndex             have = 0;
+    ssize_t             n;
+
+    output = CFDataCreateMutable(kCFAllocatorDefault, 0);
+    if(output == NULL) {
+        return NULL;
+    }
+    CFDataSetLength(output, capacity);
+
+    for(;;) {
+        if(have == capacity) {
+            capacity *= 2;
+            CFDataSetLength(output, capacity);
+        }
+        n = read(fd, CFDataGetMutableBytePtr(output) + have, capacity - have);
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0) {
+            CFRelease(output);
+            return NULL;
+        }
+        if(n == 0) break;
+        have += n;
+    }
+    CFDataSetLength(output, have);
+
+    return output;
+}
+
+static int _BLLoadFile(BLContextPtr context, const char * src, int useRsrcFork,
     CFDataRef* data) {
 
     int err = 0;
     int isHFS = 0;
+    int fd;
+    struct stat sb;
     CFDataRef                output = NULL;
-    CFURLRef                 loadSrc;
     char rsrcpath[MAXPATHLEN];
 
 	if (data) *data = NULL;
@@ -66,28 +145,37 @@ int BLLoadFile(BLContextPtr context, const char * src, int useRsrcFork,
 
     rsrcpath[MAXPATHLEN-1] = '\0';
 
-    loadSrc = CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault,
-													  (UInt8 *)rsrcpath,
-													  strlen(rsrcpath), 0);
+    fd = open(rsrcpath, O_RDONLY);
+    if(fd < 0 || fstat(fd, &sb) < 0) {
+        contextprintf(context, kBLLogLevelError,  "Can't load %s: %s\n", rsrcpath, strerror(errno));
+        if(fd >= 0) close(fd);
+        return 2;
+    }
 
-    if(loadSrc == NULL) {
-        return 1;
+    if(S_ISREG(sb.st_mode) && sb.st_size >= kMapThreshold && (uint64_t)sb.st_size <= SIZE_MAX) {
+        output = createMappedData(fd, (size_t)sb.st_size);
     }
-    
-    if(!CFURLCreateDataAndPropertiesFromResource(kCFAllocatorDefault,
-                                            loadSrc,
-                                            &output,
-                                            NULL,
-                                            NULL,
-                                            NULL)) {
+    if(output == NULL) {
+        output = createReadData(fd, S_ISREG(sb.st_mode) ? (size_t)sb.st_size : 0);
+    }
+    close(fd);
+
+    if(output == NULL) {
         contextprintf(context, kBLLogLevelError,  "Can't load %s\n", rsrcpath );
-        CFRelease(loadSrc);
         return 2;
     }
 
-    CFRelease(loadSrc); loadSrc = NULL;
-
     *data = output;
     
     return 0;
 }
+
+int BLLoadFile(BLContextPtr context, const char * src, int useRsrcFork,
+    CFDataRef* data) {
+    uint64_t span = BLTraceBegin(context);
+    int err = _BLLoadFile(context, src, useRsrcFork, data);
+
+    if (!err && data && *data) BLTimingAddBytesRead(context, CFDataGetLength(*data));
+    BLTraceEnd(context, span, "BLLoadFile", src);
+    return err;
+}
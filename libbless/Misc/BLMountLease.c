@@ -0,0 +1,315 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ *  BLMountLease.c
+ *  bless
+ *
+ *  Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/param.h>
+
+#include "bless.h"
+#include "bless_private.h"
+
+struct BLMountLease {
+	char			bsdName[64];
+	char			snapName[MAXPATHLEN];	// "" for a volume
+	char			mountPoint[MAXPATHLEN];
+	uint32_t		refs;
+	bool			owned;		// we mounted it, so we unmount it
+	bool			readOnly;
+};
+
+struct BLMountLeases {
+	pthread_mutex_t			lock;
+	uint32_t				options;
+	BLMountLeaseOps			ops;
+	void *					refcon;
+	struct BLMountLease *	leases;
+	uint32_t				count;
+	uint32_t				capacity;
+	uint32_t				mounts;
+	uint32_t				unmounts;
+	uint32_t				reused;
+};
+
+struct BLMountLeases *BLMountLeasesCreateWithOps(uint32_t options, const BLMountLeaseOps *ops, void *refcon)
+{
+	struct BLMountLeases *leases = calloc(1, sizeof(*leases));
+
+	if (!leases) return NULL;
+	pthread_mutex_init(&leases->lock, NULL);
+	leases->options = options;
+	if (ops) leases->ops = *ops;
+	leases->refcon = refcon;
+	return leases;
+}
+
+struct BLMountLeases *BLMountLeasesCreate(uint32_t options)
+{
+#ifdef __APPLE__
+	return BLMountLeasesCreateWithOps(options, &BLDefaultMountLeaseOps, NULL);
+#else
+	return BLMountLeasesCreateWithOps(options, NULL, NULL);
+#endif
+}
+
+static void removeLease(struct BLMountLeases *leases, uint32_t i)
+{
+	leases->count--;
+	if (i < leases->count) {
+		memmove(&leases->leases[i], &leases->leases[i + 1], (leases->count - i) * sizeof(leases->leases[0]));
+	}
+}
+
+static int unmountLease(BLContextPtr context, struct BLMountLeases *leases, struct BLMountLease *lease)
+{
+	int ret;
+
+	if (!leases->ops.unmount) return ENOTSUP;
+	ret = leases->ops.unmount(context, leases->refcon, lease->mountPoint);
+	if (ret == 0) leases->unmounts++;
+	return ret;
+}
+
+int BLMountLeasesRelease(BLContextPtr context, struct BLMountLeases *leases)
+{
+	int			ret = 0, err;
+	uint32_t	i;
+
+	if (!leases) return 0;
+	for (i = 0; i < leases->count; i++) {
+		if (!leases->leases[i].owned) continue;
+		if (leases->leases[i].refs) {
+			contextprintf(context, kBLLogLevelVerbose, "%u lease%s on %s still held\n", leases->leases[i].refs,
+						  leases->leases[i].refs == 1 ? "" : "s", leases->leases[i].mountPoint);
+		}
+		err = unmountLease(context, leases, &leases->leases[i]);
+		if (err && !ret) ret = err;
+	}
+	contextprintf(context, kBLLogLevelVerbose, "Mount leases: %u mount%s, %u unmount%s, %u reused\n",
+				  leases->mounts, leases->mounts == 1 ? "" : "s",
+				  leases->unmounts, leases->unmounts == 1 ? "" : "s", leases->reused);
+	free(leases->leases);
+	pthread_mutex_destroy(&leases->lock);
+	free(leases);
+	return ret;
+}
+
+void BLMountLeasesGetStatistics(struct BLMountLeases *leases, uint32_t *mounts, uint32_t *unmounts, uint32_t *reused)
+{
+	pthread_mutex_lock(&leases->lock);
+	if (mounts) *mounts = leases->mounts;
+	if (unmounts) *unmounts = leases->unmounts;
+	if (reused) *reused = leases->reused;
+	pthread_mutex_unlock(&leases->lock);
+}
+
+static struct BLMountLease *findByName(struct BLMountLeases *leases, const char *bsdName, const char *snapName)
+{
+	uint32_t i;
+
+	for (i = 0; i < leases->count; i++) {
+		if (strcmp(leases->leases[i].bsdName, bsdName) == 0 && strcmp(leases->leases[i].snapName, snapName) == 0) {
+			return &leases->leases[i];
+		}
+	}
+	return NULL;
+}
+
+// The lease a path is on; callers may hand back a path inside the mount
+static int32_t findByPath(struct BLMountLeases *leases, const char *path)
+{
+	uint32_t	i;
+	size_t		len, bestLen = 0;
+	int32_t		best = -1;
+
+	for (i = 0; i < leases->count; i++) {
+		len = strlen(leases->leases[i].mountPoint);
+		if (len > bestLen && strncmp(path, leases->leases[i].mountPoint, len) == 0 &&
+			(path[len] == '\0' || path[len] == '/' || path[len - 1] == '/')) {
+			best = i;
+			bestLen = len;
+		}
+	}
+	return best;
+}
+
+// What the mount table calls a volume, or a snapshot of one
+static void deviceName(char *device, size_t len, const char *bsdName, const char *snapName)
+{
+	if (*snapName) {
+		snprintf(device, len, "%s@/dev/%s", snapName, bsdName);
+	} else {
+		snprintf(device, len, "/dev/%s", bsdName);
+	}
+}
+
+// Without leases: use an existing mount, or mount it for the caller to unmount
+static int mountDevice(BLContextPtr context, const char *bsdName, const char *snapName, bool readOnly,
+					   char *mntPoint, int mntPtStrSize, bool *didMount)
+{
+	char	device[MAXPATHLEN];
+	int		ret;
+
+	*didMount = false;
+	deviceName(device, sizeof device, bsdName, snapName);
+	ret = BLGetMountPointForDevice(context, device, mntPoint, mntPtStrSize);
+	if (ret || *mntPoint) return ret;
+#ifdef __APPLE__
+	if (*snapName) {
+		ret = BLMountSnapshot(context, bsdName, snapName, mntPoint, mntPtStrSize);
+	} else {
+		ret = BLMountContainerVolume(context, bsdName, mntPoint, mntPtStrSize, readOnly);
+	}
+	if (ret == 0) *didMount = true;
+	return ret;
+#else
+	return ENOTSUP;
+#endif
+}
+
+static int _BLAcquireMount(BLContextPtr context, const char *bsdName, const char *snapName, bool readOnly,
+						   char *mntPoint, int mntPtStrSize, bool *mustRelease)
+{
+	struct BLMountLeases	*leases = BLContextMountLeases(context);
+	struct BLMountLease		*lease, *grown;
+	char					device[MAXPATHLEN];
+	int						ret = 0;
+
+	*mustRelease = false;
+	if (!snapName) snapName = "";
+	if (*snapName) readOnly = true;
+	if (!leases) return mountDevice(context, bsdName, snapName, readOnly, mntPoint, mntPtStrSize, mustRelease);
+
+	pthread_mutex_lock(&leases->lock);
+	lease = findByName(leases, bsdName, snapName);
+	if (lease) {
+		if (lease->owned && lease->readOnly && !readOnly) {
+			if (!leases->ops.update) {
+				ret = ENOTSUP;
+				goto exit;
+			}
+			contextprintf(context, kBLLogLevelVerbose, "Updating %s to read-write\n", lease->mountPoint);
+			ret = leases->ops.update(context, leases->refcon, lease->mountPoint, false);
+			if (ret) goto exit;
+			lease->readOnly = false;
+			leases->mounts++;
+		} else {
+			leases->reused++;
+		}
+		goto leased;
+	}
+
+	if (leases->count == leases->capacity) {
+		grown = realloc(leases->leases, (leases->capacity ? leases->capacity * 2 : 8) * sizeof(*grown));
+		if (!grown) {
+			ret = ENOMEM;
+			goto exit;
+		}
+		leases->leases = grown;
+		leases->capacity = leases->capacity ? leases->capacity * 2 : 8;
+	}
+	lease = &leases->leases[leases->count];
+	memset(lease, 0, sizeof(*lease));
+	strlcpy(lease->bsdName, bsdName, sizeof lease->bsdName);
+	strlcpy(lease->snapName, snapName, sizeof lease->snapName);
+	lease->readOnly = readOnly;
+
+	// Something else may have it mounted already; use that, and leave it be
+	deviceName(device, sizeof device, bsdName, snapName);
+	ret = BLGetMountPointForDevice(context, device, lease->mountPoint, sizeof lease->mountPoint);
+	if (ret) goto exit;
+	if (lease->mountPoint[0]) {
+		leases->reused++;
+	} else {
+		if (!leases->ops.mount) {
+			ret = ENOTSUP;
+			goto exit;
+		}
+		ret = leases->ops.mount(context, leases->refcon, bsdName, *snapName ? snapName : NULL, readOnly,
+								lease->mountPoint, sizeof lease->mountPoint);
+		if (ret) goto exit;
+		lease->owned = true;
+		leases->mounts++;
+	}
+	leases->count++;
+
+leased:
+	lease->refs++;
+	strlcpy(mntPoint, lease->mountPoint, mntPtStrSize);
+	*mustRelease = true;
+exit:
+	pthread_mutex_unlock(&leases->lock);
+	return ret;
+}
+
+int BLAcquireMount(BLContextPtr context, const char *bsdName, const char *snapName, bool readOnly,
+				   char *mntPoint, int mntPtStrSize, bool *mustRelease)
+{
+	uint64_t	span = BLTraceBegin(context);
+	int			ret = _BLAcquireMount(context, bsdName, snapName, readOnly, mntPoint, mntPtStrSize, mustRelease);
+
+	BLTraceEnd(context, span, "BLAcquireMount", bsdName);
+	return ret;
+}
+
+int BLReleaseMount(BLContextPtr context, const char *mntPoint)
+{
+	struct BLMountLeases	*leases = BLContextMountLeases(context);
+	struct BLMountLease		*lease;
+	int32_t					i;
+	int						ret = 0;
+
+	if (leases) {
+		pthread_mutex_lock(&leases->lock);
+		i = findByPath(leases, mntPoint);
+		if (i >= 0) {
+			lease = &leases->leases[i];
+			if (lease->refs) lease->refs--;
+			if (lease->refs == 0) {
+				if (!lease->owned) {
+					removeLease(leases, i);
+				} else if (!(leases->options & kBLMountLeasesKeepMounted)) {
+					ret = unmountLease(context, leases, lease);
+					if (ret == 0) removeLease(leases, i);
+				}
+			}
+		}
+		pthread_mutex_unlock(&leases->lock);
+		if (i >= 0) return ret;
+	}
+#ifdef __APPLE__
+	return BLUnmountContainerVolume(context, (char *)mntPoint);
+#else
+	return ENOTSUP;
+#endif
+}
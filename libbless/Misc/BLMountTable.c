@@ -0,0 +1,516 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ *  BLMountTable.c
+ *  bless
+ *
+ *  Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ */
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#ifdef __APPLE__
+#include <sys/mount.h>
+#include <sys/event.h>
+#endif
+
+#include "bless.h"
+#include "bless_private.h"
+
+#define kBLProcMountInfo	"/proc/self/mountinfo"
+
+#ifdef __APPLE__
+#define kBLStatMTime		st_mtimespec
+#else
+#define kBLStatMTime		st_mtim
+#endif
+
+struct BLMountEntry {
+	char *		device;         // f_mntfromname, or the mount source
+	char *		mountPoint;
+	uint32_t	order;          // position in the system's list
+};
+
+struct BLMountTable {
+	pthread_mutex_t			lock;
+	char *					mountInfoPath;  // NULL to use getfsstat()
+	int						watch;          // kqueue, or the open mountinfo file
+	bool					watchIsFile;    // a plain file: compare its stat instead
+	struct stat				fileStat;
+	bool					stale;
+	struct BLMountEntry *	entries;
+	struct BLMountEntry **	byDevice;
+	struct BLMountEntry **	byMountPoint;
+	uint32_t				count;
+	uint32_t				snapshots;
+	uint32_t				lookups;
+};
+
+static void freeEntries(struct BLMountTable *table)
+{
+	uint32_t i;
+
+	for (i = 0; i < table->count; i++) {
+		free(table->entries[i].device);
+		free(table->entries[i].mountPoint);
+	}
+	free(table->entries);
+	free(table->byDevice);
+	free(table->byMountPoint);
+	table->entries = NULL;
+	table->byDevice = NULL;
+	table->byMountPoint = NULL;
+	table->count = 0;
+}
+
+static struct BLMountTable *createTable(const char *mountInfoPath, bool watch)
+{
+	struct BLMountTable *table = calloc(1, sizeof(*table));
+
+	if (!table) return NULL;
+	pthread_mutex_init(&table->lock, NULL);
+	table->watch = -1;
+	table->stale = true;
+	if (mountInfoPath) {
+		table->mountInfoPath = strdup(mountInfoPath);
+		if (!table->mountInfoPath) goto fail;
+	}
+	if (!watch) return table;
+
+#ifdef __APPLE__
+	if (!mountInfoPath) {
+		struct kevent	kev;
+
+		// Registered before the first snapshot, so no mount can slip in between
+		table->watch = kqueue();
+		if (table->watch < 0) goto fail;
+		EV_SET(&kev, 0, EVFILT_FS, EV_ADD | EV_CLEAR, VQ_MOUNT | VQ_UNMOUNT | VQ_UPDATE, 0, NULL);
+		if (kevent(table->watch, &kev, 1, NULL, 0, NULL) < 0) goto fail;
+		return table;
+	}
+#endif
+	table->watch = open(table->mountInfoPath, O_RDONLY);
+	if (table->watch < 0) goto fail;
+	if (fstat(table->watch, &table->fileStat) < 0) goto fail;
+	// procfs files look regular too, but never change size or time
+	table->watchIsFile = strncmp(table->mountInfoPath, "/proc/", 6) != 0;
+	return table;
+
+fail:
+	BLMountTableRelease(table);
+	return NULL;
+}
+
+struct BLMountTable *BLMountTableCreate(void)
+{
+#ifdef __APPLE__
+	return createTable(NULL, true);
+#else
+	return createTable(kBLProcMountInfo, true);
+#endif
+}
+
+struct BLMountTable *BLMountTableCreateWithMountInfo(const char *path)
+{
+	return createTable(path, true);
+}
+
+void BLMountTableRelease(struct BLMountTable *table)
+{
+	if (!table) return;
+	freeEntries(table);
+	if (table->watch >= 0) close(table->watch);
+	free(table->mountInfoPath);
+	pthread_mutex_destroy(&table->lock);
+	free(table);
+}
+
+void BLMountTableInvalidate(BLContextPtr context)
+{
+	struct BLMountTable *table = BLContextMountTable(context);
+
+	if (!table) return;
+	pthread_mutex_lock(&table->lock);
+	table->stale = true;
+	pthread_mutex_unlock(&table->lock);
+}
+
+void BLMountTableGetStatistics(struct BLMountTable *table, uint32_t *snapshots, uint32_t *lookups)
+{
+	pthread_mutex_lock(&table->lock);
+	if (snapshots) *snapshots = table->snapshots;
+	if (lookups) *lookups = table->lookups;
+	pthread_mutex_unlock(&table->lock);
+}
+
+//
+// Has anything been mounted or unmounted since the last look? Cheap enough
+// to ask on every lookup: a zero-timeout kevent() or poll(), or a stat()
+// of a mountinfo file standing in for the real one.
+//
+static bool generationChanged(struct BLMountTable *table)
+{
+	if (table->watch < 0) return false;
+#ifdef __APPLE__
+	if (!table->mountInfoPath) {
+		struct kevent		kev;
+		struct timespec		zero = { 0, 0 };
+		bool				changed = false;
+
+		while (kevent(table->watch, NULL, 0, &kev, 1, &zero) > 0) changed = true;
+		return changed;
+	}
+#endif
+	if (table->watchIsFile) {
+		struct stat sb;
+
+		if (stat(table->mountInfoPath, &sb) < 0) return true;
+		return sb.st_ino != table->fileStat.st_ino || sb.st_size != table->fileStat.st_size ||
+				memcmp(&sb.kBLStatMTime, &table->fileStat.kBLStatMTime, sizeof sb.kBLStatMTime) != 0;
+	} else {
+		// The kernel flags a mountinfo file with POLLPRI when the namespace's
+		// mounts change, and clears it once that's been reported
+		struct pollfd pfd = { table->watch, POLLPRI, 0 };
+
+		return poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLPRI | POLLERR));
+	}
+}
+
+static int addEntry(struct BLMountEntry *entries, uint32_t *count, const char *device,
+					const char *mountPoint)
+{
+	struct BLMountEntry *entry = &entries[*count];
+
+	entry->device = strdup(device);
+	entry->mountPoint = strdup(mountPoint);
+	entry->order = *count;
+	if (!entry->device || !entry->mountPoint) {
+		free(entry->device);
+		free(entry->mountPoint);
+		return ENOMEM;
+	}
+	(*count)++;
+	return 0;
+}
+
+#ifdef __APPLE__
+static int readFSStat(struct BLMountEntry **outEntries, uint32_t *outCount)
+{
+	struct statfs *			mnts = NULL;
+	struct BLMountEntry *	entries = NULL;
+	uint32_t				count = 0;
+	int						mntsize;
+	int						i;
+	int						ret = 0;
+
+	// getmntinfo() would hand back a buffer shared by every caller in the process
+	do {
+		mntsize = getfsstat(NULL, 0, MNT_NOWAIT);
+		if (mntsize < 0) return errno;
+		mntsize += 8;
+		free(mnts);
+		mnts = calloc(mntsize, sizeof(*mnts));
+		if (!mnts) return ENOMEM;
+		i = getfsstat(mnts, mntsize * (int)sizeof(*mnts), MNT_NOWAIT);
+		if (i < 0) {
+			ret = errno;
+			goto exit;
+		}
+	} while (i == mntsize);
+	mntsize = i;
+
+	entries = calloc(mntsize ? mntsize : 1, sizeof(*entries));
+	if (!entries) {
+		ret = ENOMEM;
+		goto exit;
+	}
+	for (i = 0; i < mntsize; i++) {
+		ret = addEntry(entries, &count, mnts[i].f_mntfromname, mnts[i].f_mntonname);
+		if (ret) goto exit;
+	}
+
+exit:
+	free(mnts);
+	*outEntries = entries;
+	*outCount = count;
+	return ret;
+}
+#endif
+
+// mountinfo escapes space, tab, newline and backslash as \ooo
+static void unescape(char *s)
+{
+	char *out = s;
+
+	while (*s) {
+		if (s[0] == '\\' && s[1] >= '0' && s[1] <= '3' && s[2] >= '0' && s[2] <= '7' &&
+			s[3] >= '0' && s[3] <= '7') {
+			*out++ = (char)(((s[1] - '0') << 6) | ((s[2] - '0') << 3) | (s[3] - '0'));
+			s += 4;
+		} else {
+			*out++ = *s++;
+		}
+	}
+	*out = '\0';
+}
+
+//
+// One line per mount:
+//   36 35 98:0 /mnt1 /mnt2 rw,noatime master:1 - ext3 /dev/root rw,errors=continue
+// The optional fields after the mount options run up to the lone "-".
+//
+static int parseMountInfoLine(char *line, struct BLMountEntry *entries, uint32_t *count)
+{
+	char *	fields[7];
+	char *	field;
+	char *	state = NULL;
+	int		n = 0;
+	bool	separated = false;
+
+	for (field = strtok_r(line, " ", &state); field; field = strtok_r(NULL, " ", &state)) {
+		if (n < 5) {
+			fields[n++] = field;            // id, parent, major:minor, root, mount point
+		} else if (!separated) {
+			separated = strcmp(field, "-") == 0;
+		} else if (n < 7) {
+			fields[n++] = field;            // file system type, source
+		}
+	}
+	if (n < 7) return 0;
+	unescape(fields[4]);
+	unescape(fields[6]);
+	return addEntry(entries, count, fields[6], fields[4]);
+}
+
+static int readMountInfo(struct BLMountTable *table, struct BLMountEntry **outEntries, uint32_t *outCount)
+{
+	struct BLMountEntry *	entries = NULL;
+	uint32_t				count = 0;
+	uint32_t				lines = 0;
+	char *					buf = NULL;
+	size_t					size = 0;
+	size_t					capacity = 0;
+	char *					line;
+	char *					next;
+	ssize_t					got;
+	int						fd = table->watch;
+	int						ret = 0;
+
+	if (fd < 0 || table->watchIsFile) {
+		// A plain file may have been replaced since we opened it
+		fd = open(table->mountInfoPath, O_RDONLY);
+		if (fd < 0) return errno;
+		if (table->watchIsFile && fstat(fd, &table->fileStat) < 0) {
+			ret = errno;
+			goto exit;
+		}
+	} else if (lseek(fd, 0, SEEK_SET) < 0) {
+		return errno;
+	}
+
+	for (;;) {
+		if (capacity - size < 4096) {
+			char *grown = realloc(buf, capacity ? capacity * 2 : 16384);
+
+			if (!grown) {
+				ret = ENOMEM;
+				goto exit;
+			}
+			buf = grown;
+			capacity = capacity ? capacity * 2 : 16384;
+		}
+		got = read(fd, buf + size, capacity - size - 1);
+		if (got < 0) {
+			if (errno == EINTR) continue;
+			ret = errno;
+			goto exit;
+		}
+		if (got == 0) break;
+		size += got;
+	}
+	buf[size] = '\0';
+
+	for (line = buf; *line; line++) {
+		if (*line == '\n') lines++;
+	}
+	entries = calloc(lines + 1, sizeof(*entries));
+	if (!entries) {
+		ret = ENOMEM;
+		goto exit;
+	}
+	for (line = buf; *line; line = next) {
+		next = strchr(line, '\n');
+		if (next) {
+			*next++ = '\0';
+		} else {
+			next = line + strlen(line);
+		}
+		ret = parseMountInfoLine(line, entries, &count);
+		if (ret) goto exit;
+	}
+
+exit:
+	if (fd != table->watch) close(fd);
+	free(buf);
+	*outEntries = entries;
+	*outCount = count;
+	return ret;
+}
+
+// Equal keys keep the system's order, so a lookup finds the first mount like a scan would
+static int compareDevice(const void *a, const void *b)
+{
+	const struct BLMountEntry *ea = *(const struct BLMountEntry * const *)a;
+	const struct BLMountEntry *eb = *(const struct BLMountEntry * const *)b;
+	int c = strcmp(ea->device, eb->device);
+
+	return c ? c : (ea->order > eb->order) - (ea->order < eb->order);
+}
+
+static int compareMountPoint(const void *a, const void *b)
+{
+	const struct BLMountEntry *ea = *(const struct BLMountEntry * const *)a;
+	const struct BLMountEntry *eb = *(const struct BLMountEntry * const *)b;
+	int c = strcmp(ea->mountPoint, eb->mountPoint);
+
+	return c ? c : (ea->order > eb->order) - (ea->order < eb->order);
+}
+
+static int snapshot(BLContextPtr context, struct BLMountTable *table)
+{
+	struct BLMountEntry *	entries = NULL;
+	uint32_t				count = 0;
+	uint32_t				i;
+	int						ret;
+
+	freeEntries(table);
+#ifdef __APPLE__
+	if (!table->mountInfoPath) {
+		ret = readFSStat(&entries, &count);
+	} else
+#endif
+	ret = readMountInfo(table, &entries, &count);
+	table->entries = entries;
+	table->count = count;
+	if (ret) goto fail;
+
+	table->byDevice = calloc(count ? count : 1, sizeof(*table->byDevice));
+	table->byMountPoint = calloc(count ? count : 1, sizeof(*table->byMountPoint));
+	if (!table->byDevice || !table->byMountPoint) {
+		ret = ENOMEM;
+		goto fail;
+	}
+	for (i = 0; i < count; i++) {
+		table->byDevice[i] = &entries[i];
+		table->byMountPoint[i] = &entries[i];
+	}
+	qsort(table->byDevice, count, sizeof(*table->byDevice), compareDevice);
+	qsort(table->byMountPoint, count, sizeof(*table->byMountPoint), compareMountPoint);
+	table->stale = false;
+	table->snapshots++;
+	contextprintf(context, kBLLogLevelVerbose, "Mount table has %u entries\n", count);
+	return 0;
+
+fail:
+	freeEntries(table);
+	contextprintf(context, kBLLogLevelError, "Can't read the mount table: %s\n", strerror(ret));
+	return ret;
+}
+
+// First entry in index whose key (at keyOffset) is key, or NULL
+static struct BLMountEntry *find(struct BLMountEntry **index, uint32_t count, size_t keyOffset, const char *key)
+{
+	uint32_t lo = 0, hi = count, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (strcmp(*(char **)((char *)index[mid] + keyOffset), key) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo < count && strcmp(*(char **)((char *)index[lo] + keyOffset), key) == 0) return index[lo];
+	return NULL;
+}
+
+static int lookup(BLContextPtr context, bool byDevice, const char *key, char *result, int resultLen)
+{
+	struct BLMountTable *	table = BLContextMountTable(context);
+	struct BLMountTable *	oneShot = NULL;
+	struct BLMountEntry *	entry;
+	int						ret = 0;
+
+	if (!table) {
+		// Nothing to keep it in, so take a snapshot just for this
+#ifdef __APPLE__
+		oneShot = createTable(NULL, false);
+#else
+		oneShot = createTable(kBLProcMountInfo, false);
+#endif
+		if (!oneShot) return ENOMEM;
+		table = oneShot;
+	}
+
+	pthread_mutex_lock(&table->lock);
+	table->lookups++;
+	if (generationChanged(table)) table->stale = true;
+	if (table->stale) {
+		ret = snapshot(context, table);
+		if (ret) goto exit;
+	}
+	if (byDevice) {
+		entry = find(table->byDevice, table->count, offsetof(struct BLMountEntry, device), key);
+		if (entry) strlcpy(result, entry->mountPoint, resultLen);
+	} else {
+		entry = find(table->byMountPoint, table->count, offsetof(struct BLMountEntry, mountPoint), key);
+		if (entry) strlcpy(result, entry->device, resultLen);
+	}
+	if (!entry && resultLen > 0) *result = '\0';
+
+exit:
+	pthread_mutex_unlock(&table->lock);
+	BLMountTableRelease(oneShot);
+	return ret;
+}
+
+int BLGetMountPointForDevice(BLContextPtr context, const char *device, char *mountPoint, int mountPointLen)
+{
+	return lookup(context, true, device, mountPoint, mountPointLen);
+}
+
+int BLGetDeviceForMountPoint(BLContextPtr context, const char *mountPoint, char *device, int deviceLen)
+{
+	return lookup(context, false, mountPoint, device, deviceLen);
+}
@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ *  BLNVRAMCache.c
+ *  bless
+ *
+ *  Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#ifdef __APPLE__
+#include <IOKit/IOKitLib.h>
+#include <IOKit/IOKitKeys.h>
+#endif
+
+#include "bless.h"
+#include "bless_private.h"
+
+#ifdef __APPLE__
+#define kBLStatMTime		st_mtimespec
+#else
+#define kBLStatMTime		st_mtim
+#endif
+
+struct BLNVRAMCache {
+	pthread_mutex_t				lock;
+	struct BLNVRAMSnapshot *	snapshot;       // every variable, or NULL until first asked
+	uint64_t					readAt;         // when snapshot was taken, in ns
+	uint32_t					maxAgeMillis;   // 0: until invalidated
+	char *						path;           // a plist standing in for NVRAM, or NULL
+	struct stat					fileStat;
+	uint32_t					hits;
+	uint32_t					misses;
+	uint32_t					invalidations;
+};
+
+static uint64_t monotonicNanos(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+struct BLNVRAMCache *BLNVRAMCacheCreate(uint32_t maxAgeMillis)
+{
+	struct BLNVRAMCache *cache = calloc(1, sizeof(*cache));
+
+	if (!cache) return NULL;
+	pthread_mutex_init(&cache->lock, NULL);
+	cache->maxAgeMillis = maxAgeMillis;
+	cache->readAt = monotonicNanos();
+	return cache;
+}
+
+static int load(BLContextPtr context, struct BLNVRAMCache *cache);
+
+int BLNVRAMCacheCreateWithFile(BLContextPtr context, const char *path, struct BLNVRAMCache **outCache)
+{
+	struct BLNVRAMCache *	cache;
+	int						ret;
+
+	*outCache = NULL;
+	cache = BLNVRAMCacheCreate(0);
+	if (!cache) return ENOMEM;
+	cache->path = strdup(path);
+	ret = cache->path ? 0 : ENOMEM;
+	if (!ret) ret = load(context, cache);
+	if (ret) {
+		BLNVRAMCacheRelease(cache);
+		return ret;
+	}
+	*outCache = cache;
+	return 0;
+}
+
+void BLNVRAMCacheRelease(struct BLNVRAMCache *cache)
+{
+	if (!cache) return;
+	BLNVRAMSnapshotRelease(cache->snapshot);
+	free(cache->path);
+	pthread_mutex_destroy(&cache->lock);
+	free(cache);
+}
+
+static void forget(struct BLNVRAMCache *cache)
+{
+	BLNVRAMSnapshotRelease(cache->snapshot);
+	cache->snapshot = NULL;
+	cache->readAt = monotonicNanos();
+	cache->invalidations++;
+}
+
+void BLNVRAMCacheInvalidate(BLContextPtr context)
+{
+	struct BLNVRAMCache *cache = BLContextNVRAMCache(context);
+
+	if (!cache) return;
+	pthread_mutex_lock(&cache->lock);
+	forget(cache);
+	pthread_mutex_unlock(&cache->lock);
+}
+
+void BLNVRAMCacheGetStatistics(struct BLNVRAMCache *cache, uint32_t *hits, uint32_t *misses, uint32_t *invalidations)
+{
+	pthread_mutex_lock(&cache->lock);
+	if (hits) *hits = cache->hits;
+	if (misses) *misses = cache->misses;
+	if (invalidations) *invalidations = cache->invalidations;
+	pthread_mutex_unlock(&cache->lock);
+}
+
+const char *BLNVRAMCacheGetPath(struct BLNVRAMCache *cache)
+{
+	return cache ? cache->path : NULL;
+}
+
+// A snapshot older than the cache allows, or a stand-in file that changed underneath us
+static bool isStale(struct BLNVRAMCache *cache)
+{
+	struct stat sb;
+
+	if (!cache->snapshot) return false;
+	if (cache->path) {
+		if (stat(cache->path, &sb) < 0) return true;
+		return sb.st_ino != cache->fileStat.st_ino || sb.st_size != cache->fileStat.st_size ||
+				memcmp(&sb.kBLStatMTime, &cache->fileStat.kBLStatMTime, sizeof sb.kBLStatMTime) != 0;
+	}
+	return cache->maxAgeMillis && monotonicNanos() - cache->readAt > cache->maxAgeMillis * 1000000ULL;
+}
+
+static int load(BLContextPtr context, struct BLNVRAMCache *cache)
+{
+	int ret;
+
+	if (cache->path) {
+		if (stat(cache->path, &cache->fileStat) < 0) return errno;
+		ret = BLNVRAMSnapshotCreateWithFile(context, cache->path, &cache->snapshot);
+	} else {
+		ret = BLNVRAMSnapshotCreate(context, &cache->snapshot);
+	}
+	cache->readAt = monotonicNanos();
+	return ret;
+}
+
+// The cache's snapshot, taking a new one if it has none or it's stale. Called locked
+static int current(BLContextPtr context, struct BLNVRAMCache *cache)
+{
+	if (isStale(cache)) forget(cache);
+	if (cache->snapshot) {
+		cache->hits++;
+		return 0;
+	}
+	cache->misses++;
+	return load(context, cache);
+}
+
+int BLCopyNVRAMSnapshot(BLContextPtr context, struct BLNVRAMSnapshot **snapshot)
+{
+	struct BLNVRAMCache *	cache = BLContextNVRAMCache(context);
+	int						ret;
+
+	*snapshot = NULL;
+	if (!cache) return BLNVRAMSnapshotCreate(context, snapshot);
+
+	pthread_mutex_lock(&cache->lock);
+	ret = current(context, cache);
+	if (ret == 0) *snapshot = BLNVRAMSnapshotRetain(cache->snapshot);
+	pthread_mutex_unlock(&cache->lock);
+	return ret;
+}
+
+#ifdef __APPLE__
+
+static int readRegistry(BLContextPtr context, CFStringRef name, CFTypeRef *value)
+{
+	io_registry_entry_t options;
+
+	options = IORegistryEntryFromPath(kIOMasterPortDefault, kIODeviceTreePlane ":/options");
+	if (options == IO_OBJECT_NULL) {
+		contextprintf(context, kBLLogLevelError, "Could not find " kIODeviceTreePlane ":/options\n");
+		return ENOENT;
+	}
+	*value = IORegistryEntryCreateCFProperty(options, name, kCFAllocatorDefault, 0);
+	IOObjectRelease(options);
+	return 0;
+}
+
+#else
+
+static int readRegistry(BLContextPtr context, CFStringRef name, CFTypeRef *value)
+{
+	return ENOTSUP;
+}
+
+#endif /* __APPLE__ */
+
+int BLCopyNVRAMVariable(BLContextPtr context, CFStringRef name, CFTypeRef *value)
+{
+	struct BLNVRAMCache *	cache = BLContextNVRAMCache(context);
+	CFTypeRef				found;
+	int						ret;
+
+	*value = NULL;
+	// Without a cache, one variable is cheaper to ask for than the whole table
+	if (!cache) return readRegistry(context, name, value);
+
+	pthread_mutex_lock(&cache->lock);
+	ret = current(context, cache);
+	if (ret == 0) {
+		found = BLNVRAMSnapshotGetValue(cache->snapshot, name);
+		if (found) *value = CFRetain(found);
+	}
+	pthread_mutex_unlock(&cache->lock);
+	return ret;
+}
@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ *  BLNVRAMSnapshot.c
+ *  bless
+ *
+ *  Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#ifdef __APPLE__
+#include <IOKit/IOKitLib.h>
+#include <IOKit/IOKitKeys.h>
+#endif
+
+#include "bless.h"
+#include "bless_private.h"
+
+struct BLNVRAMSnapshot {
+	atomic_uint					refcount;
+	CFDictionaryRef				values;         // every variable, by name
+	pthread_mutex_t				lock;
+	CFMutableDictionaryRef		strings;        // data values as strings, made when first asked for
+	CFMutableDictionaryRef		extras;         // asked for by name, kCFNull if unset
+#ifdef __APPLE__
+	io_registry_entry_t			options;
+#endif
+};
+
+struct BLNVRAMSnapshot *BLNVRAMSnapshotCreateWithDictionary(CFDictionaryRef values)
+{
+	struct BLNVRAMSnapshot *snapshot = calloc(1, sizeof(*snapshot));
+
+	if (!snapshot) return NULL;
+	snapshot->strings = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks,
+												  &kCFTypeDictionaryValueCallBacks);
+	snapshot->extras = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks,
+												 &kCFTypeDictionaryValueCallBacks);
+	if (!snapshot->strings || !snapshot->extras) {
+		if (snapshot->strings) CFRelease(snapshot->strings);
+		if (snapshot->extras) CFRelease(snapshot->extras);
+		free(snapshot);
+		return NULL;
+	}
+	atomic_init(&snapshot->refcount, 1);
+	pthread_mutex_init(&snapshot->lock, NULL);
+	snapshot->values = CFRetain(values);
+	return snapshot;
+}
+
+#ifdef __APPLE__
+
+int BLNVRAMSnapshotCreate(BLContextPtr context, struct BLNVRAMSnapshot **outSnapshot)
+{
+	io_registry_entry_t		options;
+	CFMutableDictionaryRef	values = NULL;
+	kern_return_t			kret;
+	uint64_t				span = BLTraceBegin(context);
+
+	*outSnapshot = NULL;
+	options = IORegistryEntryFromPath(kIOMasterPortDefault, kIODeviceTreePlane ":/options");
+	if (options == IO_OBJECT_NULL) {
+		contextprintf(context, kBLLogLevelError, "Could not find " kIODeviceTreePlane ":/options\n");
+		return ENOENT;
+	}
+	// The whole property table in one call, rather than a call per variable
+	kret = IORegistryEntryCreateCFProperties(options, &values, kCFAllocatorDefault, 0);
+	if (kret != KERN_SUCCESS || values == NULL) {
+		IOObjectRelease(options);
+		contextprintf(context, kBLLogLevelError, "Could not read NVRAM variables: %#x\n", kret);
+		return EIO;
+	}
+	*outSnapshot = BLNVRAMSnapshotCreateWithDictionary(values);
+	CFRelease(values);
+	if (*outSnapshot == NULL) {
+		IOObjectRelease(options);
+		return ENOMEM;
+	}
+	// Kept for variables the table leaves out
+	(*outSnapshot)->options = options;
+	BLTraceEnd(context, span, "NVRAMSnapshot", NULL);
+	return 0;
+}
+
+#else
+
+int BLNVRAMSnapshotCreate(BLContextPtr context, struct BLNVRAMSnapshot **outSnapshot)
+{
+	*outSnapshot = NULL;
+	return ENOTSUP;
+}
+
+#endif /* __APPLE__ */
+
+int BLNVRAMSnapshotCreateWithFile(BLContextPtr context, const char *path, struct BLNVRAMSnapshot **outSnapshot)
+{
+	CFDataRef	data = NULL;
+	CFTypeRef	plist;
+	int			ret;
+
+	*outSnapshot = NULL;
+	ret = BLLoadFile(context, path, 0, &data);
+	if (ret) return ret;
+	plist = CFPropertyListCreateWithData(kCFAllocatorDefault, data, kCFPropertyListImmutable, NULL, NULL);
+	CFRelease(data);
+	if (!plist || CFGetTypeID(plist) != CFDictionaryGetTypeID()) {
+		if (plist) CFRelease(plist);
+		contextprintf(context, kBLLogLevelError, "%s is not a dictionary of NVRAM variables\n", path);
+		return EINVAL;
+	}
+	*outSnapshot = BLNVRAMSnapshotCreateWithDictionary(plist);
+	CFRelease(plist);
+	return *outSnapshot ? 0 : ENOMEM;
+}
+
+struct BLNVRAMSnapshot *BLNVRAMSnapshotRetain(struct BLNVRAMSnapshot *snapshot)
+{
+	if (snapshot) atomic_fetch_add_explicit(&snapshot->refcount, 1, memory_order_relaxed);
+	return snapshot;
+}
+
+void BLNVRAMSnapshotRelease(struct BLNVRAMSnapshot *snapshot)
+{
+	if (!snapshot) return;
+	if (atomic_fetch_sub_explicit(&snapshot->refcount, 1, memory_order_acq_rel) != 1) return;
+	CFRelease(snapshot->values);
+	CFRelease(snapshot->strings);
+	CFRelease(snapshot->extras);
+#ifdef __APPLE__
+	if (snapshot->options != IO_OBJECT_NULL) IOObjectRelease(snapshot->options);
+#endif
+	pthread_mutex_destroy(&snapshot->lock);
+	free(snapshot);
+}
+
+CFDictionaryRef BLNVRAMSnapshotGetValues(struct BLNVRAMSnapshot *snapshot)
+{
+	return snapshot->values;
+}
+
+/*
+ * The property table may leave out variables outside Apple's namespace,
+ * like the EFI global ones (BootOrder, Boot####), on some kernels. Those
+ * are asked for by name the first time and remembered, set or not.
+ */
+CFTypeRef BLNVRAMSnapshotGetValue(struct BLNVRAMSnapshot *snapshot, CFStringRef name)
+{
+	CFTypeRef value = CFDictionaryGetValue(snapshot->values, name);
+
+#ifdef __APPLE__
+	if (value || snapshot->options == IO_OBJECT_NULL) return value;
+
+	pthread_mutex_lock(&snapshot->lock);
+	value = CFDictionaryGetValue(snapshot->extras, name);
+	if (!value) {
+		value = IORegistryEntryCreateCFProperty(snapshot->options, name, kCFAllocatorDefault, 0);
+		CFDictionarySetValue(snapshot->extras, name, value ? value : kCFNull);
+		if (value) CFRelease(value);    // extras keeps it
+	}
+	pthread_mutex_unlock(&snapshot->lock);
+	if (value == kCFNull) value = NULL;
+#endif
+	return value;
+}
+
+CFDataRef BLNVRAMSnapshotGetData(struct BLNVRAMSnapshot *snapshot, CFStringRef name)
+{
+	CFTypeRef value = BLNVRAMSnapshotGetValue(snapshot, name);
+
+	return (value && CFGetTypeID(value) == CFDataGetTypeID()) ? value : NULL;
+}
+
+CFStringRef BLNVRAMSnapshotGetString(BLContextPtr context, struct BLNVRAMSnapshot *snapshot, CFStringRef name)
+{
+	CFTypeRef	value = BLNVRAMSnapshotGetValue(snapshot, name);
+	CFStringRef	string = NULL;
+
+	if (!value) return NULL;
+	if (CFGetTypeID(value) == CFStringGetTypeID()) return value;
+
+	// Converted once, and kept as long as the snapshot is
+	pthread_mutex_lock(&snapshot->lock);
+	string = CFDictionaryGetValue(snapshot->strings, name);
+	if (!string && BLCreateStringFromNVRAMValue(context, value, &string) == 0) {
+		CFDictionarySetValue(snapshot->strings, name, string);
+		CFRelease(string);
+	}
+	pthread_mutex_unlock(&snapshot->lock);
+	return string;
+}
+
+const uint16_t *BLNVRAMSnapshotGetUTF16(struct BLNVRAMSnapshot *snapshot, CFStringRef name, size_t *count)
+{
+	CFDataRef		data = BLNVRAMSnapshotGetData(snapshot, name);
+	const uint8_t *	bytes;
+
+	*count = 0;
+	if (!data) return NULL;
+	bytes = CFDataGetBytePtr(data);
+	// CFData storage is malloc-aligned; anything else can't be read in place
+	if ((uintptr_t)bytes & (sizeof(uint16_t) - 1)) return NULL;
+	*count = (size_t)CFDataGetLength(data) / sizeof(uint16_t);
+	return (const uint16_t *)bytes;
+}
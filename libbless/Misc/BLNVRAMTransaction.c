@@ -0,0 +1,396 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ *  BLNVRAMTransaction.c
+ *  bless
+ *
+ *  Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#ifdef __APPLE__
+#include <IOKit/IOKitLib.h>
+#include <IOKit/IOKitKeys.h>
+#endif
+
+#include "bless.h"
+#include "bless_private.h"
+
+struct BLNVRAMTransaction {
+	BLContextPtr				context;
+	CFMutableDictionaryRef		current;        // every variable, as the store has it
+	CFMutableDictionaryRef		staged;         // name -> new value, kCFNull to delete
+	CFMutableArrayRef			order;          // staged names, first staged first
+	const char *				path;           // a plist standing in for NVRAM, or NULL
+#ifdef __APPLE__
+	io_registry_entry_t			options;
+#endif
+	BLNVRAMTransactionStats		stats;
+	uint64_t					span;
+};
+
+static void releaseTransaction(struct BLNVRAMTransaction *txn)
+{
+	if (txn->current) CFRelease(txn->current);
+	if (txn->staged) CFRelease(txn->staged);
+	if (txn->order) CFRelease(txn->order);
+#ifdef __APPLE__
+	if (txn->options != IO_OBJECT_NULL) IOObjectRelease(txn->options);
+#endif
+	BLNVRAMCacheInvalidate(txn->context);
+	BLUnlockNVRAM();
+	free(txn);
+}
+
+int BLNVRAMTransactionBegin(BLContextPtr context, struct BLNVRAMTransaction **outTxn)
+{
+	struct BLNVRAMTransaction *	txn;
+	struct BLNVRAMSnapshot *	snapshot = NULL;
+	int							ret;
+
+	*outTxn = NULL;
+	txn = calloc(1, sizeof(*txn));
+	if (!txn) return 1;
+
+	// Held until commit or abort, so what's read here is what gets compared
+	BLLockNVRAM();
+	BLNVRAMCacheInvalidate(context);
+	txn->context = context;
+	txn->span = BLTraceBegin(context);
+	txn->path = BLNVRAMCacheGetPath(BLContextNVRAMCache(context));
+	txn->staged = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks,
+											&kCFTypeDictionaryValueCallBacks);
+	txn->order = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
+	if (!txn->staged || !txn->order) {
+		ret = ENOMEM;
+		goto exit;
+	}
+
+	// The same snapshot --info and validation read, taken fresh since the cache was just emptied
+	ret = BLCopyNVRAMSnapshot(context, &snapshot);
+	if (ret) goto exit;
+	txn->current = CFDictionaryCreateMutableCopy(kCFAllocatorDefault, 0, BLNVRAMSnapshotGetValues(snapshot));
+	BLNVRAMSnapshotRelease(snapshot);
+	if (!txn->current) {
+		ret = ENOMEM;
+		goto exit;
+	}
+
+#ifdef __APPLE__
+	if (!txn->path) {
+		txn->options = IORegistryEntryFromPath(kIOMasterPortDefault, kIODeviceTreePlane ":/options");
+		if (txn->options == IO_OBJECT_NULL) {
+			contextprintf(context, kBLLogLevelError, "Could not find " kIODeviceTreePlane ":/options\n");
+			ret = ENOENT;
+		}
+	}
+#endif
+
+exit:
+	if (ret) {
+		releaseTransaction(txn);
+		return 1;
+	}
+	*outTxn = txn;
+	return 0;
+}
+
+// What the store has for name. The property table may leave some variables out; ask for those by name
+static CFTypeRef currentValue(struct BLNVRAMTransaction *txn, CFStringRef name)
+{
+	CFTypeRef value = CFDictionaryGetValue(txn->current, name);
+
+#ifdef __APPLE__
+	if (!value && txn->options != IO_OBJECT_NULL) {
+		value = IORegistryEntryCreateCFProperty(txn->options, name, kCFAllocatorDefault, 0);
+		if (value) {
+			CFDictionarySetValue(txn->current, name, value);
+			CFRelease(value);   // current keeps it
+		}
+	}
+#endif
+	return value;
+}
+
+int BLNVRAMTransactionCopyValue(struct BLNVRAMTransaction *txn, CFStringRef name, CFTypeRef *value)
+{
+	CFTypeRef found;
+
+	found = CFDictionaryGetValue(txn->staged, name);
+	if (!found) found = currentValue(txn, name);
+	*value = (found && found != kCFNull) ? CFRetain(found) : NULL;
+	return 0;
+}
+
+int BLNVRAMTransactionSetValue(struct BLNVRAMTransaction *txn, CFStringRef name, CFTypeRef value)
+{
+	if (!CFDictionaryContainsKey(txn->staged, name)) {
+		CFArrayAppendValue(txn->order, name);
+	}
+	CFDictionarySetValue(txn->staged, name, value ? value : kCFNull);
+	return 0;
+}
+
+int BLNVRAMTransactionDeleteValue(struct BLNVRAMTransaction *txn, CFStringRef name)
+{
+	return BLNVRAMTransactionSetValue(txn, name, NULL);
+}
+
+// Bytes a value takes in NVRAM, for the statistics. Strings are stored as UTF-8
+static uint64_t valueSize(CFTypeRef value)
+{
+	CFIndex used = 0;
+
+	if (CFGetTypeID(value) == CFDataGetTypeID()) {
+		return (uint64_t)CFDataGetLength(value);
+	}
+	if (CFGetTypeID(value) == CFStringGetTypeID()) {
+		CFStringGetBytes(value, CFRangeMake(0, CFStringGetLength(value)), kCFStringEncodingUTF8, 0, false,
+						 NULL, 0, &used);
+		return (uint64_t)used;
+	}
+	return 0;
+}
+
+// The registry hands some string variables back as data, so compare those by their bytes
+static bool sameValue(CFTypeRef current, CFTypeRef staged)
+{
+	CFDataRef	data;
+	CFStringRef	string;
+	CFDataRef	bytes;
+	bool		same;
+
+	if (CFEqual(current, staged)) return true;
+	if (CFGetTypeID(current) == CFDataGetTypeID() && CFGetTypeID(staged) == CFStringGetTypeID()) {
+		data = current;
+		string = staged;
+	} else if (CFGetTypeID(current) == CFStringGetTypeID() && CFGetTypeID(staged) == CFDataGetTypeID()) {
+		data = staged;
+		string = current;
+	} else {
+		return false;
+	}
+	bytes = CFStringCreateExternalRepresentation(kCFAllocatorDefault, string, kCFStringEncodingUTF8, 0);
+	if (!bytes) return false;
+	same = CFEqual(bytes, data);
+	CFRelease(bytes);
+	return same;
+}
+
+static void logWrite(BLContextPtr context, CFStringRef name, CFTypeRef value)
+{
+	char	nameStr[128];
+	char *	valueStr;
+	CFIndex	size;
+
+	if (!contextprintfenabled(context, kBLLogLevelVerbose)) return;
+	BLCopyCStringDescription(name, nameStr, sizeof nameStr);
+	if (value == kCFNull) {
+		contextprintf(context, kBLLogLevelVerbose, "Deleting EFI NVRAM:\n\t%s\n", nameStr);
+		return;
+	}
+	contextprintf(context, kBLLogLevelVerbose, "Setting EFI NVRAM:\n");
+	if (CFGetTypeID(value) == CFStringGetTypeID()) {
+		// Sized for the value; device path XML can run well past a page
+		size = CFStringGetMaximumSizeForEncoding(CFStringGetLength(value), kCFStringEncodingUTF8) + 1;
+		valueStr = malloc(size);
+		if (valueStr && CFStringGetCString(value, valueStr, size, kCFStringEncodingUTF8)) {
+			contextprintf(context, kBLLogLevelVerbose, "\t%s='%s'\n", nameStr, valueStr);
+		}
+		free(valueStr);
+	} else {
+		contextprintf(context, kBLLogLevelVerbose, "\t%s='...'\n", nameStr);
+	}
+}
+
+#ifdef __APPLE__
+
+static int writeRegistry(struct BLNVRAMTransaction *txn, CFStringRef name, CFTypeRef value)
+{
+	kern_return_t	kret;
+	char			nameStr[128];
+
+	if (value == kCFNull) {
+		kret = IORegistryEntrySetCFProperty(txn->options, CFSTR(kIONVRAMDeletePropertyKey), name);
+	} else {
+		kret = IORegistryEntrySetCFProperty(txn->options, name, value);
+	}
+	if (kret) {
+		contextprintf(txn->context, kBLLogLevelError, "Could not %s NVRAM variable '%s': %#x\n",
+					  value == kCFNull ? "delete" : "set",
+					  BLCopyCStringDescription(name, nameStr, sizeof nameStr), kret);
+		return 2;
+	}
+	return 0;
+}
+
+#endif /* __APPLE__ */
+
+static int writeFile(struct BLNVRAMTransaction *txn)
+{
+	CFDataRef	data;
+	int			ret;
+
+	data = CFPropertyListCreateData(kCFAllocatorDefault, txn->current, kCFPropertyListXMLFormat_v1_0, 0, NULL);
+	if (!data) return 2;
+	ret = BLReplaceFileFromCFData(txn->context, data, txn->path, kNoPreallocate);
+	CFRelease(data);
+	if (ret) {
+		contextprintf(txn->context, kBLLogLevelError, "Could not write NVRAM variables to %s\n", txn->path);
+		return 2;
+	}
+	return 0;
+}
+
+/*
+ * Setting these makes the kernel derive the variables firmware boots from
+ * (efi-boot-device-data, BootNext, efi-legacy-drive-hint-data), which may
+ * have gone stale while the XML stayed the same. They're written even
+ * when unchanged; only deleting one that isn't set is skipped.
+ */
+static bool isTrigger(CFStringRef name)
+{
+	return CFEqual(name, CFSTR("efi-boot-device")) || CFEqual(name, CFSTR("efi-boot-next"))
+		|| CFEqual(name, CFSTR("efi-legacy-drive-hint"));
+}
+
+/*
+ * Write what's staged that differs from the store, and forget it. The
+ * registry takes each variable as it comes; a file store is rewritten
+ * once at the end, and only if something changed.
+ */
+static int flush(struct BLNVRAMTransaction *txn)
+{
+	CFIndex		i, count = CFArrayGetCount(txn->order);
+	CFStringRef	name;
+	CFTypeRef	value, current;
+	uint32_t	changed = 0;
+	int			ret = 0;
+
+	for (i = 0; i < count; i++) {
+		name = CFArrayGetValueAtIndex(txn->order, i);
+		value = CFDictionaryGetValue(txn->staged, name);
+		current = currentValue(txn, name);
+
+		if (value == kCFNull ? current == NULL
+			: (current != NULL && !isTrigger(name) && sameValue(current, value))) {
+			txn->stats.unchanged++;
+			continue;
+		}
+
+		logWrite(txn->context, name, value);
+#ifdef __APPLE__
+		if (!txn->path) {
+			ret = writeRegistry(txn, name, value);
+			if (ret) break;
+		}
+#endif
+		if (value == kCFNull) {
+			CFDictionaryRemoveValue(txn->current, name);
+			txn->stats.deleted++;
+		} else {
+			CFDictionarySetValue(txn->current, name, value);
+			txn->stats.written++;
+			txn->stats.bytesWritten += valueSize(value);
+		}
+		changed++;
+	}
+
+	if (ret == 0 && txn->path && changed) {
+		ret = writeFile(txn);
+	}
+	CFDictionaryRemoveAllValues(txn->staged);
+	CFArrayRemoveAllValues(txn->order);
+	return ret;
+}
+
+int BLNVRAMTransactionForward(struct BLNVRAMTransaction *txn, CFStringRef from, CFStringRef to)
+{
+	CFTypeRef	value = NULL;
+	char		fromName[128];
+	int			ret;
+
+	// Everything staged so far reaches the store now; an abort after this
+	// drops only what is staged later
+	ret = flush(txn);
+	if (ret) return ret;
+
+	// The kernel may have derived from from what was just written, so ask the store
+#ifdef __APPLE__
+	if (!txn->path) {
+		value = IORegistryEntryCreateCFProperty(txn->options, from, kCFAllocatorDefault, 0);
+		if (value) CFDictionarySetValue(txn->current, from, value);
+	}
+#endif
+	if (txn->path) {
+		value = CFDictionaryGetValue(txn->current, from);
+		if (value) CFRetain(value);
+	}
+	if (value == NULL) {
+		contextprintf(txn->context, kBLLogLevelError, "Could not find variable '%s'\n",
+					  BLCopyCStringDescription(from, fromName, sizeof fromName));
+		return 2;
+	}
+
+	BLNVRAMTransactionSetValue(txn, to, value);
+	CFRelease(value);
+	return 0;
+}
+
+int BLNVRAMTransactionCommit(struct BLNVRAMTransaction *txn, BLNVRAMTransactionStats *stats)
+{
+	BLContextPtr	context = txn->context;
+	uint64_t		span = txn->span;
+	char			detail[64];
+	int				ret;
+
+	ret = flush(txn);
+
+	contextprintf(context, kBLLogLevelVerbose, "NVRAM: %u variable(s) written (%llu bytes), %u deleted, %u unchanged\n",
+				  txn->stats.written, (unsigned long long)txn->stats.bytesWritten, txn->stats.deleted,
+				  txn->stats.unchanged);
+	snprintf(detail, sizeof detail, "%u written, %u deleted, %u unchanged",
+			 txn->stats.written, txn->stats.deleted, txn->stats.unchanged);
+	if (stats) *stats = txn->stats;
+
+	releaseTransaction(txn);
+	BLTraceEnd(context, span, "NVRAMCommit", detail);
+	return ret;
+}
+
+void BLNVRAMTransactionAbort(struct BLNVRAMTransaction *txn)
+{
+	if (!txn) return;
+	if (CFArrayGetCount(txn->order)) {
+		contextprintf(txn->context, kBLLogLevelVerbose, "NVRAM: %ld staged change(s) not written\n",
+					  (long)CFArrayGetCount(txn->order));
+	}
+	BLTraceEnd(txn->context, txn->span, "NVRAMAbort", NULL);
+	releaseTransaction(txn);
+}
@@ -32,6 +32,7 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "bless.h"
 #include "bless_private.h"
@@ -59,7 +60,6 @@ int BLPreserveBootArgsIfChanged(BLContextPtr context,
 {
     char oldbootargs[1024];
     char bootargs[1024];
-    size_t bootleft=sizeof(bootargs)-1;
     char *token, *restargs;
     int firstarg=1;
     bool changed=false;
@@ -102,13 +102,11 @@ int BLPreserveBootArgsIfChanged(BLContextPtr context,
             if(firstarg) {
                 firstarg = 0;
             } else {
-                strncat(bootargs, " ", bootleft);
-                bootleft--;
+                strlcat(bootargs, " ", sizeof(bootargs));
             }
             
             contextprintf(context, kBLLogLevelVerbose,  "\tPreserving: %s\n", token);
-            strncat(bootargs, token, bootleft);
-            bootleft -= strlen(token);
+            strlcat(bootargs, token, sizeof(bootargs));
         }
     }
     
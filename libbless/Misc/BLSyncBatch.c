@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ *  BLSyncBatch.c
+ *  bless
+ *
+ *  Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include "bless.h"
+#include "bless_private.h"
+
+struct BLSyncBatch {
+	pthread_mutex_t lock;
+	char **         directories;
+	uint32_t        count;
+	uint32_t        capacity;
+};
+
+struct BLSyncBatch *BLSyncBatchCreate(void)
+{
+	struct BLSyncBatch *batch = calloc(1, sizeof(*batch));
+
+	if (batch) pthread_mutex_init(&batch->lock, NULL);
+	return batch;
+}
+
+void BLSyncBatchRelease(struct BLSyncBatch *batch)
+{
+	uint32_t i;
+
+	if (!batch) return;
+	for (i = 0; i < batch->count; i++) {
+		free(batch->directories[i]);
+	}
+	free(batch->directories);
+	pthread_mutex_destroy(&batch->lock);
+	free(batch);
+}
+
+//
+// Push the disk's write cache out too; a plain fsync() on macOS only gets
+// the data as far as the drive
+//
+static int flushDevice(int fd)
+{
+#ifdef F_FULLFSYNC
+	if (fcntl(fd, F_FULLFSYNC) == 0) return 0;
+#endif
+	return fsync(fd) < 0 ? errno : 0;
+}
+
+static int syncDirectory(BLContextPtr context, const char *directory, bool flush)
+{
+	int fd = open(directory, O_RDONLY);
+	int ret = 0;
+
+	if (fd < 0) {
+		ret = errno;
+	} else {
+		if (flush) {
+			ret = flushDevice(fd);
+		} else if (fsync(fd) < 0) {
+			ret = errno;
+		}
+		close(fd);
+	}
+	if (ret) {
+		contextprintf(context, kBLLogLevelError, "Can't sync %s: %s\n", directory, strerror(ret));
+	}
+	return ret;
+}
+
+int BLSyncDirectory(BLContextPtr context, const char *directory)
+{
+	struct BLSyncBatch *batch = BLContextSyncBatch(context);
+	uint32_t            i;
+	int                 ret = 0;
+
+	if (!batch) return syncDirectory(context, directory, true);
+
+	pthread_mutex_lock(&batch->lock);
+	for (i = 0; i < batch->count; i++) {
+		if (strcmp(batch->directories[i], directory) == 0) goto exit;
+	}
+	if (batch->count == batch->capacity) {
+		uint32_t    capacity = batch->capacity ? batch->capacity * 2 : 8;
+		char **     directories = realloc(batch->directories, capacity * sizeof(*directories));
+
+		if (!directories) {
+			ret = ENOMEM;
+			goto exit;
+		}
+		batch->directories = directories;
+		batch->capacity = capacity;
+	}
+	batch->directories[batch->count] = strdup(directory);
+	if (!batch->directories[batch->count]) {
+		ret = ENOMEM;
+		goto exit;
+	}
+	batch->count++;
+
+exit:
+	pthread_mutex_unlock(&batch->lock);
+	if (ret) {
+		// Can't remember it for later, so do it now
+		ret = syncDirectory(context, directory, true);
+	}
+	return ret;
+}
+
+int BLSyncBatchCommit(BLContextPtr context, struct BLSyncBatch *batch)
+{
+	uint32_t *  flushes = NULL;         // a directory on each device, by index
+	dev_t *     devices = NULL;
+	uint32_t    deviceCount = 0;
+	uint64_t    span = BLTraceBegin(context);
+	uint32_t    i, j;
+	int         err;
+	int         ret = 0;
+
+	pthread_mutex_lock(&batch->lock);
+	if (batch->count) {
+		flushes = calloc(batch->count, sizeof(*flushes));
+		devices = calloc(batch->count, sizeof(*devices));
+	}
+
+	// Every directory gets an fsync...
+	for (i = 0; i < batch->count; i++) {
+		struct stat sb;
+
+		err = syncDirectory(context, batch->directories[i], !flushes || !devices);
+		if (err && !ret) ret = err;
+		if (err || !flushes || !devices || stat(batch->directories[i], &sb) < 0) continue;
+		for (j = 0; j < deviceCount && devices[j] != sb.st_dev; j++) continue;
+		if (j == deviceCount) {
+			devices[deviceCount] = sb.st_dev;
+			flushes[deviceCount++] = i;
+		}
+	}
+
+	// ...then each device gets one cache flush
+	for (j = 0; j < deviceCount; j++) {
+		err = syncDirectory(context, batch->directories[flushes[j]], true);
+		if (err && !ret) ret = err;
+	}
+	contextprintf(context, kBLLogLevelVerbose, "Synced %u directories on %u devices\n", batch->count, deviceCount);
+
+	for (i = 0; i < batch->count; i++) {
+		free(batch->directories[i]);
+	}
+	batch->count = 0;
+	pthread_mutex_unlock(&batch->lock);
+
+	free(flushes);
+	free(devices);
+	BLTraceEnd(context, span, "BLSyncBatchCommit", NULL);
+	return ret;
+}
+
+void BLTemporaryPathFor(const char *path, char *tmpPath, size_t size)
+{
+	const char *slash = strrchr(path, '/');
+
+	if (slash) {
+		snprintf(tmpPath, size, "%.*s/.%s.XXXXXX", (int)(slash - path), path, slash + 1);
+	} else {
+		snprintf(tmpPath, size, ".%s.XXXXXX", path);
+	}
+}
+
+// Sync the directory path is in, now or with the batch
+static int syncParent(BLContextPtr context, const char *path)
+{
+	char    directory[MAXPATHLEN];
+	char *  slash;
+
+	strlcpy(directory, path, sizeof directory);
+	slash = strrchr(directory, '/');
+	if (!slash) {
+		strlcpy(directory, ".", sizeof directory);
+	} else if (slash == directory) {
+		slash[1] = '\0';
+	} else {
+		*slash = '\0';
+	}
+	return BLSyncDirectory(context, directory);
+}
+
+int BLCommitTemporaryFile(BLContextPtr context, int fd, const char *tmpPath, const char *dest)
+{
+	int ret = 0;
+
+	if (fsync(fd) < 0) ret = errno;
+	if (close(fd) < 0 && !ret) ret = errno;
+	if (!ret && rename(tmpPath, dest) < 0) ret = errno;
+	if (ret) {
+		unlink(tmpPath);
+		return ret;
+	}
+	return syncParent(context, dest);
+}
+
+int BLCommitFileInPlace(BLContextPtr context, int fd, const char *path)
+{
+	int ret = 0;
+
+	if (fsync(fd) < 0) ret = errno;
+	if (close(fd) < 0 && !ret) ret = errno;
+	if (ret) return ret;
+
+	// Nothing was renamed, but the directory's sync is what flushes the device's cache
+	return syncParent(context, path);
+}
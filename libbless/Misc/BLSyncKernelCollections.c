@@ -0,0 +1,845 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ *  BLSyncKernelCollections.c
+ *  bless
+ *
+ *  Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ */
+
+#if !defined(__APPLE__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE     // copy_file_range()
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <CommonCrypto/CommonDigest.h>
+#ifdef __APPLE__
+#include <sys/clonefile.h>
+#endif
+
+#include "bless.h"
+#include "bless_private.h"
+
+#define kKCSyncMaxWorkers       8
+#define kKCSyncDefaultWorkers   4
+#define kKCSyncBufferSize       0x100000    // 1 MiB
+#define kKCSyncHashSize         CC_SHA256_DIGEST_LENGTH
+#define kKCSyncCacheHeader      "# bless kernel collection cache 1\n"
+
+/*
+ * What we remember about a file without reading it. Any write through
+ * the file system moves the ctime, so if none of these changed since we
+ * last hashed the file, neither did its contents.
+ */
+typedef struct {
+	uint64_t    size;
+	uint64_t    mtime;
+	uint64_t    ctime;
+	uint64_t    ino;
+} fileIdentity;
+
+typedef struct {
+	char *          name;
+	fileIdentity    src;
+	fileIdentity    dst;
+	bool            hasHash;
+	uint8_t         hash[kKCSyncHashSize];
+} cacheEntry;
+
+typedef struct {
+	const char *        name;
+	fileIdentity        src;
+	bool                dstExists;
+	fileIdentity        dst;
+	const cacheEntry *  cached;
+
+	// filled in by the worker
+	int                 status;
+	const char *        failure;        // what failed, if status is set
+	bool                copied;
+	bool                hasHash;
+	uint8_t             hash[kKCSyncHashSize];
+	uint64_t            bytesHashed;
+	uint64_t            bytesCopied;
+	bool                cloned;
+	bool                patched;
+} syncItem;
+
+struct syncqueue {
+	BLContextPtr    context;
+	const char *    systemKCPath;
+	const char *    prebootKCPath;
+	syncItem **     items;
+	uint32_t        count;
+	uint32_t        next;
+	pthread_mutex_t lock;
+};
+
+#pragma mark File identity
+
+static void statIdentity(const struct stat *sb, fileIdentity *identity)
+{
+	identity->size = (uint64_t)sb->st_size;
+#ifdef __APPLE__
+	identity->mtime = (uint64_t)sb->st_mtimespec.tv_sec * 1000000000ULL + (uint64_t)sb->st_mtimespec.tv_nsec;
+	identity->ctime = (uint64_t)sb->st_ctimespec.tv_sec * 1000000000ULL + (uint64_t)sb->st_ctimespec.tv_nsec;
+#else
+	identity->mtime = (uint64_t)sb->st_mtim.tv_sec * 1000000000ULL + (uint64_t)sb->st_mtim.tv_nsec;
+	identity->ctime = (uint64_t)sb->st_ctim.tv_sec * 1000000000ULL + (uint64_t)sb->st_ctim.tv_nsec;
+#endif
+	identity->ino = (uint64_t)sb->st_ino;
+}
+
+static bool sameIdentity(const fileIdentity *a, const fileIdentity *b)
+{
+	return a->size == b->size && a->mtime == b->mtime && a->ctime == b->ctime && a->ino == b->ino;
+}
+
+#pragma mark Directory listing
+
+static bool hasSuffix(const char *str, const char *suffix)
+{
+	size_t len = strlen(str), suffixLen = strlen(suffix);
+
+	return len >= suffixLen && strcmp(str + len - suffixLen, suffix) == 0;
+}
+
+static int compareNames(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static void freeNames(char **names, uint32_t count)
+{
+	uint32_t i;
+
+	if (!names) return;
+	for (i = 0; i < count; i++) free(names[i]);
+	free(names);
+}
+
+//
+// Sorted names of the regular files in directory that start with the
+// kernel collection prefix. img4 manifests are left out when skipManifests
+// is set, so they're never seen as stale.
+//
+static int listKernelCollections(const char *directory, bool skipManifests, char ***outNames, uint32_t *outCount)
+{
+	DIR *           dp;
+	struct dirent * dirent;
+	struct stat     sb;
+	char            path[MAXPATHLEN];
+	char **         names = NULL;
+	uint32_t        count = 0, capacity = 0;
+	size_t          prefixLen = strlen(kBL_NAME_BOOTKERNELEXTENSIONS);
+	int             ret = 0;
+
+	*outNames = NULL;
+	*outCount = 0;
+
+	dp = opendir(directory);
+	if (!dp) return errno;
+
+	while ((dirent = readdir(dp)) != NULL) {
+		if (strncmp(dirent->d_name, kBL_NAME_BOOTKERNELEXTENSIONS, prefixLen) != 0) continue;
+		if (skipManifests && hasSuffix(dirent->d_name, ".im4m")) continue;
+		if (snprintf(path, sizeof path, "%s/%s", directory, dirent->d_name) >= (int)sizeof path) continue;
+		if (stat(path, &sb) < 0) {
+			ret = errno;
+			break;
+		}
+		if (!S_ISREG(sb.st_mode)) continue;
+		if (count == capacity) {
+			char **newNames;
+
+			capacity = capacity ? capacity * 2 : 16;
+			newNames = realloc(names, capacity * sizeof(*names));
+			if (!newNames) {
+				ret = ENOMEM;
+				break;
+			}
+			names = newNames;
+		}
+		names[count] = strdup(dirent->d_name);
+		if (!names[count]) {
+			ret = ENOMEM;
+			break;
+		}
+		count++;
+	}
+	closedir(dp);
+
+	if (ret) {
+		freeNames(names, count);
+		return ret;
+	}
+	if (count) qsort(names, count, sizeof(*names), compareNames);
+	*outNames = names;
+	*outCount = count;
+	return 0;
+}
+
+#pragma mark Hash cache
+
+static void hashToHex(const uint8_t hash[kKCSyncHashSize], char hex[kKCSyncHashSize * 2 + 1])
+{
+	static const char digits[] = "0123456789abcdef";
+	int i;
+
+	for (i = 0; i < kKCSyncHashSize; i++) {
+		hex[i * 2] = digits[hash[i] >> 4];
+		hex[i * 2 + 1] = digits[hash[i] & 0xf];
+	}
+	hex[kKCSyncHashSize * 2] = '\0';
+}
+
+static bool hexToHash(const char *hex, uint8_t hash[kKCSyncHashSize])
+{
+	int i;
+
+	if (strlen(hex) != kKCSyncHashSize * 2) return false;
+	for (i = 0; i < kKCSyncHashSize; i++) {
+		unsigned int byte;
+
+		if (sscanf(hex + i * 2, "%2x", &byte) != 1) return false;
+		hash[i] = (uint8_t)byte;
+	}
+	return true;
+}
+
+static void freeCache(cacheEntry *entries, uint32_t count)
+{
+	uint32_t i;
+
+	if (!entries) return;
+	for (i = 0; i < count; i++) free(entries[i].name);
+	free(entries);
+}
+
+static int compareCacheEntries(const void *a, const void *b)
+{
+	return strcmp(((const cacheEntry *)a)->name, ((const cacheEntry *)b)->name);
+}
+
+//
+// The cache is a text file with a header line, then one line per file:
+//
+//   name  src size mtime ctime ino  dst size mtime ctime ino  sha256|-
+//
+// tab-separated, times in nanoseconds. A missing or unreadable cache is
+// the same as an empty one; it only saves work.
+//
+static void loadCache(BLContextPtr context, const char *path, cacheEntry **outEntries, uint32_t *outCount)
+{
+	FILE *          f;
+	char            line[MAXPATHLEN + 512];
+	cacheEntry *    entries = NULL;
+	uint32_t        count = 0, capacity = 0;
+
+	*outEntries = NULL;
+	*outCount = 0;
+
+	f = fopen(path, "r");
+	if (!f) return;
+
+	if (!fgets(line, sizeof line, f) || strcmp(line, kKCSyncCacheHeader) != 0) {
+		contextprintf(context, kBLLogLevelVerbose, "Ignoring kernel collection cache %s with unknown format\n", path);
+		fclose(f);
+		return;
+	}
+
+	while (fgets(line, sizeof line, f)) {
+		char                name[MAXPATHLEN];
+		char                hex[kKCSyncHashSize * 2 + 2];
+		unsigned long long  v[8];
+		cacheEntry          entry;
+
+		if (sscanf(line, "%1023[^\t]\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%65s",
+				   name, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], hex) != 10) {
+			continue;
+		}
+		if (count == capacity) {
+			cacheEntry *newEntries;
+
+			capacity = capacity ? capacity * 2 : 16;
+			newEntries = realloc(entries, capacity * sizeof(*entries));
+			if (!newEntries) break;
+			entries = newEntries;
+		}
+		entry.name = strdup(name);
+		if (!entry.name) break;
+		entry.src.size = v[0]; entry.src.mtime = v[1]; entry.src.ctime = v[2]; entry.src.ino = v[3];
+		entry.dst.size = v[4]; entry.dst.mtime = v[5]; entry.dst.ctime = v[6]; entry.dst.ino = v[7];
+		entry.hasHash = hexToHash(hex, entry.hash);
+		entries[count++] = entry;
+	}
+	fclose(f);
+
+	if (count) qsort(entries, count, sizeof(*entries), compareCacheEntries);
+	*outEntries = entries;
+	*outCount = count;
+}
+
+static const cacheEntry *findCacheEntry(const cacheEntry *entries, uint32_t count, const char *name)
+{
+	cacheEntry key;
+
+	if (!entries) return NULL;
+	key.name = (char *)name;
+	return bsearch(&key, entries, count, sizeof(*entries), compareCacheEntries);
+}
+
+static int saveCache(const char *prebootKCPath, syncItem *items, uint32_t count)
+{
+	char        path[MAXPATHLEN];
+	char        tmpPath[MAXPATHLEN];
+	char        hex[kKCSyncHashSize * 2 + 1];
+	FILE *      f;
+	int         fd;
+	uint32_t    i;
+
+	snprintf(path, sizeof path, "%s/%s", prebootKCPath, kBLKernelCollectionSyncCacheName);
+	snprintf(tmpPath, sizeof tmpPath, "%s.XXXXXX", path);
+	fd = mkstemp(tmpPath);
+	if (fd < 0) return errno;
+	f = fdopen(fd, "w");
+	if (!f) {
+		int ret = errno;
+
+		close(fd);
+		unlink(tmpPath);
+		return ret;
+	}
+
+	fputs(kKCSyncCacheHeader, f);
+	for (i = 0; i < count; i++) {
+		syncItem *item = &items[i];
+
+		// a file we failed on, or couldn't stat afterwards, has to be looked at again next time
+		if (item->status || !item->dstExists) continue;
+		if (item->hasHash) {
+			hashToHex(item->hash, hex);
+		} else {
+			strlcpy(hex, "-", sizeof hex);
+		}
+		fprintf(f, "%s\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%s\n", item->name,
+				(unsigned long long)item->src.size, (unsigned long long)item->src.mtime,
+				(unsigned long long)item->src.ctime, (unsigned long long)item->src.ino,
+				(unsigned long long)item->dst.size, (unsigned long long)item->dst.mtime,
+				(unsigned long long)item->dst.ctime, (unsigned long long)item->dst.ino, hex);
+	}
+	if (fclose(f) != 0) {
+		int ret = errno;
+
+		unlink(tmpPath);
+		return ret;
+	}
+	if (rename(tmpPath, path) < 0) {
+		int ret = errno;
+
+		unlink(tmpPath);
+		return ret;
+	}
+	return 0;
+}
+
+#pragma mark Workers
+
+static int hashFile(const char *path, char *buffer, uint8_t hash[kKCSyncHashSize], uint64_t *bytes)
+{
+	CC_SHA256_CTX   ctx;
+	ssize_t         n;
+	int             fd = open(path, O_RDONLY);
+
+	if (fd < 0) return errno;
+	CC_SHA256_Init(&ctx);
+	while ((n = read(fd, buffer, kKCSyncBufferSize)) > 0) {
+		CC_SHA256_Update(&ctx, buffer, (CC_LONG)n);
+		*bytes += (uint64_t)n;
+	}
+	if (n < 0) {
+		int ret = errno;
+
+		close(fd);
+		return ret;
+	}
+	close(fd);
+	CC_SHA256_Final(hash, &ctx);
+	return 0;
+}
+
+//
+// Plain read/write copy, hashing what goes by so the cache gets the
+// hash for free.
+//
+static int copyData(int fdFrom, int fdTo, char *buffer, syncItem *item)
+{
+	CC_SHA256_CTX   ctx;
+	ssize_t         n;
+
+	CC_SHA256_Init(&ctx);
+	while ((n = read(fdFrom, buffer, kKCSyncBufferSize)) > 0) {
+		char *  p = buffer;
+		ssize_t left = n;
+
+		CC_SHA256_Update(&ctx, buffer, (CC_LONG)n);
+		while (left > 0) {
+			ssize_t written = write(fdTo, p, (size_t)left);
+
+			if (written < 0) {
+				if (errno == EINTR) continue;
+				item->failure = "write";
+				return errno;
+			}
+			p += written;
+			left -= written;
+		}
+		item->bytesCopied += (uint64_t)n;
+	}
+	if (n < 0) {
+		item->failure = "read";
+		return errno;
+	}
+	CC_SHA256_Final(item->hash, &ctx);
+	item->hasHash = true;
+	return 0;
+}
+
+#ifndef __APPLE__
+//
+// Let the kernel move the data, which lets file systems that support it
+// share or server-side copy the extents. Returns ENOTSUP if nothing was
+// copied and the caller should fall back to read/write.
+//
+static int copyFileRange(int fdFrom, int fdTo, syncItem *item)
+{
+	uint64_t left = item->src.size;
+
+	while (left > 0) {
+		ssize_t n = copy_file_range(fdFrom, NULL, fdTo, NULL, MIN(left, 0x40000000ULL), 0);
+
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			if (item->bytesCopied == 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+										   errno == EOPNOTSUPP || errno == EBADF)) {
+				return ENOTSUP;
+			}
+			item->failure = "copy_file_range";
+			return errno;
+		}
+		if (n == 0) break;  // file shrank under us
+		item->bytesCopied += (uint64_t)n;
+		left -= (uint64_t)n;
+	}
+	return 0;
+}
+#endif
+
+//
+// Copy into a temporary file next to the destination and rename it into
+// place, so a copy that dies halfway never leaves a truncated collection
+// under the real name.
+//
+static int copyFile(const char *from, const char *to, char *buffer, syncItem *item)
+{
+	char    tmpPath[MAXPATHLEN];
+	int     fdFrom = -1, fdTo = -1;
+	int     ret = 0;
+
+	// temporary names start with a dot, so they never look like a collection
+	BLTemporaryPathFor(to, tmpPath, sizeof tmpPath);
+
+	fdFrom = open(from, O_RDONLY);
+	if (fdFrom < 0) {
+		item->failure = "open";
+		return errno;
+	}
+
+#ifdef __APPLE__
+	// clonefile() wants to create the file itself; reserve the name, then hand it over
+	fdTo = mkstemp(tmpPath);
+	if (fdTo < 0) {
+		item->failure = "create";
+		ret = errno;
+		goto exit;
+	}
+	close(fdTo);
+	fdTo = -1;
+	unlink(tmpPath);
+	if (clonefile(from, tmpPath, CLONE_NOFOLLOW) == 0) {
+		item->cloned = true;
+		item->bytesCopied = item->src.size;
+	} else if (errno != EXDEV && errno != ENOTSUP) {
+		item->failure = "clonefile";
+		ret = errno;
+		goto exit;
+	} else {
+		fstore_t preall;
+
+		fdTo = open(tmpPath, O_WRONLY | O_CREAT | O_EXCL, 0644);
+		if (fdTo < 0) {
+			item->failure = "create";
+			ret = errno;
+			goto exit;
+		}
+		preall.fst_length = (off_t)item->src.size;
+		preall.fst_offset = 0;
+		preall.fst_flags = F_ALLOCATECONTIG;
+		preall.fst_posmode = F_PEOFPOSMODE;
+		if (fcntl(fdTo, F_PREALLOCATE, &preall) < 0 && errno != ENOTSUP) {
+			item->failure = "preallocate";
+			ret = errno;
+			goto exit;
+		}
+		ret = copyData(fdFrom, fdTo, buffer, item);
+		if (ret) goto exit;
+	}
+#else
+	fdTo = mkstemp(tmpPath);
+	if (fdTo < 0) {
+		item->failure = "create";
+		ret = errno;
+		goto exit;
+	}
+	if (fchmod(fdTo, 0644) < 0) {
+		item->failure = "chmod";
+		ret = errno;
+		goto exit;
+	}
+	ret = copyFileRange(fdFrom, fdTo, item);
+	if (ret == ENOTSUP) {
+		ret = copyData(fdFrom, fdTo, buffer, item);
+	}
+	if (ret) goto exit;
+#endif
+
+	if (fdTo >= 0) {
+		if (fsync(fdTo) < 0) {
+			item->failure = "fsync";
+			ret = errno;
+			goto exit;
+		}
+		if (close(fdTo) < 0) {
+			fdTo = -1;
+			item->failure = "close";
+			ret = errno;
+			goto exit;
+		}
+		fdTo = -1;
+	}
+	if (rename(tmpPath, to) < 0) {
+		item->failure = "rename";
+		ret = errno;
+		goto exit;
+	}
+	tmpPath[0] = '\0';
+
+exit:
+	if (fdFrom >= 0) close(fdFrom);
+	if (fdTo >= 0) close(fdTo);
+	if (ret && tmpPath[0]) unlink(tmpPath);
+	return ret;
+}
+
+static void syncFile(struct syncqueue *queue, syncItem *item, char *buffer)
+{
+	char        from[MAXPATHLEN];
+	char        to[MAXPATHLEN];
+	struct stat sb;
+	uint64_t    span = BLTraceBegin(queue->context);
+	int         ret;
+
+	snprintf(from, sizeof from, "%s/%s", queue->systemKCPath, item->name);
+	snprintf(to, sizeof to, "%s/%s", queue->prebootKCPath, item->name);
+
+	// Same size as what's in preboot: compare contents before rewriting it
+	if (item->dstExists && item->dst.size == item->src.size) {
+		uint8_t dstHash[kKCSyncHashSize];
+		bool    same = false;
+
+		ret = hashFile(from, buffer, item->hash, &item->bytesHashed);
+		if (ret) {
+			item->failure = "read";
+			goto exit;
+		}
+		item->hasHash = true;
+		if (item->cached && item->cached->hasHash && sameIdentity(&item->cached->dst, &item->dst)) {
+			same = memcmp(item->cached->hash, item->hash, sizeof dstHash) == 0;
+		} else if (hashFile(to, buffer, dstHash, &item->bytesHashed) == 0) {
+			same = memcmp(dstHash, item->hash, sizeof dstHash) == 0;
+		}
+		// if preboot's copy can't be read back, replace it
+		if (same) goto exit;
+	}
+
+	// Preboot has an older copy: only rewrite the blocks that changed
+	if (item->dstExists) {
+		BLDeltaUpdateStats delta;
+
+		ret = BLDeltaUpdateFileFromFile(queue->context, from, to, kBLDeltaDefaultInPlacePercent, &delta);
+		item->bytesHashed += delta.bytesRead;
+		item->bytesCopied += delta.bytesWritten;
+		if (ret) {
+			item->failure = "update";
+			goto exit;
+		}
+		item->patched = delta.method == kBLDeltaPatchedClone || delta.method == kBLDeltaPatchedInPlace;
+	} else {
+		ret = copyFile(from, to, buffer, item);
+		if (ret) goto exit;
+	}
+	item->copied = true;
+
+	if (stat(to, &sb) == 0) {
+		statIdentity(&sb, &item->dst);
+		item->dstExists = true;
+	} else {
+		item->dstExists = false;
+	}
+
+exit:
+	item->status = ret;
+	BLTraceEnd(queue->context, span, item->copied ? "CopyKCFile" : "CompareKCFile", to);
+}
+
+static void *syncWorker(void *arg)
+{
+	struct syncqueue *  queue = arg;
+	char *              buffer = malloc(kKCSyncBufferSize);
+	uint32_t            index;
+
+	for (;;) {
+		pthread_mutex_lock(&queue->lock);
+		index = queue->next < queue->count ? queue->next++ : queue->count;
+		pthread_mutex_unlock(&queue->lock);
+		if (index == queue->count) break;
+
+		if (!buffer) {
+			queue->items[index]->status = ENOMEM;
+			queue->items[index]->failure = "allocate";
+			continue;
+		}
+		syncFile(queue, queue->items[index], buffer);
+	}
+	free(buffer);
+	return NULL;
+}
+
+#pragma mark Sync
+
+int BLSyncKernelCollections(BLContextPtr context, const char *systemKCPath, const char *prebootKCPath,
+							uint32_t workers, BLKernelCollectionSyncStats *stats)
+{
+	char **             systemList = NULL;
+	uint32_t            numSysFiles = 0;
+	char **             prebootList = NULL;
+	uint32_t            numPrebootFiles = 0;
+	cacheEntry *        cache = NULL;
+	uint32_t            cacheCount = 0;
+	syncItem *          items = NULL;
+	struct syncqueue    queue;
+	pthread_t           threads[kKCSyncMaxWorkers];
+	uint32_t            started = 0;
+	char                path[MAXPATHLEN];
+	struct stat         sb;
+	uint32_t            i;
+	int                 ret;
+
+	bzero(stats, sizeof(*stats));
+	bzero(&queue, sizeof(queue));
+
+	// First get a list of the relevant files in each location
+	ret = listKernelCollections(systemKCPath, false, &systemList, &numSysFiles);
+	if (ret == ENOENT) {
+		contextprintf(context, kBLLogLevelVerbose, "No KernelCollections directory in system volume\n");
+		ret = 0;
+	} else if (ret) {
+		contextprintf(context, kBLLogLevelError, "Couldn't get system kernel collection files - %s\n", strerror(ret));
+		goto exit;
+	}
+
+	ret = listKernelCollections(prebootKCPath, true, &prebootList, &numPrebootFiles);
+	if (ret == ENOENT) {
+		contextprintf(context, kBLLogLevelVerbose, "No KernelCollections directory in preboot volume\n");
+		if (numSysFiles > 0 && mkdir(prebootKCPath, 0755) < 0) {
+			ret = errno;
+			contextprintf(context, kBLLogLevelError, "Couldn't create kernel collections directory in preboot - %s\n", strerror(ret));
+			goto exit;
+		}
+		ret = 0;
+	} else if (ret) {
+		contextprintf(context, kBLLogLevelError, "Couldn't get preboot kernel collection files - %s\n", strerror(ret));
+		goto exit;
+	} else {
+		snprintf(path, sizeof path, "%s/%s", prebootKCPath, kBLKernelCollectionSyncCacheName);
+		loadCache(context, path, &cache, &cacheCount);
+	}
+
+	items = calloc(numSysFiles ? numSysFiles : 1, sizeof(*items));
+	queue.items = calloc(numSysFiles ? numSysFiles : 1, sizeof(*queue.items));
+	if (!items || !queue.items) {
+		ret = ENOMEM;
+		goto exit;
+	}
+
+	// Anything whose source and destination are both as we last left them is done
+	for (i = 0; i < numSysFiles; i++) {
+		syncItem *item = &items[i];
+
+		item->name = systemList[i];
+		snprintf(path, sizeof path, "%s/%s", systemKCPath, item->name);
+		if (stat(path, &sb) < 0) {
+			ret = errno;
+			contextprintf(context, kBLLogLevelError, "Couldn't stat KC file %s - %s\n", path, strerror(ret));
+			goto exit;
+		}
+		statIdentity(&sb, &item->src);
+
+		snprintf(path, sizeof path, "%s/%s", prebootKCPath, item->name);
+		if (stat(path, &sb) == 0 && S_ISREG(sb.st_mode)) {
+			item->dstExists = true;
+			statIdentity(&sb, &item->dst);
+		}
+
+		item->cached = findCacheEntry(cache, cacheCount, item->name);
+		if (item->cached && item->dstExists &&
+			sameIdentity(&item->cached->src, &item->src) && sameIdentity(&item->cached->dst, &item->dst)) {
+			item->hasHash = item->cached->hasHash;
+			memcpy(item->hash, item->cached->hash, sizeof(item->hash));
+			stats->unchanged++;
+			contextprintf(context, kBLLogLevelVerbose, "KC file %s unchanged since last sync\n", item->name);
+			continue;
+		}
+		queue.items[queue.count++] = item;
+	}
+
+	// Compare and copy the rest
+	if (queue.count) {
+		if (0 == workers) {
+			long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+			workers = ncpu > 0 ? (uint32_t)MIN(ncpu, kKCSyncDefaultWorkers) : 1;
+		}
+		if (workers > kKCSyncMaxWorkers) workers = kKCSyncMaxWorkers;
+		if (workers > queue.count) workers = queue.count;
+
+		queue.context = context;
+		queue.systemKCPath = systemKCPath;
+		queue.prebootKCPath = prebootKCPath;
+		pthread_mutex_init(&queue.lock, NULL);
+
+		// The calling thread is one of the workers
+		for (i = 1; i < workers; i++) {
+			if (0 != pthread_create(&threads[started], NULL, syncWorker, &queue)) break;
+			started++;
+		}
+		syncWorker(&queue);
+		for (i = 0; i < started; i++) {
+			pthread_join(threads[i], NULL);
+		}
+		pthread_mutex_destroy(&queue.lock);
+	}
+	stats->workers = queue.count ? started + 1 : 0;
+
+	for (i = 0; i < queue.count; i++) {
+		syncItem *item = queue.items[i];
+
+		stats->bytesHashed += item->bytesHashed;
+		stats->bytesCopied += item->bytesCopied;
+		if (item->status) {
+			if (!ret) ret = item->status;
+			contextprintf(context, kBLLogLevelError, "Error copying KC file %s/%s (%s) - %s\n",
+						  systemKCPath, item->name, item->failure ? item->failure : "copy", strerror(item->status));
+		} else if (item->copied) {
+			stats->copied++;
+			if (item->cloned) stats->cloned++;
+			if (item->patched) stats->patched++;
+			contextprintf(context, kBLLogLevelVerbose, "Copied KC file %s to preboot%s\n", item->name,
+						  item->cloned ? " (cloned)" : item->patched ? " (changed blocks only)" : "");
+		} else {
+			stats->unchanged++;
+			contextprintf(context, kBLLogLevelVerbose, "KC file %s unchanged. Skipping update...\n", item->name);
+		}
+	}
+
+	// Remove what the system no longer has, but only once everything else made it over
+	if (!ret) {
+		for (i = 0; i < numPrebootFiles; i++) {
+			if (bsearch(&prebootList[i], systemList, numSysFiles, sizeof(*systemList), compareNames)) continue;
+			snprintf(path, sizeof path, "%s/%s", prebootKCPath, prebootList[i]);
+			if (unlink(path) < 0) {
+				ret = errno;
+				contextprintf(context, kBLLogLevelError, "Couldn't delete file %s - %s\n", path, strerror(ret));
+				break;
+			}
+			stats->deleted++;
+			contextprintf(context, kBLLogLevelVerbose, "Deleted KC file %s\n", path);
+		}
+	}
+
+	// One directory sync covers every rename and unlink above
+	if (stats->copied || stats->deleted) {
+		int err = BLSyncDirectory(context, prebootKCPath);
+
+		if (err && !ret) ret = err;
+	}
+
+	// Remember what we saw, even after a partial failure, so the retry does less
+	if (numSysFiles && (queue.count || cacheCount != numSysFiles)) {
+		int err = saveCache(prebootKCPath, items, numSysFiles);
+
+		if (err) {
+			contextprintf(context, kBLLogLevelVerbose, "Couldn't save kernel collection cache in %s - %s\n",
+						  prebootKCPath, strerror(err));
+		}
+	} else if (!numSysFiles && cache) {
+		snprintf(path, sizeof path, "%s/%s", prebootKCPath, kBLKernelCollectionSyncCacheName);
+		unlink(path);
+	}
+
+	contextprintf(context, kBLLogLevelVerbose,
+				  "KC sync: %u copied (%u cloned, %u patched), %u unchanged, %u deleted, %llu bytes copied, %llu hashed\n",
+				  stats->copied, stats->cloned, stats->patched, stats->unchanged, stats->deleted,
+				  (unsigned long long)stats->bytesCopied, (unsigned long long)stats->bytesHashed);
+	BLTimingAddBytesRead(context, stats->bytesCopied + stats->bytesHashed);
+	BLTimingAddBytesWritten(context, stats->bytesCopied);
+
+exit:
+	freeNames(systemList, numSysFiles);
+	freeNames(prebootList, numPrebootFiles);
+	freeCache(cache, cacheCount);
+	free(items);
+	free(queue.items);
+	return ret;
+}
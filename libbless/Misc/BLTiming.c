@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ *  BLTiming.c
+ *  bless
+ *
+ *  Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <mach/mach.h>
+
+#include "bless.h"
+#include "bless_private.h"
+
+static const char *gPhaseNames[kBLTimingPhaseCount] = {
+	"mount point",
+	"preboot mount",
+	"label",
+	"booter",
+	"manifests",
+	"kernel collections",
+	"snapshot",
+	"nvram",
+};
+
+struct BLTimingCounters *BLTimingCountersCreate(void)
+{
+	return calloc(1, sizeof(struct BLTimingCounters));
+}
+
+void BLTimingCountersRelease(struct BLTimingCounters *timing)
+{
+	free(timing);
+}
+
+const char *BLTimingPhaseName(BLTimingPhase phase)
+{
+	if (phase >= kBLTimingPhaseCount) return "unknown";
+	return gPhaseNames[phase];
+}
+
+/*
+ * BSD and Mach system calls made by this task so far. Mach traps are
+ * counted too, since IOKit and the mount helpers go through them.
+ */
+static uint64_t syscallCount(void)
+{
+	task_events_info_data_t     info;
+	mach_msg_type_number_t      count = TASK_EVENTS_INFO_COUNT;
+
+	if (task_info(mach_task_self(), TASK_EVENTS_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) {
+		return 0;
+	}
+	return (uint64_t)info.syscalls_unix + (uint64_t)info.syscalls_mach;
+}
+
+void BLTimingSampleTake(struct BLTimingCounters *timing, BLTimingSample *sample)
+{
+	sample->syscalls = syscallCount();
+	sample->bytesRead = timing->bytesRead;
+	sample->bytesWritten = timing->bytesWritten;
+	sample->begin = BLTraceNow();
+}
+
+void BLTimingSampleAdd(struct BLTimingCounters *timing, const BLTimingSample *sample, BLTimingPhase phase)
+{
+	uint64_t                now = BLTraceNow();
+	uint64_t                syscalls = syscallCount();
+	BLTimingPhaseCounters   *counters;
+
+	if (phase >= kBLTimingPhaseCount) return;
+	counters = &timing->phases[phase];
+
+	counters->runs++;
+	counters->wallNanos += now - sample->begin;
+	counters->syscalls += syscalls - sample->syscalls;
+	counters->bytesRead += timing->bytesRead - sample->bytesRead;
+	counters->bytesWritten += timing->bytesWritten - sample->bytesWritten;
+}
+
+static void printRow(BLContextPtr context, const char *name, const BLTimingPhaseCounters *counters)
+{
+	contextprintf(context, kBLLogLevelNormal, "%-20s %6llu %12llu %10llu %14llu %14llu\n", name,
+				  (unsigned long long)counters->runs, (unsigned long long)(counters->wallNanos / 1000),
+				  (unsigned long long)counters->syscalls, (unsigned long long)counters->bytesRead,
+				  (unsigned long long)counters->bytesWritten);
+}
+
+void BLTimingCountersPrint(BLContextPtr context, struct BLTimingCounters *timing)
+{
+	BLTimingPhaseCounters   total = { 0 };
+	uint32_t                i;
+
+	contextprintf(context, kBLLogLevelNormal, "%-20s %6s %12s %10s %14s %14s\n",
+				  "phase", "runs", "usec", "syscalls", "bytes read", "bytes written");
+	for (i = 0; i < kBLTimingPhaseCount; i++) {
+		BLTimingPhaseCounters *counters = &timing->phases[i];
+
+		if (counters->runs == 0) continue;
+		printRow(context, BLTimingPhaseName(i), counters);
+		total.runs += counters->runs;
+		total.wallNanos += counters->wallNanos;
+		total.syscalls += counters->syscalls;
+		total.bytesRead += counters->bytesRead;
+		total.bytesWritten += counters->bytesWritten;
+	}
+	printRow(context, "total", &total);
+}
+
+static void addNumber(CFMutableDictionaryRef dict, CFStringRef key, uint64_t value)
+{
+	long long   n = (long long)value;
+	CFNumberRef num = CFNumberCreate(kCFAllocatorDefault, kCFNumberLongLongType, &n);
+
+	CFDictionaryAddValue(dict, key, num);
+	CFRelease(num);
+}
+
+/*
+ * { "Phases" = ( { "Name", "Runs", "Wall Time (us)", "Syscalls",
+ *   "Bytes Read", "Bytes Written" }, ... ) }, phases that never ran
+ * left out.
+ */
+CFDictionaryRef BLTimingCountersCopyDictionary(struct BLTimingCounters *timing)
+{
+	CFMutableDictionaryRef  dict;
+	CFMutableArrayRef       phases;
+	uint32_t                i;
+
+	dict = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks,
+									 &kCFTypeDictionaryValueCallBacks);
+	phases = CFArrayCreateMutable(kCFAllocatorDefault, kBLTimingPhaseCount, &kCFTypeArrayCallBacks);
+
+	for (i = 0; i < kBLTimingPhaseCount; i++) {
+		BLTimingPhaseCounters   *counters = &timing->phases[i];
+		CFMutableDictionaryRef  phase;
+		CFStringRef             name;
+
+		if (counters->runs == 0) continue;
+		phase = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks,
+										  &kCFTypeDictionaryValueCallBacks);
+		name = CFStringCreateWithCString(kCFAllocatorDefault, BLTimingPhaseName(i), kCFStringEncodingUTF8);
+		CFDictionaryAddValue(phase, CFSTR("Name"), name);
+		CFRelease(name);
+		addNumber(phase, CFSTR("Runs"), counters->runs);
+		addNumber(phase, CFSTR("Wall Time (us)"), counters->wallNanos / 1000);
+		addNumber(phase, CFSTR("Syscalls"), counters->syscalls);
+		addNumber(phase, CFSTR("Bytes Read"), counters->bytesRead);
+		addNumber(phase, CFSTR("Bytes Written"), counters->bytesWritten);
+		CFArrayAppendValue(phases, phase);
+		CFRelease(phase);
+	}
+	CFDictionaryAddValue(dict, CFSTR("Phases"), phases);
+	CFRelease(phases);
+
+	return dict;
+}
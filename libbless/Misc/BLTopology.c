@@ -0,0 +1,1290 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ *  BLTopology.c
+ *  bless
+ *
+ *  Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/param.h>
+
+#ifdef __APPLE__
+#include <IOKit/IOKitLib.h>
+#include <IOKit/IOBSD.h>
+#include <IOKit/storage/IOMedia.h>
+#include <CoreFoundation/CoreFoundation.h>
+#endif
+
+#include <APFS/APFS.h>
+
+#include "bless.h"
+#include "bless_private.h"
+
+#define kBLTopologyESPContent		"C12A7328-F81F-11D2-BA4B-00A0C93EC93B"
+#define kBLTopologyGPTBootContent	"426F6F74-0000-11AA-AA11-00306543ECAC"
+#define kBLTopologyGPTHFSContent	"48465300-0000-11AA-AA11-00306543ECAC"
+
+// One reading of the disks. The nodes never change once loaded, so they can be read without a lock.
+struct BLTopologyModel {
+	atomic_uint			refcount;
+	BLTopologyNode *	nodes;
+	uint32_t			count;
+	uint32_t			capacity;
+	char				(*parentNames)[32];     // while loading: parent and preboot BSD names
+	char				(*prebootNames)[32];
+	int32_t *			byBSD;                  // node indices sorted by BSD name
+	BLTopologyList		internalESPs;
+	bool				fromSnapshot;
+	pthread_mutex_t		prebootLock;
+	BLTopologyPrebootEntry *preboots;           // registry answers for containers the nodes don't cover
+	uint32_t			prebootCount;
+};
+
+struct BLTopology {
+	pthread_mutex_t				lock;
+	struct BLTopologyModel *	model;          // NULL until first asked, and after an invalidation
+	int							loadError;
+	char *						snapshotPath;   // re-read from here rather than the registry
+	uint32_t					loads;
+};
+
+static const struct {
+	const char *	name;
+	uint16_t		role;
+} roleNames[] = {
+	{ kAPFSVolumeRoleNone,			APFS_VOL_ROLE_NONE },
+	{ kAPFSVolumeRoleSystem,		APFS_VOL_ROLE_SYSTEM },
+	{ kAPFSVolumeRoleUser,			APFS_VOL_ROLE_USER },
+	{ kAPFSVolumeRoleRecovery,		APFS_VOL_ROLE_RECOVERY },
+	{ kAPFSVolumeRoleVM,			APFS_VOL_ROLE_VM },
+	{ kAPFSVolumeRolePreBoot,		APFS_VOL_ROLE_PREBOOT },
+	{ kAPFSVolumeRoleInstaller,		APFS_VOL_ROLE_INSTALLER },
+	{ kAPFSVolumeRoleData,			APFS_VOL_ROLE_DATA },
+	{ kAPFSVolumeRoleBaseband,		APFS_VOL_ROLE_BASEBAND },
+	{ kAPFSVolumeRoleXART,			APFS_VOL_ROLE_XART },
+	{ kAPFSVolumeRoleInternal,		APFS_VOL_ROLE_INTERNAL },
+	{ kAPFSVolumeRoleBackup,		APFS_VOL_ROLE_BACKUP },
+	{ kAPFSVolumeRoleUpdate,		APFS_VOL_ROLE_UPDATE },
+	{ kAPFSVolumeRoleHardware,		APFS_VOL_ROLE_HARDWARE },
+	{ kAPFSVolumeRoleSideCar,		APFS_VOL_ROLE_SIDECAR },
+	{ kAPFSVolumeRoleEnterprise,	APFS_VOL_ROLE_ENTERPRISE },
+	{ kAPFSVolumeRoleIDiags,		APFS_VOL_ROLE_IDIAGS },
+};
+
+static const char *kindNames[] = { "disk", "partition", "container", "volume", "snapshot" };
+
+uint16_t BLAPFSRoleForName(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof roleNames / sizeof roleNames[0]; i++) {
+		if (strcmp(name, roleNames[i].name) == 0) return roleNames[i].role;
+	}
+	return 0xFFFF;
+}
+
+static const char *nameForRole(uint16_t role)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof roleNames / sizeof roleNames[0]; i++) {
+		if (roleNames[i].role == role) return roleNames[i].name;
+	}
+	return NULL;
+}
+
+struct BLTopology *BLTopologyCreate(void)
+{
+	struct BLTopology *topology = calloc(1, sizeof(*topology));
+
+	if (topology) pthread_mutex_init(&topology->lock, NULL);
+	return topology;
+}
+
+static struct BLTopologyModel *createModel(void)
+{
+	struct BLTopologyModel *model = calloc(1, sizeof(*model));
+
+	if (!model) return NULL;
+	atomic_init(&model->refcount, 1);
+	pthread_mutex_init(&model->prebootLock, NULL);
+	return model;
+}
+
+struct BLTopologyModel *BLTopologyModelRetain(struct BLTopologyModel *model)
+{
+	if (model) atomic_fetch_add_explicit(&model->refcount, 1, memory_order_relaxed);
+	return model;
+}
+
+void BLTopologyModelRelease(struct BLTopologyModel *model)
+{
+	if (!model) return;
+	if (atomic_fetch_sub_explicit(&model->refcount, 1, memory_order_acq_rel) != 1) return;
+	free(model->nodes);
+	free(model->parentNames);
+	free(model->prebootNames);
+	free(model->byBSD);
+	free(model->internalESPs.nodes);
+	free(model->preboots);
+	pthread_mutex_destroy(&model->prebootLock);
+	free(model);
+}
+
+void BLTopologyRelease(struct BLTopology *topology)
+{
+	if (!topology) return;
+	BLTopologyModelRelease(topology->model);
+	free(topology->snapshotPath);
+	pthread_mutex_destroy(&topology->lock);
+	free(topology);
+}
+
+// Forget the model; the next question reads it again. Holders of the old one keep it until they release it.
+void BLTopologyInvalidate(struct BLTopology *topology)
+{
+	struct BLTopologyModel *model;
+
+	if (!topology) return;
+	pthread_mutex_lock(&topology->lock);
+	model = topology->model;
+	topology->model = NULL;
+	topology->loadError = 0;
+	pthread_mutex_unlock(&topology->lock);
+	BLTopologyModelRelease(model);
+}
+
+void BLTopologyGetStatistics(struct BLTopology *topology, uint32_t *loads)
+{
+	pthread_mutex_lock(&topology->lock);
+	if (loads) *loads = topology->loads;
+	pthread_mutex_unlock(&topology->lock);
+}
+
+// A new node, with its names to resolve set to ""
+static BLTopologyNode *addNode(struct BLTopologyModel *model, BLTopologyKind kind, const char *bsd)
+{
+	BLTopologyNode *node;
+
+	if (model->count == model->capacity) {
+		uint32_t			capacity = model->capacity ? model->capacity * 2 : 64;
+		BLTopologyNode *	nodes = realloc(model->nodes, capacity * sizeof(*nodes));
+		char				(*parents)[32] = realloc(model->parentNames, capacity * sizeof(*parents));
+		char				(*preboots)[32];
+
+		if (nodes) model->nodes = nodes;
+		if (parents) model->parentNames = parents;
+		if (!nodes || !parents) return NULL;
+		preboots = realloc(model->prebootNames, capacity * sizeof(*preboots));
+		if (!preboots) return NULL;
+		model->prebootNames = preboots;
+		model->capacity = capacity;
+	}
+	node = &model->nodes[model->count];
+	memset(node, 0, sizeof(*node));
+	node->kind = kind;
+	node->parent = -1;
+	node->firstChild = -1;
+	node->nextSibling = -1;
+	node->preboot = -1;
+	node->recovery = -1;
+	node->partitionID = -1;
+	node->role = APFS_VOL_ROLE_NONE;
+	strlcpy(node->bsd, bsd, sizeof node->bsd);
+	model->parentNames[model->count][0] = '\0';
+	model->prebootNames[model->count][0] = '\0';
+	model->count++;
+	return node;
+}
+
+typedef struct {
+	const char *	bsd;
+	int32_t			index;
+} BSDSortEntry;
+
+static int compareBSD(const void *a, const void *b)
+{
+	const BSDSortEntry *ea = a, *eb = b;
+	int c = strcmp(ea->bsd, eb->bsd);
+
+	return c ? c : ea->index - eb->index;
+}
+
+static int32_t findIndex(struct BLTopologyModel *model, const char *bsd)
+{
+	uint32_t lo = 0, hi = model->count, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (strcmp(model->nodes[model->byBSD[mid]].bsd, bsd) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo < model->count && strcmp(model->nodes[model->byBSD[lo]].bsd, bsd) == 0) {
+		return model->byBSD[lo];
+	}
+	return -1;
+}
+
+static int appendUnique(BLTopologyList *list, int32_t index)
+{
+	int32_t *nodes;
+	uint32_t i;
+
+	for (i = 0; i < list->count; i++) {
+		if (list->nodes[i] == index) return 0;
+	}
+	nodes = realloc(list->nodes, (list->count + 1) * sizeof(*nodes));
+	if (!nodes) return ENOMEM;
+	list->nodes = nodes;
+	list->nodes[list->count++] = index;
+	return 0;
+}
+
+static int insertAt(BLTopologyList *list, uint32_t at, int32_t index)
+{
+	int32_t *nodes = realloc(list->nodes, (list->count + 1) * sizeof(*nodes));
+
+	if (!nodes) return ENOMEM;
+	list->nodes = nodes;
+	if (at > list->count) at = list->count;
+	memmove(&nodes[at + 1], &nodes[at], (list->count - at) * sizeof(*nodes));
+	nodes[at] = index;
+	list->count++;
+	return 0;
+}
+
+static void swap(BLTopologyList *list, uint32_t a, uint32_t b)
+{
+	int32_t tmp = list->nodes[a];
+
+	list->nodes[a] = list->nodes[b];
+	list->nodes[b] = tmp;
+}
+
+//
+// Index the nodes by name and turn the parent and preboot names into
+// indices. Each container's recovery volume is the first volume in it
+// with the recovery role.
+//
+static int finishLoading(BLContextPtr context, struct BLTopologyModel *model)
+{
+	BSDSortEntry	*sorted;
+	uint32_t		i, k;
+
+	model->byBSD = malloc((model->count ? model->count : 1) * sizeof(*model->byBSD));
+	sorted = malloc((model->count ? model->count : 1) * sizeof(*sorted));
+	if (!model->byBSD || !sorted) {
+		free(sorted);
+		return ENOMEM;
+	}
+	for (i = 0; i < model->count; i++) {
+		sorted[i].bsd = model->nodes[i].bsd;
+		sorted[i].index = (int32_t)i;
+	}
+	qsort(sorted, model->count, sizeof(*sorted), compareBSD);
+	for (i = 0; i < model->count; i++) model->byBSD[i] = sorted[i].index;
+	free(sorted);
+
+	for (i = 0; i < model->count; i++) {
+		BLTopologyNode *node = &model->nodes[i];
+
+		if (model->parentNames[i][0]) {
+			node->parent = findIndex(model, model->parentNames[i]);
+			if (node->parent < 0) {
+				contextprintf(context, kBLLogLevelVerbose, "Parent %s of %s is not in the topology\n",
+							  model->parentNames[i], node->bsd);
+			}
+		}
+		if (model->prebootNames[i][0]) {
+			node->preboot = findIndex(model, model->prebootNames[i]);
+		}
+	}
+	for (i = model->count; i-- > 0; ) {
+		BLTopologyNode *node = &model->nodes[i];
+
+		if (node->parent >= 0) {
+			node->nextSibling = model->nodes[node->parent].firstChild;
+			model->nodes[node->parent].firstChild = (int32_t)i;
+		}
+	}
+	for (i = 0; i < model->count; i++) {
+		BLTopologyNode *node = &model->nodes[i];
+
+		if (node->internal && strcmp(node->content, kBLTopologyESPContent) == 0 &&
+			appendUnique(&model->internalESPs, (int32_t)i)) {
+			return ENOMEM;
+		}
+		if (node->kind != kBLTopologyVolume || node->role != APFS_VOL_ROLE_RECOVERY || node->parent < 0) continue;
+		k = (uint32_t)node->parent;
+		if (model->nodes[k].kind == kBLTopologyContainer && model->nodes[k].recovery < 0) {
+			model->nodes[k].recovery = (int32_t)i;
+		}
+	}
+
+	free(model->parentNames);
+	free(model->prebootNames);
+	model->parentNames = NULL;
+	model->prebootNames = NULL;
+	contextprintf(context, kBLLogLevelVerbose, "Disk topology has %u media\n", model->count);
+	return 0;
+}
+
+#ifdef __APPLE__
+
+extern bool isPreferredSystemPartitionService(BLContextPtr context, io_service_t service);
+
+static void copyStringProperty(io_registry_entry_t entry, const char *key, char *buf, size_t len)
+{
+	CFStringRef		keyCF = CFStringCreateWithCString(kCFAllocatorDefault, key, kCFStringEncodingUTF8);
+	CFTypeRef		value = keyCF ? IORegistryEntryCreateCFProperty(entry, keyCF, kCFAllocatorDefault, 0) : NULL;
+
+	buf[0] = '\0';
+	if (value && CFGetTypeID(value) == CFStringGetTypeID()) {
+		CFStringGetCString(value, buf, len, kCFStringEncodingUTF8);
+	}
+	if (value) CFRelease(value);
+	if (keyCF) CFRelease(keyCF);
+}
+
+// The preboot volume named by the container's IOAPFSPreBootDevice property
+static void copyPrebootName(io_registry_entry_t media, char *buf, size_t len)
+{
+	io_registry_entry_t		container = IO_OBJECT_NULL;
+	CFTypeRef				prebootData;
+	CFStringRef				component = NULL;
+	CFStringRef				containerPath, fullPath;
+	io_registry_entry_t		preboot;
+
+	buf[0] = '\0';
+	if (IORegistryEntryGetChildEntry(media, kIOServicePlane, &container) != KERN_SUCCESS) return;
+	prebootData = IORegistryEntryCreateCFProperty(container, CFSTR("IOAPFSPreBootDevice"), kCFAllocatorDefault, 0);
+	if (prebootData && CFGetTypeID(prebootData) == CFStringGetTypeID()) {
+		component = prebootData;
+	} else if (prebootData && CFGetTypeID(prebootData) == CFArrayGetTypeID() && CFArrayGetCount(prebootData) > 0) {
+		component = CFArrayGetValueAtIndex(prebootData, 0);
+	}
+	if (component && CFGetTypeID(component) == CFStringGetTypeID()) {
+		containerPath = IORegistryEntryCopyPath(container, kIOServicePlane);
+		if (containerPath) {
+			fullPath = CFStringCreateWithFormat(kCFAllocatorDefault, NULL, CFSTR("%@/%@"), containerPath, component);
+			CFRelease(containerPath);
+			preboot = fullPath ? IORegistryEntryCopyFromPath(kIOMasterPortDefault, fullPath) : IO_OBJECT_NULL;
+			if (fullPath) CFRelease(fullPath);
+			if (preboot) {
+				copyStringProperty(preboot, kIOBSDNameKey, buf, len);
+				IOObjectRelease(preboot);
+			}
+		}
+	}
+	if (prebootData) CFRelease(prebootData);
+	IOObjectRelease(container);
+}
+
+static int addRegistryNode(BLContextPtr context, struct BLTopologyModel *model, io_registry_entry_t media)
+{
+	char				bsd[32];
+	BLTopologyKind		kind;
+	BLTopologyNode *	node;
+	io_registry_entry_t	entry, parent;
+	CFTypeRef			value;
+	uint32_t			index;
+
+	copyStringProperty(media, kIOBSDNameKey, bsd, sizeof bsd);
+	if (!bsd[0]) return 0;
+
+	if (IOObjectConformsTo(media, "AppleAPFSSnapshot")) {
+		kind = kBLTopologySnapshot;
+	} else if (IOObjectConformsTo(media, APFS_VOLUME_OBJECT)) {
+		kind = kBLTopologyVolume;
+	} else if (IOObjectConformsTo(media, APFS_MEDIA_OBJECT)) {
+		kind = kBLTopologyContainer;
+	} else {
+		value = IORegistryEntryCreateCFProperty(media, CFSTR(kIOMediaWholeKey), kCFAllocatorDefault, 0);
+		kind = (value == kCFBooleanTrue) ? kBLTopologyWholeDisk : kBLTopologyPartition;
+		if (value) CFRelease(value);
+	}
+
+	node = addNode(model, kind, bsd);
+	if (!node) return ENOMEM;
+	index = model->count - 1;
+
+	copyStringProperty(media, kIOMediaContentKey, node->content, sizeof node->content);
+	copyStringProperty(media, kIOMediaUUIDKey, node->uuid, sizeof node->uuid);
+	value = IORegistryEntryCreateCFProperty(media, CFSTR(kIOMediaPartitionIDKey), kCFAllocatorDefault, 0);
+	if (value && CFGetTypeID(value) == CFNumberGetTypeID()) {
+		CFNumberGetValue(value, kCFNumberSInt32Type, &node->partitionID);
+	}
+	if (value) CFRelease(value);
+
+	if (kind == kBLTopologyVolume) {
+		char status[32];
+
+		copyStringProperty(media, kAPFSVolGroupUUIDKey, node->groupUUID, sizeof node->groupUUID);
+		copyStringProperty(media, kAPFSStatusKey, status, sizeof status);
+		node->online = strcmp(status, "Online") == 0;
+		value = IORegistryEntryCreateCFProperty(media, CFSTR(kAPFSRoleKey), kCFAllocatorDefault, 0);
+		if (value && CFGetTypeID(value) == CFArrayGetTypeID() && CFArrayGetCount(value) > 0) {
+			CFStringRef	roleName = CFArrayGetValueAtIndex(value, 0);
+			char		name[32];
+
+			node->roleCount = (uint16_t)CFArrayGetCount(value);
+			if (CFGetTypeID(roleName) == CFStringGetTypeID() &&
+				CFStringGetCString(roleName, name, sizeof name, kCFStringEncodingUTF8)) {
+				node->role = BLAPFSRoleForName(name);
+			}
+		}
+		if (value) CFRelease(value);
+	}
+	if (kind == kBLTopologyContainer) {
+		copyPrebootName(media, model->prebootNames[index], sizeof model->prebootNames[index]);
+	}
+	if (strcmp(node->content, kBLTopologyESPContent) == 0) {
+		node->internal = isPreferredSystemPartitionService(context, media);
+	}
+	value = IORegistryEntrySearchCFProperty(media, kIOServicePlane, CFSTR(kIOBootDeviceKey), kCFAllocatorDefault,
+											kIORegistryIterateRecursively | kIORegistryIterateParents);
+	node->aggregate = value != NULL;
+	if (value) CFRelease(value);
+
+	// The parent is the closest IOMedia above this one
+	entry = media;
+	IOObjectRetain(entry);
+	while (IORegistryEntryGetParentEntry(entry, kIOServicePlane, &parent) == KERN_SUCCESS) {
+		IOObjectRelease(entry);
+		entry = parent;
+		if (IOObjectConformsTo(entry, kIOMediaClass)) {
+			copyStringProperty(entry, kIOBSDNameKey, model->parentNames[index], sizeof model->parentNames[index]);
+			break;
+		}
+	}
+	IOObjectRelease(entry);
+	return 0;
+}
+
+static int loadRegistry(BLContextPtr context, struct BLTopologyModel *model)
+{
+	io_iterator_t	iter;
+	io_service_t	media;
+	int				ret = 0;
+
+	if (IOServiceGetMatchingServices(kIOMasterPortDefault, IOServiceMatching(kIOMediaClass), &iter) != KERN_SUCCESS) {
+		contextprintf(context, kBLLogLevelError, "Could not list IOMedia objects\n");
+		return ENOTSUP;
+	}
+	while ((media = IOIteratorNext(iter)) != IO_OBJECT_NULL) {
+		if (!ret) ret = addRegistryNode(context, model, media);
+		IOObjectRelease(media);
+	}
+	IOObjectRelease(iter);
+	return ret ? ret : finishLoading(context, model);
+}
+
+#else
+
+static int loadRegistry(BLContextPtr context, struct BLTopologyModel *model)
+{
+	return ENOTSUP;
+}
+
+#endif /* __APPLE__ */
+
+static int loadSnapshot(BLContextPtr context, const char *path, struct BLTopologyModel *model);
+
+//
+// The current model, read first if need be, retained for the caller. Nodes
+// it hands out stay valid until the caller releases it, whatever
+// BLTopologyInvalidate() does meanwhile.
+//
+int BLTopologyCopyModel(BLContextPtr context, struct BLTopology *topology, struct BLTopologyModel **outModel)
+{
+	struct BLTopologyModel *model;
+	int ret;
+
+	*outModel = NULL;
+	pthread_mutex_lock(&topology->lock);
+	if (!topology->model && !topology->loadError) {
+		uint64_t span = BLTraceBegin(context);
+
+		model = createModel();
+		if (!model) {
+			ret = ENOMEM;
+		} else if (topology->snapshotPath) {
+			model->fromSnapshot = true;
+			ret = loadSnapshot(context, topology->snapshotPath, model);
+		} else {
+			ret = loadRegistry(context, model);
+		}
+		if (ret) {
+			BLTopologyModelRelease(model);
+			topology->loadError = ret;
+		} else {
+			topology->model = model;
+		}
+		topology->loads++;
+		BLTraceEnd(context, span, "BLTopologyLoad", NULL);
+	}
+	*outModel = BLTopologyModelRetain(topology->model);
+	ret = topology->model ? 0 : topology->loadError;
+	pthread_mutex_unlock(&topology->lock);
+	return ret;
+}
+
+#pragma mark Snapshots
+
+//
+// Just enough JSON for snapshots: one object holding a "media" array of
+// flat objects whose values are strings, integers, booleans or arrays of
+// strings.
+//
+typedef struct {
+	const char *	p;
+	const char *	end;
+	int				line;
+} JSONReader;
+
+static void skipSpace(JSONReader *r)
+{
+	while (r->p < r->end && isspace((unsigned char)*r->p)) {
+		if (*r->p == '\n') r->line++;
+		r->p++;
+	}
+}
+
+static bool expect(JSONReader *r, char c)
+{
+	skipSpace(r);
+	if (r->p < r->end && *r->p == c) {
+		r->p++;
+		return true;
+	}
+	return false;
+}
+
+static bool readString(JSONReader *r, char *buf, size_t len)
+{
+	size_t n = 0;
+
+	if (!expect(r, '"')) return false;
+	while (r->p < r->end && *r->p != '"') {
+		char c = *r->p++;
+
+		if (c == '\\') {
+			if (r->p >= r->end) return false;
+			c = *r->p++;
+			switch (c) {
+				case 'n': c = '\n'; break;
+				case 't': c = '\t'; break;
+				case 'r': c = '\r'; break;
+				case 'b': c = '\b'; break;
+				case 'f': c = '\f'; break;
+				case 'u':
+					// BSD names and UUIDs are ASCII; anything else is kept as '?'
+					if (r->end - r->p < 4) return false;
+					c = (strncmp(r->p, "00", 2) == 0 && isxdigit((unsigned char)r->p[2]) &&
+						 isxdigit((unsigned char)r->p[3])) ? (char)strtol((char[]){ r->p[2], r->p[3], 0 }, NULL, 16) : '?';
+					r->p += 4;
+					break;
+				default: break;
+			}
+		}
+		if (n + 1 < len) buf[n++] = c;
+	}
+	if (len) buf[n] = '\0';
+	return expect(r, '"');
+}
+
+static bool readInteger(JSONReader *r, long *value)
+{
+	char *end;
+
+	skipSpace(r);
+	*value = strtol(r->p, &end, 10);
+	if (end == r->p || end > r->end) return false;
+	r->p = end;
+	return true;
+}
+
+static bool readBool(JSONReader *r, bool *value)
+{
+	skipSpace(r);
+	if (r->end - r->p >= 4 && strncmp(r->p, "true", 4) == 0) {
+		*value = true;
+		r->p += 4;
+		return true;
+	}
+	if (r->end - r->p >= 5 && strncmp(r->p, "false", 5) == 0) {
+		*value = false;
+		r->p += 5;
+		return true;
+	}
+	return false;
+}
+
+static int readMediaObject(JSONReader *r, struct BLTopologyModel *model)
+{
+	BLTopologyNode	node;
+	char			key[32], value[64], parent[32] = "", preboot[32] = "";
+	BLTopologyNode	*added;
+	long			number;
+	size_t			i;
+
+	memset(&node, 0, sizeof node);
+	node.kind = -1;
+	node.partitionID = -1;
+	node.role = APFS_VOL_ROLE_NONE;
+	if (!expect(r, '{')) return EINVAL;
+	if (expect(r, '}')) return EINVAL;
+	do {
+		if (!readString(r, key, sizeof key) || !expect(r, ':')) return EINVAL;
+		if (strcmp(key, "kind") == 0) {
+			if (!readString(r, value, sizeof value)) return EINVAL;
+			for (i = 0; i < sizeof kindNames / sizeof kindNames[0]; i++) {
+				if (strcmp(value, kindNames[i]) == 0) node.kind = (BLTopologyKind)i;
+			}
+		} else if (strcmp(key, "bsd") == 0) {
+			if (!readString(r, node.bsd, sizeof node.bsd)) return EINVAL;
+		} else if (strcmp(key, "parent") == 0) {
+			if (!readString(r, parent, sizeof parent)) return EINVAL;
+		} else if (strcmp(key, "preboot") == 0) {
+			if (!readString(r, preboot, sizeof preboot)) return EINVAL;
+		} else if (strcmp(key, "content") == 0) {
+			if (!readString(r, node.content, sizeof node.content)) return EINVAL;
+		} else if (strcmp(key, "uuid") == 0) {
+			if (!readString(r, node.uuid, sizeof node.uuid)) return EINVAL;
+		} else if (strcmp(key, "group") == 0) {
+			if (!readString(r, node.groupUUID, sizeof node.groupUUID)) return EINVAL;
+		} else if (strcmp(key, "status") == 0) {
+			if (!readString(r, value, sizeof value)) return EINVAL;
+			node.online = strcmp(value, "Online") == 0;
+		} else if (strcmp(key, "id") == 0) {
+			if (!readInteger(r, &number)) return EINVAL;
+			node.partitionID = (int32_t)number;
+		} else if (strcmp(key, "internal") == 0) {
+			if (!readBool(r, &node.internal)) return EINVAL;
+		} else if (strcmp(key, "aggregate") == 0) {
+			if (!readBool(r, &node.aggregate)) return EINVAL;
+		} else if (strcmp(key, "roles") == 0) {
+			if (!expect(r, '[')) return EINVAL;
+			if (!expect(r, ']')) {
+				do {
+					if (!readString(r, value, sizeof value)) return EINVAL;
+					if (node.roleCount++ == 0) node.role = BLAPFSRoleForName(value);
+				} while (expect(r, ','));
+				if (!expect(r, ']')) return EINVAL;
+			}
+		} else {
+			return EINVAL;
+		}
+	} while (expect(r, ','));
+	if (!expect(r, '}') || !node.bsd[0] || (int)node.kind < 0) return EINVAL;
+
+	added = addNode(model, node.kind, node.bsd);
+	if (!added) return ENOMEM;
+	node.parent = node.firstChild = node.nextSibling = -1;
+	node.preboot = node.recovery = -1;
+	*added = node;
+	strlcpy(model->parentNames[model->count - 1], parent, sizeof model->parentNames[0]);
+	strlcpy(model->prebootNames[model->count - 1], preboot, sizeof model->prebootNames[0]);
+	return 0;
+}
+
+static int readSnapshot(JSONReader *r, struct BLTopologyModel *model)
+{
+	char	key[32];
+	int		ret;
+
+	if (!expect(r, '{') || !readString(r, key, sizeof key) || strcmp(key, "media") != 0 ||
+		!expect(r, ':') || !expect(r, '[')) {
+		return EINVAL;
+	}
+	if (!expect(r, ']')) {
+		do {
+			ret = readMediaObject(r, model);
+			if (ret) return ret;
+		} while (expect(r, ','));
+		if (!expect(r, ']')) return EINVAL;
+	}
+	if (!expect(r, '}')) return EINVAL;
+	skipSpace(r);
+	return r->p == r->end ? 0 : EINVAL;
+}
+
+static int loadSnapshot(BLContextPtr context, const char *path, struct BLTopologyModel *model)
+{
+	CFDataRef	data = NULL;
+	JSONReader	reader;
+	int			ret;
+
+	ret = BLLoadFile(context, path, 0, &data);
+	if (ret) return ret;
+
+	reader.p = (const char *)CFDataGetBytePtr(data);
+	reader.end = reader.p + CFDataGetLength(data);
+	reader.line = 1;
+	ret = readSnapshot(&reader, model);
+	CFRelease(data);
+	if (ret == EINVAL) {
+		contextprintf(context, kBLLogLevelError, "%s:%d: not a disk topology snapshot\n", path, reader.line);
+	}
+	if (!ret) ret = finishLoading(context, model);
+	return ret;
+}
+
+int BLTopologyCreateFromSnapshot(BLContextPtr context, const char *path, struct BLTopology **outTopology)
+{
+	struct BLTopology *			topology;
+	struct BLTopologyModel *	model;
+	int							ret;
+
+	*outTopology = NULL;
+	topology = BLTopologyCreate();
+	if (!topology) return ENOMEM;
+	topology->snapshotPath = strdup(path);
+	if (!topology->snapshotPath) {
+		BLTopologyRelease(topology);
+		return ENOMEM;
+	}
+	ret = BLTopologyCopyModel(context, topology, &model);
+	if (ret) {
+		BLTopologyRelease(topology);
+		return ret;
+	}
+	BLTopologyModelRelease(model);
+	*outTopology = topology;
+	return 0;
+}
+
+static void writeString(FILE *f, const char *key, const char *s)
+{
+	fprintf(f, ", \"%s\": \"", key);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\') {
+			fprintf(f, "\\%c", *s);
+		} else if ((unsigned char)*s < 0x20) {
+			fprintf(f, "\\u%04x", (unsigned char)*s);
+		} else {
+			fputc(*s, f);
+		}
+	}
+	fputc('"', f);
+}
+
+int BLTopologyWriteSnapshot(BLContextPtr context, struct BLTopology *topology, const char *path)
+{
+	struct BLTopologyModel *	model;
+	FILE *						f;
+	uint32_t					i;
+	int							ret;
+
+	ret = BLTopologyCopyModel(context, topology, &model);
+	if (ret) return ret;
+	f = fopen(path, "w");
+	if (!f) {
+		ret = errno;
+		contextprintf(context, kBLLogLevelError, "Can't write %s: %s\n", path, strerror(ret));
+		BLTopologyModelRelease(model);
+		return ret;
+	}
+	fprintf(f, "{ \"media\": [\n");
+	for (i = 0; i < model->count; i++) {
+		const BLTopologyNode *node = &model->nodes[i];
+
+		fprintf(f, "  { \"kind\": \"%s\"", kindNames[node->kind]);
+		writeString(f, "bsd", node->bsd);
+		if (node->parent >= 0) writeString(f, "parent", model->nodes[node->parent].bsd);
+		if (node->preboot >= 0) writeString(f, "preboot", model->nodes[node->preboot].bsd);
+		if (node->content[0]) writeString(f, "content", node->content);
+		if (node->partitionID >= 0) fprintf(f, ", \"id\": %d", node->partitionID);
+		if (node->uuid[0]) writeString(f, "uuid", node->uuid);
+		if (node->groupUUID[0]) writeString(f, "group", node->groupUUID);
+		if (node->roleCount) {
+			const char *name = nameForRole(node->role);
+
+			// only the first role is kept; the rest are written as None
+			fprintf(f, ", \"roles\": [");
+			fprintf(f, "\"%s\"", name ? name : kAPFSVolumeRoleNone);
+			for (uint16_t r = 1; r < node->roleCount; r++) fprintf(f, ", \"%s\"", kAPFSVolumeRoleNone);
+			fprintf(f, "]");
+		}
+		if (node->kind == kBLTopologyVolume) writeString(f, "status", node->online ? "Online" : "Offline");
+		if (node->internal) fprintf(f, ", \"internal\": true");
+		if (node->aggregate) fprintf(f, ", \"aggregate\": true");
+		fprintf(f, " }%s\n", i + 1 < model->count ? "," : "");
+	}
+	fprintf(f, "] }\n");
+	if (fclose(f) != 0) {
+		ret = errno;
+		contextprintf(context, kBLLogLevelError, "Can't write %s: %s\n", path, strerror(ret));
+	}
+	BLTopologyModelRelease(model);
+	return ret;
+}
+
+#pragma mark Lookups
+
+int BLTopologyLookup(struct BLTopologyModel *model, const char *bsd, const BLTopologyNode **node)
+{
+	int32_t index;
+
+	*node = NULL;
+	if (strncmp(bsd, "/dev/", 5) == 0) bsd += 5;
+	index = findIndex(model, bsd);
+	if (index < 0) return ENOENT;
+	*node = &model->nodes[index];
+	return 0;
+}
+
+const BLTopologyNode *BLTopologyGetNode(struct BLTopologyModel *model, int32_t index)
+{
+	if (index < 0 || (uint32_t)index >= model->count) return NULL;
+	return &model->nodes[index];
+}
+
+const BLTopologyNode *BLTopologyGetParent(struct BLTopologyModel *model, const BLTopologyNode *node)
+{
+	return BLTopologyGetNode(model, node->parent);
+}
+
+// The volume itself, or the volume a snapshot is of
+const BLTopologyNode *BLTopologyGetVolume(struct BLTopologyModel *model, const BLTopologyNode *node)
+{
+	while (node && node->kind == kBLTopologySnapshot) node = BLTopologyGetParent(model, node);
+	return (node && node->kind == kBLTopologyVolume) ? node : NULL;
+}
+
+static int getPrebootVolumes(BLContextPtr context, struct BLTopologyModel *model, const char *volBSD,
+							 char *prebootBSD, int prebootBSDLen, char *recoveryBSD, int recoveryBSDLen)
+{
+	const BLTopologyNode	*node, *entry;
+	int						ret;
+
+	ret = BLTopologyLookup(model, volBSD, &node);
+	if (ret) return ret;
+	if (node->aggregate) return ENOTSUP;
+	for (entry = BLTopologyGetParent(model, node); entry; entry = BLTopologyGetParent(model, entry)) {
+		if (entry->kind == kBLTopologyContainer && entry->preboot >= 0) {
+			strlcpy(prebootBSD, model->nodes[entry->preboot].bsd, prebootBSDLen);
+			if (recoveryBSD) {
+				strlcpy(recoveryBSD, entry->recovery >= 0 ? model->nodes[entry->recovery].bsd : "", recoveryBSDLen);
+			}
+			return 0;
+		}
+	}
+	contextprintf(context, kBLLogLevelError, "No preboot volume associated with device %s\n", volBSD);
+	return EINVAL;
+}
+
+int BLTopologyGetPrebootVolumes(BLContextPtr context, struct BLTopology *topology, const char *volBSD,
+								char *prebootBSD, int prebootBSDLen, char *recoveryBSD, int recoveryBSDLen)
+{
+	struct BLTopologyModel	*model;
+	int						ret;
+
+	ret = BLTopologyCopyModel(context, topology, &model);
+	if (ret) return ret;
+	ret = getPrebootVolumes(context, model, volBSD, prebootBSD, prebootBSDLen, recoveryBSD, recoveryBSDLen);
+	BLTopologyModelRelease(model);
+	return ret;
+}
+
+static int getParentDevice(struct BLTopologyModel *model, const char *partitionDev,
+						   char *parentDev, uint32_t *partitionNum, BLPartitionType *partitionType)
+{
+	const BLTopologyNode	*node, *disk;
+	BLPartitionType			type;
+	int						ret;
+
+	ret = BLTopologyLookup(model, partitionDev, &node);
+	if (ret) return ret;
+	if (node->kind == kBLTopologyVolume) return 10;
+	if (node->partitionID < 0) return 4;
+	*partitionNum = (uint32_t)node->partitionID;
+
+	disk = BLTopologyGetParent(model, node);
+	if (!disk) return 8;
+	if (strcmp(disk->content, "Apple_partition_scheme") == 0) {
+		type = kBLPartitionType_APM;
+	} else if (strcmp(disk->content, "FDisk_partition_scheme") == 0) {
+		type = kBLPartitionType_MBR;
+	} else if (strcmp(disk->content, "GUID_partition_scheme") == 0) {
+		type = kBLPartitionType_GPT;
+	} else {
+		return 8;
+	}
+	if (partitionType) *partitionType = type;
+	sprintf(parentDev, "/dev/%s", disk->bsd);
+	return 0;
+}
+
+int BLTopologyGetParentDevice(BLContextPtr context, struct BLTopology *topology, const char *partitionDev,
+							  char *parentDev, uint32_t *partitionNum, BLPartitionType *partitionType)
+{
+	struct BLTopologyModel	*model;
+	int						ret;
+
+	parentDev[0] = '\0';
+	ret = BLTopologyCopyModel(context, topology, &model);
+	if (ret) return ret;
+	ret = getParentDevice(model, partitionDev, parentDev, partitionNum, partitionType);
+	BLTopologyModelRelease(model);
+	return ret;
+}
+
+int BLTopologyGetSystemVolumeForGroup(BLContextPtr context, struct BLTopology *topology, const char *groupUUID,
+									  char *bsd, int len)
+{
+	struct BLTopologyModel	*model;
+	uint32_t				i;
+	int						ret;
+
+	ret = BLTopologyCopyModel(context, topology, &model);
+	if (ret) return ret;
+	ret = EINVAL;
+	for (i = 0; i < model->count; i++) {
+		const BLTopologyNode *node = &model->nodes[i];
+
+		if (node->kind == kBLTopologyVolume && node->roleCount == 1 && node->role == APFS_VOL_ROLE_SYSTEM &&
+			strcmp(node->groupUUID, groupUUID) == 0) {
+			snprintf(bsd, len, "/dev/%s", node->bsd);
+			ret = 0;
+			break;
+		}
+	}
+	BLTopologyModelRelease(model);
+	if (ret) contextprintf(context, kBLLogLevelVerbose, "Cannot find matching system volume\n");
+	return ret;
+}
+
+static int groupHasOnlineSystemVolume(BLContextPtr context, struct BLTopologyModel *model, const char *volumeDev,
+									  bool *result)
+{
+	const BLTopologyNode	*node, *volume, *container;
+	int32_t					i;
+	int						ret;
+
+	ret = BLTopologyLookup(model, volumeDev, &node);
+	if (ret) return ret;
+	volume = BLTopologyGetVolume(model, node);
+	if (!volume) {
+		contextprintf(context, kBLLogLevelError, "%s is not an APFS volume\n", volumeDev);
+		return 3;
+	}
+	if (!volume->groupUUID[0]) {
+		contextprintf(context, kBLLogLevelError, "Volume has no group UUID\n");
+		return 4;
+	}
+	container = BLTopologyGetParent(model, volume);
+	if (!container || container->kind != kBLTopologyContainer) return 6;
+
+	for (i = container->firstChild; i >= 0; i = node->nextSibling) {
+		node = &model->nodes[i];
+		if (node->kind == kBLTopologyVolume && node->roleCount == 1 &&
+			node->role == APFS_VOL_ROLE_SYSTEM && node->online && strcmp(node->groupUUID, volume->groupUUID) == 0) {
+			*result = true;
+			break;
+		}
+	}
+	return 0;
+}
+
+int BLTopologyGroupHasOnlineSystemVolume(BLContextPtr context, struct BLTopology *topology, const char *volumeDev,
+										 bool *result)
+{
+	struct BLTopologyModel	*model;
+	int						ret;
+
+	*result = false;
+	ret = BLTopologyCopyModel(context, topology, &model);
+	if (ret) return ret;
+	ret = groupHasOnlineSystemVolume(context, model, volumeDev, result);
+	BLTopologyModelRelease(model);
+	return ret;
+}
+
+int BLTopologyGetContainerVolumes(BLContextPtr context, struct BLTopologyModel *model, const char *bsd, uint16_t role,
+								  BLTopologyList *list)
+{
+	const BLTopologyNode	*node, *container = NULL;
+	int32_t					i;
+	int						ret;
+
+	memset(list, 0, sizeof(*list));
+	ret = BLTopologyLookup(model, bsd, &node);
+	if (ret) return ret;
+	if (node->kind == kBLTopologyContainer) {
+		container = node;
+	} else if (node->kind == kBLTopologyPartition) {
+		// a physical store; its container hangs off it
+		for (i = node->firstChild; i >= 0 && !container; i = model->nodes[i].nextSibling) {
+			if (model->nodes[i].kind == kBLTopologyContainer) container = &model->nodes[i];
+		}
+	} else {
+		node = BLTopologyGetVolume(model, node);
+		if (node) container = BLTopologyGetParent(model, node);
+	}
+	if (!container || container->kind != kBLTopologyContainer) {
+		contextprintf(context, kBLLogLevelError, "%s is not in an APFS container\n", bsd);
+		return 6;
+	}
+
+	for (i = container->firstChild; i >= 0; i = node->nextSibling) {
+		node = &model->nodes[i];
+		if (node->kind == kBLTopologyVolume && node->roleCount == 1 && node->role == role) {
+			ret = appendUnique(list, i);
+			if (ret) {
+				free(list->nodes);
+				memset(list, 0, sizeof(*list));
+				return ret;
+			}
+		}
+	}
+	return 0;
+}
+
+//
+// Preboot and recovery volumes found in the registry, by the registry entry
+// ID of their AppleAPFSContainer, for volumes the nodes have no answer for.
+// They go when the model does, so an invalidation forgets them too. A
+// model replayed from a snapshot doesn't describe the registry and keeps
+// none.
+//
+bool BLTopologyModelGetPrebootEntry(struct BLTopologyModel *model, uint64_t containerID, BLTopologyPrebootEntry *entry)
+{
+	uint32_t	i;
+	bool		found = false;
+
+	if (model->fromSnapshot) return false;
+	pthread_mutex_lock(&model->prebootLock);
+	for (i = 0; i < model->prebootCount; i++) {
+		if (model->preboots[i].containerID == containerID) {
+			*entry = model->preboots[i];
+			found = true;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&model->prebootLock);
+	return found;
+}
+
+void BLTopologyModelSetPrebootEntry(struct BLTopologyModel *model, const BLTopologyPrebootEntry *entry)
+{
+	BLTopologyPrebootEntry	*preboots;
+	uint32_t				i;
+
+	if (model->fromSnapshot) return;
+	pthread_mutex_lock(&model->prebootLock);
+	for (i = 0; i < model->prebootCount && model->preboots[i].containerID != entry->containerID; i++) continue;
+	if (i == model->prebootCount) {
+		preboots = realloc(model->preboots, (model->prebootCount + 1) * sizeof(*preboots));
+		if (preboots) {
+			model->preboots = preboots;
+			model->prebootCount++;
+		}
+	}
+	if (i < model->prebootCount) model->preboots[i] = *entry;
+	pthread_mutex_unlock(&model->prebootLock);
+}
+
+#pragma mark Booter information
+
+void BLTopologyBooterInfoFree(BLTopologyBooterInfo *info)
+{
+	free(info->data.nodes);
+	free(info->auxiliary.nodes);
+	free(info->system.nodes);
+	free(info->preboot.nodes);
+	memset(info, 0, sizeof(*info));
+}
+
+// addDataPartitionSupportInfo(), over the partitions of one disk
+static int addSupportPartitions(BLContextPtr context, struct BLTopologyModel *model, const BLTopologyNode *data,
+								const BLTopologyNode *disk, bool simple, BLTopologyBooterInfo *info)
+{
+	const char *	booterContent = NULL;
+	const char *	systemContent = NULL;
+	int32_t			booterID = -1;
+	int32_t			i;
+	int				ret;
+
+	if (simple) {
+		if (data->partitionID < 0) return 1;
+		if (!data->content[0]) {
+			contextprintf(context, kBLLogLevelError, "Partition does not have Content key\n");
+			return 1;
+		}
+#if SUPPORT_APPLE_PARTITION_MAP
+		if (strcmp(disk->content, "Apple_partition_scheme") == 0) {
+			contextprintf(context, kBLLogLevelVerbose, "APM detected\n");
+			if (strcmp(data->content, "Apple_HFS") != 0 && strcmp(data->content, "Apple_HFSX") != 0 &&
+				strcmp(data->content, "Apple_Boot") != 0 && strcmp(data->content, "Apple_Boot_RAID") != 0) {
+				booterContent = "Apple_Boot";
+				booterID = data->partitionID - 1;
+			}
+		} else
+#endif // SUPPORT_APPLE_PARTITION_MAP
+		if (strcmp(disk->content, "GUID_partition_scheme") == 0) {
+			contextprintf(context, kBLLogLevelVerbose, "GPT detected\n");
+			if (strcmp(data->content, kBLTopologyGPTHFSContent) != 0 &&
+				strcmp(data->content, kBLTopologyGPTBootContent) != 0) {
+				booterContent = kBLTopologyGPTBootContent;
+				booterID = data->partitionID + 1;
+			}
+			systemContent = kBLTopologyESPContent;
+		} else {
+			contextprintf(context, kBLLogLevelVerbose, "Other partition scheme detected\n");
+		}
+	} else {
+		systemContent = kBLTopologyESPContent;
+	}
+
+	if (booterContent) {
+		contextprintf(context, kBLLogLevelVerbose, "Booter partition required at index %d\n", booterID);
+	} else {
+		contextprintf(context, kBLLogLevelVerbose, "No auxiliary booter partition required\n");
+	}
+	if (!booterContent && !systemContent) return 0;
+
+	for (i = disk->firstChild; i >= 0; i = model->nodes[i].nextSibling) {
+		const BLTopologyNode *child = &model->nodes[i];
+
+		if (!child->content[0]) continue;
+		if (booterContent && strcmp(child->content, booterContent) == 0) {
+			if (child->partitionID == booterID) {
+				ret = appendUnique(&info->auxiliary, (int32_t)i);
+				if (ret) return ret;
+			}
+		} else if (systemContent && strcmp(child->content, systemContent) == 0) {
+			ret = appendUnique(&info->system, (int32_t)i);
+			if (ret) return ret;
+		}
+	}
+	return 0;
+}
+
+// addDataPartitionInfo()
+static int addDataPartition(BLContextPtr context, struct BLTopologyModel *model, const BLTopologyNode *node,
+							BLTopologyBooterInfo *info)
+{
+	const BLTopologyNode	*data = node;
+	const BLTopologyNode	*store, *disk;
+	bool					simple;
+	int						ret;
+
+	ret = appendUnique(&info->data, (int32_t)(node - model->nodes));
+	if (ret) return ret;
+
+	if (data->kind == kBLTopologySnapshot) {
+		data = BLTopologyGetVolume(model, data);
+		if (!data) {
+			contextprintf(context, kBLLogLevelError, "Could not get live volume for APFS snapshot at %s", node->bsd);
+			return 1;
+		}
+	}
+	if (data->kind == kBLTopologyVolume) {
+		// the container's first physical store
+		store = BLTopologyGetParent(model, data);
+		if (store) store = BLTopologyGetParent(model, store);
+		if (!store) {
+			contextprintf(context, kBLLogLevelError, "Could not get physical store for APFS volume %s", data->bsd);
+			return 1;
+		}
+		simple = false;
+	} else {
+		store = data;
+		simple = true;
+	}
+	disk = BLTopologyGetParent(model, store);
+	if (store->kind != kBLTopologyPartition || !disk) return 0;
+	return addSupportPartitions(context, model, data, disk, simple, info);
+}
+
+int BLTopologyCopyBooterInfo(BLContextPtr context, struct BLTopologyModel *model, const char *bsdName,
+							 BLTopologyBooterInfo *info)
+{
+	const BLTopologyNode	*node, *entry;
+	const char				*env;
+	uint32_t				i;
+	bool					gotOne;
+	int						ret;
+
+	memset(info, 0, sizeof(*info));
+	ret = BLTopologyLookup(model, bsdName, &node);
+	if (ret) return ret;
+	if (node->aggregate || node->kind == kBLTopologyWholeDisk || node->kind == kBLTopologyContainer) return ENOTSUP;
+
+	for (entry = BLTopologyGetParent(model, node); entry; entry = BLTopologyGetParent(model, entry)) {
+		if (entry->kind == kBLTopologyContainer && entry->preboot >= 0) {
+			info->apfs = true;
+			ret = appendUnique(&info->preboot, entry->preboot);
+			if (ret) goto exit;
+			break;
+		}
+	}
+	ret = addDataPartition(context, model, node, info);
+	if (ret) goto exit;
+
+	env = getenv("BL_PRIMARY_BOOTER_INDEX");
+	if (env) {
+		long index = atol(env);
+
+		if (index >= 0 && index < (long)info->auxiliary.count) swap(&info->auxiliary, 0, (uint32_t)index);
+	}
+
+	// A preferred system partition goes first; see BLCreateBooterInformationDictionary()
+	gotOne = false;
+	for (i = 0; i < info->system.count; i++) {
+		if (model->nodes[info->system.nodes[i]].internal) {
+			if (i > 0) swap(&info->system, 0, i);
+			gotOne = true;
+			break;
+		}
+	}
+	for (i = 0; i < model->internalESPs.count; i++) {
+		int32_t		esp = model->internalESPs.nodes[i];
+		uint32_t	j;
+
+		for (j = 0; j < info->system.count && info->system.nodes[j] != esp; j++) continue;
+		if (j < info->system.count) continue;
+		contextprintf(context, kBLLogLevelVerbose, "Preferred system partition found: %s\n", model->nodes[esp].bsd);
+		ret = insertAt(&info->system, gotOne ? 1 : 0, esp);
+		if (ret) goto exit;
+		gotOne = true;
+	}
+
+exit:
+	if (ret) BLTopologyBooterInfoFree(info);
+	return ret;
+}
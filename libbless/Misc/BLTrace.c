@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ *  BLTrace.c
+ *  bless
+ *
+ *  Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "bless.h"
+#include "bless_private.h"
+
+#define kBLTraceDetailLength    80
+
+/*
+ * Slot states. A writer or the reader claims a slot by swapping its state
+ * to kSlotBusy and publishes it again when done, so every access to the
+ * slot contents is ordered through the state. A writer that finds the slot
+ * busy, or already holding a newer span, drops its span.
+ */
+#define kSlotEmpty      0
+#define kSlotBusy       1
+#define kSlotSpan(n)    ((n) + 2)
+
+typedef struct {
+	_Atomic uint64_t    state;
+	const char *        name;
+	uint64_t            begin;
+	uint64_t            end;
+	uint64_t            tid;
+	char                detail[kBLTraceDetailLength];
+} BLTraceSpan;
+
+struct BLTraceBuffer {
+	uint32_t            mask;
+	_Atomic uint64_t    next;
+	BLTraceSpan         spans[];
+};
+
+uint64_t BLTraceNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+struct BLTraceBuffer *BLTraceBufferCreate(uint32_t capacity)
+{
+	struct BLTraceBuffer    *buffer;
+	uint32_t                size = 1;
+
+	if (capacity == 0) capacity = kBLTraceDefaultCapacity;
+	// round up to a power of two so a span number maps to a slot with a mask
+	while (size < capacity && size < 0x80000000U) size <<= 1;
+
+	buffer = calloc(1, sizeof(*buffer) + (size_t)size * sizeof(BLTraceSpan));
+	if (!buffer) return NULL;
+	buffer->mask = size - 1;
+	atomic_init(&buffer->next, 0);
+	return buffer;
+}
+
+void BLTraceBufferRelease(struct BLTraceBuffer *buffer)
+{
+	free(buffer);
+}
+
+void BLTraceRecord(struct BLTraceBuffer *buffer, const char *name, const char *detail, uint64_t begin, uint64_t end)
+{
+	uint64_t        n, state;
+	BLTraceSpan     *span;
+
+	if (!buffer) return;
+
+	n = atomic_fetch_add_explicit(&buffer->next, 1, memory_order_relaxed);
+	span = &buffer->spans[n & buffer->mask];
+
+	state = atomic_load_explicit(&span->state, memory_order_relaxed);
+	if (state == kSlotBusy || (state != kSlotEmpty && state > kSlotSpan(n))) return;
+	if (!atomic_compare_exchange_strong_explicit(&span->state, &state, kSlotBusy,
+												 memory_order_acquire, memory_order_relaxed)) {
+		return;
+	}
+
+	span->name = name;
+	span->begin = begin;
+	span->end = end;
+	pthread_threadid_np(NULL, &span->tid);
+	if (detail) {
+		strlcpy(span->detail, detail, sizeof(span->detail));
+	} else {
+		span->detail[0] = '\0';
+	}
+
+	atomic_store_explicit(&span->state, kSlotSpan(n), memory_order_release);
+}
+
+static void writeJSONString(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; *s; s++) {
+		unsigned char c = (unsigned char)*s;
+
+		if (c == '"' || c == '\\') {
+			fputc('\\', f);
+			fputc(c, f);
+		} else if (c < 0x20) {
+			fprintf(f, "\\u%04x", c);
+		} else {
+			fputc(c, f);
+		}
+	}
+	fputc('"', f);
+}
+
+/*
+ * Write the spans still in the ring as Chrome trace-event JSON (complete
+ * "X" events, microsecond timestamps), loadable in chrome://tracing or
+ * Perfetto. Spans being written while we read are skipped.
+ */
+int BLTraceBufferWriteChromeTrace(BLContextPtr context, struct BLTraceBuffer *buffer, const char *path)
+{
+	FILE        *f;
+	uint64_t    next, n, first;
+	uint32_t    written = 0, skipped = 0;
+	int         pid = getpid();
+
+	if (!buffer) return 1;
+
+	f = fopen(path, "w");
+	if (!f) {
+		contextprintf(context, kBLLogLevelError, "Can't open trace file %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+
+	next = atomic_load_explicit(&buffer->next, memory_order_acquire);
+	first = next > (uint64_t)buffer->mask + 1 ? next - buffer->mask - 1 : 0;
+
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", f);
+	for (n = first; n < next; n++) {
+		BLTraceSpan     *slot = &buffer->spans[n & buffer->mask];
+		BLTraceSpan     span;
+		uint64_t        state = kSlotSpan(n);
+
+		if (!atomic_compare_exchange_strong_explicit(&slot->state, &state, kSlotBusy,
+													 memory_order_acquire, memory_order_relaxed)) {
+			skipped++;
+			continue;
+		}
+		span.name = slot->name;
+		span.begin = slot->begin;
+		span.end = slot->end;
+		span.tid = slot->tid;
+		memcpy(span.detail, slot->detail, sizeof(span.detail));
+		atomic_store_explicit(&slot->state, kSlotSpan(n), memory_order_release);
+		span.detail[sizeof(span.detail) - 1] = '\0';
+
+		fprintf(f, "%s\n{\"name\":", written ? "," : "");
+		writeJSONString(f, span.name);
+		fprintf(f, ",\"cat\":\"bless\",\"ph\":\"X\",\"ts\":%llu.%03llu,\"dur\":%llu.%03llu,\"pid\":%d,\"tid\":%llu",
+				(unsigned long long)(span.begin / 1000), (unsigned long long)(span.begin % 1000),
+				(unsigned long long)((span.end - span.begin) / 1000), (unsigned long long)((span.end - span.begin) % 1000),
+				pid, (unsigned long long)span.tid);
+		if (span.detail[0]) {
+			fputs(",\"args\":{\"detail\":", f);
+			writeJSONString(f, span.detail);
+			fputc('}', f);
+		}
+		fputc('}', f);
+		written++;
+	}
+	fputs("\n]}\n", f);
+
+	if (fclose(f) != 0) {
+		contextprintf(context, kBLLogLevelError, "Can't write trace file %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+
+	contextprintf(context, kBLLogLevelVerbose, "Wrote %u trace span(s) to %s (%llu dropped by the ring, %u in flight)\n",
+				  written, path, (unsigned long long)first, skipped);
+	return 0;
+}
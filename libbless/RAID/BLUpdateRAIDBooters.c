@@ -33,6 +33,8 @@
 
 #include <stdlib.h>
 #include <unistd.h>
+#include <string.h>
+#include <pthread.h>
 #include <sys/param.h>
 
 #include <mach/mach_error.h>
@@ -57,10 +59,26 @@
 
 #define kBootPlistName "com.apple.Boot.plist"
 
+// Members are mostly a handful of disks; each update is dominated by I/O
+#define kRAIDUpdateMaxWorkers	16
+
+struct raidqueue {
+	BLContextPtr				context;
+	mach_port_t					iokitPort;
+	CFDataRef					xmlData;
+	CFDataRef					bootxData;
+	CFDictionaryRef *			members;
+	CFDataRef *					labels;		// per member, may be NULL
+	BLRAIDMemberUpdateResult *	results;
+	uint32_t					count;
+	uint32_t					next;
+	pthread_mutex_t				lock;
+};
 
 int updateRAIDMember(BLContextPtr context, mach_port_t iokitPort, 
 					 CFDictionaryRef raidEntry, CFDataRef opaqueData,
-					 CFDataRef bootxData, CFDataRef labelData);
+					 CFDataRef bootxData, CFDataRef labelData,
+					 BLRAIDMemberUpdateResult *result);
 int getExternalBooter(BLContextPtr context,
                       mach_port_t iokitPort,
 					  io_service_t dataPartition,
@@ -71,18 +89,84 @@ int updateAppleBoot(BLContextPtr context, const char *devname, CFDataRef opaqueD
 
 CFDataRef _createLabel(BLContextPtr context, CFStringRef name, int index);
 
+static void *raidWorker(void *arg)
+{
+	struct raidqueue *	queue = arg;
+	uint32_t			index;
+	uint64_t			start, span;
+
+	for(;;) {
+		pthread_mutex_lock(&queue->lock);
+		index = queue->next < queue->count ? queue->next++ : queue->count;
+		pthread_mutex_unlock(&queue->lock);
+		if(index == queue->count) break;
+
+		span = BLTraceBegin(queue->context);
+		start = BLTraceNow();
+		queue->results[index].status = updateRAIDMember(queue->context, queue->iokitPort,
+														queue->members[index], queue->xmlData,
+														queue->bootxData, queue->labels[index],
+														&queue->results[index]);
+		queue->results[index].elapsedNanos = BLTraceNow() - start;
+		BLTraceEnd(queue->context, span, "RAIDMember", queue->results[index].path);
+	}
+	return NULL;
+}
+
 int BLUpdateRAIDBooters(BLContextPtr context, const char * device,
 						CFTypeRef bootData,
 						CFDataRef bootxData, CFDataRef labelData)
+{
+	BLRAIDMemberUpdateResult	*results = NULL;
+	BLRAIDMemberUpdateStats		stats;
+	uint32_t					count = 0, i;
+	int							ret;
+
+	ret = BLUpdateRAIDBootersWithResults(context, device, bootData, bootxData, labelData, 0,
+										 &results, &count, &stats);
+
+	for(i = 0; i < count; i++) {
+		if(results[i].status) {
+			contextprintf(context, kBLLogLevelVerbose, "Member %s not updated (error %d)\n",
+						  results[i].path[0] ? results[i].path : "?", results[i].status);
+		} else if(results[i].skipped) {
+			contextprintf(context, kBLLogLevelVerbose, "Member %s skipped (Apple_Boot_RAID)\n",
+						  results[i].path);
+		} else {
+			contextprintf(context, kBLLogLevelVerbose, "Member %s updated in %llu us\n",
+						  results[i].path, (unsigned long long)(results[i].elapsedNanos / 1000));
+		}
+	}
+	if(count) {
+		contextprintf(context, kBLLogLevelVerbose, "%u of %u RAID member(s) updated, %u skipped, with %u worker(s) in %llu us\n",
+					  stats.updatedCount, stats.memberCount, stats.skippedCount, stats.workers,
+					  (unsigned long long)(stats.wallNanos / 1000));
+	}
+
+	free(results);
+	return ret;
+}
+
+int BLUpdateRAIDBootersWithResults(BLContextPtr context, const char *device, CFTypeRef bootData,
+								   CFDataRef bootxData, CFDataRef labelData, uint32_t workers,
+								   BLRAIDMemberUpdateResult **outResults, uint32_t *outCount,
+								   BLRAIDMemberUpdateStats *stats)
 {
 	int ret = 0;
-	int anyFailed = 0;
 	CFDataRef xmlData = NULL;
 	CFStringRef		daName = NULL;
+	struct raidqueue	queue;
+	pthread_t			threads[kRAIDUpdateMaxWorkers];
+	uint32_t			started = 0, i;
+	uint64_t			start;
 	
 	kern_return_t           kret;
 	mach_port_t             ourIOKitPort;
 	
+	*outResults = NULL;
+	*outCount = 0;
+	bzero(stats, sizeof(*stats));
+	bzero(&queue, sizeof(queue));
 	
 	xmlData = CFPropertyListCreateXMLData(kCFAllocatorDefault, bootData);
 	if(xmlData == NULL) {
@@ -96,6 +180,7 @@ int BLUpdateRAIDBooters(BLContextPtr context, const char * device,
 	
 	// Obtain the I/O Kit communication handle.
     if((kret = IOMasterPort(bootstrap_port, &ourIOKitPort)) != KERN_SUCCESS) {
+		CFRelease(xmlData);
 		return 2;
     }
 	
@@ -103,28 +188,9 @@ int BLUpdateRAIDBooters(BLContextPtr context, const char * device,
 		// try to get a symbolic name from DA, if possible
 		if(labelData == NULL) {
 #if USE_DISKARBITRATION
-			DADiskRef disk = NULL;
-			DASessionRef session = NULL;
 			CFDictionaryRef props = NULL;
 			
-			session = DASessionCreate(kCFAllocatorDefault);
-			if(session == NULL) {
-				contextprintf(context, kBLLogLevelVerbose, "Can't connect to DiskArb\n");
-				break;
-			}
-			
-			disk = DADiskCreateFromBSDName(kCFAllocatorDefault, session, device+5);
-			if(disk == NULL) {
-				CFRelease(session);
-				contextprintf(context, kBLLogLevelVerbose, "Can't create DADisk for %s\n",
-							  device + 5);
-				break;
-			}
-			
-			props = DADiskCopyDescription(disk);
-			if(props == NULL) {
-				CFRelease(session);
-				CFRelease(disk);
+			if(BLCopyDiskDescription(context, device, &props)) {
 				contextprintf(context, kBLLogLevelVerbose, "Can't get properties for %s\n",
 							  device + 5);
 				break;
@@ -134,8 +200,6 @@ int BLUpdateRAIDBooters(BLContextPtr context, const char * device,
 			if(daName) CFRetain(daName);
 			
 			CFRelease(props);
-			CFRelease(disk);
-			CFRelease(session);			
 #else // !USE_DISKARBITRATION
 			daName = CFSTR("RAID");
 #endif // !USE_DISKARBITRATION
@@ -143,56 +207,113 @@ int BLUpdateRAIDBooters(BLContextPtr context, const char * device,
 		break;
 	}
 	
-	
 	if(CFGetTypeID(bootData) == CFArrayGetTypeID()) {
-		CFIndex i, count = CFArrayGetCount(bootData);
+		queue.count = (uint32_t)CFArrayGetCount(bootData);
+	} else {
+		queue.count = 1;
+	}
+	
+	queue.members = calloc(queue.count ? queue.count : 1, sizeof(queue.members[0]));
+	queue.labels = calloc(queue.count ? queue.count : 1, sizeof(queue.labels[0]));
+	queue.results = calloc(queue.count ? queue.count : 1, sizeof(queue.results[0]));
+	if(!queue.members || !queue.labels || !queue.results) {
+		contextprintf(context, kBLLogLevelError,  "Could not allocate RAID member list\n");
+		free(queue.results);
+		queue.results = NULL;
+		ret = 1;
+		goto exit;
+	}
+	
+	// The members' labels only differ by index; render them all here, once,
+	// so the workers only do the I/O
+	for(i = 0; i < queue.count; i++) {
+		if(CFGetTypeID(bootData) == CFArrayGetTypeID()) {
+			queue.members[i] = CFArrayGetValueAtIndex(bootData, i);
+		} else {
+			queue.members[i] = (CFDictionaryRef)bootData;
+		}
 		
-		for(i=0; i < count; i++) {
-			CFDictionaryRef dict = CFArrayGetValueAtIndex(bootData,i);
-			CFDataRef	tempLabel = NULL;
-			
-			if(!labelData && daName) {
-				tempLabel = _createLabel(context, daName, i+1);
-			}
-			
-			ret = updateRAIDMember(context, ourIOKitPort, dict, xmlData,
-								   bootxData, labelData ? labelData : tempLabel);
-			if(ret) {
-				anyFailed = 1;
-				// keep going to update other booters
-			}
-			
-			if(tempLabel) CFRelease(tempLabel);
+		if(labelData) {
+			queue.labels[i] = CFRetain(labelData);
+		} else if(daName) {
+			queue.labels[i] = _createLabel(context, daName, i+1);
 		}
-	} else {
-		CFDataRef	tempLabel = NULL;
+	}
+	
+	if(0 == workers) {
+		long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		workers = ncpu > 0 ? (uint32_t)ncpu : 1;
+	}
+	if(workers > kRAIDUpdateMaxWorkers) workers = kRAIDUpdateMaxWorkers;
+	if(workers > queue.count) workers = queue.count ? queue.count : 1;
+	
+	queue.context = context;
+	queue.iokitPort = ourIOKitPort;
+	queue.xmlData = xmlData;
+	queue.bootxData = bootxData;
+	queue.next = 0;
+	pthread_mutex_init(&queue.lock, NULL);
+	
+	contextprintf(context, kBLLogLevelVerbose,  "Updating %u RAID member(s) with %u worker(s)\n",
+				  queue.count, workers);
+	
+	start = BLTraceNow();
+	
+	// The calling thread is one of the workers. A member that fails
+	// doesn't stop the others from being updated
+	for(i = 1; i < workers; i++) {
+		if(0 != pthread_create(&threads[started], NULL, raidWorker, &queue)) {
+			contextprintf(context, kBLLogLevelVerbose, "pthread_create failed; continuing with %u worker(s)\n", started + 1);
+			break;
+		}
+		started++;
+	}
+	raidWorker(&queue);
+	for(i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	
+	stats->wallNanos = BLTraceNow() - start;
+	stats->workers = started + 1;
+	pthread_mutex_destroy(&queue.lock);
+	
+	stats->memberCount = queue.count;
+	for(i = 0; i < queue.count; i++) {
+		uint64_t elapsed = queue.results[i].elapsedNanos;
 		
-		if(!labelData && daName) {
-			tempLabel = _createLabel(context, daName, 1);
+		if(queue.results[i].status) {
+			stats->failedCount++;
+			ret = 1;
+		} else if(queue.results[i].skipped) {
+			stats->skippedCount++;
+		} else {
+			stats->updatedCount++;
 		}
+		stats->totalNanos += elapsed;
+		if(elapsed > stats->maxNanos) stats->maxNanos = elapsed;
+	}
+	
+	*outResults = queue.results;
+	*outCount = queue.count;
 
-		ret = updateRAIDMember(context, ourIOKitPort,
-							   (CFDictionaryRef)bootData, xmlData,
-							   bootxData, labelData ? labelData : tempLabel);
-		if(ret) {
-			anyFailed = 1;
-			// keep going to update other booters
-		}		
-
-		if(tempLabel) CFRelease(tempLabel);
-}
+exit:
+	if(queue.labels) {
+		for(i = 0; i < queue.count; i++) {
+			if(queue.labels[i]) CFRelease(queue.labels[i]);
+		}
+	}
+	free(queue.labels);
+	free(queue.members);
+	if(daName) CFRelease(daName);
 	CFRelease(xmlData);
 
-	if(anyFailed) {
-		return 1;
-	} else {
-		return 0;
-	}
+	return ret;
 }
 
 int updateRAIDMember(BLContextPtr context, mach_port_t iokitPort,
 					 CFDictionaryRef raidEntry, CFDataRef opaqueData,
-					 CFDataRef bootxData, CFDataRef labelData)
+					 CFDataRef bootxData, CFDataRef labelData,
+					 BLRAIDMemberUpdateResult *result)
 {
     int ret;
     CFStringRef path;
@@ -211,6 +332,7 @@ int updateRAIDMember(BLContextPtr context, mach_port_t iokitPort,
     if(!CFStringGetCString(path,cpath,sizeof(cpath),kCFStringEncodingUTF8))
         return 2;
     
+    strlcpy(result->path, cpath, sizeof(result->path));
     contextprintf(context, kBLLogLevelVerbose,  "Updating booter data for %s\n", cpath);
     
     service = IORegistryEntryFromPath(iokitPort, cpath);
@@ -230,6 +352,7 @@ int updateRAIDMember(BLContextPtr context, mach_port_t iokitPort,
            && CFEqual(content, CFSTR("Apple_Boot_RAID"))) {
          
             contextprintf(context, kBLLogLevelVerbose,  "Member at \"%s\" is RAIDv1 Apple_Boot_RAID partition. Ignoring...\n", cpath);
+            result->skipped = true;
             
             CFRelease(content);
             IOObjectRelease(service);
@@ -260,6 +383,7 @@ int updateRAIDMember(BLContextPtr context, mach_port_t iokitPort,
     
     CFRelease(name);
     
+    strlcpy(result->booter, cname, sizeof(result->booter));
     contextprintf(context, kBLLogLevelVerbose,  "Booter partition is %s\n", cname);	
     ret = updateAppleBoot(context, cname, opaqueData,
 						  bootxData, labelData);
@@ -62,24 +62,129 @@ __BEGIN_DECLS
  *    to all functions in the Bless Library. Only one function
  *    should be performed with a given context at the same time,
  *    although multiple functions can be called simultaneously if
- *    they are provided unique contexts. All bless functions can
+ *    they are provided unique contexts. The library keeps no other
+ *    per-call state: results go to caller-provided buffers, NVRAM
+ *    writes from different threads are serialized inside the
+ *    library, and the sync batch, mount table, mount leases, NVRAM
+ *    cache and disk descriptions lock themselves, so one of each may
+ *    be shared by the contexts of several threads. So may a
+ *    topology: its nodes are only read through a model each caller
+ *    retains, which an invalidation on another thread replaces
+ *    rather than frees. Trace buffers may be shared too; timing
+ *    counters may not. Two threads blessing the same volume still
+ *    race on its files. All bless functions can
  *    be called with a null context, or a non-null context with
  *    a null <b>logstring</b> member. a null <b>logrefcon</b>
  *    may or may not be allowed depending on the user-defined
  *    <b>logstring</b> function.
- * @field version version of BLContext in use by client. Currently
- *    0
+ * @field version version of BLContext in use by client. 0, or
+ *    the kBLContextVersion constant matching the last field filled in
  * @field logstring function used for messages from the library. It
  *    will be called with <b>logrefcon</b> and a log level, which
  *    can be used to tailor the output
  * @field logrefcon arbitrary data passed to <b>logrefcon</b>
+ * @field loglevels (version 1) mask of the log levels that
+ *    <b>logstring</b> will actually print. Messages at other levels
+ *    are dropped before they are formatted. Version 0 contexts get
+ *    every message, as before
+ * @field tracebuffer (version 2) if non-null, library operations
+ *    record timed spans into this buffer. See BLTraceBufferCreate()
+ * @field timing (version 3) if non-null, folder-mode blessing adds
+ *    per-phase wall-clock time, syscall counts and bytes read and
+ *    written to these counters. See BLTimingCountersCreate()
+ * @field syncbatch (version 4) if non-null, files the library
+ *    replaces are still written to disk before they are renamed into
+ *    place, but the directories holding them are only synced when the
+ *    batch is committed. See BLSyncBatchCreate()
+ * @field mounttable (version 5) if non-null, mount point and device
+ *    lookups are answered from this snapshot of the mount table,
+ *    which is only re-read when something is mounted or unmounted.
+ *    See BLMountTableCreate()
+ * @field topology (version 6) if non-null, questions about how
+ *    disks, partitions, APFS containers, volumes and snapshots relate
+ *    are answered from this model, read from the I/O Registry the
+ *    first time it is needed. See BLTopologyCreate()
+ * @field mountleases (version 7) if non-null, volumes and snapshots
+ *    the library mounts are shared by everything that needs them and
+ *    unmounted once, when the last user is done or the leases are
+ *    released. See BLMountLeasesCreate()
+ * @field nvramcache (version 8) if non-null, NVRAM variables the
+ *    library reads are kept here until the library writes NVRAM, the
+ *    cache's maximum age passes or it is invalidated. See
+ *    BLNVRAMCacheCreate()
+ * @field diskdescriptions (version 9) if non-null, DiskArbitration
+ *    descriptions are fetched over one session and kept until the disk
+ *    changes. See BLDiskDescriptionsCreate()
  */
 typedef struct {
   int32_t	version;
   int32_t	(*logstring)(void *refcon, int32_t level, char const *string);
   void		*logrefcon;
+  int32_t	loglevels;
+  struct BLTraceBuffer	*tracebuffer;
+  struct BLTimingCounters	*timing;
+  struct BLSyncBatch	*syncbatch;
+  struct BLMountTable	*mounttable;
+  struct BLTopology	*topology;
+  struct BLMountLeases	*mountleases;
+  struct BLNVRAMCache	*nvramcache;
+  struct BLDiskDescriptions	*diskdescriptions;
 } BLContext, *BLContextPtr;
 
+/*!
+ * @define kBLContextVersion1
+ * @discussion BLContext version with a valid <b>loglevels</b> mask
+ */
+#define kBLContextVersion1	1
+
+/*!
+ * @define kBLContextVersion2
+ * @discussion BLContext version with a valid <b>tracebuffer</b> as well
+ */
+#define kBLContextVersion2	2
+
+/*!
+ * @define kBLContextVersion3
+ * @discussion BLContext version with a valid <b>timing</b> pointer as well
+ */
+#define kBLContextVersion3	3
+
+/*!
+ * @define kBLContextVersion4
+ * @discussion BLContext version with a valid <b>syncbatch</b> as well
+ */
+#define kBLContextVersion4	4
+
+/*!
+ * @define kBLContextVersion5
+ * @discussion BLContext version with a valid <b>mounttable</b> as well
+ */
+#define kBLContextVersion5	5
+
+/*!
+ * @define kBLContextVersion6
+ * @discussion BLContext version with a valid <b>topology</b> as well
+ */
+#define kBLContextVersion6	6
+
+/*!
+ * @define kBLContextVersion7
+ * @discussion BLContext version with a valid <b>mountleases</b> as well
+ */
+#define kBLContextVersion7	7
+
+/*!
+ * @define kBLContextVersion8
+ * @discussion BLContext version with a valid <b>nvramcache</b> as well
+ */
+#define kBLContextVersion8	8
+
+/*!
+ * @define kBLContextVersion9
+ * @discussion BLContext version with a valid <b>diskdescriptions</b> as well
+ */
+#define kBLContextVersion9	9
+
 /*!
  * @define kBLLogLevelNormal
  * @discussion Normal output indicating status
@@ -638,7 +743,8 @@ int BLCreateAPFSVolumeInformationDictionary(BLContextPtr context, const char *mo
  *             the associated APFS Volume Role, such as Preboot, is found, and if
  *             found, then the roled-volume is attempted to mounted if not mounted
  *             already. A flag is returned so that you can restore the mount state,
- *             e.g. with BLUnmountContainerVolume. The Role that you pass in must
+ *             e.g. with BLReleaseMount, which only drops the lease on a context
+ *             with <b>mountleases</b>. The Role that you pass in must
  *             be limited to those of "special" volumes for which there is only exactly
  *             zero or one per container, such as Preboot and Recovery.
  * @param context Bless Library context (input)
@@ -647,7 +753,7 @@ int BLCreateAPFSVolumeInformationDictionary(BLContextPtr context, const char *mo
  * @param useGroupUUID Whether to assume the on-special-volume UUID dir should be named after the Volume Group (input)
  * @param subjectpath Path to the role-volume mountpoint plus slash plus target-volume uuid (output)
  * @param subjectLen Maximum (string buffer) size for subject dir path (input)
- * @param didMount Whether this routine had to mount the roled volume (output)
+ * @param didMount Whether this routine had to mount (or lease) the roled volume (output)
  */
 int BLEnsureSpecialAPFSVolumeUUIDPath(BLContextPtr context, const char *volumeDev, int specialRole, bool useGroupUUID, char *subjectPath, int subjectLen, bool *didMount);
 
@@ -970,9 +1076,12 @@ int BLSetDiskLabelForDevice(BLContextPtr context,
 /*!
  * @function BLLoadFile
  * @abstract Load the contents of a file into a CFDataRef
- * @discussion use URLAccess to load <b>src</b> into
- *     a newly allocated CFDataRef. Caller must release
- *     it.
+ * @discussion Load <b>src</b> into a newly allocated
+ *     CFDataRef. Caller must release it. Regular files of
+ *     64KB or more are mapped read-only rather than copied,
+ *     and stay mapped until the data is released, so they
+ *     must not be truncated in the meantime. Smaller files,
+ *     and anything that can't be mapped, are read.
  * @param context Bless Library context
  * @param src path to source
  * @param useRsrcFork whether to copy data from resource fork
@@ -1193,6 +1302,8 @@ int BLCreateEFIXMLRepresentationForLegacyDevice(BLContextPtr context,
                                           const char *bsdName,
                                           CFStringRef *xmlString);
 
+// A NULL bsdName leaves out the IOMedia node, for a partial device path
+// built without touching the I/O Registry
 int BLCreateEFIXMLRepresentationForElToritoEntry(BLContextPtr context,
                                                  const char *bsdName,
                                                  int bootEntry,
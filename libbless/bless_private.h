@@ -40,6 +40,7 @@
 #include <sys/cdefs.h>
 #include <TargetConditionals.h>
 #include <AvailabilityMacros.h>
+#include <stdarg.h>
 
 #include "bless.h"
 
@@ -90,6 +91,9 @@
 /*
  * Internal support for EFI routines shared between tool & library.
  */
+struct BLNVRAMTransaction;
+struct BLNVRAMSnapshot;
+
 int setefidevice(BLContextPtr context, const char * bsdname, int bootNext,
                  int bootLegacy, const char *legacyHint, 
 				 const char *optionalData, bool shortForm);
@@ -99,10 +103,19 @@ int setefinetworkpath(BLContextPtr context, CFStringRef booterXML,
                       CFStringRef kernelXML, CFStringRef mkextXML,
 					  CFStringRef kernelcacheXML, int bootNext);
 int efinvramcleanup(BLContextPtr context);
+// efinvramcleanup()'s deletes and boot-args filtering, staged in a transaction
+int stageefinvramcleanup(BLContextPtr context, struct BLNVRAMTransaction *txn);
 int setit(BLContextPtr context, mach_port_t masterPort, const char *bootvar,
 		  CFStringRef xmlstring);
 int _forwardNVRAM(BLContextPtr context, CFStringRef from, CFStringRef to);
 
+/*
+ * Each of the above writes NVRAM under a process-wide lock. Take it
+ * yourself (it nests) to read, change and write variables as one step.
+ */
+void BLLockNVRAM(void);
+void BLUnlockNVRAM(void);
+
 
 /* Calculate a shift-1-left & add checksum of all
  * 32-bit words
@@ -121,15 +134,392 @@ int BLCopyFileFromCFData(BLContextPtr context, const CFDataRef data,
 	     				 const char * dest, int shouldPreallocate);
 
 /*
- * convert to a char * description
+ * Bring an existing file up to date with new contents by writing only the
+ * blocks that differ. Where the file system can clone, a clone of the file
+ * is patched and renamed over it, so a crash leaves the old file or the new
+ * one. Otherwise the blocks are patched in place if no more than
+ * <inPlacePercent> of them changed, and the whole file is written under a
+ * temporary name and renamed over it if more did (or if <inPlacePercent>
+ * is 0). A missing file is written in full. Renamed files are synced as
+ * for BLReplaceFileFromCFData(), and a file patched in place is synced
+ * before it's reported updated, though a crash while patching can still
+ * leave it torn. Returns 0 or an errno.
+ */
+#define kBLDeltaBlockSize               16384
+#define kBLDeltaDefaultInPlacePercent   10
+
+enum {
+    kBLDeltaUnchanged,
+    kBLDeltaPatchedClone,
+    kBLDeltaPatchedInPlace,
+    kBLDeltaFullCopy
+};
+
+typedef struct {
+    uint32_t        method;
+    uint32_t        blockSize;
+    uint64_t        blocks;
+    uint64_t        changedBlocks;
+    uint64_t        bytesRead;
+    uint64_t        bytesWritten;
+} BLDeltaUpdateStats;
+
+int BLDeltaUpdateFileFromBytes(BLContextPtr context, const void *bytes, uint64_t length, const char *dest,
+                               uint32_t inPlacePercent, BLDeltaUpdateStats *stats);
+int BLDeltaUpdateFileFromFile(BLContextPtr context, const char *source, const char *dest,
+                              uint32_t inPlacePercent, BLDeltaUpdateStats *stats);
+
+/*
+ * Does dest already hold exactly what source does? Sizes are compared
+ * first; then both files are mapped a window at a time and compared up to
+ * the first difference, so neither is copied onto the heap. A missing or
+ * unreadable dest is reported as different, not as an error.
+ */
+int BLFilesAreIdentical(BLContextPtr context, const char *source, const char *dest, bool *identical);
+
+/*
+ * convert to a char * description. The string lives in thread-local
+ * storage and is only good until the thread's next call, so library
+ * code uses BLCopyCStringDescription() instead
  */
 char *BLGetCStringDescription(CFTypeRef typeRef);
 
+/*
+ * convert to a char * description in the caller's buffer, truncating
+ * if needed. Returns buffer
+ */
+char *BLCopyCStringDescription(CFTypeRef typeRef, char *buffer, size_t size);
+
 /*
  * check if the context is null. if not, check if the log function is null
  */
 int contextprintf(BLContextPtr context, int loglevel, char const *fmt, ...) __printflike(3, 4);;
 
+// contextprintf() for callers with a va_list of their own, such as the tool's
+int contextvprintf(BLContextPtr context, int loglevel, char const *fmt, va_list ap) __printflike(3, 0);
+
+/*
+ * would contextprintf() at this level reach the log function? use this to
+ * skip building expensive log messages that would be thrown away
+ */
+bool contextprintfenabled(BLContextPtr context, int loglevel);
+
+/*
+ * Span tracing. A trace buffer is a fixed-size ring of completed spans that
+ * any number of threads can append to without locking; once it wraps, the
+ * oldest spans are overwritten. Hang one off a version 2 context to trace
+ * everything done with that context:
+ *
+ *   uint64_t span = BLTraceBegin(context);
+ *   ...
+ *   BLTraceEnd(context, span, "BLLoadFile", path);
+ *
+ * With no trace buffer, BLTraceBegin() returns 0 and BLTraceEnd() does
+ * nothing. The name must be a string constant; the detail is copied
+ * (truncated) and may be NULL.
+ */
+#define kBLTraceDefaultCapacity 8192
+
+struct BLTraceBuffer *BLTraceBufferCreate(uint32_t capacity);
+void BLTraceBufferRelease(struct BLTraceBuffer *buffer);
+int BLTraceBufferWriteChromeTrace(BLContextPtr context, struct BLTraceBuffer *buffer, const char *path);
+
+uint64_t BLTraceNow(void);
+void BLTraceRecord(struct BLTraceBuffer *buffer, const char *name, const char *detail, uint64_t begin, uint64_t end);
+
+static inline struct BLTraceBuffer *BLContextTraceBuffer(BLContextPtr context) {
+    return (context && context->version >= kBLContextVersion2) ? context->tracebuffer : NULL;
+}
+
+static inline uint64_t BLTraceBegin(BLContextPtr context) {
+    return BLContextTraceBuffer(context) ? BLTraceNow() : 0;
+}
+
+static inline void BLTraceEnd(BLContextPtr context, uint64_t begin, const char *name, const char *detail) {
+    if (begin) BLTraceRecord(context->tracebuffer, name, detail, begin, BLTraceNow());
+}
+
+/*
+ * Per-phase timing. Hang a BLTimingCounters off a version 3 context and
+ * the folder-mode blessing code accumulates, for each phase it runs,
+ * wall-clock time, system calls made by the process, and bytes the
+ * library read and wrote:
+ *
+ *   BLTimingSample sample;
+ *   BLTimingPhaseBegin(context, &sample);
+ *   ...
+ *   BLTimingPhaseEnd(context, &sample, kBLTimingPhaseLabel);
+ *
+ * With no counters both calls do nothing. Phases can run more than once
+ * (labels are written to the system and the preboot volume); each run
+ * adds to the same counters; a run cut short by an error return isn't
+ * recorded. Like the rest of the context, the counters must only be
+ * updated from the thread using the context.
+ */
+typedef enum {
+    kBLTimingPhaseMountPoint = 0,     // resolving the target mount point
+    kBLTimingPhasePrebootMount,       // finding and mounting the preboot volume
+    kBLTimingPhaseLabel,              // rendering and writing .disk_label files
+    kBLTimingPhaseBooter,             // boot.efi compare and copy
+    kBLTimingPhaseManifests,          // img4 manifest copy
+    kBLTimingPhaseKernelCollections,  // kernel collection sync to preboot
+    kBLTimingPhaseSnapshot,           // snapshot lookup, mount, bless and create
+    kBLTimingPhaseNVRAM,              // firmware boot variable update
+    kBLTimingPhaseCount
+} BLTimingPhase;
+
+typedef struct {
+    uint64_t    runs;
+    uint64_t    wallNanos;
+    uint64_t    syscalls;
+    uint64_t    bytesRead;
+    uint64_t    bytesWritten;
+} BLTimingPhaseCounters;
+
+struct BLTimingCounters {
+    // running totals, bumped by the library's file I/O
+    uint64_t                bytesRead;
+    uint64_t                bytesWritten;
+    BLTimingPhaseCounters   phases[kBLTimingPhaseCount];
+};
+
+typedef struct {
+    uint64_t    begin;
+    uint64_t    syscalls;
+    uint64_t    bytesRead;
+    uint64_t    bytesWritten;
+} BLTimingSample;
+
+struct BLTimingCounters *BLTimingCountersCreate(void);
+void BLTimingCountersRelease(struct BLTimingCounters *timing);
+const char *BLTimingPhaseName(BLTimingPhase phase);
+void BLTimingSampleTake(struct BLTimingCounters *timing, BLTimingSample *sample);
+void BLTimingSampleAdd(struct BLTimingCounters *timing, const BLTimingSample *sample, BLTimingPhase phase);
+void BLTimingCountersPrint(BLContextPtr context, struct BLTimingCounters *timing);
+CFDictionaryRef BLTimingCountersCopyDictionary(struct BLTimingCounters *timing);
+
+static inline struct BLTimingCounters *BLContextTiming(BLContextPtr context) {
+    return (context && context->version >= kBLContextVersion3) ? context->timing : NULL;
+}
+
+static inline void BLTimingPhaseBegin(BLContextPtr context, BLTimingSample *sample) {
+    struct BLTimingCounters *timing = BLContextTiming(context);
+
+    if (timing) {
+        BLTimingSampleTake(timing, sample);
+    } else {
+        sample->begin = 0;
+    }
+}
+
+static inline void BLTimingPhaseEnd(BLContextPtr context, BLTimingSample *sample, BLTimingPhase phase) {
+    if (sample->begin) BLTimingSampleAdd(context->timing, sample, phase);
+}
+
+static inline void BLTimingAddBytesRead(BLContextPtr context, uint64_t bytes) {
+    struct BLTimingCounters *timing = BLContextTiming(context);
+
+    if (timing) timing->bytesRead += bytes;
+}
+
+static inline void BLTimingAddBytesWritten(BLContextPtr context, uint64_t bytes) {
+    struct BLTimingCounters *timing = BLContextTiming(context);
+
+    if (timing) timing->bytesWritten += bytes;
+}
+
+/*
+ * Durable file replacement. A replaced file is written under a temporary
+ * name next to it, preallocated, written, synced and renamed over the old
+ * one, so a crash leaves one or the other. The rename itself is only
+ * durable once the directory is synced. Hang a BLSyncBatch off a version 4
+ * context to put that off, and pay for one sync per directory (and one
+ * cache flush per device) when the batch is committed, however many files
+ * were replaced:
+ *
+ *   context->syncbatch = BLSyncBatchCreate();
+ *   ... write the label, boot.efi, version plist ...
+ *   BLSyncBatchCommit(context, context->syncbatch);
+ *   BLSyncBatchRelease(context->syncbatch);
+ *
+ * Without a batch, each directory is synced as soon as something in it
+ * is replaced. Batches can be added to from any thread.
+ */
+struct BLSyncBatch *BLSyncBatchCreate(void);
+int BLSyncBatchCommit(BLContextPtr context, struct BLSyncBatch *batch);
+void BLSyncBatchRelease(struct BLSyncBatch *batch);
+
+static inline struct BLSyncBatch *BLContextSyncBatch(BLContextPtr context) {
+    return (context && context->version >= kBLContextVersion4) ? context->syncbatch : NULL;
+}
+
+// Sync a directory now, or add it to the context's batch
+int BLSyncDirectory(BLContextPtr context, const char *directory);
+
+// A mkstemp() template for a dot name next to path, so a rename stays in one directory
+void BLTemporaryPathFor(const char *path, char *tmpPath, size_t size);
+
+// Sync and close fd, rename tmpPath to dest, and sync dest's directory
+int BLCommitTemporaryFile(BLContextPtr context, int fd, const char *tmpPath, const char *dest);
+
+// Sync and close fd, written over path in place, and sync path's directory
+int BLCommitFileInPlace(BLContextPtr context, int fd, const char *path);
+
+/*
+ * Mount table. Finding where a device is mounted used to mean a
+ * getmntinfo() and a walk over every mount, several times a run, which
+ * adds up on a machine with hundreds of disk images attached. A
+ * BLMountTable on a version 5 context keeps a snapshot sorted by device
+ * and by mount point. It is re-read when bless mounts or unmounts
+ * something itself, or when the system reports a mount change (an
+ * EVFILT_FS kevent on macOS, POLLPRI on /proc/self/mountinfo on Linux).
+ * Without a table each lookup reads the mount table afresh.
+ *
+ * BLMountTableCreateWithMountInfo() reads a file in /proc/self/mountinfo
+ * format instead, and re-reads it whenever the file changes.
+ */
+struct BLMountTable *BLMountTableCreate(void);
+struct BLMountTable *BLMountTableCreateWithMountInfo(const char *path);
+void BLMountTableRelease(struct BLMountTable *table);
+void BLMountTableGetStatistics(struct BLMountTable *table, uint32_t *snapshots, uint32_t *lookups);
+
+static inline struct BLMountTable *BLContextMountTable(BLContextPtr context) {
+    return (context && context->version >= kBLContextVersion5) ? context->mounttable : NULL;
+}
+
+// Call after mounting or unmounting anything
+void BLMountTableInvalidate(BLContextPtr context);
+
+// Where device (a mount source such as /dev/disk1s2) is first mounted; "" if it isn't
+int BLGetMountPointForDevice(BLContextPtr context, const char *device, char *mountPoint, int mountPointLen);
+
+// What is mounted at mountPoint; "" if nothing is
+int BLGetDeviceForMountPoint(BLContextPtr context, const char *mountPoint, char *device, int deviceLen);
+
+/*
+ * Disk topology. Finding a volume's preboot volume, a partition's disk or
+ * the partitions a booter has to be copied to each took several I/O
+ * Registry walks, repeated for every question bless asks in a run. A
+ * BLTopology on a version 6 context reads every IOMedia once, the first
+ * time it is asked anything, and keeps whole disks, partitions, APFS
+ * containers, volumes and snapshots with their parents, roles, group
+ * UUIDs and each container's preboot and recovery volumes.
+ *
+ * BLTopologyCreateFromSnapshot() builds one from a file written by
+ * BLTopologyWriteSnapshot() instead, so a machine's layout can be
+ * replayed elsewhere.
+ *
+ * Each reading is a BLTopologyModel that never changes once loaded.
+ * Node lookups go through a model retained with BLTopologyCopyModel(),
+ * and the nodes stay valid until it is released. A long-running process
+ * calls BLTopologyInvalidate() when disks come or go: the current model
+ * is dropped, holders of it keep theirs, and the next question reads
+ * the registry (or the snapshot file) again.
+ *
+ * Queries return ENOENT for a device the model doesn't have and ENOTSUP
+ * for one it can't answer for (RAID members, or no registry); callers
+ * then ask the registry directly.
+ */
+typedef enum {
+    kBLTopologyWholeDisk,
+    kBLTopologyPartition,
+    kBLTopologyContainer,
+    kBLTopologyVolume,
+    kBLTopologySnapshot
+} BLTopologyKind;
+
+typedef struct {
+    BLTopologyKind  kind;
+    int32_t         parent;         // node indices, -1 for none
+    int32_t         firstChild;
+    int32_t         nextSibling;
+    int32_t         preboot;        // containers only
+    int32_t         recovery;       // containers only
+    int32_t         partitionID;    // -1 if the media has none
+    uint16_t        role;           // first APFS role, APFS_VOL_ROLE_*
+    uint16_t        roleCount;
+    bool            online;
+    bool            internal;       // ESPs only
+    bool            aggregate;      // part of a RAID set
+    char            bsd[32];
+    char            content[64];
+    char            uuid[40];
+    char            groupUUID[40];
+} BLTopologyNode;
+
+typedef struct {
+    int32_t     *nodes;
+    uint32_t    count;
+} BLTopologyList;
+
+// A container's preboot and recovery volumes as the registry gave them
+typedef struct {
+    uint64_t    containerID;
+    char        preboot[32];
+    char        recovery[32];
+} BLTopologyPrebootEntry;
+
+// What BLCreateBooterInformationDictionary() returns, as node indices into one model
+typedef struct {
+    BLTopologyList  data;
+    BLTopologyList  auxiliary;
+    BLTopologyList  system;
+    BLTopologyList  preboot;
+    bool            apfs;
+} BLTopologyBooterInfo;
+
+struct BLTopologyModel;
+
+struct BLTopology *BLTopologyCreate(void);
+int BLTopologyCreateFromSnapshot(BLContextPtr context, const char *path, struct BLTopology **topology);
+int BLTopologyWriteSnapshot(BLContextPtr context, struct BLTopology *topology, const char *path);
+void BLTopologyRelease(struct BLTopology *topology);
+void BLTopologyInvalidate(struct BLTopology *topology);
+void BLTopologyGetStatistics(struct BLTopology *topology, uint32_t *loads);
+int BLTopologyCopyModel(BLContextPtr context, struct BLTopology *topology, struct BLTopologyModel **model);
+struct BLTopologyModel *BLTopologyModelRetain(struct BLTopologyModel *model);
+void BLTopologyModelRelease(struct BLTopologyModel *model);
+
+static inline struct BLTopology *BLContextTopology(BLContextPtr context) {
+    return (context && context->version >= kBLContextVersion6) ? context->topology : NULL;
+}
+
+// APFS_VOL_ROLE_* for a kAPFSVolumeRole* name, 0xFFFF if there is none
+uint16_t BLAPFSRoleForName(const char *name);
+
+int BLTopologyLookup(struct BLTopologyModel *model, const char *bsd, const BLTopologyNode **node);
+const BLTopologyNode *BLTopologyGetNode(struct BLTopologyModel *model, int32_t index);
+const BLTopologyNode *BLTopologyGetParent(struct BLTopologyModel *model, const BLTopologyNode *node);
+const BLTopologyNode *BLTopologyGetVolume(struct BLTopologyModel *model, const BLTopologyNode *node);
+bool BLTopologyModelGetPrebootEntry(struct BLTopologyModel *model, uint64_t containerID, BLTopologyPrebootEntry *entry);
+void BLTopologyModelSetPrebootEntry(struct BLTopologyModel *model, const BLTopologyPrebootEntry *entry);
+
+// Same results as the functions they stand in for
+int BLTopologyGetPrebootVolumes(BLContextPtr context, struct BLTopology *topology, const char *volBSD,
+                                char *prebootBSD, int prebootBSDLen, char *recoveryBSD, int recoveryBSDLen);
+int BLTopologyGetParentDevice(BLContextPtr context, struct BLTopology *topology, const char *partitionDev,
+                              char *parentDev, uint32_t *partitionNum, BLPartitionType *partitionType);
+int BLTopologyGetSystemVolumeForGroup(BLContextPtr context, struct BLTopology *topology, const char *groupUUID,
+                                      char *bsd, int len);
+int BLTopologyGroupHasOnlineSystemVolume(BLContextPtr context, struct BLTopology *topology, const char *volumeDev,
+                                         bool *result);
+// Volumes with role as their only role in the container bsd is, is in, or is the physical store of.
+// Free list->nodes when done.
+int BLTopologyGetContainerVolumes(BLContextPtr context, struct BLTopologyModel *model, const char *bsd, uint16_t role,
+                                  BLTopologyList *list);
+int BLTopologyCopyBooterInfo(BLContextPtr context, struct BLTopologyModel *model, const char *bsdName,
+                             BLTopologyBooterInfo *info);
+void BLTopologyBooterInfoFree(BLTopologyBooterInfo *info);
+
+// Atomically replace dest (or create it) with the contents of data, which may be NULL
+int BLReplaceFileFromCFData(BLContextPtr context, const CFDataRef data, const char *dest,
+                            int shouldPreallocate);
+
+// Atomically replace dest (or create it) with a clone of src, sharing its blocks.
+// Returns an errno (ENOTSUP or EXDEV where the file system can't clone); write the
+// file the usual way then.
+int BLCloneFile(BLContextPtr context, const char *src, const char *dest);
+
 /*
  * stringify the OSType into the caller-provided buffer
  */
@@ -147,14 +537,486 @@ int blsustatfs(const char *path, struct statfs *buf);
 // give info that, when converted to XML form and put in the IOReg->NVRAM, will command EFI to boot it.
 bool isDVDWithElToritoWithUEFIBootableOS (BLContextPtr inContext, const char* inDevBSD, int* outBootEntry, int* outPartitionStart, int* outPartitionSize);
 
+// El Torito boot catalog index. The catalog is read (mmap'd for disc images) and walked
+// once across all of its sectors; every validation, default, section header, section and
+// extension entry is recorded in a compact array that can be queried repeatedly.
+enum {
+    kBLElToritoEntryValidation = 0,
+    kBLElToritoEntryDefault,
+    kBLElToritoEntryHeader,
+    kBLElToritoEntrySection,
+    kBLElToritoEntryExtension
+};
+
+#define kBLElToritoNoEntry  0xFFFFFFFF
+
+typedef struct {
+    uint8_t     kind;           // kBLElToritoEntry*
+    uint8_t     platformID;     // from the owning section header (validation arch for the default entry)
+    uint8_t     bootIndicator;  // 0x88 = bootable
+    uint8_t     bootMedia;
+    uint8_t     systemType;
+    uint8_t     reserved;
+    uint16_t    header;         // index in the entry array of the owning section header
+    uint16_t    sectionCount;   // section headers only
+    uint16_t    sectorCount;
+    uint32_t    loadRBA;
+    uint32_t    catalogIndex;   // position of the 32-byte entry in the on-disc catalog
+} BLElToritoEntry;
+
+typedef struct BLElToritoCatalog *BLElToritoCatalogRef;
+
+int BLElToritoCatalogCreateWithFD(BLContextPtr context, int fd, BLElToritoCatalogRef *catalog);
+int BLElToritoCatalogCreateWithPath(BLContextPtr context, const char *path, BLElToritoCatalogRef *catalog);
+void BLElToritoCatalogRelease(BLElToritoCatalogRef catalog);
+const BLElToritoEntry *BLElToritoCatalogGetEntries(BLElToritoCatalogRef catalog, uint32_t *count);
+uint32_t BLElToritoCatalogGetVolumeSpaceSize(BLElToritoCatalogRef catalog);
+uint32_t BLElToritoCatalogGetSectorCount(BLElToritoCatalogRef catalog);
+const BLElToritoEntry *BLElToritoCatalogGetUEFIBootEntry(BLElToritoCatalogRef catalog, uint32_t *offsetBlocks, uint32_t *sizeBlocks);
+
+// The BootEntry bless has always put in the CD-ROM device path node for a UEFI-bootable
+// disc, whichever catalog entry the MS-DOS region came from
+#define kBLElToritoUEFIBootEntry    1
+
+// Like isDVDWithElToritoWithUEFIBootableOS(), but hands back the catalog index so it can be
+// given to BLCreateEFIXMLRepresentationForElToritoCatalog() without reading the disc again.
+// *catalog is NULL if the disc isn't UEFI bootable.
+bool BLCopyUEFIBootableElToritoCatalogForDVD(BLContextPtr context, const char *devBSD, BLElToritoCatalogRef *catalog);
+int BLCreateEFIXMLRepresentationForElToritoCatalog(BLContextPtr context, const char *bsdName,
+                                                   BLElToritoCatalogRef catalog, CFStringRef *xmlString);
+
+// Probe a batch of disc image files (directories are expanded to the regular files
+// in them) for a bootable EFI El Torito section on a pool of worker threads.
+// workers == 0 means one per CPU. Returns nonzero only if the list itself could
+// not be built; per-image failures are reported in each result's status/reason.
+typedef struct {
+    const char *    path;
+    int             status;         // 0 if bootable, else an errno
+    const char *    reason;         // static description of status
+    uint32_t        bootEntry;      // CDROM boot entry for the EFI device path
+    uint32_t        offsetBlocks;   // MS-DOS region, in 2048-byte blocks
+    uint32_t        sizeBlocks;
+    uint32_t        entryCount;     // catalog entries indexed
+    uint64_t        elapsedNanos;
+} BLElToritoImageScanResult;
+
+typedef struct {
+    uint32_t        imageCount;
+    uint32_t        bootableCount;
+    uint32_t        rejectedCount;
+    uint32_t        workers;
+    uint64_t        wallNanos;
+    uint64_t        totalNanos;     // sum of per-image latencies
+    uint64_t        minNanos;
+    uint64_t        maxNanos;
+} BLElToritoImageScanStats;
+
+int BLScanElToritoImages(BLContextPtr context, const char * const *paths, uint32_t pathCount, uint32_t workers,
+                         BLElToritoImageScanResult **results, uint32_t *resultCount, BLElToritoImageScanStats *stats);
+void BLElToritoImageScanResultsRelease(BLElToritoImageScanResult *results, uint32_t count);
+
+/*
+ * EFI device paths built in libbless rather than by the kernel from XML.
+ * Each node type is described once (BLEFIDevicePath.c), and that one
+ * description gives both the node's bytes and its IOEFIDevicePathType
+ * dictionary, for the XML form efi-boot-device still has to be written in.
+ * Numbers are given in host order and written little-endian.
+ */
+typedef enum {
+    kBLEFIDevicePathHardDrive,          // MEDIA_DEVICE_PATH / MEDIA_HARDDRIVE_DP
+    kBLEFIDevicePathFilePath,           // MEDIA_DEVICE_PATH / MEDIA_FILEPATH_DP
+    kBLEFIDevicePathCDROM,              // MEDIA_DEVICE_PATH / MEDIA_CDROM_DP
+    kBLEFIDevicePathMACAddress,         // MESSAGING_DEVICE_PATH / MSG_MAC_ADDR_DP
+    kBLEFIDevicePathIPv4,               // MESSAGING_DEVICE_PATH / MSG_IPv4_DP
+    kBLEFIDevicePathMemoryMapped,       // HARDWARE_DEVICE_PATH / HW_MEMMAP_DP
+    kBLEFIDevicePathNodeTypeCount
+} BLEFIDevicePathNodeType;
+
+typedef struct {
+    BLEFIDevicePathNodeType type;
+    union {
+        struct {
+            uint32_t    partitionNumber;
+            uint64_t    partitionStart;     // in blocks
+            uint64_t    partitionSize;
+            uint8_t     signature[16];      // GPT partition GUID as stored on disk, or MBR signature
+            uint8_t     mbrType;            // 1 MBR, 2 GPT
+            uint8_t     signatureType;      // 1 MBR signature, 2 GUID
+        } hardDrive;
+        struct {
+            const char  *path;              // UTF-8, '\\' separated
+        } filePath;
+        struct {
+            uint32_t    bootEntry;
+            uint64_t    partitionStart;     // in 2048-byte blocks
+            uint64_t    partitionSize;
+        } cdrom;
+        struct {
+            uint8_t     address[32];
+            uint8_t     ifType;
+        } mac;
+        struct {
+            uint8_t     localAddress[4];
+            uint8_t     remoteAddress[4];
+            uint16_t    localPort;
+            uint16_t    remotePort;
+            uint16_t    protocol;
+            uint8_t     staticAddress;
+            uint8_t     gatewayAddress[4];
+            uint8_t     subnetMask[4];
+        } ipv4;
+        struct {
+            uint32_t    memoryType;
+            uint64_t    startingAddress;
+            uint64_t    endingAddress;
+        } memoryMapped;
+    } u;
+} BLEFIDevicePathNode;
+
+// Bytes for the nodes plus the end node, 0 if a node can't be encoded
+size_t BLEFIDevicePathGetSize(const BLEFIDevicePathNode *nodes, size_t count);
+// Into a buffer of at least BLEFIDevicePathGetSize() bytes; EINVAL or ENOSPC otherwise
+int BLEncodeEFIDevicePath(const BLEFIDevicePathNode *nodes, size_t count, uint8_t *buffer, size_t size);
+int BLCreateEFIDevicePath(BLContextPtr context, const BLEFIDevicePathNode *nodes, size_t count,
+                          CFDataRef *devicePath);
+// The node as an IOEFIDevicePathType dictionary, NULL if it can't be encoded
+CFDictionaryRef BLCreateEFIDevicePathNodeDictionary(const BLEFIDevicePathNode *node);
+int BLCreateEFIXMLRepresentationForDevicePath(BLContextPtr context, const BLEFIDevicePathNode *nodes,
+                                              size_t count, const char *optionalData, CFStringRef *xmlString);
+// IOCFSerialize() an array of device path dictionaries straight into a string
+int BLCreateEFIXMLStringFromArray(BLContextPtr context, CFArrayRef array, CFStringRef *xmlString);
+
+// A node of an encoded path, pointing into the caller's bytes
+typedef struct {
+    uint8_t         type;
+    uint8_t         subType;
+    uint16_t        length;         // header included
+    const uint8_t   *bytes;         // header included
+} BLEFIDevicePathNodeRef;
+
+// Split a path into its nodes, up to the end node. *count is every node found,
+// even past maxNodes, so nodes may be NULL to count them. EINVAL if a length
+// runs past size or there is no end node.
+int BLParseEFIDevicePath(const uint8_t *path, size_t size, BLEFIDevicePathNodeRef *nodes,
+                         uint32_t maxNodes, uint32_t *count);
+// The same dictionary BLCreateEFIDevicePathNodeDictionary() makes; node types the
+// description doesn't cover come back as "Unknown" with their Type, SubType and Data
+CFDictionaryRef BLCreateEFIDevicePathNodeDictionaryFromBytes(const BLEFIDevicePathNodeRef *node);
+CFArrayRef BLCreateEFIDevicePathArray(const uint8_t *path, size_t size);
+
+/*
+ * EFI_LOAD_OPTIONs (the Boot#### variables), decoded where they lie: the
+ * description, device path and optional data all point into the bytes
+ * parsed, so the bytes must outlive the option. BLCopyEFIBootOptions()
+ * walks BootOrder in a snapshot and allocates only the returned array,
+ * which is good while the snapshot is held. An entry whose Boot#### is
+ * missing or malformed is kept, with status ENOENT or EINVAL.
+ */
+#define kBLEFIGlobalVariableGUID    "8BE4DF61-93CA-11D2-AA0D-00E098032B8C"
+#define kBLEFILoadOptionActive      0x00000001
+
+typedef struct {
+    uint16_t        number;             // the #### of Boot####
+    int             status;
+    uint32_t        attributes;
+    const uint8_t   *description;       // UTF-16LE, without its NUL
+    uint32_t        descriptionLength;  // in UTF-16 code units
+    const uint8_t   *devicePath;
+    uint32_t        devicePathSize;     // FilePathListLength
+    uint32_t        nodeCount;          // in devicePath, end node not counted
+    const uint8_t   *optionalData;
+    uint32_t        optionalDataSize;
+} BLEFILoadOption;
+
+int BLParseEFILoadOption(const uint8_t *bytes, size_t size, BLEFILoadOption *option);
+int BLCopyEFIBootOptions(BLContextPtr context, struct BLNVRAMSnapshot *snapshot,
+                         BLEFILoadOption **options, uint32_t *count);
+// Number, Name, Attributes, Active, Description, Device Path and Optional Data
+// as the plist --info shows, or Number, Name and Error for one that didn't parse
+CFDictionaryRef BLCreateEFILoadOptionDictionary(const BLEFILoadOption *option);
+CFArrayRef BLCreateEFIBootMenu(BLContextPtr context, struct BLNVRAMSnapshot *snapshot);
+
+/*
+ * Unserializing the IOCFSerialize() XML of the EFI boot variables, with no
+ * limit on its length. Objects are made straight from the UTF-8 bytes;
+ * what's needed on the way comes from a per-call arena freed in one go.
+ * BLCreateEFIXMLArray() returns 1 if the string can't be had as UTF-8 and
+ * 2 if it isn't an array, as the interpreting functions always have.
+ */
+typedef struct {
+    uint32_t        objects;        // CF objects made
+    uint32_t        arenaBlocks;    // heap blocks the arena needed past its first
+    size_t          arenaBytes;     // arena bytes handed out
+} BLEFIXMLParseStatistics;
+
+// stats and errorString may be NULL
+CFTypeRef BLCreateObjectFromEFIXML(CFAllocatorRef allocator, const char *bytes, size_t length,
+                                   BLEFIXMLParseStatistics *stats, CFStringRef *errorString);
+int BLCreateEFIXMLArray(BLContextPtr context, CFStringRef xmlString, CFArrayRef *array);
+
+// Bring the kernel collections in a preboot KernelCollections directory in line
+// with the system's: new or changed files are copied (cloned where the file system
+// allows it; an existing preboot copy only has its changed blocks rewritten, see
+// BLDeltaUpdateFileFromFile), stale ones deleted, and files that are already
+// identical left alone.
+// img4 manifests in preboot are never touched. A cache of each file's size, times,
+// inode and SHA-256 is kept next to the copies, so files that haven't changed on
+// either side since the last sync aren't read at all. Files are compared and copied
+// on up to <workers> threads (0 for the default). Stale files are only deleted if
+// every copy succeeded.
+#define kBLKernelCollectionSyncCacheName ".BootKernelExtensions.kc.sync"
+
+typedef struct {
+    uint32_t        copied;
+    uint32_t        cloned;         // of those copied
+    uint32_t        patched;        // of those copied, only changed blocks written
+    uint32_t        unchanged;
+    uint32_t        deleted;
+    uint32_t        workers;
+    uint64_t        bytesCopied;
+    uint64_t        bytesHashed;    // read only to compare contents
+} BLKernelCollectionSyncStats;
+
+int BLSyncKernelCollections(BLContextPtr context, const char *systemKCPath, const char *prebootKCPath,
+                            uint32_t workers, BLKernelCollectionSyncStats *stats);
+
+// BLUpdateRAIDBooters, with the members' Apple_Boot partitions updated on up to
+// <workers> threads (0 for one per CPU). The XML payload and every member's label
+// are built once, before any member is touched. Each member is tried whether or not
+// the others succeed; the return is 1 if any failed, as for BLUpdateRAIDBooters,
+// and the per-member outcome is in *results, which the caller frees.
+typedef struct {
+    char            path[512];      // member's IORegistry path (io_string_t)
+    char            booter[64];     // BSD name of its Apple_Boot partition, if found
+    int             status;         // 0, or why the member wasn't updated
+    bool            skipped;        // a RAIDv1 Apple_Boot_RAID member, left alone
+    uint64_t        elapsedNanos;
+} BLRAIDMemberUpdateResult;
+
+typedef struct {
+    uint32_t        memberCount;
+    uint32_t        updatedCount;
+    uint32_t        skippedCount;
+    uint32_t        failedCount;
+    uint32_t        workers;
+    uint64_t        wallNanos;
+    uint64_t        totalNanos;     // sum of per-member latencies
+    uint64_t        maxNanos;
+} BLRAIDMemberUpdateStats;
+
+int BLUpdateRAIDBootersWithResults(BLContextPtr context, const char *device, CFTypeRef bootData,
+                                   CFDataRef bootxData, CFDataRef labelData, uint32_t workers,
+                                   BLRAIDMemberUpdateResult **results, uint32_t *resultCount,
+                                   BLRAIDMemberUpdateStats *stats);
+
 int GetPrebootBSDForVolumeBSD(BLContextPtr context, const char *volBSD, char *prebootBSD, int prebootBSDLen);
+// The preboot and recovery volumes of the container volBSD is in, without building the booter
+// information dictionary. recoveryBSD may be NULL, and is "" if the container has no recovery volume.
+// Answers are kept per container for the life of the process.
+int GetPrebootAndRecoveryBSDForVolumeBSD(BLContextPtr context, const char *volBSD, char *prebootBSD, int prebootBSDLen,
+                                         char *recoveryBSD, int recoveryBSDLen);
 int GetMountForBSD(BLContextPtr context, const char *bsd, char *mountPoint, int mountPointLen);
 int GetUUIDFolderPathInPreboot(BLContextPtr context, const char *prebootMountPoint, const char *rootBSD, char *prebootDirPath, int len);
 
 
 int BLAPFSCreatePhysicalStoreBSDsFromVolumeBSD(BLContextPtr context, const char *volBSD, CFArrayRef *physBSDs);
+// BSD names of the volumes with role as their only role in the APFS container bsd is, is in,
+// or is the physical store of
+int BLAPFSCreateVolumeBSDsWithRole(BLContextPtr context, const char *bsd, uint16_t role, CFArrayRef *volBSDs);
 int BLMountContainerVolume(BLContextPtr context, const char *bsdName, char *mntPoint, int mntPtStrSize, bool readOnly);
 int BLUnmountContainerVolume(BLContextPtr context, char *mntPoint);
 int BLMountSnapshot(BLContextPtr context, const char *bsdName, const char *snapName, char *mntPoint, int mntPtStrSize);
+// Make a mount read-only or read-write in place, keeping its mount point
+int BLRemountContainerVolume(BLContextPtr context, const char *mntPoint, bool readOnly);
+
+/*
+ * Mount leases. Preboot, Recovery, the system volume and root snapshots
+ * are mounted by whichever routine needs them, and each used to mount and
+ * unmount on its own, so one run could mount the same Preboot volume two
+ * or three times. BLAcquireMount() takes a lease on a volume (or, with a
+ * snapName, a snapshot of it) and returns its mount point: an existing
+ * mount if there is one, otherwise a new one. Asking for read-write on a
+ * volume leased read-only updates the mount in place. Mounts bless didn't
+ * make are used as they are and never unmounted.
+ *
+ * BLReleaseMount() takes the mount point, or any path inside it, and
+ * unmounts when the last lease on it goes. With kBLMountLeasesKeepMounted
+ * the mount is kept until BLMountLeasesRelease() instead, so routines run
+ * one after another share it too. BLMountLeasesRelease() unmounts whatever
+ * is left and logs the mount, unmount and reuse counts.
+ *
+ * Without leases on the context, BLAcquireMount() mounts only if the
+ * volume isn't mounted, sets *mustRelease if it did, and BLReleaseMount()
+ * unmounts, as callers did by hand before.
+ */
+typedef struct {
+    int (*mount)(BLContextPtr context, void *refcon, const char *bsdName, const char *snapName, bool readOnly,
+                 char *mntPoint, int mntPtStrSize);
+    int (*update)(BLContextPtr context, void *refcon, const char *mntPoint, bool readOnly);
+    int (*unmount)(BLContextPtr context, void *refcon, const char *mntPoint);
+} BLMountLeaseOps;
+
+#define kBLMountLeasesKeepMounted	0x00000001
+
+// /sbin/mount, /sbin/mount_apfs and /sbin/umount
+extern const BLMountLeaseOps BLDefaultMountLeaseOps;
+
+struct BLMountLeases *BLMountLeasesCreate(uint32_t options);
+struct BLMountLeases *BLMountLeasesCreateWithOps(uint32_t options, const BLMountLeaseOps *ops, void *refcon);
+int BLMountLeasesRelease(BLContextPtr context, struct BLMountLeases *leases);
+void BLMountLeasesGetStatistics(struct BLMountLeases *leases, uint32_t *mounts, uint32_t *unmounts, uint32_t *reused);
+
+static inline struct BLMountLeases *BLContextMountLeases(BLContextPtr context) {
+    return (context && context->version >= kBLContextVersion7) ? context->mountleases : NULL;
+}
+
+int BLAcquireMount(BLContextPtr context, const char *bsdName, const char *snapName, bool readOnly,
+                   char *mntPoint, int mntPtStrSize, bool *mustRelease);
+int BLReleaseMount(BLContextPtr context, const char *mntPoint);
+
+/*
+ * NVRAM read cache. Reading a variable means finding IODeviceTree:/options
+ * and asking it, and --info asks for the same few variables several times.
+ * A BLNVRAMCache on a version 8 context keeps a snapshot of every
+ * variable, taken in one read the first time one is asked for. The
+ * library's own NVRAM writes empty it, since they take the NVRAM lock.
+ * Nothing reports writes by other processes, so a cache shared by a
+ * long-running process should be given a maximum age; 0 keeps the
+ * snapshot until the cache is invalidated. Misses count snapshots taken.
+ *
+ * BLNVRAMCacheCreateWithFile() answers from a plist dictionary of
+ * variables instead, re-read whenever the file changes, to stand in for
+ * NVRAM on a machine that has none.
+ */
+struct BLNVRAMCache *BLNVRAMCacheCreate(uint32_t maxAgeMillis);
+int BLNVRAMCacheCreateWithFile(BLContextPtr context, const char *path, struct BLNVRAMCache **cache);
+void BLNVRAMCacheRelease(struct BLNVRAMCache *cache);
+void BLNVRAMCacheGetStatistics(struct BLNVRAMCache *cache, uint32_t *hits, uint32_t *misses, uint32_t *invalidations);
+
+static inline struct BLNVRAMCache *BLContextNVRAMCache(BLContextPtr context) {
+    return (context && context->version >= kBLContextVersion8) ? context->nvramcache : NULL;
+}
+
+// Call after writing NVRAM
+void BLNVRAMCacheInvalidate(BLContextPtr context);
+
+/*
+ * NVRAM snapshot: every variable, read from IODeviceTree:/options in one
+ * property-table read (or from a plist, for running offline), for code
+ * that asks for several variables at once. The accessors follow the Get
+ * rule: what they return belongs to the snapshot and is good while it is
+ * held. GetString() hands back string variables as they are and converts
+ * data ones once; GetUTF16() points into a data variable (BootOrder, the
+ * description in Boot####) as little-endian 16-bit units.
+ *
+ * BLCopyNVRAMSnapshot() shares the context's NVRAM cache snapshot if it
+ * has one, and takes a new one otherwise. Release what it returns.
+ */
+int BLNVRAMSnapshotCreate(BLContextPtr context, struct BLNVRAMSnapshot **snapshot);
+int BLNVRAMSnapshotCreateWithFile(BLContextPtr context, const char *path, struct BLNVRAMSnapshot **snapshot);
+struct BLNVRAMSnapshot *BLNVRAMSnapshotCreateWithDictionary(CFDictionaryRef values);
+struct BLNVRAMSnapshot *BLNVRAMSnapshotRetain(struct BLNVRAMSnapshot *snapshot);
+void BLNVRAMSnapshotRelease(struct BLNVRAMSnapshot *snapshot);
+int BLCopyNVRAMSnapshot(BLContextPtr context, struct BLNVRAMSnapshot **snapshot);
+
+CFDictionaryRef BLNVRAMSnapshotGetValues(struct BLNVRAMSnapshot *snapshot);
+CFTypeRef BLNVRAMSnapshotGetValue(struct BLNVRAMSnapshot *snapshot, CFStringRef name);
+CFDataRef BLNVRAMSnapshotGetData(struct BLNVRAMSnapshot *snapshot, CFStringRef name);
+CFStringRef BLNVRAMSnapshotGetString(BLContextPtr context, struct BLNVRAMSnapshot *snapshot, CFStringRef name);
+const uint16_t *BLNVRAMSnapshotGetUTF16(struct BLNVRAMSnapshot *snapshot, CFStringRef name, size_t *count);
+
+// BLValidateXMLBootOption() against a snapshot already taken
+int BLValidateXMLBootOptionInSnapshot(BLContextPtr context, struct BLNVRAMSnapshot *snapshot,
+                                      CFStringRef xmlName, CFStringRef binaryName);
+
+// The value of an NVRAM variable, or NULL in *value if it isn't set
+int BLCopyNVRAMVariable(BLContextPtr context, CFStringRef name, CFTypeRef *value);
+// A variable's string or data value as a string, as BLCopyEFINVRAMVariableAsString() returns it
+int BLCreateStringFromNVRAMValue(BLContextPtr context, CFTypeRef value, CFStringRef *string);
+
+// The plist a cache made by BLNVRAMCacheCreateWithFile() reads, or NULL
+const char *BLNVRAMCacheGetPath(struct BLNVRAMCache *cache);
+
+/*
+ * NVRAM write transaction. Setting a boot device writes several variables;
+ * a transaction reads every variable once when it begins, takes sets and
+ * deletes without touching the store, and on commit writes only the ones
+ * whose value actually changes, in the order they were staged, through one
+ * handle on IODeviceTree:/options. A variable set to the value it already
+ * has, or deleted when it isn't set, is not written at all, which saves
+ * flash wear and firmware time. Setting efi-boot-device, efi-boot-next or
+ * efi-legacy-drive-hint is always written, since the kernel derives what
+ * firmware boots from each time one is set.
+ *
+ * The NVRAM lock is held from begin to commit or abort, and the context's
+ * NVRAM cache is emptied at both ends. If the context's cache was made by
+ * BLNVRAMCacheCreateWithFile(), the transaction reads and rewrites that
+ * plist instead of the firmware.
+ *
+ * Forwarding copies a variable the kernel derives from one just written
+ * (efi-legacy-drive-hint-data from efi-legacy-drive-hint, say), so it
+ * writes what is staged so far first. Abort drops what is still staged,
+ * not what a forward already wrote: a transaction that forwards is
+ * all-or-nothing only up to the forward.
+ * Begin returns 1 if the store can't be read; commit returns 2 if a write
+ * failed, and frees the transaction either way.
+ */
+typedef struct {
+    uint32_t        written;        // variables set
+    uint32_t        deleted;
+    uint32_t        unchanged;      // staged, but already so; not written
+    uint64_t        bytesWritten;   // string and data values
+} BLNVRAMTransactionStats;
+
+int BLNVRAMTransactionBegin(BLContextPtr context, struct BLNVRAMTransaction **txn);
+// The staged value of a variable, or else its value when the transaction began; NULL if unset
+int BLNVRAMTransactionCopyValue(struct BLNVRAMTransaction *txn, CFStringRef name, CFTypeRef *value);
+// A NULL value deletes the variable
+int BLNVRAMTransactionSetValue(struct BLNVRAMTransaction *txn, CFStringRef name, CFTypeRef value);
+int BLNVRAMTransactionDeleteValue(struct BLNVRAMTransaction *txn, CFStringRef name);
+int BLNVRAMTransactionForward(struct BLNVRAMTransaction *txn, CFStringRef from, CFStringRef to);
+int BLNVRAMTransactionCommit(struct BLNVRAMTransaction *txn, BLNVRAMTransactionStats *stats);
+void BLNVRAMTransactionAbort(struct BLNVRAMTransaction *txn);
+
+/*
+ * Disk descriptions. Building and interpreting the EFI device XML, RAID
+ * booter labels and the tool's OF label each opened a DiskArbitration
+ * session of their own to ask for one description, often the same one.
+ * A BLDiskDescriptions on a version 9 context opens one session the
+ * first time a description is needed and keeps every description it
+ * fetched, by BSD name, until DiskArbitration reports that the disk
+ * changed or went away.
+ *
+ * BLDiskDescriptionsCreateWithOps() asks copyDescription instead, and
+ * BLDiskDescriptionsCreateWithFile() answers from a plist dictionary of
+ * descriptions by BSD name (UUIDs as strings), so descriptions can be
+ * served without DiskArbitration for tests and benchmarks.
+ *
+ * Without one on the context, BLCopyDiskDescription() opens and closes
+ * a session for each call, as callers did by hand before.
+ */
+typedef struct {
+    int (*copyDescription)(BLContextPtr context, void *refcon, const char *bsdName, CFDictionaryRef *description);
+} BLDiskDescriptionOps;
+
+struct BLDiskDescriptions *BLDiskDescriptionsCreate(void);
+struct BLDiskDescriptions *BLDiskDescriptionsCreateWithOps(const BLDiskDescriptionOps *ops, void *refcon);
+int BLDiskDescriptionsCreateWithFile(BLContextPtr context, const char *path, struct BLDiskDescriptions **cache);
+void BLDiskDescriptionsRelease(struct BLDiskDescriptions *cache);
+void BLDiskDescriptionsGetStatistics(struct BLDiskDescriptions *cache, uint32_t *sessions, uint32_t *lookups,
+                                     uint32_t *hits, uint32_t *invalidations);
+
+// Forget one disk's description, or every description for NULL
+void BLDiskDescriptionsInvalidate(struct BLDiskDescriptions *cache, const char *bsdName);
+
+// Forget every description, unless DiskArbitration answers and keeps them current
+void BLDiskDescriptionsInvalidateStandIns(struct BLDiskDescriptions *cache);
+
+static inline struct BLDiskDescriptions *BLContextDiskDescriptions(BLContextPtr context) {
+    return (context && context->version >= kBLContextVersion9) ? context->diskdescriptions : NULL;
+}
+
+// The DiskArbitration description of bsdName ("disk1s2" or "/dev/disk1s2")
+int BLCopyDiskDescription(BLContextPtr context, const char *bsdName, CFDictionaryRef *description);
 
 #endif // _BLESS_PRIVATE_H_
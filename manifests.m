@@ -18,7 +18,8 @@
 #include "protos.h"
 
 
-int CopyManifests(BLContextPtr context, const char *destPath, const char *srcPath, const char *srcSystemPath)
+int CopyManifests(BLContextPtr context, const char *destPath, const char *srcPath, const char *srcSystemPath,
+                  struct prebootpass *pass)
 {
     int							ret = 0;
     OSPersonalizationController	*pc;
@@ -54,6 +55,7 @@ int CopyManifests(BLContextPtr context, const char *destPath, const char *srcPat
 	bool						foundUUIDPath = false;
 	uint16_t					role;
 	bool						isAPFSRegVol = false;
+	bool						shared;
 	
 	// OSPersonalization is weak-linked, so check to make sure it's present
 	if ([OSPersonalizationController class] == nil) {
@@ -132,16 +134,11 @@ int CopyManifests(BLContextPtr context, const char *destPath, const char *srcPat
 					blesscontextprintf(context, kBLLogLevelVerbose, "No UUID for volume at %s\n", srcPath);
 					break;
 				}
-				ret = GetMountForBSD(context, prebootBSD, prebootMnt, sizeof prebootMnt);
-				if (ret) { ret = 0; break; }
-				if (!prebootMnt[0]) {
-					ret = BLMountContainerVolume(context, prebootBSD, prebootMnt, sizeof prebootMnt, true);
-					if (ret) {
-						ret = 0;
-						blesscontextprintf(context, kBLLogLevelVerbose, "Could not mount preboot volume at %s\n", prebootBSD);
-						break;
-					}
-					mustUnmountPreboot = true;
+				ret = BLAcquireMount(context, prebootBSD, NULL, true, prebootMnt, sizeof prebootMnt, &mustUnmountPreboot);
+				if (ret) {
+					ret = 0;
+					blesscontextprintf(context, kBLLogLevelVerbose, "Could not mount preboot volume at %s\n", prebootBSD);
+					break;
 				}
 				prebootMntPt = [NSString stringWithUTF8String:prebootMnt];
 				prebootPath = [prebootMntPt stringByAppendingPathComponent:(NSString *)volUUID];
@@ -172,19 +169,28 @@ int CopyManifests(BLContextPtr context, const char *destPath, const char *srcPat
 			// to make noise about it.  rdar://problem/61842081
 //			blesscontextprintf(context, kBLLogLevelError, "WARNING: Missing required manifest: \"%s\".  Continuing...\n", [newSrcName UTF8String]);
 		} else {
-			[fmd removeItemAtPath:newDestPath error:NULL];
-			if ([fmd copyItemAtPath:srcPathToUse toPath:newDestPath error:&nserr] == NO) {
-				blesscontextprintf(context, kBLLogLevelError, "Couldn't copy file \"%s\" - %s\n",
-								   [newDestPath UTF8String], [[nserr description] UTF8String]);
-				ret = [nserr code];
-				break;
+			shared = false;
+			if (pass) {
+				SharePrebootFile(context, pass, [srcPathToUse fileSystemRepresentation], NULL,
+								 [newDestPath fileSystemRepresentation], &shared);
+			}
+			if (!shared) {
+				[fmd removeItemAtPath:newDestPath error:NULL];
+				if ([fmd copyItemAtPath:srcPathToUse toPath:newDestPath error:&nserr] == NO) {
+					blesscontextprintf(context, kBLLogLevelError, "Couldn't copy file \"%s\" - %s\n",
+									   [newDestPath UTF8String], [[nserr description] UTF8String]);
+					ret = [nserr code];
+					break;
+				}
+				if (pass) pass->written++;
 			}
+			if (pass) RememberPrebootFile(pass, [newDestPath fileSystemRepresentation], NULL);
 		}
     }
 	if (volUUID) CFRelease(volUUID);
 	if (groupUUID) CFRelease(groupUUID);
 	if (mustUnmountPreboot) {
-		BLUnmountContainerVolume(context, prebootMnt);
+		BLReleaseMount(context, prebootMnt);
 	}
     return ret;
 }
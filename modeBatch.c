@@ -0,0 +1,417 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ *  modeBatch.c
+ *  bless
+ *
+ *  Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/param.h>
+
+#include "enums.h"
+#include "structs.h"
+
+#include "bless.h"
+#include "bless_private.h"
+#include "protos.h"
+
+#define kMaxBatchWords  256
+
+typedef struct {
+    uint32_t    operations;
+    uint32_t    succeeded;
+    uint32_t    failed;
+    bool        stopped;
+    uint32_t    mounts;
+    uint32_t    unmounts;
+    uint32_t    reused;
+    uint64_t    wallNanos;
+} batchStats;
+
+/* Options that only make sense for the whole process, not for one line of a batch or request */
+static const int batchOnlyOptions[] = { kbatch, kstoponerror, kserve, ktrace, ktiming };
+
+static uint64_t monotonicNanos(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void addNumber(CFMutableDictionaryRef dict, CFStringRef key, long long value)
+{
+    CFNumberRef num = CFNumberCreate(kCFAllocatorDefault, kCFNumberLongLongType, &value);
+
+    CFDictionaryAddValue(dict, key, num);
+    CFRelease(num);
+}
+
+static void addString(CFMutableDictionaryRef dict, CFStringRef key, const char *value)
+{
+    CFStringRef str = CFStringCreateWithCString(kCFAllocatorDefault, value, kCFStringEncodingUTF8);
+
+    if (str) {
+        CFDictionaryAddValue(dict, key, str);
+        CFRelease(str);
+    }
+}
+
+/*
+ * Split a line into words in place, the way sh(1) would for the simple
+ * cases: blanks separate words, '...' and "..." group them, and a
+ * backslash escapes the next character outside single quotes. Returns the
+ * number of words, or -1 for an unterminated quote or too many words.
+ */
+static int splitLine(char *line, char *words[], int maxWords)
+{
+    char    *in = line, *out = line;
+    char    quote;
+    int     count = 0;
+
+    for (;;) {
+        while (*in == ' ' || *in == '\t') in++;
+        if (*in == '\0') break;
+        if (count == maxWords) return -1;
+
+        words[count++] = out;
+        quote = 0;
+        while (*in && (quote || (*in != ' ' && *in != '\t'))) {
+            if (quote && *in == quote) {
+                quote = 0;
+                in++;
+            } else if (!quote && (*in == '\'' || *in == '"')) {
+                quote = *in++;
+            } else if (*in == '\\' && quote != '\'' && in[1]) {
+                in++;
+                *out++ = *in++;
+            } else {
+                *out++ = *in++;
+            }
+        }
+        if (quote) return -1;
+        if (*in) in++;
+        *out++ = '\0';
+    }
+    return count;
+}
+
+/*
+ * Send fd (stdout or stderr) to a temporary file while an operation runs,
+ * so what it prints can be handed back with its result rather than
+ * around it
+ */
+FILE *beginOutputCapture(int fd, int *savedFD)
+{
+    FILE *capture = tmpfile();
+
+    if (!capture) return NULL;
+    fflush(fd == STDERR_FILENO ? stderr : stdout);
+    *savedFD = dup(fd);
+    if (*savedFD < 0 || dup2(fileno(capture), fd) < 0) {
+        if (*savedFD >= 0) close(*savedFD);
+        fclose(capture);
+        return NULL;
+    }
+    return capture;
+}
+
+// What was printed, or NULL for nothing
+CFDataRef endOutputCapture(int fd, FILE *capture, int savedFD)
+{
+    CFMutableDataRef    data = NULL;
+    long                len;
+
+    fflush(fd == STDERR_FILENO ? stderr : stdout);
+    dup2(savedFD, fd);
+    close(savedFD);
+
+    len = ftell(capture);
+    if (len > 0 && fseek(capture, 0, SEEK_SET) == 0) {
+        data = CFDataCreateMutable(kCFAllocatorDefault, len);
+        if (data) {
+            CFDataSetLength(data, len);
+            if (fread(CFDataGetMutableBytePtr(data), 1, len, capture) != (size_t)len) {
+                CFRelease(data);
+                data = NULL;
+            }
+        }
+    }
+    fclose(capture);
+    return data;
+}
+
+/*
+ * Parse and run one line of --batch or --serve. Returns what bless would
+ * have exited with had the line been its command line.
+ */
+int runCommandLine(BLContextPtr context, struct blesscon *bcon, struct clarg lineargs[klast],
+                   uint32_t lineno, char *line)
+{
+    char    *words[kMaxBatchWords + 1];
+    int     count, nextArg, globalVerbose = bcon->verbose;
+    int     i, ret;
+
+    // argv[0] is the program name, as getopt expects; a leading "bless" is allowed too
+    words[0] = (char *)getprogname();
+    count = splitLine(line, words + 1, kMaxBatchWords - 1);
+    if (count < 0) {
+        blesscontextprintf(context, kBLLogLevelError, "Line %u: unterminated quote or too many words\n", lineno);
+        return 1;
+    }
+    if (count > 0 && strcmp(words[1], "bless") == 0) {
+        memmove(&words[1], &words[2], (count - 1) * sizeof(words[0]));
+        count--;
+    }
+    if (count == 0) {
+        blesscontextprintf(context, kBLLogLevelError, "Line %u: no options\n", lineno);
+        return 1;
+    }
+    count++;
+    words[count] = NULL;
+
+    memset(lineargs, 0, klast * sizeof(lineargs[0]));
+    if (parseArguments(count, words, lineargs, bcon, true, &nextArg)) {
+        blesscontextprintf(context, kBLLogLevelError, "Line %u: bad options\n", lineno);
+        ret = 1;
+        goto exit;
+    }
+    for (i = 0; i < (int)(sizeof(batchOnlyOptions) / sizeof(batchOnlyOptions[0])); i++) {
+        if (lineargs[batchOnlyOptions[i]].present) {
+            blesscontextprintf(context, kBLLogLevelError,
+                               "Line %u: --batch, --stop-on-error, --serve, --trace and --timing can't be used here\n",
+                               lineno);
+            ret = 1;
+            goto exit;
+        }
+    }
+
+    context->loglevels = blessloglevels(bcon);
+    ret = runMode(context, lineargs, count - nextArg, words + nextArg);
+
+    // Each operation's files are durable before its status is reported
+    if (BLContextSyncBatch(context) && BLSyncBatchCommit(context, BLContextSyncBatch(context)) && ret == 0) {
+        ret = 1;
+    }
+
+exit:
+    bcon->verbose = globalVerbose;
+    context->loglevels = blessloglevels(bcon);
+    return ret;
+}
+
+static int printPlist(CFArrayRef operations, batchStats *stats)
+{
+    CFMutableDictionaryRef  dict, stat;
+    CFDataRef               tempData;
+
+    dict = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks,
+                                     &kCFTypeDictionaryValueCallBacks);
+    CFDictionaryAddValue(dict, CFSTR("Operations"), operations);
+
+    stat = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks,
+                                     &kCFTypeDictionaryValueCallBacks);
+    addNumber(stat, CFSTR("Operations"), stats->operations);
+    addNumber(stat, CFSTR("Succeeded"), stats->succeeded);
+    addNumber(stat, CFSTR("Failed"), stats->failed);
+    CFDictionaryAddValue(stat, CFSTR("Stopped"), stats->stopped ? kCFBooleanTrue : kCFBooleanFalse);
+    addNumber(stat, CFSTR("Mounts"), stats->mounts);
+    addNumber(stat, CFSTR("Unmounts"), stats->unmounts);
+    addNumber(stat, CFSTR("Reused Mounts"), stats->reused);
+    addNumber(stat, CFSTR("Wall Time (us)"), stats->wallNanos / 1000);
+    CFDictionaryAddValue(dict, CFSTR("Statistics"), stat);
+    CFRelease(stat);
+
+    tempData = CFPropertyListCreateData(kCFAllocatorDefault, dict, kCFPropertyListXMLFormat_v1_0, 0, NULL);
+    CFRelease(dict);
+    if (!tempData) return 1;
+
+    write(fileno(stdout), CFDataGetBytePtr(tempData), CFDataGetLength(tempData));
+    CFRelease(tempData);
+    return 0;
+}
+
+/*
+ * Run one bless command line per line of a file (or stdin for "-"), in
+ * this process, sharing the context's mount table, disk topology, mount
+ * leases and trace buffer. Blank lines and lines starting with '#' are
+ * skipped. Each operation is reported as it finishes:
+ *
+ *   op <line> ok usec=N <command>
+ *   op <line> failed error=N usec=N <command>
+ *   summary operations=N succeeded=N failed=N stopped=yes|no mounts=N unmounts=N reused=N wall_usec=N
+ *
+ * With --plist, the same goes into one plist at the end, and whatever an
+ * operation printed is kept as its "Output".
+ */
+int modeBatch(BLContextPtr context, struct clarg actargs[klast], struct blesscon *bcon)
+{
+    struct BLMountLeases    *leases = BLContextMountLeases(context);
+    struct clarg            *lineargs = NULL;
+    CFMutableArrayRef       operations = NULL;
+    batchStats              stats;
+    const char              *path = actargs[kbatch].argument;
+    bool                    usePlist = actargs[kplist].present;
+    FILE                    *input = NULL;
+    char                    *line = NULL, *command = NULL;
+    size_t                  lineCap = 0;
+    ssize_t                 len;
+    uint32_t                lineno = 0;
+    uint64_t                start = monotonicNanos(), opStart, opNanos;
+    int                     i, ret = 0, status;
+
+    memset(&stats, 0, sizeof stats);
+
+    // Only options about the batch itself may sit beside --batch
+    for (i = 1; i < klast; i++) {
+        if (!actargs[i].present) continue;
+        if (i == kbatch || i == kstoponerror || i == kplist || i == ktrace || i == kverbose || i == kquiet) continue;
+        blesscontextprintf(context, kBLLogLevelError,
+                           "Only --stop-on-error, --plist, --trace, --verbose and --quiet can be used with --batch\n");
+        return 1;
+    }
+
+    if (strcmp(path, "-") == 0) {
+        input = stdin;
+    } else {
+        input = fopen(path, "r");
+        if (!input) {
+            blesscontextprintf(context, kBLLogLevelError, "Can't open batch file %s\n", path);
+            return 1;
+        }
+    }
+
+    // One 2K-per-option table for every line, not one per operation
+    lineargs = calloc(klast, sizeof(*lineargs));
+    if (!lineargs) {
+        ret = 1;
+        goto exit;
+    }
+    if (usePlist) {
+        operations = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
+    }
+
+    while ((len = getline(&line, &lineCap, input)) != -1) {
+        uint64_t    span;
+        CFDataRef   output = NULL;
+        FILE        *capture = NULL;
+        int         savedFD = -1;
+        char        *text = line;
+
+        lineno++;
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) line[--len] = '\0';
+        while (*text == ' ' || *text == '\t') text++;
+        if (*text == '\0' || *text == '#') continue;
+
+        // splitLine() works in place; keep the line as written for the report
+        free(command);
+        command = strdup(text);
+        if (!command) {
+            ret = 1;
+            goto exit;
+        }
+
+        if (usePlist) capture = beginOutputCapture(STDOUT_FILENO, &savedFD);
+        span = BLTraceBegin(context);
+        opStart = monotonicNanos();
+        status = runCommandLine(context, bcon, lineargs, lineno, text);
+        opNanos = monotonicNanos() - opStart;
+        BLTraceEnd(context, span, "batch", command);
+        if (capture) output = endOutputCapture(STDOUT_FILENO, capture, savedFD);
+
+        stats.operations++;
+        if (status == 0) {
+            stats.succeeded++;
+        } else {
+            stats.failed++;
+        }
+
+        if (usePlist) {
+            CFMutableDictionaryRef op;
+
+            op = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks,
+                                           &kCFTypeDictionaryValueCallBacks);
+            addNumber(op, CFSTR("Line"), lineno);
+            addString(op, CFSTR("Command"), command);
+            CFDictionaryAddValue(op, CFSTR("Succeeded"), status ? kCFBooleanFalse : kCFBooleanTrue);
+            if (status) addNumber(op, CFSTR("Error"), status);
+            addNumber(op, CFSTR("Latency (us)"), opNanos / 1000);
+            if (output) {
+                CFStringRef str = CFStringCreateFromExternalRepresentation(kCFAllocatorDefault, output,
+                                                                           kCFStringEncodingUTF8);
+                if (str) {
+                    CFDictionaryAddValue(op, CFSTR("Output"), str);
+                    CFRelease(str);
+                }
+            }
+            CFArrayAppendValue(operations, op);
+            CFRelease(op);
+        } else if (status == 0) {
+            blesscontextprintf(context, kBLLogLevelNormal, "op\t%u\tok\tusec=%llu\t%s\n",
+                               lineno, (unsigned long long)(opNanos / 1000), command);
+        } else {
+            blesscontextprintf(context, kBLLogLevelNormal, "op\t%u\tfailed\terror=%d\tusec=%llu\t%s\n",
+                               lineno, status, (unsigned long long)(opNanos / 1000), command);
+        }
+        if (output) CFRelease(output);
+
+        if (status && actargs[kstoponerror].present) {
+            stats.stopped = true;
+            break;
+        }
+    }
+    if (ferror(input)) {
+        blesscontextprintf(context, kBLLogLevelError, "Can't read batch file %s\n", path);
+        ret = 1;
+    }
+
+    if (leases) BLMountLeasesGetStatistics(leases, &stats.mounts, &stats.unmounts, &stats.reused);
+    stats.wallNanos = monotonicNanos() - start;
+
+    if (usePlist) {
+        if (printPlist(operations, &stats)) ret = 1;
+    } else {
+        blesscontextprintf(context, kBLLogLevelNormal,
+                           "summary\toperations=%u\tsucceeded=%u\tfailed=%u\tstopped=%s"
+                           "\tmounts=%u\tunmounts=%u\treused=%u\twall_usec=%llu\n",
+                           stats.operations, stats.succeeded, stats.failed, stats.stopped ? "yes" : "no",
+                           stats.mounts, stats.unmounts, stats.reused,
+                           (unsigned long long)(stats.wallNanos / 1000));
+    }
+    if (!ret && stats.failed) ret = 2;
+
+exit:
+    if (operations) CFRelease(operations);
+    free(command);
+    free(line);
+    free(lineargs);
+    if (input && input != stdin) fclose(input);
+    return ret;
+}
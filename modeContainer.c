@@ -0,0 +1,348 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ *  modeContainer.c
+ *  bless
+ *
+ *  Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <paths.h>
+#include <sys/param.h>
+#include <APFS/APFS.h>
+
+#include "enums.h"
+#include "structs.h"
+
+#include "bless.h"
+#include "bless_private.h"
+#include "protos.h"
+
+typedef struct {
+    char        bsd[64];
+    char        folder[MAXPATHLEN];
+    int         status;
+    uint32_t    written;
+    uint32_t    cloned;
+    uint32_t    unchanged;
+    uint64_t    elapsedNanos;
+} containerResult;
+
+typedef struct {
+    uint32_t    volumeCount;
+    uint32_t    blessedCount;
+    uint32_t    failedCount;
+    uint32_t    mounts;
+    uint32_t    unmounts;
+    uint32_t    reused;
+    uint64_t    wallNanos;
+} containerStats;
+
+static uint64_t monotonicNanos(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void addNumber(CFMutableDictionaryRef dict, CFStringRef key, long long value)
+{
+    CFNumberRef num = CFNumberCreate(kCFAllocatorDefault, kCFNumberLongLongType, &value);
+
+    CFDictionaryAddValue(dict, key, num);
+    CFRelease(num);
+}
+
+static void addString(CFMutableDictionaryRef dict, CFStringRef key, const char *value)
+{
+    CFStringRef str = CFStringCreateWithCString(kCFAllocatorDefault, value, kCFStringEncodingUTF8);
+
+    if (str) {
+        CFDictionaryAddValue(dict, key, str);
+        CFRelease(str);
+    }
+}
+
+static int printPlist(containerResult *results, uint32_t count, struct prebootpass *pass, containerStats *stats)
+{
+    CFMutableDictionaryRef  dict, stat;
+    CFMutableArrayRef       volumes;
+    CFDataRef               tempData;
+    uint32_t                i;
+
+    dict = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks,
+                                     &kCFTypeDictionaryValueCallBacks);
+    volumes = CFArrayCreateMutable(kCFAllocatorDefault, count, &kCFTypeArrayCallBacks);
+
+    for (i = 0; i < count; i++) {
+        CFMutableDictionaryRef  volume;
+
+        volume = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks,
+                                           &kCFTypeDictionaryValueCallBacks);
+        addString(volume, CFSTR("Device"), results[i].bsd);
+        CFDictionaryAddValue(volume, CFSTR("Blessed"), results[i].status ? kCFBooleanFalse : kCFBooleanTrue);
+        if (results[i].status) {
+            addNumber(volume, CFSTR("Error"), results[i].status);
+        } else {
+            addString(volume, CFSTR("Preboot Folder"), results[i].folder);
+            addNumber(volume, CFSTR("Written"), results[i].written);
+            addNumber(volume, CFSTR("Cloned"), results[i].cloned);
+            addNumber(volume, CFSTR("Unchanged"), results[i].unchanged);
+        }
+        addNumber(volume, CFSTR("Latency (us)"), results[i].elapsedNanos / 1000);
+        CFArrayAppendValue(volumes, volume);
+        CFRelease(volume);
+    }
+    CFDictionaryAddValue(dict, CFSTR("Volumes"), volumes);
+    CFRelease(volumes);
+
+    stat = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks,
+                                     &kCFTypeDictionaryValueCallBacks);
+    addNumber(stat, CFSTR("Volumes"), stats->volumeCount);
+    addNumber(stat, CFSTR("Blessed"), stats->blessedCount);
+    addNumber(stat, CFSTR("Failed"), stats->failedCount);
+    addNumber(stat, CFSTR("Written"), pass->written);
+    addNumber(stat, CFSTR("Cloned"), pass->cloned);
+    addNumber(stat, CFSTR("Cloned Bytes"), pass->clonedBytes);
+    addNumber(stat, CFSTR("Unchanged"), pass->unchanged);
+    addNumber(stat, CFSTR("Mounts"), stats->mounts);
+    addNumber(stat, CFSTR("Unmounts"), stats->unmounts);
+    addNumber(stat, CFSTR("Reused Mounts"), stats->reused);
+    addNumber(stat, CFSTR("Wall Time (us)"), stats->wallNanos / 1000);
+    CFDictionaryAddValue(dict, CFSTR("Statistics"), stat);
+    CFRelease(stat);
+
+    tempData = CFPropertyListCreateData(kCFAllocatorDefault, dict, kCFPropertyListXMLFormat_v1_0, 0, NULL);
+    CFRelease(dict);
+    if (!tempData) return 1;
+
+    write(fileno(stdout), CFDataGetBytePtr(tempData), CFDataGetLength(tempData));
+    CFRelease(tempData);
+    return 0;
+}
+
+/*
+ * One tab-separated record per system volume, then a summary record:
+ *
+ *   volume <bsd> blessed folder=<path> written=N cloned=N unchanged=N usec=N
+ *   volume <bsd> failed error=N usec=N
+ *   summary volumes=N blessed=N failed=N written=N cloned=N cloned_bytes=N unchanged=N
+ *           mounts=N unmounts=N reused=N wall_usec=N
+ */
+static void printRecords(BLContextPtr context, containerResult *results, uint32_t count,
+                         struct prebootpass *pass, containerStats *stats)
+{
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        if (0 == results[i].status) {
+            blesscontextprintf(context, kBLLogLevelNormal,
+                               "volume\t%s\tblessed\tfolder=%s\twritten=%u\tcloned=%u\tunchanged=%u\tusec=%llu\n",
+                               results[i].bsd, results[i].folder, results[i].written, results[i].cloned,
+                               results[i].unchanged, (unsigned long long)(results[i].elapsedNanos / 1000));
+        } else {
+            blesscontextprintf(context, kBLLogLevelNormal, "volume\t%s\tfailed\terror=%d\tusec=%llu\n",
+                               results[i].bsd, results[i].status,
+                               (unsigned long long)(results[i].elapsedNanos / 1000));
+        }
+    }
+
+    blesscontextprintf(context, kBLLogLevelNormal,
+                       "summary\tvolumes=%u\tblessed=%u\tfailed=%u\twritten=%u\tcloned=%u\tcloned_bytes=%llu"
+                       "\tunchanged=%u\tmounts=%u\tunmounts=%u\treused=%u\twall_usec=%llu\n",
+                       stats->volumeCount, stats->blessedCount, stats->failedCount,
+                       pass->written, pass->cloned, (unsigned long long)pass->clonedBytes, pass->unchanged,
+                       stats->mounts, stats->unmounts, stats->reused,
+                       (unsigned long long)(stats->wallNanos / 1000));
+}
+
+static int loadLabels(BLContextPtr context, struct clarg actargs[klast], CFDataRef *labelData, CFDataRef *labelData2)
+{
+    int ret;
+
+    if (actargs[klabelfile].present) {
+        ret = BLLoadFile(context, actargs[klabelfile].argument, 0, labelData);
+        if (ret) {
+            blesscontextprintf(context, kBLLogLevelError, "Can't load label '%s'\n",
+                               actargs[klabelfile].argument);
+            return 2;
+        }
+    } else if (actargs[klabel].present) {
+        ret = BLGenerateLabelData(context, actargs[klabel].argument, kBitmapScale_1x, labelData);
+        if (!ret) ret = BLGenerateLabelData(context, actargs[klabel].argument, kBitmapScale_2x, labelData2);
+        if (ret) {
+            blesscontextprintf(context, kBLLogLevelError, "Can't render label '%s'\n",
+                               actargs[klabel].argument);
+            return 3;
+        }
+    }
+    return 0;
+}
+
+// Bless the Preboot folder of one system volume, sharing files with those done before it
+static int blessVolume(BLContextPtr context, struct clarg actargs[klast], const char *bsd,
+                       CFDataRef labelData, CFDataRef labelData2, struct prebootpass *pass)
+{
+    char        systemPath[MAXPATHLEN];
+    char        bootdev[MAXPATHLEN];
+    const char  *bootEFISource;
+    bool        mustRelease = false;
+    int         ret;
+
+    // BlessPrebootVolume() reads the booter and kernel collections from the mounted system volume
+    ret = BLAcquireMount(context, bsd, NULL, true, systemPath, sizeof systemPath, &mustRelease);
+    if (ret) {
+        blesscontextprintf(context, kBLLogLevelError, "Couldn't mount system volume %s\n", bsd);
+        return ret;
+    }
+
+    if (actargs[kbootefi].hasArg) {
+        bootEFISource = actargs[kbootefi].argument;
+    } else {
+        // Relative to the volume, or the snapshot it boots from
+        snprintf(bootdev, sizeof bootdev, "%s%s", systemPath, kBL_PATH_I386_BOOTDEV_EFI);
+        bootEFISource = access(bootdev, R_OK) == 0 ? kBL_PATH_I386_BOOTDEV_EFI : kBL_PATH_I386_BOOT_EFI;
+    }
+    ret = BlessPrebootVolume(context, bsd, bootEFISource, labelData, labelData2, actargs, pass);
+
+    if (mustRelease) BLReleaseMount(context, systemPath);
+    return ret;
+}
+
+int modeContainer(BLContextPtr context, struct clarg actargs[klast])
+{
+    CFArrayRef          volumes = NULL;
+    CFDataRef           labelData = NULL;
+    CFDataRef           labelData2 = NULL;
+    containerResult     *results = NULL;
+    containerStats      stats;
+    struct prebootpass  pass;
+    struct BLMountLeases *leases = BLContextMountLeases(context);
+    char                prebootBSD[64];
+    char                prebootMount[MAXPATHLEN];
+    bool                mustRelease = false;
+    const char          *container = actargs[kcontainer].argument;
+    uint64_t            start = monotonicNanos();
+    uint64_t            volStart;
+    uint32_t            written, cloned, unchanged;
+    uint32_t            i;
+    int                 ret;
+
+    memset(&stats, 0, sizeof stats);
+    memset(&pass, 0, sizeof pass);
+
+    if (actargs[kcreatesnapshot].present || actargs[klastsealedsnapshot].present) {
+        blesscontextprintf(context, kBLLogLevelError,
+                           "Can't use create-snapshot or last-sealed-snapshot with --container\n");
+        return 1;
+    }
+
+    ret = BLAPFSCreateVolumeBSDsWithRole(context, container, APFS_VOL_ROLE_SYSTEM, &volumes);
+    if (ret) {
+        blesscontextprintf(context, kBLLogLevelError, "Can't find the system volumes of %s\n", container);
+        return 1;
+    }
+    stats.volumeCount = (uint32_t)CFArrayGetCount(volumes);
+    if (stats.volumeCount == 0) {
+        blesscontextprintf(context, kBLLogLevelError, "No system volumes in the container of %s\n", container);
+        ret = 1;
+        goto exit;
+    }
+    results = calloc(stats.volumeCount, sizeof(*results));
+    if (!results) {
+        ret = 1;
+        goto exit;
+    }
+    for (i = 0; i < stats.volumeCount; i++) {
+        CFStringGetCString(CFArrayGetValueAtIndex(volumes, i), results[i].bsd, sizeof results[i].bsd,
+                           kCFStringEncodingUTF8);
+    }
+
+    ret = loadLabels(context, actargs, &labelData, &labelData2);
+    if (ret) goto exit;
+
+    // Every volume shares one Preboot; mount it once, writable, for the whole pass
+    ret = GetPrebootBSDForVolumeBSD(context, results[0].bsd, prebootBSD, sizeof prebootBSD);
+    if (ret) {
+        blesscontextprintf(context, kBLLogLevelError, "Could not find preboot volume for %s\n", results[0].bsd);
+        ret = 1;
+        goto exit;
+    }
+    ret = BLAcquireMount(context, prebootBSD, NULL, false, prebootMount, sizeof prebootMount, &mustRelease);
+    if (ret) {
+        blesscontextprintf(context, kBLLogLevelError, "Couldn't mount preboot volume %s\n", prebootBSD);
+        ret = 1;
+        goto exit;
+    }
+
+    for (i = 0; i < stats.volumeCount; i++) {
+        volStart = monotonicNanos();
+        written = pass.written;
+        cloned = pass.cloned;
+        unchanged = pass.unchanged;
+        pass.folder[0] = '\0';
+
+        blesscontextprintf(context, kBLLogLevelVerbose, "Blessing system volume %s\n", results[i].bsd);
+        results[i].status = blessVolume(context, actargs, results[i].bsd, labelData, labelData2, &pass);
+        if (results[i].status) {
+            stats.failedCount++;
+        } else {
+            stats.blessedCount++;
+            strlcpy(results[i].folder, pass.folder, sizeof results[i].folder);
+        }
+        results[i].written = pass.written - written;
+        results[i].cloned = pass.cloned - cloned;
+        results[i].unchanged = pass.unchanged - unchanged;
+        results[i].elapsedNanos = monotonicNanos() - volStart;
+    }
+
+    if (mustRelease) {
+        BLReleaseMount(context, prebootMount);
+        mustRelease = false;
+    }
+    if (leases) BLMountLeasesGetStatistics(leases, &stats.mounts, &stats.unmounts, &stats.reused);
+    stats.wallNanos = monotonicNanos() - start;
+
+    if (actargs[kplist].present) {
+        ret = printPlist(results, stats.volumeCount, &pass, &stats);
+    } else {
+        printRecords(context, results, stats.volumeCount, &pass, &stats);
+    }
+    if (!ret && stats.failedCount) ret = 2;
+
+exit:
+    if (mustRelease) BLReleaseMount(context, prebootMount);
+    FreePrebootPass(&pass);
+    free(results);
+    if (labelData) CFRelease(labelData);
+    if (labelData2) CFRelease(labelData2);
+    if (volumes) CFRelease(volumes);
+    return ret;
+}
@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2013-2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ *  modeScanImages.c
+ *  bless
+ *
+ *  Copyright (c) 2013-2020 Apple Inc. All Rights Reserved.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/param.h>
+
+#include "enums.h"
+#include "structs.h"
+
+#include "bless.h"
+#include "bless_private.h"
+#include "protos.h"
+
+static void addNumber(CFMutableDictionaryRef dict, CFStringRef key, long long value)
+{
+    CFNumberRef num = CFNumberCreate(kCFAllocatorDefault, kCFNumberLongLongType, &value);
+
+    CFDictionaryAddValue(dict, key, num);
+    CFRelease(num);
+}
+
+static int printPlist(BLElToritoImageScanResult *results, uint32_t count, BLElToritoImageScanStats *stats)
+{
+    CFMutableDictionaryRef  dict, stat;
+    CFMutableArrayRef       images;
+    CFDataRef               tempData;
+    uint32_t                i;
+
+    dict = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks,
+                                     &kCFTypeDictionaryValueCallBacks);
+    images = CFArrayCreateMutable(kCFAllocatorDefault, count, &kCFTypeArrayCallBacks);
+
+    for (i = 0; i < count; i++) {
+        CFMutableDictionaryRef  image;
+        CFStringRef             str;
+
+        image = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks,
+                                          &kCFTypeDictionaryValueCallBacks);
+        str = CFStringCreateWithCString(kCFAllocatorDefault, results[i].path, kCFStringEncodingUTF8);
+        if (str) {
+            CFDictionaryAddValue(image, CFSTR("Path"), str);
+            CFRelease(str);
+        }
+        CFDictionaryAddValue(image, CFSTR("Bootable"), results[i].status ? kCFBooleanFalse : kCFBooleanTrue);
+        if (results[i].status) {
+            str = CFStringCreateWithCString(kCFAllocatorDefault, results[i].reason, kCFStringEncodingUTF8);
+            CFDictionaryAddValue(image, CFSTR("Reason"), str);
+            CFRelease(str);
+            addNumber(image, CFSTR("Error"), results[i].status);
+        } else {
+            addNumber(image, CFSTR("Boot Entry"), results[i].bootEntry);
+            addNumber(image, CFSTR("Partition Start"), results[i].offsetBlocks);
+            addNumber(image, CFSTR("Partition Size"), results[i].sizeBlocks);
+        }
+        addNumber(image, CFSTR("Catalog Entries"), results[i].entryCount);
+        addNumber(image, CFSTR("Latency (us)"), results[i].elapsedNanos / 1000);
+        CFArrayAppendValue(images, image);
+        CFRelease(image);
+    }
+    CFDictionaryAddValue(dict, CFSTR("Images"), images);
+    CFRelease(images);
+
+    stat = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks,
+                                     &kCFTypeDictionaryValueCallBacks);
+    addNumber(stat, CFSTR("Images"), stats->imageCount);
+    addNumber(stat, CFSTR("Bootable"), stats->bootableCount);
+    addNumber(stat, CFSTR("Rejected"), stats->rejectedCount);
+    addNumber(stat, CFSTR("Workers"), stats->workers);
+    addNumber(stat, CFSTR("Wall Time (us)"), stats->wallNanos / 1000);
+    addNumber(stat, CFSTR("Min Latency (us)"), stats->minNanos / 1000);
+    addNumber(stat, CFSTR("Max Latency (us)"), stats->maxNanos / 1000);
+    addNumber(stat, CFSTR("Mean Latency (us)"), stats->imageCount ? stats->totalNanos / stats->imageCount / 1000 : 0);
+    CFDictionaryAddValue(dict, CFSTR("Statistics"), stat);
+    CFRelease(stat);
+
+    tempData = CFPropertyListCreateData(kCFAllocatorDefault, dict, kCFPropertyListXMLFormat_v1_0, 0, NULL);
+    CFRelease(dict);
+    if (!tempData) return 1;
+
+    write(fileno(stdout), CFDataGetBytePtr(tempData), CFDataGetLength(tempData));
+    CFRelease(tempData);
+    return 0;
+}
+
+/*
+ * One tab-separated record per image, then a summary record:
+ *
+ *   image <path> bootable entry=N offset=N size=N entries=N usec=N
+ *   image <path> rejected reason=<text> error=N entries=N usec=N
+ *   summary images=N bootable=N rejected=N workers=N wall_usec=N images_per_sec=N
+ *           min_usec=N mean_usec=N max_usec=N
+ */
+static void printRecords(BLContextPtr context, BLElToritoImageScanResult *results, uint32_t count,
+                         BLElToritoImageScanStats *stats)
+{
+    uint32_t i;
+    double   wall = stats->wallNanos / 1e9;
+
+    for (i = 0; i < count; i++) {
+        if (0 == results[i].status) {
+            blesscontextprintf(context, kBLLogLevelNormal,
+                               "image\t%s\tbootable\tentry=%u\toffset=%u\tsize=%u\tentries=%u\tusec=%llu\n",
+                               results[i].path, results[i].bootEntry, results[i].offsetBlocks,
+                               results[i].sizeBlocks, results[i].entryCount,
+                               (unsigned long long)(results[i].elapsedNanos / 1000));
+        } else {
+            blesscontextprintf(context, kBLLogLevelNormal,
+                               "image\t%s\trejected\treason=%s\terror=%d\tentries=%u\tusec=%llu\n",
+                               results[i].path, results[i].reason, results[i].status,
+                               results[i].entryCount,
+                               (unsigned long long)(results[i].elapsedNanos / 1000));
+        }
+    }
+
+    blesscontextprintf(context, kBLLogLevelNormal,
+                       "summary\timages=%u\tbootable=%u\trejected=%u\tworkers=%u\twall_usec=%llu\timages_per_sec=%.1f"
+                       "\tmin_usec=%llu\tmean_usec=%llu\tmax_usec=%llu\n",
+                       stats->imageCount, stats->bootableCount, stats->rejectedCount, stats->workers,
+                       (unsigned long long)(stats->wallNanos / 1000),
+                       wall > 0 ? stats->imageCount / wall : 0.0,
+                       (unsigned long long)(stats->minNanos / 1000),
+                       (unsigned long long)(stats->imageCount ? stats->totalNanos / stats->imageCount / 1000 : 0),
+                       (unsigned long long)(stats->maxNanos / 1000));
+}
+
+int modeScanImages(BLContextPtr context, struct clarg actargs[klast], int argc, char * const argv[])
+{
+    const char                  **paths;
+    uint32_t                    pathCount = 0;
+    uint32_t                    workers = 0;
+    BLElToritoImageScanResult   *results = NULL;
+    uint32_t                    count = 0;
+    BLElToritoImageScanStats    stats;
+    int                         i;
+    int                         ret;
+
+    if (actargs[kjobs].present) {
+        char *end;
+        long n = strtol(actargs[kjobs].argument, &end, 0);
+
+        if (*end != '\0' || n < 0) {
+            blesscontextprintf(context, kBLLogLevelError, "Invalid --jobs value '%s'\n", actargs[kjobs].argument);
+            return 1;
+        }
+        workers = (uint32_t)n;
+    }
+
+    // --scanimages takes the first path; any further operands are more images or directories
+    paths = calloc(argc + 1, sizeof(*paths));
+    if (!paths) return 1;
+    paths[pathCount++] = actargs[kscanimages].argument;
+    for (i = 0; i < argc; i++) {
+        paths[pathCount++] = argv[i];
+    }
+
+    ret = BLScanElToritoImages(context, paths, pathCount, workers, &results, &count, &stats);
+    free(paths);
+    if (ret) {
+        blesscontextprintf(context, kBLLogLevelError, "Can't build image list: %s\n", strerror(ret));
+        return 1;
+    }
+
+    if (actargs[kplist].present) {
+        ret = printPlist(results, count, &stats);
+    } else {
+        printRecords(context, results, count, &stats);
+    }
+
+    BLElToritoImageScanResultsRelease(results, count);
+
+    if (ret) return ret;
+    return stats.bootableCount == stats.imageCount ? 0 : 2;
+}
@@ -0,0 +1,523 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ *  modeServe.c
+ *  bless
+ *
+ *  Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#ifdef __APPLE__
+#include <dispatch/dispatch.h>
+#include <IOKit/IOKitLib.h>
+#include <IOKit/storage/IOMedia.h>
+#endif
+
+#include "enums.h"
+#include "structs.h"
+
+#include "bless.h"
+#include "bless_private.h"
+#include "protos.h"
+
+#define kMaxServeClients        32
+#define kMaxRequestLength       4096
+#define kResponseTimeoutSecs    5
+#define kPollMillis             1000
+
+#ifdef __APPLE__
+#define kBLStatMTime            st_mtimespec
+#else
+#define kBLStatMTime            st_mtim
+#endif
+
+struct serveClient {
+    int         fd;
+    size_t      len;
+    char        buffer[kMaxRequestLength];
+};
+
+typedef struct {
+    uint32_t    requests;
+    uint32_t    failed;
+    uint32_t    topologyChanges;
+    uint32_t    mounts;
+    uint32_t    unmounts;
+    uint32_t    reused;
+    uint64_t    busyNanos;
+    const char  *snapshotPath;      // BL_TOPOLOGY_SNAPSHOT, watched instead of IOKit
+    struct stat snapshotStat;
+} serveState;
+
+static volatile sig_atomic_t gStopServing;
+static atomic_bool gDisksChanged;
+
+static void catchStop(int sig)
+{
+    gStopServing = 1;
+}
+
+static uint64_t monotonicNanos(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#ifdef __APPLE__
+
+static void mediaChanged(void *refcon, io_iterator_t iter)
+{
+    io_object_t obj;
+
+    // Draining the iterator re-arms the notification
+    while ((obj = IOIteratorNext(iter)) != IO_OBJECT_NULL) IOObjectRelease(obj);
+    atomic_store(&gDisksChanged, true);
+}
+
+/*
+ * Have IOKit tell us when a disk, partition or volume comes or goes, so
+ * the topology is only read again when it has changed. The callbacks run
+ * on their own queue and just raise a flag for the request loop.
+ */
+static IONotificationPortRef watchDisks(BLContextPtr context, io_iterator_t iters[2])
+{
+    IONotificationPortRef   port;
+    kern_return_t           kret;
+
+    port = IONotificationPortCreate(kIOMasterPortDefault);
+    if (!port) return NULL;
+    IONotificationPortSetDispatchQueue(port, dispatch_queue_create("com.apple.bless.serve.disks", NULL));
+
+    kret = IOServiceAddMatchingNotification(port, kIOFirstPublishNotification, IOServiceMatching(kIOMediaClass),
+                                            mediaChanged, NULL, &iters[0]);
+    if (kret == KERN_SUCCESS) {
+        kret = IOServiceAddMatchingNotification(port, kIOTerminatedNotification, IOServiceMatching(kIOMediaClass),
+                                                mediaChanged, NULL, &iters[1]);
+    }
+    if (kret != KERN_SUCCESS) {
+        blesscontextprintf(context, kBLLogLevelError, "Can't watch for disk changes: %#x\n", kret);
+        if (iters[0] != IO_OBJECT_NULL) IOObjectRelease(iters[0]);
+        IONotificationPortDestroy(port);
+        return NULL;
+    }
+    mediaChanged(NULL, iters[0]);
+    mediaChanged(NULL, iters[1]);
+    atomic_store(&gDisksChanged, false);
+    return port;
+}
+
+static void unwatchDisks(IONotificationPortRef port, io_iterator_t iters[2])
+{
+    if (!port) return;
+    IOObjectRelease(iters[0]);
+    IOObjectRelease(iters[1]);
+    IONotificationPortDestroy(port);
+}
+
+#endif /* __APPLE__ */
+
+// The snapshot standing in for the registry was replaced or rewritten
+static bool snapshotChanged(serveState *state)
+{
+    struct stat sb;
+
+    if (!state->snapshotPath || stat(state->snapshotPath, &sb) < 0) return false;
+    if (sb.st_ino == state->snapshotStat.st_ino && sb.st_size == state->snapshotStat.st_size &&
+        memcmp(&sb.kBLStatMTime, &state->snapshotStat.kBLStatMTime, sizeof sb.kBLStatMTime) == 0) {
+        return false;
+    }
+    state->snapshotStat = sb;
+    return true;
+}
+
+/*
+ * Drop what a change notification says is out of date. The mount table
+ * notices mounts and unmounts itself, disk descriptions hear from
+ * DiskArbitration and the NVRAM cache ages out on its own, so only the
+ * topology needs telling, and stand-in descriptions with it.
+ */
+static void refreshCaches(BLContextPtr context, serveState *state)
+{
+    bool changed = atomic_exchange(&gDisksChanged, false);
+
+    if (snapshotChanged(state)) changed = true;
+    if (changed && BLContextTopology(context)) {
+        blesscontextprintf(context, kBLLogLevelVerbose, "Disks changed, reading the topology again\n");
+        BLTopologyInvalidate(BLContextTopology(context));
+        BLDiskDescriptionsInvalidateStandIns(BLContextDiskDescriptions(context));
+        state->topologyChanges++;
+    }
+}
+
+/*
+ * Nothing stays mounted between requests: a volume bless mounted for
+ * one request is unmounted before the next, as a command line would
+ */
+static int renewMountLeases(BLContextPtr context, serveState *state)
+{
+    struct BLMountLeases    *leases = BLContextMountLeases(context);
+    uint32_t                mounts = 0, unmounts = 0, reused = 0;
+    int                     ret;
+
+    if (!leases) return 0;
+    BLMountLeasesGetStatistics(leases, &mounts, &unmounts, &reused);
+    ret = BLMountLeasesRelease(context, leases);
+    state->mounts += mounts;
+    state->unmounts += unmounts;
+    state->reused += reused;
+    context->mountleases = BLMountLeasesCreate(kBLMountLeasesKeepMounted);
+    if (!context->mountleases) return ENOMEM;
+    return ret;
+}
+
+static int writeAll(int fd, const void *bytes, size_t len)
+{
+    const char  *p = bytes;
+    ssize_t     n;
+
+    while (len > 0) {
+        n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return errno ? errno : EIO;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * Every response is a header line followed by exactly what the header
+ * says: what the request printed to stdout, then what it printed to
+ * stderr
+ */
+static int respond(int fd, int status, const void *out, size_t outLen, const void *err, size_t errLen)
+{
+    char    header[64];
+    int     ret;
+
+    snprintf(header, sizeof header, "status %d %zu %zu\n", status, outLen, errLen);
+    ret = writeAll(fd, header, strlen(header));
+    if (!ret && outLen) ret = writeAll(fd, out, outLen);
+    if (!ret && errLen) ret = writeAll(fd, err, errLen);
+    return ret;
+}
+
+static int respondWithStatistics(BLContextPtr context, int fd, serveState *state)
+{
+    uint32_t    loads = 0, hits = 0, misses = 0, invalidations = 0;
+    uint32_t    daSessions = 0, daLookups = 0, daHits = 0;
+    char        text[512];
+
+    if (BLContextTopology(context)) BLTopologyGetStatistics(BLContextTopology(context), &loads);
+    if (BLContextNVRAMCache(context)) {
+        BLNVRAMCacheGetStatistics(BLContextNVRAMCache(context), &hits, &misses, &invalidations);
+    }
+    if (BLContextDiskDescriptions(context)) {
+        BLDiskDescriptionsGetStatistics(BLContextDiskDescriptions(context), &daSessions, &daLookups, &daHits, NULL);
+    }
+    snprintf(text, sizeof text,
+             "requests=%u\tfailed=%u\tbusy_usec=%llu\ttopology_loads=%u\ttopology_changes=%u"
+             "\tnvram_hits=%u\tnvram_misses=%u\tnvram_invalidations=%u\tda_sessions=%u\tda_lookups=%u\tda_hits=%u"
+             "\tmounts=%u\tunmounts=%u\treused=%u\n",
+             state->requests, state->failed, (unsigned long long)(state->busyNanos / 1000),
+             loads, state->topologyChanges, hits, misses, invalidations, daSessions, daLookups, daHits,
+             state->mounts, state->unmounts, state->reused);
+    return respond(fd, 0, text, strlen(text), NULL, 0);
+}
+
+/*
+ * Run one request line as if it were bless's command line and send back
+ * what it returned and printed. Requests are run one at a time, in the
+ * order they arrive, so operations that change NVRAM or a volume never
+ * overlap.
+ */
+static int handleRequest(BLContextPtr context, struct blesscon *bcon, struct clarg lineargs[klast],
+                         serveState *state, int fd, char *line)
+{
+    CFDataRef   out = NULL, err = NULL;
+    FILE        *outCapture, *errCapture;
+    int         outFD = -1, errFD = -1;
+    uint64_t    span, start;
+    int         status, ret;
+
+    if (strcmp(line, "stats") == 0) return respondWithStatistics(context, fd, state);
+
+    refreshCaches(context, state);
+
+    outCapture = beginOutputCapture(STDOUT_FILENO, &outFD);
+    errCapture = beginOutputCapture(STDERR_FILENO, &errFD);
+    span = BLTraceBegin(context);
+    start = monotonicNanos();
+    state->requests++;
+    status = runCommandLine(context, bcon, lineargs, state->requests, line);
+    if (renewMountLeases(context, state) && status == 0) status = 1;
+    state->busyNanos += monotonicNanos() - start;
+    BLTraceEnd(context, span, "serve", NULL);
+    if (errCapture) err = endOutputCapture(STDERR_FILENO, errCapture, errFD);
+    if (outCapture) out = endOutputCapture(STDOUT_FILENO, outCapture, outFD);
+
+    if (status) state->failed++;
+    ret = respond(fd, status,
+                  out ? CFDataGetBytePtr(out) : NULL, out ? CFDataGetLength(out) : 0,
+                  err ? CFDataGetBytePtr(err) : NULL, err ? CFDataGetLength(err) : 0);
+    if (out) CFRelease(out);
+    if (err) CFRelease(err);
+    return ret;
+}
+
+/*
+ * Handle whatever complete lines a client has sent. Returns non-zero
+ * when the client should be dropped.
+ */
+static int readRequests(BLContextPtr context, struct blesscon *bcon, struct clarg lineargs[klast],
+                        serveState *state, struct serveClient *client)
+{
+    char    *line, *newline;
+    size_t  used;
+    ssize_t n;
+
+    n = read(client->fd, client->buffer + client->len, sizeof(client->buffer) - client->len);
+    if (n < 0 && errno == EINTR) return 0;
+    if (n <= 0) return 1;
+    client->len += n;
+
+    line = client->buffer;
+    while ((newline = memchr(line, '\n', client->len - (line - client->buffer))) != NULL) {
+        *newline = '\0';
+        if (newline > line && newline[-1] == '\r') newline[-1] = '\0';
+        if (handleRequest(context, bcon, lineargs, state, client->fd, line)) return 1;
+        line = newline + 1;
+    }
+
+    used = line - client->buffer;
+    memmove(client->buffer, line, client->len - used);
+    client->len -= used;
+    if (client->len == sizeof(client->buffer)) {
+        static const char tooLong[] = "Request too long\n";
+
+        respond(client->fd, 1, NULL, 0, tooLong, sizeof(tooLong) - 1);
+        return 1;
+    }
+    return 0;
+}
+
+static int listenOn(BLContextPtr context, const char *path)
+{
+    struct sockaddr_un  sun;
+    struct stat         sb;
+    mode_t              mask;
+    int                 fd;
+
+    if (strlen(path) >= sizeof(sun.sun_path)) {
+        blesscontextprintf(context, kBLLogLevelError, "Socket path %s is too long\n", path);
+        return -1;
+    }
+    // A socket left behind by an earlier run is replaced, anything else is not
+    if (lstat(path, &sb) == 0) {
+        if (!S_ISSOCK(sb.st_mode)) {
+            blesscontextprintf(context, kBLLogLevelError, "%s exists and is not a socket\n", path);
+            return -1;
+        }
+        unlink(path);
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        blesscontextprintf(context, kBLLogLevelError, "Can't create socket: %s\n", strerror(errno));
+        return -1;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    memset(&sun, 0, sizeof sun);
+    sun.sun_family = AF_UNIX;
+    strlcpy(sun.sun_path, path, sizeof(sun.sun_path));
+
+    // Only our own user may connect: requests run with our privileges
+    mask = umask(0077);
+    if (bind(fd, (struct sockaddr *)&sun, sizeof sun) < 0 || listen(fd, kMaxServeClients) < 0) {
+        blesscontextprintf(context, kBLLogLevelError, "Can't listen on %s: %s\n", path, strerror(errno));
+        umask(mask);
+        close(fd);
+        return -1;
+    }
+    umask(mask);
+    return fd;
+}
+
+static void acceptClient(BLContextPtr context, int listenFD, struct serveClient *clients, int *count)
+{
+    struct timeval  timeout = { kResponseTimeoutSecs, 0 };
+    int             fd;
+
+    fd = accept(listenFD, NULL, NULL);
+    if (fd < 0) return;
+    if (*count == kMaxServeClients) {
+        blesscontextprintf(context, kBLLogLevelVerbose, "Too many clients, refusing a connection\n");
+        close(fd);
+        return;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    // A client that stops reading its responses can't hold up everyone else for long
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+    clients[*count].fd = fd;
+    clients[*count].len = 0;
+    (*count)++;
+}
+
+/*
+ * Answer bless requests on a Unix-domain socket until SIGTERM or SIGINT,
+ * keeping the disk topology, mount table and NVRAM variables read in
+ * between. Each request is one line in --batch syntax; each response is
+ *
+ *   status <exit status> <stdout length> <stderr length>\n<stdout><stderr>
+ *
+ * The line "stats" answers with the service's counters instead.
+ */
+int modeServe(BLContextPtr context, struct clarg actargs[klast], struct blesscon *bcon)
+{
+    struct serveClient  *clients = NULL;
+    struct clarg        *lineargs = NULL;
+    struct pollfd       pfds[kMaxServeClients + 1];
+    struct sigaction    sa, oldTerm, oldInt;
+    serveState          state;
+    const char          *path = actargs[kserve].argument;
+    int                 listenFD = -1, count = 0, i, n, ret = 0;
+#ifdef __APPLE__
+    IONotificationPortRef   port = NULL;
+    io_iterator_t           iters[2] = { IO_OBJECT_NULL, IO_OBJECT_NULL };
+#endif
+
+    memset(&state, 0, sizeof state);
+
+    // Only options about the service itself may sit beside --serve
+    for (i = 1; i < klast; i++) {
+        if (!actargs[i].present) continue;
+        if (i == kserve || i == ktrace || i == kverbose || i == kquiet) continue;
+        blesscontextprintf(context, kBLLogLevelError,
+                           "Only --trace, --verbose and --quiet can be used with --serve\n");
+        return 1;
+    }
+
+    state.snapshotPath = getenv("BL_TOPOLOGY_SNAPSHOT");
+    if (state.snapshotPath) stat(state.snapshotPath, &state.snapshotStat);
+
+    clients = calloc(kMaxServeClients, sizeof(*clients));
+    lineargs = calloc(klast, sizeof(*lineargs));
+    if (!clients || !lineargs) {
+        ret = 1;
+        goto exit;
+    }
+
+    listenFD = listenOn(context, path);
+    if (listenFD < 0) {
+        ret = 1;
+        goto exit;
+    }
+
+#ifdef __APPLE__
+    if (!state.snapshotPath) {
+        port = watchDisks(context, iters);
+        if (!port) {
+            ret = 1;
+            goto exit;
+        }
+    }
+#endif
+
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = catchStop;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGTERM, &sa, &oldTerm);
+    sigaction(SIGINT, &sa, &oldInt);
+    signal(SIGPIPE, SIG_IGN);
+
+    blesscontextprintf(context, kBLLogLevelVerbose, "Serving requests on %s\n", path);
+
+    while (!gStopServing) {
+        pfds[0].fd = listenFD;
+        pfds[0].events = POLLIN;
+        for (i = 0; i < count; i++) {
+            pfds[i + 1].fd = clients[i].fd;
+            pfds[i + 1].events = POLLIN;
+        }
+
+        // poll() isn't always restarted, but wake up now and then to check anyway
+        n = poll(pfds, count + 1, kPollMillis);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            blesscontextprintf(context, kBLLogLevelError, "poll: %s\n", strerror(errno));
+            ret = 1;
+            break;
+        }
+
+        // Serve each client with something to say, dropping the ones that are done
+        for (i = count - 1; i >= 0; i--) {
+            if (!pfds[i + 1].revents) continue;
+            if (readRequests(context, bcon, lineargs, &state, &clients[i])) {
+                close(clients[i].fd);
+                clients[i] = clients[count - 1];
+                count--;
+            }
+        }
+        if (pfds[0].revents & POLLIN) acceptClient(context, listenFD, clients, &count);
+    }
+
+    sigaction(SIGTERM, &oldTerm, NULL);
+    sigaction(SIGINT, &oldInt, NULL);
+
+    blesscontextprintf(context, kBLLogLevelVerbose,
+                       "Served %u requests (%u failed) in %llu us, read the topology again %u times\n",
+                       state.requests, state.failed, (unsigned long long)(state.busyNanos / 1000),
+                       state.topologyChanges);
+
+exit:
+    for (i = 0; i < count; i++) close(clients[i].fd);
+    if (listenFD >= 0) {
+        close(listenFD);
+        unlink(path);
+    }
+#ifdef __APPLE__
+    unwatchDisks(port, iters);
+#endif
+    free(lineargs);
+    free(clients);
+    return ret;
+}
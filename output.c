@@ -35,13 +35,26 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
+#include <unistd.h>
 
 #include <sys/types.h>
 #include "enums.h"
 #include "structs.h"
 #include "bless.h"
+#include "bless_private.h"
 #include "protos.h"
 
+/*
+ * The levels blesslog() will print for this configuration, so the
+ * context can drop everything else before it is formatted
+ */
+int blessloglevels(struct blesscon *con) {
+    if(con->quiet) {
+        return kBLLogLevelError;
+    }
+    return kBLLogLevelNormal | kBLLogLevelError | (con->verbose ? kBLLogLevelVerbose : 0);
+}
+
 int blesslog(void *context, int loglevel, const char *string) {
     int ret = 0;
     int willprint = 0;
@@ -79,3 +92,25 @@ int blesslog(void *context, int loglevel, const char *string) {
     }
     return ret;
 }
+
+/*
+ * Report the --timing counters, as a table on stdout or as a plist
+ */
+int printTiming(BLContextPtr context, struct BLTimingCounters *timing, int usePlist) {
+    CFDictionaryRef dict;
+    CFDataRef tempData;
+
+    if(!usePlist) {
+        BLTimingCountersPrint(context, timing);
+        return 0;
+    }
+
+    dict = BLTimingCountersCopyDictionary(timing);
+    tempData = CFPropertyListCreateData(kCFAllocatorDefault, dict, kCFPropertyListXMLFormat_v1_0, 0, NULL);
+    CFRelease(dict);
+    if(!tempData) return 1;
+
+    write(fileno(stdout), CFDataGetBytePtr(tempData), CFDataGetLength(tempData));
+    CFRelease(tempData);
+    return 0;
+}
@@ -40,8 +40,23 @@ int modeFolder(BLContextPtr context, struct clarg actargs[klast]);
 int modeFirmware(BLContextPtr context, struct clarg actargs[klast]);
 int modeNetboot(BLContextPtr context, struct clarg actargs[klast]);
 int modeUnbless(BLContextPtr context, struct clarg actargs[klast]);
+int modeScanImages(BLContextPtr context, struct clarg actargs[klast], int argc, char * const argv[]);
+int modeContainer(BLContextPtr context, struct clarg actargs[klast]);
+int modeBatch(BLContextPtr context, struct clarg actargs[klast], struct blesscon *bcon);
+
+int parseArguments(int argc, char * argv[], struct clarg actargs[klast], struct blesscon *bcon,
+                   bool batch, int *nextArg);
+int runMode(BLContextPtr context, struct clarg actargs[klast], int argc, char * argv[]);
+int modeServe(BLContextPtr context, struct clarg actargs[klast], struct blesscon *bcon);
+
+int runCommandLine(BLContextPtr context, struct blesscon *bcon, struct clarg lineargs[klast],
+                   uint32_t lineno, char *line);
+FILE *beginOutputCapture(int fd, int *savedFD);
+CFDataRef endOutputCapture(int fd, FILE *capture, int savedFD);
 
 int blesslog(void *context, int loglevel, const char *string);
+int blessloglevels(struct blesscon *con);
+int printTiming(BLContextPtr context, struct BLTimingCounters *timing, int usePlist);
 int blesscontextprintf(BLContextPtr context, int loglevel, char const *fmt, ...) __printflike(3, 4);
 
 void usage(void);
@@ -49,7 +64,8 @@ void usage_short(void);
 
 void addPayload(const char *path);
 
-int CopyManifests(BLContextPtr context, const char *destPath, const char *srcPath, const char *srcSystemPath);
+int CopyManifests(BLContextPtr context, const char *destPath, const char *srcPath, const char *srcSystemPath,
+                  struct prebootpass *pass);
 int PersonalizeOSVolume(BLContextPtr context, const char *volumePath, const char *prFile, bool suppressACPrompt);
 
 
@@ -59,7 +75,12 @@ extern int setefilegacypath(BLContextPtr context, const char * path, int bootNex
                             const char *legacyHint, const char *optionalData);
 
 int BlessPrebootVolume(BLContextPtr context, const char *rootBSD, const char *bootEFISourceLocation,
-					   CFDataRef labelData, CFDataRef labelData2, struct clarg actargs[klast]);
+					   CFDataRef labelData, CFDataRef labelData2, struct clarg actargs[klast],
+					   struct prebootpass *pass);
+int SharePrebootFile(BLContextPtr context, struct prebootpass *pass, const char *srcPath, CFDataRef data,
+					 const char *dest, bool *shared);
+int RememberPrebootFile(struct prebootpass *pass, const char *dest, CFDataRef data);
+void FreePrebootPass(struct prebootpass *pass);
 int GetVolumeUUIDs(BLContextPtr context, const char *volBSD, CFStringRef *volUUID, CFStringRef *groupUUID);
 int GetMountForSnapshot(BLContextPtr context, const char *snapshotName, const char *bsd, char *mountPoint, int mountPointLen);
 int WriteLabelFile(BLContextPtr context, const char *path, CFDataRef labeldata, int doTypeCreator, int scale);
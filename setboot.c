@@ -146,32 +146,13 @@ static int updateAppleBootIfPresent(BLContextPtr context, char *device, CFDataRe
 	for(;;) {
 		char label[MAXPATHLEN];
 #if USE_DISKARBITRATION
-		DADiskRef disk = NULL;
-		DASessionRef session = NULL;
 		CFDictionaryRef props = NULL;
 		CFStringRef	daName = NULL;
 
 		
 		if(labelData) break; // no need to generate
 		
-		session = DASessionCreate(kCFAllocatorDefault);
-		if(session == NULL) {
-			blesscontextprintf(context, kBLLogLevelVerbose, "Can't connect to DiskArb\n");
-			break;
-		}
-		
-		disk = DADiskCreateFromBSDName(kCFAllocatorDefault, session, device+5);
-		if(disk == NULL) {
-			CFRelease(session);
-			blesscontextprintf(context, kBLLogLevelVerbose, "Can't create DADisk for %s\n",
-						  device + 5);
-			break;
-		}
-		
-		props = DADiskCopyDescription(disk);
-		if(props == NULL) {
-			CFRelease(session);
-			CFRelease(disk);
+		if(BLCopyDiskDescription(context, device, &props)) {
 			blesscontextprintf(context, kBLLogLevelVerbose, "Can't get properties for %s\n",
 						  device + 5);
 			break;
@@ -180,8 +161,6 @@ static int updateAppleBootIfPresent(BLContextPtr context, char *device, CFDataRe
 		daName = CFDictionaryGetValue(props, kDADiskDescriptionVolumeNameKey);
 		if(daName == NULL) {
 			CFRelease(props);
-			CFRelease(disk);
-			CFRelease(session);	
 			blesscontextprintf(context, kBLLogLevelVerbose, "Can't get properties for %s\n",
 							   device + 5);
 			break;			
@@ -192,14 +171,10 @@ static int updateAppleBootIfPresent(BLContextPtr context, char *device, CFDataRe
 		if(!CFStringGetCString(daName, label, sizeof(label),
 							   kCFStringEncodingUTF8)) {
 			CFRelease(props);
-			CFRelease(disk);
-			CFRelease(session);	
 			break;
 		}
 
 		CFRelease(props);
-		CFRelease(disk);
-		CFRelease(session);	
 #else // !USE_DISKARBITRATION
 		strlcpy(label, "Unknown", sizeof(label));
 #endif // !USE_DISKARBITRATION
@@ -319,7 +294,8 @@ int setefilegacypath(BLContextPtr context, const char * path, int bootNext,
                             const char *legacyHint, const char *optionalData)
 {
     CFStringRef xmlString = NULL;
-    const char *bootString = NULL;
+    CFStringRef bootString = NULL;
+    struct BLNVRAMTransaction *txn;
     int ret;
     struct statfs sb;
     if(0 != blsustatfs(path, &sb)) {
@@ -328,6 +304,9 @@ int setefilegacypath(BLContextPtr context, const char * path, int bootNext,
         return 1;           
     }
     
+    ret = BLNVRAMTransactionBegin(context, &txn);
+    if(ret) return ret;
+    
     if(legacyHint) {
         ret = BLCreateEFIXMLRepresentationForDevice(context,
                                                     legacyHint+5,
@@ -336,17 +315,23 @@ int setefilegacypath(BLContextPtr context, const char * path, int bootNext,
                                                     false);
         
         if(ret) {
+            BLNVRAMTransactionAbort(txn);
             return 1;
         }
         
-        ret = setit(context, kIOMasterPortDefault, "efi-legacy-drive-hint", xmlString);    
-        if(ret) return ret;
-        
-        ret = _forwardNVRAM(context, CFSTR("efi-legacy-drive-hint-data"), CFSTR("BootCampHD"));
-        if(ret) return ret;     
-        
-        ret = setit(context, kIOMasterPortDefault, kIONVRAMDeletePropertyKey, CFSTR("efi-legacy-drive-hint"));    
-        if(ret) return ret;
+        ret = BLNVRAMTransactionSetValue(txn, CFSTR("efi-legacy-drive-hint"), xmlString);
+        CFRelease(xmlString);
+        // The forward writes the hint; an abort from here on leaves it set
+        if(ret == 0) {
+            ret = BLNVRAMTransactionForward(txn, CFSTR("efi-legacy-drive-hint-data"), CFSTR("BootCampHD"));
+        }
+        if(ret == 0) {
+            ret = BLNVRAMTransactionDeleteValue(txn, CFSTR("efi-legacy-drive-hint"));
+        }
+        if(ret) {
+            BLNVRAMTransactionAbort(txn);
+            return ret;
+        }
         
     }
     
@@ -355,23 +340,29 @@ int setefilegacypath(BLContextPtr context, const char * path, int bootNext,
                                                       sb.f_mntfromname + 5,
                                                       &xmlString);
     if(ret) {
+        BLNVRAMTransactionAbort(txn);
         return 1;
     }
     
     if(bootNext) {
-        bootString = "efi-boot-next";
+        bootString = CFSTR("efi-boot-next");
     } else {
-        bootString = "efi-boot-device";
+        bootString = CFSTR("efi-boot-device");
     }
     
-    ret = setit(context, kIOMasterPortDefault, bootString, xmlString);
+    // The boot device and the cleanup are written together, skipping anything unchanged
+    ret = BLNVRAMTransactionSetValue(txn, bootString, xmlString);
     CFRelease(xmlString);
+    if(ret == 0) {
+        ret = stageefinvramcleanup(context, txn);
+    }
     if(ret) {
-        return 2;
-    }        
+        BLNVRAMTransactionAbort(txn);
+        return ret;
+    }
     
-	ret = efinvramcleanup(context);
-	if(ret) return ret;
+    ret = BLNVRAMTransactionCommit(txn, NULL);
+    if(ret) return ret;
     
     return 0;
 }
@@ -34,8 +34,14 @@
 #ifndef _STRUCTS_H_
 #define _STRUCTS_H_
 
+#include <sys/param.h>
+#include <CoreFoundation/CoreFoundation.h>
+
 #define kMaxArgLength 2048
 
+// How long --serve trusts NVRAM variables it has read
+#define kServeNVRAMMaxAgeMillis 1000
+
 struct clarg {
     short present;
     short hasArg;
@@ -48,4 +54,23 @@ struct blesscon {
     int quiet;
 };
 
+// A file written to the preboot volume during a container pass
+struct prebootfile {
+    char dest[MAXPATHLEN];
+    CFDataRef data;             // what it was written from, if not a file
+};
+
+// State shared by the BlessPrebootVolume() calls of a container pass,
+// so later volumes can clone what earlier ones wrote
+struct prebootpass {
+    struct prebootfile *files;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t written;
+    uint32_t cloned;
+    uint32_t unchanged;
+    uint64_t clonedBytes;
+    char folder[MAXPATHLEN];    // UUID folder of the last volume blessed
+};
+
 #endif // _STRUCTS_H_
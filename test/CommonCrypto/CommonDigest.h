@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ * Stand-in for the SHA-256 part of <CommonCrypto/CommonDigest.h>, so the
+ * tests that drive BLSyncKernelCollections() can be built where CommonCrypto
+ * isn't available. Put test/ on the include path and link CommonDigest.c.
+ * Never used by the Xcode build.
+ */
+
+#ifndef _TEST_COMMONDIGEST_H_
+#define _TEST_COMMONDIGEST_H_
+
+#include <stdint.h>
+
+#define CC_SHA256_DIGEST_LENGTH     32
+#define CC_SHA256_BLOCK_BYTES       64
+
+typedef uint32_t CC_LONG;
+
+typedef struct {
+    uint32_t    state[8];
+    uint64_t    length;
+    uint8_t     block[CC_SHA256_BLOCK_BYTES];
+    uint32_t    used;
+} CC_SHA256_CTX;
+
+int CC_SHA256_Init(CC_SHA256_CTX *ctx);
+int CC_SHA256_Update(CC_SHA256_CTX *ctx, const void *data, CC_LONG len);
+int CC_SHA256_Final(unsigned char *md, CC_SHA256_CTX *ctx);
+
+#endif // _TEST_COMMONDIGEST_H_
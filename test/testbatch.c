@@ -0,0 +1,308 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ * Run bless --batch on a small batch file, with NVRAM read from
+ * test/nvram.plist and the disk topology from test/topology.json, and
+ * check what it reports: quoted and escaped words, skipped comments and
+ * blank lines, the status of each line, --stop-on-error, and the same
+ * results as a plist.
+ *
+ * Most lines scan a synthetic El Torito image, which needs no disks.
+ * The --getboot line still needs the registry to match the boot device,
+ * so only that it was run and reported is checked.
+ *
+ *   ./build/testbatch -b ./build/bless [scratch dir]
+ */
+
+#define DEBUG 1
+
+#include <libc.h>
+#include <stdint.h>
+#include <sys/wait.h>
+#include <CoreFoundation/CoreFoundation.h>
+#include <bless.h>
+#include <bless_private.h>
+#include <AssertMacros.h>
+
+#define kSectorSize         2048
+#define kCatalogSector      32
+#define kMaxLines           16
+#define kStatusUnreported   (-1000)
+
+static void usage(void) {
+    fprintf(stderr, "Usage: %s [-b bless] [scratch dir]\n", getprogname());
+    exit(1);
+}
+
+static void putEntry(uint8_t *catalog, uint32_t *index, const uint8_t bytes[32]) {
+    memcpy(catalog + (*index) * 32, bytes, 32);
+    (*index)++;
+}
+
+// A default entry and an EFI section header with one bootable section
+static int writeImage(const char *path, bool bootable) {
+    size_t      imageSize = (kCatalogSector + 2) * kSectorSize;
+    uint8_t     *image = calloc(1, imageSize);
+    uint8_t     *catalog = image + kCatalogSector * kSectorSize;
+    uint32_t    count = 0;
+    int         fd, ret = 1;
+
+    if (!image) return 1;
+
+    if (bootable) {
+        uint8_t validation[32] = { 0x01 };
+        uint8_t initial[32] = { 0x88, 0, 0, 0, 0, 0, 4, 0, 0x40 };
+        uint8_t header[32] = { 0x91, 0xEF, 1, 0 };
+        uint8_t section[32] = { 0x88, 0, 0, 0, 0, 0, 4, 0, 0x45, 0x23, 0x01, 0x00 };
+
+        image[16 * kSectorSize + 0] = 1;
+        memcpy(image + 16 * kSectorSize + 1, "CD001", 5);
+        image[16 * kSectorSize + 82] = 0x02;        // volume space size 0x00020000 sectors
+        memcpy(image + 17 * kSectorSize + 1, "CD001", 5);
+        image[17 * kSectorSize + 71] = kCatalogSector;
+
+        validation[0x1e] = 0x55;
+        validation[0x1f] = 0xaa;
+        putEntry(catalog, &count, validation);
+        putEntry(catalog, &count, initial);
+        putEntry(catalog, &count, header);
+        putEntry(catalog, &count, section);
+    }
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        if (write(fd, image, imageSize) == (ssize_t)imageSize) ret = 0;
+        close(fd);
+    }
+    free(image);
+    return ret;
+}
+
+/*
+ * Run bless with the NVRAM and topology stand-ins and its standard output
+ * going to outPath. Returns its exit status, or -1.
+ */
+static int runBless(const char *bless, const char *outPath, char *const args[]) {
+    pid_t   pid;
+    int     status, fd;
+
+    pid = fork();
+    if (pid == 0) {
+        setenv("BL_NVRAM_FILE", "test/nvram.plist", 1);
+        setenv("BL_TOPOLOGY_SNAPSHOT", "test/topology.json", 1);
+        fd = open(outPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || dup2(fd, STDOUT_FILENO) < 0) _exit(127);
+        close(fd);
+        fd = open("/dev/null", O_WRONLY);
+        if (fd >= 0) dup2(fd, STDERR_FILENO);
+        execv(bless, args);
+        _exit(127);
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) return -1;
+    return WEXITSTATUS(status);
+}
+
+static CFDataRef readFile(const char *path) {
+    CFDataRef   data = NULL;
+    struct stat sb;
+    uint8_t     *buf;
+    int         fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    if (fstat(fd, &sb) == 0 && (buf = malloc(sb.st_size + 1)) != NULL) {
+        if (read(fd, buf, sb.st_size) == sb.st_size) data = CFDataCreate(kCFAllocatorDefault, buf, sb.st_size);
+        free(buf);
+    }
+    close(fd);
+    return data;
+}
+
+/*
+ * The "op" and batch "summary" records of a --batch run. status[n] is 0
+ * for line n reported ok, its error for one reported failed, and
+ * kStatusUnreported otherwise.
+ */
+static int readRecords(const char *path, int status[kMaxLines], uint32_t *operations, uint32_t *succeeded,
+                       uint32_t *failed, char *stopped, size_t stoppedLen) {
+    FILE        *f = fopen(path, "r");
+    char        line[4096], result[16], fmt[64];
+    unsigned    lineno;
+    int         error, summaries = 0;
+
+    if (!f) return 1;
+    for (lineno = 0; lineno < kMaxLines; lineno++) status[lineno] = kStatusUnreported;
+    snprintf(fmt, sizeof(fmt), "summary\toperations=%%u\tsucceeded=%%u\tfailed=%%u\tstopped=%%%zus", stoppedLen - 1);
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "op\t%u\t%15s", &lineno, result) == 2 && lineno < kMaxLines) {
+            if (strcmp(result, "ok") == 0) {
+                status[lineno] = 0;
+            } else if (sscanf(line, "op\t%*u\tfailed\terror=%d", &error) == 1) {
+                status[lineno] = error;
+            }
+        } else if (sscanf(line, fmt, operations, succeeded, failed, stopped) == 4) {
+            // scanned images have summary lines of their own; this one is the batch's
+            summaries++;
+        }
+    }
+    fclose(f);
+    return summaries == 1 ? 0 : 1;
+}
+
+static long long numberValue(CFDictionaryRef dict, CFStringRef key) {
+    CFNumberRef num = CFDictionaryGetValue(dict, key);
+    long long   value = -1;
+
+    if (num && CFGetTypeID(num) == CFNumberGetTypeID()) CFNumberGetValue(num, kCFNumberLongLongType, &value);
+    return value;
+}
+
+// Operation i of a --batch --plist run was line lineno, and ended with error (0 for success)
+static int checkOperation(CFArrayRef operations, CFIndex i, long long lineno, long long error) {
+    CFDictionaryRef op = CFArrayGetValueAtIndex(operations, i);
+
+    if (CFGetTypeID(op) != CFDictionaryGetTypeID()) return 1;
+    if (numberValue(op, CFSTR("Line")) != lineno) return 1;
+    if (CFDictionaryGetValue(op, CFSTR("Command")) == NULL) return 1;
+    if (numberValue(op, CFSTR("Latency (us)")) < 0) return 1;
+    if (error == 0) {
+        return CFDictionaryGetValue(op, CFSTR("Succeeded")) == kCFBooleanTrue &&
+               CFDictionaryGetValue(op, CFSTR("Error")) == NULL ? 0 : 1;
+    }
+    return CFDictionaryGetValue(op, CFSTR("Succeeded")) == kCFBooleanFalse &&
+           numberValue(op, CFSTR("Error")) == error ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+    const char      *bless = "./build/bless";
+    const char      *scratch;
+    char            root[MAXPATHLEN], good[MAXPATHLEN], blank[MAXPATHLEN], batch[MAXPATHLEN], out[MAXPATHLEN];
+    char            stopped[8], *args[8];
+    int             status[kMaxLines];
+    uint32_t        operations, succeeded, failed;
+    CFDataRef       data = NULL;
+    CFDictionaryRef plist = NULL, stats;
+    CFArrayRef      ops;
+    CFStringRef     output;
+    FILE            *f;
+    int             ch;
+
+    while ((ch = getopt(argc, argv, "b:")) != -1) {
+        switch (ch) {
+            case 'b':
+                bless = optarg;
+                break;
+            default:
+                usage();
+        }
+    }
+    scratch = optind < argc ? argv[optind] : "/tmp";
+
+    snprintf(root, sizeof(root), "%s/testbatch.XXXXXX", scratch);
+    require(mkdtemp(root) != NULL, fail);
+    snprintf(good, sizeof(good), "%s/good image.iso", root);
+    snprintf(blank, sizeof(blank), "%s/blank.iso", root);
+    snprintf(batch, sizeof(batch), "%s/batch.txt", root);
+    snprintf(out, sizeof(out), "%s/out.txt", root);
+
+    printf("1. Writing a batch file and images to %s\n", root);
+    require_noerr(writeImage(good, true), fail);
+    require_noerr(writeImage(blank, false), fail);
+    f = fopen(batch, "w");
+    require(f != NULL, fail);
+    fprintf(f, "# lines 1 and 2 are skipped\n");
+    fprintf(f, "\n");
+    fprintf(f, "--scanimages \"%s/good image.iso\"\n", root);     // 3: ok
+    fprintf(f, "bless --scanimages %s/good\\ image.iso\n", root);  // 4: ok
+    fprintf(f, "  --scanimages '%s'\n", blank);                     // 5: not bootable, 2
+    fprintf(f, "--no-such-option\n");                               // 6: bad options, 1
+    fprintf(f, "--scanimages \"%s\n", good);                        // 7: unterminated quote, 1
+    fprintf(f, "--batch %s\n", batch);                              // 8: not allowed on a line, 1
+    fprintf(f, "--info --getboot\n");                               // 9: needs the registry
+    require(fclose(f) == 0, fail);
+
+    printf("2. Running it\n");
+    args[0] = (char *)bless;
+    args[1] = "--batch";
+    args[2] = batch;
+    args[3] = NULL;
+    require(runBless(bless, out, args) == 2, fail);
+    require_noerr(readRecords(out, status, &operations, &succeeded, &failed, stopped, sizeof(stopped)), fail);
+    require(status[1] == kStatusUnreported && status[2] == kStatusUnreported, fail);
+    require(status[3] == 0 && status[4] == 0, fail);
+    require(status[5] == 2 && status[6] == 1 && status[7] == 1 && status[8] == 1, fail);
+    require(status[9] != kStatusUnreported, fail);
+    require(operations == 7 && succeeded + failed == 7 && failed >= 4, fail);
+    require(strcmp(stopped, "no") == 0, fail);
+
+    printf("3. Stopping at the first failure\n");
+    args[1] = "--stop-on-error";
+    args[2] = "--batch";
+    args[3] = batch;
+    args[4] = NULL;
+    require(runBless(bless, out, args) == 2, fail);
+    require_noerr(readRecords(out, status, &operations, &succeeded, &failed, stopped, sizeof(stopped)), fail);
+    require(status[3] == 0 && status[4] == 0 && status[5] == 2, fail);
+    require(status[6] == kStatusUnreported && status[9] == kStatusUnreported, fail);
+    require(operations == 3 && succeeded == 2 && failed == 1, fail);
+    require(strcmp(stopped, "yes") == 0, fail);
+
+    printf("4. The same as a plist\n");
+    args[1] = "--batch";
+    args[2] = batch;
+    args[3] = "--plist";
+    args[4] = NULL;
+    require(runBless(bless, out, args) == 2, fail);
+    data = readFile(out);
+    require(data != NULL, fail);
+    plist = CFPropertyListCreateWithData(kCFAllocatorDefault, data, kCFPropertyListImmutable, NULL, NULL);
+    require(plist != NULL && CFGetTypeID(plist) == CFDictionaryGetTypeID(), fail);
+    ops = CFDictionaryGetValue(plist, CFSTR("Operations"));
+    require(ops != NULL && CFGetTypeID(ops) == CFArrayGetTypeID() && CFArrayGetCount(ops) == 7, fail);
+    require_noerr(checkOperation(ops, 0, 3, 0), fail);
+    require_noerr(checkOperation(ops, 1, 4, 0), fail);
+    require_noerr(checkOperation(ops, 2, 5, 2), fail);
+    require_noerr(checkOperation(ops, 3, 6, 1), fail);
+    require_noerr(checkOperation(ops, 4, 7, 1), fail);
+    require_noerr(checkOperation(ops, 5, 8, 1), fail);
+    output = CFDictionaryGetValue(CFArrayGetValueAtIndex(ops, 0), CFSTR("Output"));
+    require(output != NULL && CFStringFind(output, CFSTR("\tbootable\t"), 0).location != kCFNotFound, fail);
+    stats = CFDictionaryGetValue(plist, CFSTR("Statistics"));
+    require(stats != NULL && CFGetTypeID(stats) == CFDictionaryGetTypeID(), fail);
+    require(numberValue(stats, CFSTR("Operations")) == 7, fail);
+    require(numberValue(stats, CFSTR("Succeeded")) + numberValue(stats, CFSTR("Failed")) == 7, fail);
+    require(CFDictionaryGetValue(stats, CFSTR("Stopped")) == kCFBooleanFalse, fail);
+
+    CFRelease(plist);
+    CFRelease(data);
+    snprintf(out, sizeof(out), "rm -rf '%s'", root);
+    system(out);
+    printf("Success\n");
+    return 0;
+
+fail:
+    if (plist) CFRelease(plist);
+    if (data) CFRelease(data);
+    printf("Failure (scratch directory %s left behind)\n", root);
+    return 1;
+}
@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ * Block-delta update test. Updates a file with BLDeltaUpdateFileFromFile()
+ * and BLDeltaUpdateFileFromBytes() and checks the result and how much was
+ * written each time:
+ *
+ *   1. no destination: written in full
+ *   2. nothing changed: nothing written
+ *   3. one block changed: one block written
+ *   4. file grew: only the tail written
+ *   5. file shrank: truncated, nothing written
+ *   6. most blocks changed: rewritten (or patched, if the file system clones)
+ *   7. same, from an in-memory image
+ *
+ * Then times a full copy of a large file against an update where 1% of
+ * the blocks changed, and reports the bytes each wrote.
+ *
+ *   ./build/testblockdelta [scratch dir] [MiB]
+ */
+
+#define DEBUG 1
+
+#include <libc.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <bless.h>
+#include <bless_private.h>
+#include <AssertMacros.h>
+
+#define kBlock  kBLDeltaBlockSize
+
+static int testlog(void *refcon, int level, const char *string) {
+    if(level & kBLLogLevelError) fputs(string, stderr);
+    return 0;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int writeFile(const char *path, const char *data, size_t size) {
+    int fd, ret = 1;
+
+    fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if(fd >= 0) {
+        ret = write(fd, data, size) == (ssize_t)size ? 0 : 1;
+        close(fd);
+    }
+    return ret;
+}
+
+// 0 if the file holds exactly these bytes
+static int checkFile(const char *path, const char *data, size_t size) {
+    struct stat sb;
+    char *buf;
+    int fd, ret = 1;
+
+    if(stat(path, &sb) != 0 || (size_t)sb.st_size != size) return 1;
+    buf = malloc(size ? size : 1);
+    fd = open(path, O_RDONLY);
+    if(buf && fd >= 0 && read(fd, buf, size) == (ssize_t)size) ret = memcmp(buf, data, size) ? 1 : 0;
+    if(fd >= 0) close(fd);
+    free(buf);
+    return ret;
+}
+
+static const char *methodName(uint32_t method) {
+    switch(method) {
+        case kBLDeltaUnchanged: return "unchanged";
+        case kBLDeltaPatchedClone: return "patched clone";
+        case kBLDeltaPatchedInPlace: return "patched in place";
+        case kBLDeltaFullCopy: return "full copy";
+    }
+    return "?";
+}
+
+static int update(BLContextPtr context, const char *src, const char *dst, const char *data, size_t size,
+                  BLDeltaUpdateStats *stats) {
+    int ret;
+
+    require_noerr(writeFile(src, data, size), fail);
+    ret = BLDeltaUpdateFileFromFile(context, src, dst, kBLDeltaDefaultInPlacePercent, stats);
+    printf("  %s: %llu of %llu blocks changed, %llu bytes read, %llu written\n", methodName(stats->method),
+           (unsigned long long)stats->changedBlocks, (unsigned long long)stats->blocks,
+           (unsigned long long)stats->bytesRead, (unsigned long long)stats->bytesWritten);
+    if(ret) return ret;
+    return checkFile(dst, data, size);
+fail:
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    BLContext   context = { kBLContextVersion1, testlog, NULL, kBLLogLevelError };
+    BLDeltaUpdateStats stats;
+    const char  *scratch = argc > 1 ? argv[1] : "/tmp";
+    size_t      mib = argc > 2 ? strtoul(argv[2], NULL, 0) : 64;
+    size_t      size = 40 * kBlock + 123;
+    char        root[MAXPATHLEN], src[MAXPATHLEN], dst[MAXPATHLEN], copy[MAXPATHLEN], cmd[MAXPATHLEN + 16];
+    char        *data = NULL;
+    size_t      i, big;
+    double      start, full, delta;
+    uint64_t    fullWritten;
+    bool        patched;
+
+    snprintf(root, sizeof(root), "%s/testblockdelta.XXXXXX", scratch);
+    require(mkdtemp(root) != NULL, fail);
+    snprintf(src, sizeof(src), "%s/src", root);
+    snprintf(dst, sizeof(dst), "%s/dst", root);
+    snprintf(copy, sizeof(copy), "%s/copy", root);
+
+    data = malloc(size + kBlock);
+    require(data != NULL, fail);
+    for(i = 0; i < size + kBlock; i++) data[i] = (char)((i * 31) >> 3);
+
+    printf("1. no destination\n");
+    require_noerr(update(&context, src, dst, data, size, &stats), fail);
+    require(stats.method == kBLDeltaFullCopy && stats.bytesWritten == size, fail);
+
+    printf("2. nothing changed\n");
+    require_noerr(update(&context, src, dst, data, size, &stats), fail);
+    require(stats.method == kBLDeltaUnchanged && stats.bytesWritten == 0, fail);
+
+    printf("3. one block changed\n");
+    data[7 * kBlock + 5] ^= 0xff;
+    require_noerr(update(&context, src, dst, data, size, &stats), fail);
+    require(stats.changedBlocks == 1 && stats.bytesWritten == kBlock, fail);
+    patched = stats.method == kBLDeltaPatchedClone || stats.method == kBLDeltaPatchedInPlace;
+    require(patched, fail);
+
+    printf("4. grew\n");
+    require_noerr(update(&context, src, dst, data, size + 1000, &stats), fail);
+    // the old partial last block and the new bytes after it
+    require(stats.changedBlocks == 1 && stats.bytesWritten == size + 1000 - 40 * kBlock, fail);
+
+    printf("5. shrank\n");
+    require_noerr(update(&context, src, dst, data, size - kBlock, &stats), fail);
+    require(stats.changedBlocks == 0 && stats.bytesWritten == 0, fail);
+    require(stats.method != kBLDeltaUnchanged, fail);
+
+    printf("6. most blocks changed\n");
+    for(i = 0; i < size; i += kBlock / 2) data[i] ^= 0x55;
+    require_noerr(update(&context, src, dst, data, size, &stats), fail);
+    require(stats.method == kBLDeltaFullCopy || stats.method == kBLDeltaPatchedClone, fail);
+
+    printf("7. from memory\n");
+    data[3 * kBlock] ^= 0xff;
+    require_noerr(BLDeltaUpdateFileFromBytes(&context, data, size, dst, kBLDeltaDefaultInPlacePercent, &stats), fail);
+    require_noerr(checkFile(dst, data, size), fail);
+    require(stats.changedBlocks == 1 && stats.bytesWritten == kBlock && stats.bytesRead == size, fail);
+
+    free(data);
+    data = NULL;
+
+    if(mib > 0) {
+        big = mib << 20;
+        data = malloc(big);
+        require(data != NULL, fail);
+        for(i = 0; i < big; i++) data[i] = (char)((i * 131) >> 5);
+        require_noerr(writeFile(src, data, big), fail);
+        require_noerr(writeFile(dst, data, big), fail);
+
+        start = now();
+        require_noerr(BLDeltaUpdateFileFromFile(&context, src, copy, 0, &stats), fail);
+        full = now() - start;
+        fullWritten = stats.bytesWritten;
+
+        // change one block in a hundred
+        for(i = 0; i < big; i += 100 * kBlock) data[i] ^= 0xff;
+        require_noerr(writeFile(src, data, big), fail);
+        start = now();
+        require_noerr(BLDeltaUpdateFileFromFile(&context, src, dst, kBLDeltaDefaultInPlacePercent, &stats), fail);
+        delta = now() - start;
+        require_noerr(checkFile(dst, data, big), fail);
+        printf("%zu MiB: full copy %.1f ms, %llu bytes written; 1%% changed (%s) %.1f ms, %llu bytes written\n",
+               mib, full * 1e3, (unsigned long long)fullWritten, methodName(stats.method), delta * 1e3,
+               (unsigned long long)stats.bytesWritten);
+        free(data);
+    }
+
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", root);
+    system(cmd);
+    printf("Success\n");
+    return 0;
+
+fail:
+    free(data);
+    printf("Failure (scratch directory %s left behind)\n", root);
+    return 1;
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ * File comparison test. Checks BLFilesAreIdentical() on identical files,
+ * files differing in size, in the first byte, in the last byte of a later
+ * mapping window, and against a missing destination. Then times comparing
+ * two identical large files.
+ *
+ *   ./build/testcomparefiles [scratch dir] [MiB]
+ */
+
+#define DEBUG 1
+
+#include <libc.h>
+#include <stdint.h>
+#include <time.h>
+#include <bless.h>
+#include <bless_private.h>
+#include <AssertMacros.h>
+
+static int testlog(void *refcon, int level, const char *string) {
+    if(level & kBLLogLevelError) fputs(string, stderr);
+    return 0;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int writeFile(const char *path, const char *data, size_t size) {
+    int fd, ret = 1;
+
+    fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if(fd >= 0) {
+        ret = write(fd, data, size) == (ssize_t)size ? 0 : 1;
+        close(fd);
+    }
+    return ret;
+}
+
+static int expect(BLContextPtr context, const char *a, const char *b, bool expected) {
+    bool identical = !expected;
+
+    if(BLFilesAreIdentical(context, a, b, &identical)) return 1;
+    return identical == expected ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+    BLContext   context = { kBLContextVersion1, testlog, NULL, kBLLogLevelError };
+    const char  *scratch = argc > 1 ? argv[1] : "/tmp";
+    size_t      mib = argc > 2 ? strtoul(argv[2], NULL, 0) : 64;
+    size_t      size = (20 << 20) + 17, i;
+    char        root[MAXPATHLEN], a[MAXPATHLEN + 8], b[MAXPATHLEN + 8], cmd[MAXPATHLEN + 16];
+    char        *data = NULL;
+    bool        identical;
+    double      start;
+
+    snprintf(root, sizeof(root), "%s/testcomparefiles.XXXXXX", scratch);
+    require(mkdtemp(root) != NULL, fail);
+    snprintf(a, sizeof(a), "%s/a", root);
+    snprintf(b, sizeof(b), "%s/b", root);
+
+    data = malloc(MAX(size, mib << 20));
+    require(data != NULL, fail);
+    for(i = 0; i < MAX(size, mib << 20); i++) data[i] = (char)((i * 131) >> 5);
+
+    printf("1. missing destination\n");
+    require_noerr(writeFile(a, data, size), fail);
+    require_noerr(expect(&context, a, b, false), fail);
+
+    printf("2. identical\n");
+    require_noerr(writeFile(b, data, size), fail);
+    require_noerr(expect(&context, a, b, true), fail);
+    require_noerr(expect(&context, a, a, true), fail);
+
+    printf("3. different size\n");
+    require_noerr(writeFile(b, data, size - 1), fail);
+    require_noerr(expect(&context, a, b, false), fail);
+
+    printf("4. first byte differs\n");
+    data[0] ^= 1;
+    require_noerr(writeFile(b, data, size), fail);
+    require_noerr(expect(&context, a, b, false), fail);
+    data[0] ^= 1;
+
+    printf("5. last byte differs\n");
+    data[size - 1] ^= 1;
+    require_noerr(writeFile(b, data, size), fail);
+    require_noerr(expect(&context, a, b, false), fail);
+    data[size - 1] ^= 1;
+
+    printf("6. missing source\n");
+    require(BLFilesAreIdentical(&context, root, "/nonexistent", &identical) == 0 && !identical, fail);
+    snprintf(cmd, sizeof(cmd), "%s/none", root);
+    require(BLFilesAreIdentical(&context, cmd, b, &identical) != 0 && !identical, fail);
+
+    if(mib > 0) {
+        require_noerr(writeFile(a, data, mib << 20), fail);
+        require_noerr(writeFile(b, data, mib << 20), fail);
+        start = now();
+        require_noerr(expect(&context, a, b, true), fail);
+        printf("%zu MiB identical: %.1f ms\n", mib, (now() - start) * 1e3);
+    }
+
+    free(data);
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", root);
+    system(cmd);
+    printf("Success\n");
+    return 0;
+
+fail:
+    free(data);
+    printf("Failure (scratch directory %s left behind)\n", root);
+    return 1;
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ * Microbenchmark for contextprintf(). Replays the verbose logging done by
+ * a non-verbose "bless --info" (a few hundred verbose lines, plus El Torito
+ * hex dumps done one byte per call) through:
+ *
+ *   old     the previous vasprintf()/free() implementation, with the
+ *           sink throwing verbose output away
+ *   v0      contextprintf() with a version 0 context (formats on the
+ *           stack, sink throws verbose output away)
+ *   v1      contextprintf() with a version 1 context whose loglevels
+ *           mask leaves out kBLLogLevelVerbose
+ *
+ *   ./build/testcontextprint [iterations]
+ */
+
+#define DEBUG 1
+
+#include <libc.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <time.h>
+#include <bless.h>
+#include <bless_private.h>
+#include <AssertMacros.h>
+
+static int nonverboselog(void *refcon, int level, const char *string) {
+    if(level & kBLLogLevelVerbose) return 0;
+    (*(uint64_t *)refcon) += strlen(string);
+    return 0;
+}
+
+static int oldcontextprintf(BLContextPtr context, int loglevel, char const *fmt, ...) {
+    int ret;
+    char *out;
+    va_list ap;
+
+    va_start(ap, fmt);
+    ret = vasprintf(&out, fmt, ap);
+    va_end(ap);
+    if((ret == -1) || (out == NULL)) return 0;
+    ret = context->logstring(context->logrefcon, loglevel, out);
+    free(out);
+    return ret;
+}
+
+typedef int (*printer)(BLContextPtr context, int loglevel, char const *fmt, ...);
+
+static void replay(printer p, BLContextPtr context) {
+    static const uint8_t bytes[16] = { 0x01, 'C', 'D', '0', '0', '1', 0x01, 0x00,
+	'A', 'P', 'P', 'L', 'E', 0x55, 0xaa, 0x00 };
+    int i, line;
+
+    for(i = 0; i < 200; i++) {
+	p(context, kBLLogLevelVerbose, "Getting boot device from NVRAM: entry %d of %s\n", i, "efi-boot-device");
+    }
+    for(line = 0; line < 4; line++) {
+	p(context, kBLLogLevelVerbose, "%s", "validation entry        ");
+	for(i = 0; i < 16; i++) p(context, kBLLogLevelVerbose, "%02x ", bytes[i]);
+	p(context, kBLLogLevelVerbose, "| ");
+	for(i = 0; i < 16; i++) p(context, kBLLogLevelVerbose, "%c", bytes[i]);
+	p(context, kBLLogLevelVerbose, "\n");
+    }
+    p(context, kBLLogLevelNormal, "Blessed System Folder is %s\n", "/System/Library/CoreServices");
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double run(const char *name, printer p, BLContextPtr context, uint32_t iterations, double baseline) {
+    double start, elapsed;
+    uint32_t i;
+
+    start = now();
+    for(i = 0; i < iterations; i++) replay(p, context);
+    elapsed = now() - start;
+
+    printf("%-4s %8.2f us/run", name, elapsed * 1e6 / iterations);
+    if(baseline > 0) printf("  (%.1fx)", baseline / elapsed);
+    printf("\n");
+    return elapsed;
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t  printed = 0;
+    BLContext v0 = { 0, nonverboselog, &printed };
+    BLContext v1 = { kBLContextVersion1, nonverboselog, &printed, kBLLogLevelNormal | kBLLogLevelError };
+    uint32_t  iterations = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 20000;
+    double    baseline;
+
+    require(iterations > 0, badArgs);
+
+    require(!contextprintfenabled(&v1, kBLLogLevelVerbose), badMask);
+    require(contextprintfenabled(&v1, kBLLogLevelError), badMask);
+    require(contextprintfenabled(&v0, kBLLogLevelVerbose), badMask);
+    require(!contextprintfenabled(NULL, kBLLogLevelError), badMask);
+
+    baseline = run("old", (printer)oldcontextprintf, &v0, iterations, 0);
+    run("v0", (printer)contextprintf, &v0, iterations, baseline);
+    run("v1", (printer)contextprintf, &v1, iterations, baseline);
+
+    printf("Success (%llu bytes of normal output)\n", (unsigned long long)printed);
+    return 0;
+
+badArgs:
+    fprintf(stderr, "Usage: %s [iterations]\n", getprogname());
+    return 1;
+badMask:
+    printf("Failure: contextprintfenabled() disagrees with the context\n");
+    return 1;
+}
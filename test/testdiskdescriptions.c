@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ * Disk description cache test. Serves descriptions from a provider that
+ * counts its calls, so it runs without DiskArbitration: each disk is
+ * described once however often it's asked for, "/dev/" prefixes share
+ * an entry, failures aren't remembered, and invalidating one disk or
+ * all of them asks again. Then reads descriptions from a plist the way
+ * BL_DISK_DESCRIPTIONS does and checks UUID strings come back as UUIDs.
+ *
+ *   ./build/testdiskdescriptions [-n lookups]
+ */
+
+#define DEBUG 1
+
+#include <libc.h>
+#include <stdint.h>
+#include <bless.h>
+#include <bless_private.h>
+#include <AssertMacros.h>
+
+#define kPlistPath      "/tmp/testdiskdescriptions.plist"
+#define kVolumeUUID     "0A1B2C3D-0000-4000-8000-000000000101"
+
+typedef struct {
+    uint32_t    calls;
+} provider;
+
+static int testlog(void *refcon, int level, const char *string) {
+    if(level & kBLLogLevelError) fputs(string, stderr);
+    return 0;
+}
+
+static int copyDescription(BLContextPtr context, void *refcon, const char *bsdName, CFDictionaryRef *description) {
+    provider                *p = refcon;
+    CFMutableDictionaryRef  dict;
+    CFStringRef             name;
+
+    p->calls++;
+    if (strncmp(bsdName, "disk", 4) != 0) return ENOENT;
+
+    dict = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks,
+                                     &kCFTypeDictionaryValueCallBacks);
+    name = CFStringCreateWithFormat(kCFAllocatorDefault, NULL, CFSTR("Volume %s"), bsdName);
+    CFDictionarySetValue(dict, CFSTR("DAVolumeName"), name);
+    CFRelease(name);
+    *description = dict;
+    return 0;
+}
+
+static bool hasName(CFDictionaryRef description, const char *expected) {
+    CFStringRef name = CFDictionaryGetValue(description, CFSTR("DAVolumeName"));
+    char        buf[64];
+
+    return name && CFStringGetCString(name, buf, sizeof(buf), kCFStringEncodingUTF8) && strcmp(buf, expected) == 0;
+}
+
+static int writePlist(const char *path) {
+    const char *plist =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<!DOCTYPE plist PUBLIC \"-//Apple//DTD PLIST 1.0//EN\" \"http://www.apple.com/DTDs/PropertyList-1.0.dtd\">\n"
+        "<plist version=\"1.0\">\n"
+        "<dict>\n"
+        "  <key>disk1s1</key>\n"
+        "  <dict>\n"
+        "    <key>DAVolumeName</key><string>Macintosh HD</string>\n"
+        "    <key>DAVolumeUUID</key><string>" kVolumeUUID "</string>\n"
+        "  </dict>\n"
+        "</dict>\n"
+        "</plist>\n";
+    FILE *f = fopen(path, "w");
+
+    if (!f) return 1;
+    fputs(plist, f);
+    return fclose(f) ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    BLContext           context = { kBLContextVersion9, testlog, NULL, kBLLogLevelError };
+    BLDiskDescriptionOps ops = { copyDescription };
+    provider            p = { 0 };
+    CFDictionaryRef     description = NULL;
+    CFTypeRef           uuid;
+    CFUUIDRef           expected = NULL;
+    uint32_t            lookups = 1000, i, hits = 0, total = 0;
+    int                 ch;
+
+    while ((ch = getopt(argc, argv, "n:")) != -1) {
+        switch (ch) {
+            case 'n':
+                lookups = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n lookups]\n", getprogname());
+                return 1;
+        }
+    }
+    if (lookups < 2) lookups = 2;
+
+    printf("1. Every disk is described once\n");
+    context.diskdescriptions = BLDiskDescriptionsCreateWithOps(&ops, &p);
+    require(context.diskdescriptions != NULL, fail);
+    for (i = 0; i < lookups; i++) {
+        require_noerr(BLCopyDiskDescription(&context, (i & 1) ? "/dev/disk1s1" : "disk1s1", &description), fail);
+        require(hasName(description, "Volume disk1s1"), fail);
+        CFRelease(description);
+        description = NULL;
+        require_noerr(BLCopyDiskDescription(&context, "disk2s2", &description), fail);
+        require(hasName(description, "Volume disk2s2"), fail);
+        CFRelease(description);
+        description = NULL;
+    }
+    require(p.calls == 2, fail);
+    BLDiskDescriptionsGetStatistics(context.diskdescriptions, NULL, &total, &hits, NULL);
+    require(total == 2 * lookups && hits == 2 * lookups - 2, fail);
+    printf("   %u lookups, %u answered from the cache\n", total, hits);
+
+    printf("2. Failures are asked for again\n");
+    require(BLCopyDiskDescription(&context, "nosuchdisk", &description) == ENOENT, fail);
+    require(description == NULL, fail);
+    require(BLCopyDiskDescription(&context, "nosuchdisk", &description) == ENOENT, fail);
+    require(p.calls == 4, fail);
+
+    printf("3. Invalidating one disk, then all of them, then the stand-ins\n");
+    BLDiskDescriptionsInvalidate(context.diskdescriptions, "disk1s1");
+    require_noerr(BLCopyDiskDescription(&context, "disk2s2", &description), fail);
+    CFRelease(description);
+    description = NULL;
+    require(p.calls == 4, fail);
+    require_noerr(BLCopyDiskDescription(&context, "disk1s1", &description), fail);
+    CFRelease(description);
+    description = NULL;
+    require(p.calls == 5, fail);
+    BLDiskDescriptionsInvalidate(context.diskdescriptions, NULL);
+    require_noerr(BLCopyDiskDescription(&context, "disk2s2", &description), fail);
+    CFRelease(description);
+    description = NULL;
+    require(p.calls == 6, fail);
+    // Descriptions from ops are stand-ins, which nothing else keeps current
+    BLDiskDescriptionsInvalidateStandIns(context.diskdescriptions);
+    require_noerr(BLCopyDiskDescription(&context, "disk2s2", &description), fail);
+    CFRelease(description);
+    description = NULL;
+    require(p.calls == 7, fail);
+    BLDiskDescriptionsRelease(context.diskdescriptions);
+    context.diskdescriptions = NULL;
+
+    printf("4. Descriptions from %s\n", kPlistPath);
+    require_noerr(writePlist(kPlistPath), fail);
+    require_noerr(BLDiskDescriptionsCreateWithFile(&context, kPlistPath, &context.diskdescriptions), fail);
+    require_noerr(BLCopyDiskDescription(&context, "/dev/disk1s1", &description), fail);
+    uuid = CFDictionaryGetValue(description, CFSTR("DAVolumeUUID"));
+    require(uuid && CFGetTypeID(uuid) == CFUUIDGetTypeID(), fail);
+    expected = CFUUIDCreateFromString(kCFAllocatorDefault, CFSTR(kVolumeUUID));
+    require(CFEqual(uuid, expected), fail);
+    CFRelease(description);
+    description = NULL;
+    require(BLCopyDiskDescription(&context, "disk9", &description) == ENOENT, fail);
+
+    CFRelease(expected);
+    BLDiskDescriptionsRelease(context.diskdescriptions);
+    unlink(kPlistPath);
+    printf("Success\n");
+    return 0;
+
+fail:
+    if (description) CFRelease(description);
+    if (expected) CFRelease(expected);
+    BLDiskDescriptionsRelease(context.diskdescriptions);
+    unlink(kPlistPath);
+    printf("Failure\n");
+    return 1;
+}
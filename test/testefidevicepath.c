@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ * EFI device path builder test. Encodes the El Torito boot path (a CDROM
+ * node and the \EFI\BOOT\BOOTX64.efi file node) and checks the bytes, walks
+ * a path of every node type by its length fields, checks the XML made from
+ * the same nodes unserializes to what the hand-built dictionaries gave, and
+ * rejects what can't be encoded. Then times the XML route against the
+ * binary one.
+ *
+ *   ./build/testefidevicepath [-n paths]
+ */
+
+#define DEBUG 1
+
+#include <libc.h>
+#include <stdint.h>
+#include <IOKit/IOCFSerialize.h>
+#include <IOKit/IOCFUnserialize.h>
+#include <bless.h>
+#include <bless_private.h>
+#include <AssertMacros.h>
+
+#define kBootFile       "\\EFI\\BOOT\\BOOTX64.efi"
+
+static int testlog(void *refcon, int level, const char *string) {
+    if(level & kBLLogLevelError) fputs(string, stderr);
+    return 0;
+}
+
+static uint64_t monotonicNanos(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void elToritoNodes(BLEFIDevicePathNode nodes[2]) {
+    memset(nodes, 0, 2 * sizeof(nodes[0]));
+    nodes[0].type = kBLEFIDevicePathCDROM;
+    nodes[0].u.cdrom.bootEntry = 1;
+    nodes[0].u.cdrom.partitionStart = 0x1234;
+    nodes[0].u.cdrom.partitionSize = 0x100;
+    nodes[1].type = kBLEFIDevicePathFilePath;
+    nodes[1].u.filePath.path = kBootFile;
+}
+
+// The El Torito path as the XML builders made it before they had nodes
+static CFArrayRef createHandBuiltArray(void) {
+    CFMutableArrayRef       array = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
+    CFMutableDictionaryRef  dict;
+    CFNumberRef             number;
+    uint32_t                values[3] = { 1, 0x1234, 0x100 };
+    CFStringRef             keys[3] = { CFSTR("BootEntry"), CFSTR("PartitionStart"), CFSTR("PartitionSize") };
+    int                     i;
+
+    dict = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks,
+                                     &kCFTypeDictionaryValueCallBacks);
+    CFDictionaryAddValue(dict, CFSTR("IOEFIDevicePathType"), CFSTR("MediaCDROM"));
+    for (i = 0; i < 3; i++) {
+        number = CFNumberCreate(kCFAllocatorDefault, kCFNumberSInt32Type, &values[i]);
+        CFDictionaryAddValue(dict, keys[i], number);
+        CFRelease(number);
+    }
+    CFArrayAppendValue(array, dict);
+    CFRelease(dict);
+
+    dict = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks,
+                                     &kCFTypeDictionaryValueCallBacks);
+    CFDictionaryAddValue(dict, CFSTR("IOEFIDevicePathType"), CFSTR("MediaFilePath"));
+    CFDictionaryAddValue(dict, CFSTR("Path"), CFSTR(kBootFile));
+    CFArrayAppendValue(array, dict);
+    CFRelease(dict);
+    return array;
+}
+
+// The old route to a string: serialize, copy into a terminated buffer, make a string of that
+static CFStringRef createHandBuiltXML(void) {
+    CFArrayRef  array = createHandBuiltArray();
+    CFDataRef   xmlData = IOCFSerialize(array, 0);
+    CFIndex     count = CFDataGetLength(xmlData);
+    UInt8       *outBuffer = calloc(count + 1, sizeof(char));
+    CFStringRef xmlString;
+
+    memcpy(outBuffer, CFDataGetBytePtr(xmlData), count);
+    CFRelease(xmlData);
+    CFRelease(array);
+    xmlString = CFStringCreateWithCString(kCFAllocatorDefault, (const char *)outBuffer, kCFStringEncodingUTF8);
+    free(outBuffer);
+    return xmlString;
+}
+
+int main(int argc, char *argv[]) {
+    BLContext               context = { kBLContextVersion9, testlog, NULL, kBLLogLevelError };
+    BLEFIDevicePathNode     nodes[6];
+    static const uint8_t    cdrom[] = {
+        0x04, 0x02, 0x18, 0x00, 0x01, 0x00, 0x00, 0x00,
+        0x34, 0x12, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    };
+    static const uint8_t    end[] = { 0x7F, 0xFF, 0x04, 0x00 };
+    static const uint16_t   nodeSizes[] = { 24, 48, 42, 37, 27, 24, 4 };
+    CFDataRef               devicePath = NULL;
+    CFStringRef             xmlString = NULL;
+    CFArrayRef              parsed = NULL, expected = NULL;
+    char                    cxml[4096];
+    const uint8_t           *bytes;
+    uint8_t                 buffer[256];
+    size_t                  size, offset;
+    uint32_t                count = 10000, i;
+    uint64_t                start, xmlNanos, binaryNanos;
+    int                     ch;
+
+    while ((ch = getopt(argc, argv, "n:")) != -1) {
+        switch (ch) {
+            case 'n':
+                count = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n paths]\n", getprogname());
+                return 1;
+        }
+    }
+    if (count < 1) count = 1;
+
+    printf("1. El Torito boot path bytes\n");
+    elToritoNodes(nodes);
+    require(BLEFIDevicePathGetSize(nodes, 2) == 24 + 48 + 4, fail);
+    require_noerr(BLCreateEFIDevicePath(&context, nodes, 2, &devicePath), fail);
+    require(CFDataGetLength(devicePath) == 24 + 48 + 4, fail);
+    bytes = CFDataGetBytePtr(devicePath);
+    require(memcmp(bytes, cdrom, sizeof(cdrom)) == 0, fail);
+    require(bytes[24] == 0x04 && bytes[25] == 0x04 && bytes[26] == 48 && bytes[27] == 0, fail);
+    for (i = 0; i < strlen(kBootFile); i++) {
+        require(bytes[28 + 2 * i] == kBootFile[i] && bytes[29 + 2 * i] == 0, fail);
+    }
+    require(bytes[28 + 2 * i] == 0 && bytes[29 + 2 * i] == 0, fail);
+    require(memcmp(bytes + 72, end, sizeof(end)) == 0, fail);
+    CFRelease(devicePath);
+    devicePath = NULL;
+
+    printf("2. Every node type, walked by length\n");
+    memset(&nodes[2], 0, 4 * sizeof(nodes[0]));
+    nodes[2].type = kBLEFIDevicePathHardDrive;
+    nodes[2].u.hardDrive.partitionNumber = 2;
+    nodes[2].u.hardDrive.mbrType = 2;
+    nodes[2].u.hardDrive.signatureType = 2;
+    nodes[3].type = kBLEFIDevicePathMACAddress;
+    nodes[3].u.mac.address[0] = 0x00;
+    nodes[3].u.mac.address[5] = 0x42;
+    nodes[3].u.mac.ifType = 1;
+    nodes[4].type = kBLEFIDevicePathIPv4;
+    memcpy(nodes[4].u.ipv4.remoteAddress, "\x0a\x00\x00\x01", 4);
+    nodes[4].u.ipv4.remotePort = 69;
+    nodes[5].type = kBLEFIDevicePathMemoryMapped;
+    nodes[5].u.memoryMapped.memoryType = 11;
+    nodes[5].u.memoryMapped.startingAddress = 0xffe00000ULL;
+    nodes[5].u.memoryMapped.endingAddress = 0xffe00000ULL + 0x1a0000ULL - 1;
+    size = BLEFIDevicePathGetSize(nodes, 6);
+    require(size == 206, fail);
+    require_noerr(BLEncodeEFIDevicePath(nodes, 6, buffer, size), fail);
+    for (i = 0, offset = 0; i < sizeof(nodeSizes) / sizeof(nodeSizes[0]); i++) {
+        require(offset + 4 <= size, fail);
+        require((buffer[offset + 2] | (buffer[offset + 3] << 8)) == nodeSizes[i], fail);
+        offset += nodeSizes[i];
+    }
+    require(offset == size && buffer[size - 4] == 0x7F, fail);
+    require(buffer[24 + 48 + 42 + 37 + 8] == 0x0a && buffer[24 + 48 + 42 + 37 + 14] == 69, fail);
+    require(BLEncodeEFIDevicePath(nodes, 6, buffer, size - 1) == ENOSPC, fail);
+
+    printf("3. XML from the same nodes\n");
+    require_noerr(BLCreateEFIXMLRepresentationForDevicePath(&context, nodes, 2, NULL, &xmlString), fail);
+    require(CFStringGetCString(xmlString, cxml, sizeof(cxml), kCFStringEncodingUTF8), fail);
+    parsed = IOCFUnserialize(cxml, kCFAllocatorDefault, 0, NULL);
+    expected = createHandBuiltArray();
+    require(parsed && CFEqual(parsed, expected), fail);
+    CFRelease(parsed);
+    parsed = NULL;
+    CFRelease(xmlString);
+    xmlString = NULL;
+
+    printf("4. What can't be encoded\n");
+    nodes[1].u.filePath.path = "\\EFI\\\xc3(";
+    require(BLEFIDevicePathGetSize(nodes, 2) == 0, fail);
+    require(BLCreateEFIDevicePath(&context, nodes, 2, &devicePath) == EINVAL && devicePath == NULL, fail);
+    require(BLCreateEFIDevicePathNodeDictionary(&nodes[1]) == NULL, fail);
+    nodes[1].u.filePath.path = NULL;
+    require(BLEFIDevicePathGetSize(nodes, 2) == 0, fail);
+    nodes[1].type = kBLEFIDevicePathNodeTypeCount;
+    require(BLEFIDevicePathGetSize(nodes, 2) == 0, fail);
+
+    printf("5. %u boot paths each way\n", count);
+    elToritoNodes(nodes);
+    start = monotonicNanos();
+    for (i = 0; i < count; i++) {
+        xmlString = createHandBuiltXML();
+        require(xmlString != NULL, fail);
+        CFRelease(xmlString);
+    }
+    xmlNanos = monotonicNanos() - start;
+    xmlString = NULL;
+    start = monotonicNanos();
+    for (i = 0; i < count; i++) {
+        require_noerr(BLCreateEFIDevicePath(&context, nodes, 2, &devicePath), fail);
+        CFRelease(devicePath);
+    }
+    binaryNanos = monotonicNanos() - start;
+    devicePath = NULL;
+    printf("   XML %.2f us, binary %.2f us each\n", xmlNanos / 1e3 / count, binaryNanos / 1e3 / count);
+
+    CFRelease(expected);
+    printf("Success\n");
+    return 0;
+
+fail:
+    if (devicePath) CFRelease(devicePath);
+    if (xmlString) CFRelease(xmlString);
+    if (parsed) CFRelease(parsed);
+    if (expected) CFRelease(expected);
+    printf("Failure\n");
+    return 1;
+}
@@ -0,0 +1,323 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ * EFI load option test. Builds a Boot#### the way firmware lays it out and
+ * checks it decodes in place, then walks a BootOrder from a plist standing
+ * in for NVRAM, with one entry missing. Then parses a fuzz corpus made by
+ * flipping bits in, truncating and corrupting the lengths of good options
+ * (plus any files given with -d), which must not crash, and reports the
+ * parsing rate over it.
+ *
+ *   ./build/testefiloadoption [-n rounds] [-d corpusdir]
+ */
+
+#define DEBUG 1
+
+#include <libc.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <bless.h>
+#include <bless_private.h>
+#include <AssertMacros.h>
+
+#define kPlistPath      "/tmp/testefiloadoption.plist"
+#define kDescription    "Mac OS X"
+#define kBootFile       "\\System\\Library\\CoreServices\\boot.efi"
+#define kOptionalData   "RC\0\0"
+#define kCorpusSize     4096
+#define kMaxOption      512
+
+static int testlog(void *refcon, int level, const char *string) {
+    if(level & kBLLogLevelError) fputs(string, stderr);
+    return 0;
+}
+
+static uint64_t monotonicNanos(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// xorshift32, so the corpus is the same every run
+static uint32_t nextRandom(uint32_t *state) {
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+// An EFI_LOAD_OPTION for a hard drive boot.efi; returns its size
+static size_t buildOption(uint8_t *buffer, size_t size, uint32_t attributes) {
+    BLEFIDevicePathNode nodes[2];
+    size_t              offset = 6, pathSize, i;
+
+    memset(nodes, 0, sizeof(nodes));
+    nodes[0].type = kBLEFIDevicePathHardDrive;
+    nodes[0].u.hardDrive.partitionNumber = 2;
+    nodes[0].u.hardDrive.partitionStart = 409640;
+    nodes[0].u.hardDrive.partitionSize = 0x3a000000;
+    nodes[0].u.hardDrive.mbrType = 2;
+    nodes[0].u.hardDrive.signatureType = 2;
+    nodes[1].type = kBLEFIDevicePathFilePath;
+    nodes[1].u.filePath.path = kBootFile;
+    pathSize = BLEFIDevicePathGetSize(nodes, 2);
+
+    if (size < offset + 2 * (strlen(kDescription) + 1) + pathSize + sizeof(kOptionalData) - 1) return 0;
+    buffer[0] = attributes & 0xFF;
+    buffer[1] = (attributes >> 8) & 0xFF;
+    buffer[2] = (attributes >> 16) & 0xFF;
+    buffer[3] = (attributes >> 24) & 0xFF;
+    buffer[4] = pathSize & 0xFF;
+    buffer[5] = (pathSize >> 8) & 0xFF;
+    for (i = 0; i <= strlen(kDescription); i++) {
+        buffer[offset++] = kDescription[i];
+        buffer[offset++] = 0;
+    }
+    if (BLEncodeEFIDevicePath(nodes, 2, buffer + offset, pathSize)) return 0;
+    offset += pathSize;
+    memcpy(buffer + offset, kOptionalData, sizeof(kOptionalData) - 1);
+    return offset + sizeof(kOptionalData) - 1;
+}
+
+static void base64(const uint8_t *bytes, size_t size, char *out) {
+    static const char   alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t              i;
+
+    for (i = 0; i + 2 < size; i += 3) {
+        *out++ = alphabet[bytes[i] >> 2];
+        *out++ = alphabet[((bytes[i] & 3) << 4) | (bytes[i + 1] >> 4)];
+        *out++ = alphabet[((bytes[i + 1] & 0xF) << 2) | (bytes[i + 2] >> 6)];
+        *out++ = alphabet[bytes[i + 2] & 0x3F];
+    }
+    if (size - i == 1) {
+        *out++ = alphabet[bytes[i] >> 2];
+        *out++ = alphabet[(bytes[i] & 3) << 4];
+        *out++ = '=';
+        *out++ = '=';
+    } else if (size - i == 2) {
+        *out++ = alphabet[bytes[i] >> 2];
+        *out++ = alphabet[((bytes[i] & 3) << 4) | (bytes[i + 1] >> 4)];
+        *out++ = alphabet[(bytes[i + 1] & 0xF) << 2];
+        *out++ = '=';
+    }
+    *out = '\0';
+}
+
+// BootOrder is 0080, 0001; only Boot0080 is set
+static int writePlist(const char *path, const uint8_t *option, size_t size) {
+    char    encoded[4 * kMaxOption / 3 + 4];
+    FILE    *f = fopen(path, "w");
+
+    if (!f) return 1;
+    base64(option, size, encoded);
+    fprintf(f,
+            "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            "<!DOCTYPE plist PUBLIC \"-//Apple//DTD PLIST 1.0//EN\" \"http://www.apple.com/DTDs/PropertyList-1.0.dtd\">\n"
+            "<plist version=\"1.0\">\n"
+            "<dict>\n"
+            "  <key>%s:BootOrder</key><data>gAABAA==</data>\n"
+            "  <key>%s:Boot0080</key><data>%s</data>\n"
+            "</dict>\n"
+            "</plist>\n",
+            kBLEFIGlobalVariableGUID, kBLEFIGlobalVariableGUID, encoded);
+    return fclose(f) ? 1 : 0;
+}
+
+// What a parse said must stay inside the bytes it was given
+static int checkBounds(const uint8_t *bytes, size_t size, const BLEFILoadOption *option) {
+    const uint8_t *end = bytes + size;
+
+    if (option->status) return 0;
+    if (option->description + 2 * option->descriptionLength > end) return 1;
+    if (option->devicePath + option->devicePathSize > end) return 1;
+    if (option->optionalData && option->optionalData + option->optionalDataSize != end) return 1;
+    return 0;
+}
+
+// Extra corpus entries from a directory, appended to the generated ones
+static uint32_t readCorpus(const char *dir, uint8_t *corpus, size_t *sizes, uint32_t used, uint32_t max) {
+    DIR             *d = opendir(dir);
+    struct dirent   *entry;
+    char            path[MAXPATHLEN];
+
+    if (d == NULL) return used;
+    while (used < max && (entry = readdir(d)) != NULL) {
+        FILE *f;
+
+        if (entry->d_name[0] == '.') continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        f = fopen(path, "r");
+        if (f == NULL) continue;
+        sizes[used] = fread(corpus + (size_t)used * kMaxOption, 1, kMaxOption, f);
+        fclose(f);
+        used++;
+    }
+    closedir(d);
+    return used;
+}
+
+int main(int argc, char *argv[]) {
+    BLContext               context = { kBLContextVersion9, testlog, NULL, kBLLogLevelError };
+    struct BLNVRAMSnapshot  *snapshot = NULL;
+    BLEFILoadOption         option, *options = NULL;
+    CFArrayRef              menu = NULL;
+    CFDictionaryRef         dict;
+    uint8_t                 good[kMaxOption];
+    uint8_t                 *corpus = NULL;
+    size_t                  goodSize, pathOffset, *sizes = NULL, total = 0;
+    uint32_t                rounds = 100, count, i, r, entries, parsed = 0;
+    uint32_t                seed = 0x424c4553;
+    const char              *corpusDir = NULL;
+    uint64_t                start, nanos;
+    int                     ch;
+
+    while ((ch = getopt(argc, argv, "n:d:")) != -1) {
+        switch (ch) {
+            case 'n':
+                rounds = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 'd':
+                corpusDir = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n rounds] [-d corpusdir]\n", getprogname());
+                return 1;
+        }
+    }
+    if (rounds < 1) rounds = 1;
+
+    printf("1. A Boot#### decoded in place\n");
+    goodSize = buildOption(good, sizeof(good), kBLEFILoadOptionActive);
+    require(goodSize != 0, fail);
+    pathOffset = 6 + 2 * (strlen(kDescription) + 1);
+    option.number = 0x80;
+    require_noerr(BLParseEFILoadOption(good, goodSize, &option), fail);
+    require(option.number == 0x80 && option.status == 0, fail);
+    require(option.attributes == kBLEFILoadOptionActive, fail);
+    require(option.description == good + 6 && option.descriptionLength == strlen(kDescription), fail);
+    require(option.devicePath == good + pathOffset, fail);
+    require(option.devicePathSize == 42 + 4 + 2 * (strlen(kBootFile) + 1) + 4, fail);
+    require(option.nodeCount == 2, fail);
+    require(option.optionalDataSize == sizeof(kOptionalData) - 1, fail);
+    require(memcmp(option.optionalData, kOptionalData, option.optionalDataSize) == 0, fail);
+
+    printf("2. What doesn't parse\n");
+    require(BLParseEFILoadOption(good, 5, &option) == EINVAL && option.status == EINVAL, fail);
+    // description with no NUL
+    require(BLParseEFILoadOption(good, 6 + 2 * strlen(kDescription), &option) == EINVAL, fail);
+    // FilePathListLength past the end
+    require(BLParseEFILoadOption(good, pathOffset + 10, &option) == EINVAL, fail);
+
+    printf("3. BootOrder from %s\n", kPlistPath);
+    require_noerr(writePlist(kPlistPath, good, goodSize), fail);
+    require_noerr(BLNVRAMSnapshotCreateWithFile(&context, kPlistPath, &snapshot), fail);
+    require_noerr(BLCopyEFIBootOptions(&context, snapshot, &options, &count), fail);
+    require(count == 2, fail);
+    require(options[0].number == 0x0080 && options[0].status == 0 && options[0].nodeCount == 2, fail);
+    require(options[1].number == 0x0001 && options[1].status == ENOENT, fail);
+    menu = BLCreateEFIBootMenu(&context, snapshot);
+    require(menu && CFArrayGetCount(menu) == 2, fail);
+    dict = CFArrayGetValueAtIndex(menu, 0);
+    require(CFEqual(CFDictionaryGetValue(dict, CFSTR("Name")), CFSTR("Boot0080")), fail);
+    require(CFEqual(CFDictionaryGetValue(dict, CFSTR("Description")), CFSTR(kDescription)), fail);
+    require(CFDictionaryGetValue(dict, CFSTR("Active")) == kCFBooleanTrue, fail);
+    require(CFArrayGetCount(CFDictionaryGetValue(dict, CFSTR("Device Path"))) == 2, fail);
+    dict = CFArrayGetValueAtIndex(menu, 1);
+    require(CFEqual(CFDictionaryGetValue(dict, CFSTR("Error")), CFSTR("Not set")), fail);
+    CFRelease(menu);
+    menu = NULL;
+    free(options);
+    options = NULL;
+    BLNVRAMSnapshotRelease(snapshot);
+    snapshot = NULL;
+
+    printf("4. Fuzz corpus\n");
+    corpus = malloc((size_t)kCorpusSize * kMaxOption);
+    sizes = calloc(kCorpusSize, sizeof(*sizes));
+    require(corpus && sizes, fail);
+    entries = corpusDir ? kCorpusSize * 7 / 8 : kCorpusSize;
+    for (i = 0; i < entries; i++) {
+        uint8_t *entry = corpus + (size_t)i * kMaxOption;
+        size_t  n;
+
+        memcpy(entry, good, goodSize);
+        sizes[i] = goodSize;
+        switch (nextRandom(&seed) % 4) {
+            case 0:     // bit flips
+                for (n = 1 + nextRandom(&seed) % 8; n; n--) {
+                    entry[nextRandom(&seed) % goodSize] ^= 1 << (nextRandom(&seed) % 8);
+                }
+                break;
+            case 1:     // truncated
+                sizes[i] = nextRandom(&seed) % goodSize;
+                break;
+            case 2:     // FilePathListLength or a node length corrupted
+                n = (nextRandom(&seed) & 1) ? 4 : pathOffset + 2;
+                entry[n] = nextRandom(&seed) & 0xFF;
+                entry[n + 1] = nextRandom(&seed) & 0xFF;
+                break;
+            default:    // random bytes
+                for (n = 0; n < goodSize; n++) entry[n] = nextRandom(&seed) & 0xFF;
+                break;
+        }
+    }
+    if (corpusDir) entries = readCorpus(corpusDir, corpus, sizes, entries, kCorpusSize);
+    for (i = 0; i < entries; i++) {
+        option.number = (uint16_t)i;
+        if (BLParseEFILoadOption(corpus + (size_t)i * kMaxOption, sizes[i], &option) == 0) parsed++;
+        require_noerr(checkBounds(corpus + (size_t)i * kMaxOption, sizes[i], &option), fail);
+        total += sizes[i];
+    }
+    printf("   %u entries, %u parsed\n", entries, parsed);
+
+    printf("5. %u rounds over the corpus\n", rounds);
+    start = monotonicNanos();
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < entries; i++) {
+            BLParseEFILoadOption(corpus + (size_t)i * kMaxOption, sizes[i], &option);
+        }
+    }
+    nanos = monotonicNanos() - start;
+    if (nanos == 0) nanos = 1;
+    printf("   %.1f ns each, %.1f MB/s\n", (double)nanos / rounds / entries,
+           (double)total * rounds * 1000.0 / nanos);
+
+    free(corpus);
+    free(sizes);
+    unlink(kPlistPath);
+    printf("Success\n");
+    return 0;
+
+fail:
+    if (menu) CFRelease(menu);
+    free(options);
+    BLNVRAMSnapshotRelease(snapshot);
+    free(corpus);
+    free(sizes);
+    unlink(kPlistPath);
+    printf("Failure\n");
+    return 1;
+}
@@ -0,0 +1,291 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ * EFI boot XML parser test. Unserializes a corpus of efi-boot-device
+ * strings like the ones bless writes (disk, Preboot path with optional
+ * data, network, El Torito, legacy, and one well past 1024 bytes), plus
+ * any files given with -d, and checks each against IOCFUnserialize().
+ * Checks what should be rejected is, and that an object a dict or set
+ * dropped as a duplicate can still be referred to. Then times both over
+ * the corpus, counting allocations with a counting allocator.
+ *
+ *   ./build/testefixmlparse [-n rounds] [-d corpusdir]
+ */
+
+#define DEBUG 1
+
+#include <libc.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <IOKit/IOCFUnserialize.h>
+#include <bless.h>
+#include <bless_private.h>
+#include <AssertMacros.h>
+
+#define kMaxCorpus      64
+
+static const char *corpus[] = {
+    // disk, by volume UUID, with the booter path
+    "<array><dict><key>IOMatch</key><dict><key>IOProviderClass</key><string>IOMedia</string>"
+    "<key>IOPropertyMatch</key><dict><key>UUID</key><string>2C3A1C9E-8E5A-4F3E-9A4B-0E3C8F6B1D22</string>"
+    "</dict></dict><key>BLLastBSDName</key><string>disk1s2</string></dict><dict><key>IOEFIDevicePathType</key>"
+    "<string>MediaFilePath</string><key>Path</key><string>\\System\\Library\\CoreServices\\boot.efi</string>"
+    "</dict></array>",
+    // APFS Preboot, with optional data
+    "<array><dict><key>IOMatch</key><dict><key>IOProviderClass</key><string>IOMedia</string>"
+    "<key>IOPropertyMatch</key><dict><key>UUID</key><string>C1A5D6E4-1B2C-4D3E-8F9A-0B1C2D3E4F50</string>"
+    "</dict></dict><key>BLLastBSDName</key><string>disk1s2</string></dict><dict><key>IOEFIDevicePathType</key>"
+    "<string>MediaFilePath</string><key>Path</key><string>\\9A8B7C6D-5E4F-4A3B-2C1D-0E9F8A7B6C5D\\System\\"
+    "Library\\CoreServices\\boot.efi</string></dict><dict><key>IOEFIBootOption</key><string>rd=disk1s1 "
+    "-v</string></dict></array>",
+    // network
+    "<array><dict><key>IOMatch</key><dict><key>BSD Name</key><string>en0</string></dict>"
+    "<key>BLMACAddress</key><data>ABEkAAAA</data></dict><dict><key>IOEFIDevicePathType</key>"
+    "<string>MessagingIPv4</string><key>RemoteIpAddress</key><string>10.0.1.1</string></dict></array>",
+    // El Torito
+    "<array><dict><key>IOEFIDevicePathType</key><string>MediaCDROM</string><key>BootEntry</key>"
+    "<integer size=\"32\">0x1</integer><key>PartitionStart</key><integer size=\"32\">0x1234</integer>"
+    "<key>PartitionSize</key><integer size=\"32\">0x100</integer></dict><dict><key>IOEFIDevicePathType</key>"
+    "<string>MediaFilePath</string><key>Path</key><string>\\EFI\\BOOT\\BOOTX64.efi</string></dict></array>",
+    // legacy, with an object written twice
+    "<array ID=\"0\"><dict ID=\"1\"><key>IOEFIDevicePathType</key><string ID=\"2\">MediaFirmwareVolumeFilePath"
+    "</string><key>Guid</key><string ID=\"3\">2B0585EB-D8B8-49A9-8B8C-E21B01AEF2B7</string></dict>"
+    "<dict ID=\"4\"><key>IOEFIBootOption</key><string ID=\"5\">HD</string><key>Legacy</key><true/></dict>"
+    "<dict ID=\"6\"><key>Name</key><string IDREF=\"5\"/><key>Escaped</key><string>a &amp; b &lt;c&gt;</string>"
+    "</dict></array>",
+};
+
+static long allocations;
+
+static void *countingAllocate(CFIndex size, CFOptionFlags hint, void *info) {
+    allocations++;
+    return malloc(size);
+}
+
+static void *countingReallocate(void *ptr, CFIndex size, CFOptionFlags hint, void *info) {
+    allocations++;
+    return realloc(ptr, size);
+}
+
+static void countingDeallocate(void *ptr, void *info) {
+    free(ptr);
+}
+
+static uint64_t monotonicNanos(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// A Preboot path folders deep, with optional data: more than the old 1024-byte buffers held
+static char *createLongString(void) {
+    size_t  size = 8192;
+    char    *s = malloc(size);
+    int     i;
+
+    strlcpy(s, "<array><dict><key>IOMatch</key><dict><key>IOProviderClass</key><string>IOMedia</string>"
+            "<key>IOPropertyMatch</key><dict><key>UUID</key><string>C1A5D6E4-1B2C-4D3E-8F9A-0B1C2D3E4F50"
+            "</string></dict></dict></dict><dict><key>IOEFIDevicePathType</key><string>MediaFilePath</string>"
+            "<key>Path</key><string>", size);
+    for (i = 0; i < 40; i++) {
+        strlcat(s, "\\9A8B7C6D-5E4F-4A3B-2C1D-0E9F8A7B6C5D", size);
+    }
+    strlcat(s, "\\boot.efi</string></dict><dict><key>IOEFIBootOption</key><data>", size);
+    for (i = 0; i < 40; i++) {
+        strlcat(s, "AAECAwQFBgcICQoLDA0ODw", size);
+    }
+    strlcat(s, "</data></dict></array>", size);
+    return s;
+}
+
+static int readCorpus(const char *dir, char **strings, int used) {
+    DIR             *d = opendir(dir);
+    struct dirent   *entry;
+    char            path[MAXPATHLEN];
+
+    if (d == NULL) return used;
+    while (used < kMaxCorpus && (entry = readdir(d)) != NULL) {
+        struct stat st;
+        FILE        *f;
+
+        if (entry->d_name[0] == '.') continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        if (stat(path, &st) || !S_ISREG(st.st_mode)) continue;
+        f = fopen(path, "r");
+        if (f == NULL) continue;
+        strings[used] = calloc(st.st_size + 1, 1);
+        fread(strings[used], 1, st.st_size, f);
+        fclose(f);
+        used++;
+    }
+    closedir(d);
+    return used;
+}
+
+int main(int argc, char *argv[]) {
+    BLContext               context = { kBLContextVersion9, NULL, NULL, 0 };
+    CFAllocatorContext      allocatorContext = { 0, NULL, NULL, NULL, NULL,
+                                                 countingAllocate, countingReallocate, countingDeallocate, NULL };
+    CFAllocatorRef          counting = NULL;
+    BLEFIXMLParseStatistics stats;
+    char                    *strings[kMaxCorpus];
+    const char              *corpusDir = NULL;
+    static const char       *bad[] = {
+        "", "<array>", "<array><string>a</array>", "<dict><string>a</string></dict>",
+        "<data>A</data>", "<integer>0xZ</integer>", "<string IDREF=\"9\"/>", "<foo/>",
+        "<array></array>x", "<string>&bogus;</string>",
+    };
+    // Only one of each duplicate key or member is kept, but all four are referred to
+    static const char       *duplicates =
+        "<array><dict><key>a</key><string ID=\"1\">x</string><key>a</key><string ID=\"2\">y</string></dict>"
+        "<set><string ID=\"3\">z</string><string ID=\"4\">z</string></set>"
+        "<string IDREF=\"1\"/><string IDREF=\"2\"/><string IDREF=\"3\"/><string IDREF=\"4\"/></array>";
+    CFTypeRef               ours = NULL, theirs = NULL;
+    CFStringRef             xmlString = NULL;
+    CFArrayRef              array = NULL;
+    uint32_t                rounds = 1000, r;
+    int                     count = 0, i, ch;
+    size_t                  bytes = 0;
+    long                    ourAllocations, theirAllocations;
+    uint64_t                start, ourNanos, theirNanos;
+
+    while ((ch = getopt(argc, argv, "n:d:")) != -1) {
+        switch (ch) {
+            case 'n':
+                rounds = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 'd':
+                corpusDir = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n rounds] [-d corpusdir]\n", getprogname());
+                return 1;
+        }
+    }
+    if (rounds < 1) rounds = 1;
+
+    for (i = 0; i < (int)(sizeof(corpus) / sizeof(corpus[0])); i++) {
+        strings[count++] = strdup(corpus[i]);
+    }
+    strings[count++] = createLongString();
+    if (corpusDir) count = readCorpus(corpusDir, strings, count);
+
+    printf("1. %d boot strings, against IOCFUnserialize\n", count);
+    for (i = 0; i < count; i++) {
+        ours = BLCreateObjectFromEFIXML(kCFAllocatorDefault, strings[i], strlen(strings[i]), NULL, NULL);
+        theirs = IOCFUnserialize(strings[i], kCFAllocatorDefault, 0, NULL);
+        require(ours && theirs && CFEqual(ours, theirs), fail);
+        CFRelease(ours);
+        CFRelease(theirs);
+        ours = theirs = NULL;
+        bytes += strlen(strings[i]);
+    }
+
+    printf("2. Past 1024 bytes, through the context\n");
+    xmlString = CFStringCreateWithCString(kCFAllocatorDefault, strings[sizeof(corpus) / sizeof(corpus[0])],
+                                          kCFStringEncodingUTF8);
+    require(xmlString && CFStringGetLength(xmlString) > 1024, fail);
+    require_noerr(BLCreateEFIXMLArray(&context, xmlString, &array), fail);
+    require(CFArrayGetCount(array) == 3, fail);
+    CFRelease(array);
+    array = NULL;
+    CFRelease(xmlString);
+    xmlString = NULL;
+
+    printf("3. What isn't the dialect\n");
+    for (i = 0; i < (int)(sizeof(bad) / sizeof(bad[0])); i++) {
+        CFStringRef error = NULL;
+
+        ours = BLCreateObjectFromEFIXML(kCFAllocatorDefault, bad[i], strlen(bad[i]), NULL, &error);
+        require(ours == NULL && error != NULL, fail);
+        CFRelease(error);
+    }
+    xmlString = CFSTR("<dict><key>a</key><string>b</string></dict>");
+    require(BLCreateEFIXMLArray(&context, xmlString, &array) == 2 && array == NULL, fail);
+    xmlString = NULL;
+
+    printf("4. IDREFs to duplicates a container dropped\n");
+    ours = BLCreateObjectFromEFIXML(kCFAllocatorDefault, duplicates, strlen(duplicates), NULL, NULL);
+    require(ours && CFGetTypeID(ours) == CFArrayGetTypeID() && CFArrayGetCount(ours) == 6, fail);
+    require(CFEqual(CFArrayGetValueAtIndex(ours, 2), CFSTR("x")), fail);
+    require(CFEqual(CFArrayGetValueAtIndex(ours, 3), CFSTR("y")), fail);
+    require(CFEqual(CFArrayGetValueAtIndex(ours, 4), CFSTR("z")), fail);
+    require(CFEqual(CFArrayGetValueAtIndex(ours, 5), CFSTR("z")), fail);
+    CFRelease(ours);
+    ours = NULL;
+
+    printf("5. %u rounds over %zu bytes\n", rounds, bytes);
+    counting = CFAllocatorCreate(kCFAllocatorDefault, &allocatorContext);
+    require(counting != NULL, fail);
+
+    allocations = 0;
+    memset(&stats, 0, sizeof(stats));
+    start = monotonicNanos();
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < count; i++) {
+            ours = BLCreateObjectFromEFIXML(counting, strings[i], strlen(strings[i]), &stats, NULL);
+            require(ours != NULL, fail);
+            CFRelease(ours);
+        }
+    }
+    ourNanos = monotonicNanos() - start;
+    ourAllocations = allocations;
+    ours = NULL;
+
+    allocations = 0;
+    start = monotonicNanos();
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < count; i++) {
+            theirs = IOCFUnserialize(strings[i], counting, 0, NULL);
+            require(theirs != NULL, fail);
+            CFRelease(theirs);
+        }
+    }
+    theirNanos = monotonicNanos() - start;
+    theirAllocations = allocations;
+    theirs = NULL;
+
+    if (ourNanos == 0) ourNanos = 1;
+    if (theirNanos == 0) theirNanos = 1;
+    printf("   arena: %.1f MB/s, %.1f CF allocations and %.2f heap blocks per string\n",
+           (double)bytes * rounds * 1000.0 / ourNanos, (double)ourAllocations / rounds / count,
+           (double)stats.arenaBlocks / rounds / count);
+    printf("   IOCFUnserialize: %.1f MB/s, %.1f CF allocations per string\n",
+           (double)bytes * rounds * 1000.0 / theirNanos, (double)theirAllocations / rounds / count);
+
+    CFRelease(counting);
+    for (i = 0; i < count; i++) free(strings[i]);
+    printf("Success\n");
+    return 0;
+
+fail:
+    if (ours) CFRelease(ours);
+    if (theirs) CFRelease(theirs);
+    if (array) CFRelease(array);
+    if (xmlString) CFRelease(xmlString);
+    if (counting) CFRelease(counting);
+    for (i = 0; i < count; i++) free(strings[i]);
+    printf("Failure\n");
+    return 1;
+}
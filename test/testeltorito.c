@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2013-2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ * Self-test and benchmark for the El Torito catalog index.
+ *
+ * With no image argument, a synthetic ISO is written to /tmp (this is the
+ * generator that used to live under TESTMODE in BLElToritoFindUEFI.c),
+ * checked, and then indexed repeatedly:
+ *
+ *   ./build/testeltorito                       # the original layout
+ *   ./build/testeltorito -s 40 -n 2000         # 40 catalog sectors of filler sections
+ *   ./build/testeltorito /path/to/image.iso    # benchmark an existing image
+ */
+
+#define DEBUG 1
+
+#include <libc.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+#include <bless.h>
+#include <bless_private.h>
+#include <AssertMacros.h>
+
+#define kSectorSize         2048
+#define kCatalogSector      32
+#define kSyntheticPath      "/tmp/testeltorito.iso"
+
+static int testlog(void *refcon, int level, const char *string) {
+    if(level & (kBLLogLevelError | kBLLogLevelNormal))
+	fputs(string, stderr);
+    return 0;
+}
+
+void usage() {
+    fprintf(stderr, "Usage: %s [-s extrasectors] [-n iterations] [image]\n", getprogname());
+    exit(1);
+}
+
+static void putEntry(uint8_t *catalog, uint32_t *index, const uint8_t bytes[32]) {
+    memcpy(catalog + (*index)*32, bytes, 32);
+    (*index)++;
+}
+
+static void putSection(uint8_t *catalog, uint32_t *index, uint8_t bootable, uint32_t rba) {
+    uint8_t e[32] = { bootable, 0, 0, 0, 0, 0, 4, 0,
+	(uint8_t)rba, (uint8_t)(rba >> 8), (uint8_t)(rba >> 16), (uint8_t)(rba >> 24) };
+    putEntry(catalog, index, e);
+}
+
+static uint32_t fillerCount(uint32_t extraSectors) {
+    return extraSectors ? (extraSectors * 64 - 1) : 0;
+}
+
+/*
+ * Same layout as the old TESTMODE image, optionally followed by
+ * extraSectors worth of non-bootable platform 0x36 sections ahead of the
+ * final EFI header, so the catalog spans several sectors.
+ */
+static int writeSyntheticImage(const char *path, uint32_t extraSectors, uint32_t *expectedEntries) {
+    uint32_t    catalogSectors = 1 + extraSectors;
+    uint32_t    fillerSections = fillerCount(extraSectors);
+    uint32_t    i, count = 0;
+    size_t      imageSize = (kCatalogSector + catalogSectors + 1) * kSectorSize;
+    uint8_t     *image = calloc(1, imageSize);
+    uint8_t     *catalog = image + kCatalogSector * kSectorSize;
+    int         fd;
+
+    if (!image) return 1;
+
+    // PVD: volume space size 0x00112233 sectors
+    image[16*kSectorSize + 0] = 1;
+    memcpy(image + 16*kSectorSize + 1, "CD001", 5);
+    image[16*kSectorSize + 80] = 0x33;
+    image[16*kSectorSize + 81] = 0x22;
+    image[16*kSectorSize + 82] = 0x11;
+    image[16*kSectorSize + 83] = 0x00;
+
+    // BRVD pointing at the boot catalog
+    image[17*kSectorSize + 0] = 0;
+    memcpy(image + 17*kSectorSize + 1, "CD001", 5);
+    image[17*kSectorSize + 71] = kCatalogSector;
+
+    {   // validation entry
+	uint8_t e[32] = { 0x01 };
+	e[0x1e] = 0x55; e[0x1f] = 0xaa;
+	putEntry(catalog, &count, e);
+    }
+    putSection(catalog, &count, 0x88, 0x40);            // default entry
+    {   // header, platform 0x33, no sections
+	uint8_t e[32] = { 0x90, 0x33, 0, 0 };
+	putEntry(catalog, &count, e);
+    }
+    {   // header, platform 0x34, two sections each with an extension chain
+	uint8_t h[32] = { 0x90, 0x34, 2, 0 };
+	uint8_t s[32] = { 0x00, 0x20, 0, 0, 0, 0, 4, 0, 0x50 };
+	uint8_t x1[32] = { 0x44, 0x20 };
+	uint8_t x2[32] = { 0x44, 0x00 };
+	putEntry(catalog, &count, h);
+	putEntry(catalog, &count, s);
+	putEntry(catalog, &count, x1);
+	putEntry(catalog, &count, x2);
+	putEntry(catalog, &count, s);
+	putEntry(catalog, &count, x2);
+    }
+    {   // header, platform 0x35, three sections
+	uint8_t h[32] = { 0x90, 0x35, 3, 0 };
+	putEntry(catalog, &count, h);
+	for (i = 0; i < 3; i++)
+	    putSection(catalog, &count, 0x00, 0x60 + i);
+    }
+    if (fillerSections) {
+	uint8_t h[32] = { 0x90, 0x36, (uint8_t)fillerSections, (uint8_t)(fillerSections >> 8) };
+	putEntry(catalog, &count, h);
+	for (i = 0; i < fillerSections; i++)
+	    putSection(catalog, &count, 0x00, 0x100 + i);
+    }
+    {   // header, platform 0xEF, two sections, the second one bootable
+	uint8_t h[32] = { 0x90, 0xEF, 2, 0 };
+	putEntry(catalog, &count, h);
+	putSection(catalog, &count, 0x00, 0x00102030);
+	putSection(catalog, &count, 0x88, 0x00012345);
+    }
+    {   // final header
+	uint8_t h[32] = { 0x91, 0xEF, 0, 0 };
+	putEntry(catalog, &count, h);
+    }
+
+    *expectedEntries = count;
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+	free(image);
+	return 1;
+    }
+    if (write(fd, image, imageSize) != (ssize_t)imageSize) {
+	close(fd);
+	free(image);
+	return 1;
+    }
+    close(fd);
+    free(image);
+    return 0;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    BLContext               context = { 0, testlog, NULL };
+    BLElToritoCatalogRef    catalog = NULL;
+    const BLElToritoEntry   *entry;
+    const char              *path = kSyntheticPath;
+    uint32_t                extraSectors = 0;
+    uint32_t                iterations = 10000;
+    uint32_t                expectedEntries = 0;
+    uint32_t                count, offset, size, i;
+    uint64_t                totalEntries = 0;
+    double                  start, elapsed;
+    int                     ch;
+
+    while ((ch = getopt(argc, argv, "s:n:")) != -1) {
+	switch (ch) {
+	    case 's':
+		extraSectors = (uint32_t)strtoul(optarg, NULL, 0);
+		break;
+	    case 'n':
+		iterations = (uint32_t)strtoul(optarg, NULL, 0);
+		break;
+	    default:
+		usage();
+	}
+    }
+    argc -= optind;
+    argv += optind;
+    if (argc > 1) usage();
+
+    if (argc == 1) {
+	path = argv[0];
+    } else {
+	require_noerr(writeSyntheticImage(path, extraSectors, &expectedEntries), cantWrite);
+    }
+
+    require_noerr(BLElToritoCatalogCreateWithPath(&context, path, &catalog), cantIndex);
+
+    BLElToritoCatalogGetEntries(catalog, &count);
+    entry = BLElToritoCatalogGetUEFIBootEntry(catalog, &offset, &size);
+    printf("%s: %u entries in %u catalog sector(s), volume space size %u\n", path, count,
+	   BLElToritoCatalogGetSectorCount(catalog), BLElToritoCatalogGetVolumeSpaceSize(catalog));
+    if (entry) {
+	printf("UEFI boot entry at catalog index %u: offset %u size %u\n",
+	       entry->catalogIndex, offset, size);
+    } else {
+	printf("No UEFI boot entry\n");
+    }
+
+    if (expectedEntries) {
+	require(count == expectedEntries, badIndex);
+	require(entry != NULL, badIndex);
+	require(offset == 0x00012345, badIndex);
+	require(size == 0x00112233 - 0x00012345, badIndex);
+	require(BLElToritoCatalogGetSectorCount(catalog) == 1 + extraSectors, badIndex);
+    }
+    BLElToritoCatalogRelease(catalog);
+    catalog = NULL;
+
+    start = now();
+    for (i = 0; i < iterations; i++) {
+	require_noerr(BLElToritoCatalogCreateWithPath(&context, path, &catalog), cantIndex);
+	BLElToritoCatalogGetEntries(catalog, &count);
+	totalEntries += count;
+	BLElToritoCatalogRelease(catalog);
+	catalog = NULL;
+    }
+    elapsed = now() - start;
+
+    printf("%u iterations in %.3f s: %.0f catalogs/s, %.0f entries/s, %.2f us/catalog\n",
+	   iterations, elapsed, iterations / elapsed, totalEntries / elapsed,
+	   elapsed * 1e6 / (iterations ? iterations : 1));
+
+    printf("Success\n");
+    return 0;
+
+cantWrite:
+    printf("Failure: could not write %s: %s\n", path, strerror(errno));
+    return 1;
+cantIndex:
+    printf("Failure: could not index El Torito catalog of %s\n", path);
+    return 1;
+badIndex:
+    printf("Failure: unexpected catalog index for %s\n", path);
+    if (catalog) BLElToritoCatalogRelease(catalog);
+    return 1;
+}
@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ * Kernel collection sync test. Runs BLSyncKernelCollections() between two
+ * plain directories standing in for the system and preboot KernelCollections
+ * directories, and checks what it copied, skipped and deleted each time:
+ *
+ *   1. initial sync into an empty preboot directory
+ *   2. nothing changed: no file is read
+ *   3. system file rewritten with the same size but new contents
+ *   4. system file rewritten with the same contents: hashed, not copied
+ *   5. file added, file removed; preboot manifests are left alone
+ *   6. preboot copy modified behind our back
+ *
+ * Then times a full copy against a no-op resync of the same files.
+ *
+ *   ./build/testkcsync [scratch dir] [MiB per file]
+ *
+ * Where CommonCrypto isn't available, build with -I test and link
+ * test/CommonDigest.c for the SHA-256 calls.
+ */
+
+#define DEBUG 1
+
+#include <libc.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <bless.h>
+#include <bless_private.h>
+#include <AssertMacros.h>
+
+#define kKC     kBL_NAME_BOOTKERNELEXTENSIONS
+
+static int testlog(void *refcon, int level, const char *string) {
+    if(level & kBLLogLevelError) fputs(string, stderr);
+    return 0;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int writeFile(const char *dir, const char *name, size_t size, unsigned seed) {
+    char path[MAXPATHLEN];
+    char *data = malloc(size ? size : 1);
+    size_t i;
+    int fd, ret = 1;
+
+    if(!data) return 1;
+    for(i = 0; i < size; i++) data[i] = (char)((i * 31 + seed) >> 3);
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if(fd >= 0) {
+        ret = write(fd, data, size) == (ssize_t)size ? 0 : 1;
+        close(fd);
+    }
+    free(data);
+    return ret;
+}
+
+// 0 if the two files have the same contents
+static int compareFiles(const char *dir1, const char *dir2, const char *name) {
+    char path[MAXPATHLEN];
+    char cmd[3 * MAXPATHLEN];
+
+    snprintf(path, sizeof(path), "%s/%s", dir2, name);
+    if(access(path, R_OK) != 0) return 1;
+    snprintf(cmd, sizeof(cmd), "cmp -s '%s/%s' '%s'", dir1, name, path);
+    return system(cmd);
+}
+
+static int exists(const char *dir, const char *name) {
+    char path[MAXPATHLEN];
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    return access(path, F_OK) == 0;
+}
+
+static int runSync(BLContextPtr context, const char *sys, const char *pre, BLKernelCollectionSyncStats *stats,
+                uint32_t copied, uint32_t unchanged, uint32_t deleted) {
+    int ret = BLSyncKernelCollections(context, sys, pre, 0, stats);
+
+    printf("  copied %u (%u cloned, %u patched), unchanged %u, deleted %u, %llu bytes copied, %llu hashed, %u workers\n",
+           stats->copied, stats->cloned, stats->patched, stats->unchanged, stats->deleted,
+           (unsigned long long)stats->bytesCopied, (unsigned long long)stats->bytesHashed, stats->workers);
+    if(ret) return ret;
+    if(stats->copied != copied || stats->unchanged != unchanged || stats->deleted != deleted) return 1;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    BLContext   context = { kBLContextVersion1, testlog, NULL, kBLLogLevelError };
+    BLKernelCollectionSyncStats stats;
+    const char  *scratch = argc > 1 ? argv[1] : "/tmp";
+    size_t      mib = argc > 2 ? strtoul(argv[2], NULL, 0) : 32;
+    char        root[MAXPATHLEN], sys[MAXPATHLEN], pre[MAXPATHLEN], cmd[MAXPATHLEN + 16];
+    const char  *names[] = { kKC, kKC ".development", kKC ".kasan", kKC ".debug" };
+    double      start, full, noop;
+    int         i, fd;
+
+    snprintf(root, sizeof(root), "%s/testkcsync.XXXXXX", scratch);
+    require(mkdtemp(root) != NULL, fail);
+    snprintf(sys, sizeof(sys), "%s/system", root);
+    snprintf(pre, sizeof(pre), "%s/preboot", root);
+    require_noerr(mkdir(sys, 0755), fail);
+
+    for(i = 0; i < 4; i++) require_noerr(writeFile(sys, names[i], 100000 + i * 4099, i), fail);
+    require_noerr(writeFile(sys, "unrelated.txt", 10, 0), fail);
+
+    printf("1. initial sync\n");
+    require_noerr(runSync(&context, sys, pre, &stats, 4, 0, 0), fail);
+    for(i = 0; i < 4; i++) require_noerr(compareFiles(sys, pre, names[i]), fail);
+    require(!exists(pre, "unrelated.txt"), fail);
+    require(exists(pre, kBLKernelCollectionSyncCacheName), fail);
+
+    printf("2. nothing changed\n");
+    require_noerr(runSync(&context, sys, pre, &stats, 0, 4, 0), fail);
+    require(stats.bytesHashed == 0 && stats.bytesCopied == 0, fail);
+
+    printf("3. same size, new contents\n");
+    sleep(1);
+    require_noerr(writeFile(sys, names[1], 100000 + 4099, 77), fail);
+    require_noerr(runSync(&context, sys, pre, &stats, 1, 3, 0), fail);
+    require_noerr(compareFiles(sys, pre, names[1]), fail);
+    require_noerr(runSync(&context, sys, pre, &stats, 0, 4, 0), fail);
+
+    printf("4. touched, unchanged\n");
+    sleep(1);
+    require_noerr(writeFile(sys, names[2], 100000 + 2 * 4099, 2), fail);
+    require_noerr(runSync(&context, sys, pre, &stats, 0, 4, 0), fail);
+    // a kernel-side copy leaves no hash behind, so preboot may have been read too
+    require(stats.bytesHashed >= 100000 + 2 * 4099, fail);
+    sleep(1);
+    require_noerr(writeFile(sys, names[2], 100000 + 2 * 4099, 2), fail);
+    require_noerr(runSync(&context, sys, pre, &stats, 0, 4, 0), fail);
+    // now preboot's hash comes from the cache
+    require(stats.bytesHashed == 100000 + 2 * 4099, fail);
+    require_noerr(runSync(&context, sys, pre, &stats, 0, 4, 0), fail);
+    require(stats.bytesHashed == 0, fail);
+
+    printf("5. added, removed, manifest kept\n");
+    require_noerr(writeFile(pre, kKC ".im4m", 100, 0), fail);
+    require_noerr(writeFile(sys, kKC ".new", 5000, 9), fail);
+    snprintf(cmd, sizeof(cmd), "%s/%s", sys, names[3]);
+    require_noerr(unlink(cmd), fail);
+    require_noerr(runSync(&context, sys, pre, &stats, 1, 3, 1), fail);
+    require(!exists(pre, names[3]), fail);
+    require(exists(pre, kKC ".im4m"), fail);
+    require_noerr(compareFiles(sys, pre, kKC ".new"), fail);
+
+    printf("6. preboot copy modified\n");
+    sleep(1);
+    require_noerr(writeFile(pre, names[0], 100000, 55), fail);
+    require_noerr(runSync(&context, sys, pre, &stats, 1, 3, 0), fail);
+    require_noerr(compareFiles(sys, pre, names[0]), fail);
+
+    printf("7. one block changed\n");
+    require_noerr(writeFile(sys, names[2], 2 << 20, 2), fail);
+    require_noerr(runSync(&context, sys, pre, &stats, 1, 3, 0), fail);
+    sleep(1);
+    snprintf(cmd, sizeof(cmd), "%s/%s", sys, names[2]);
+    fd = open(cmd, O_WRONLY);
+    require(fd >= 0 && pwrite(fd, "x", 1, 1 << 20) == 1, fail);
+    close(fd);
+    require_noerr(runSync(&context, sys, pre, &stats, 1, 3, 0), fail);
+    require(stats.patched == 1 && stats.bytesCopied == kBLDeltaBlockSize, fail);
+    require_noerr(compareFiles(sys, pre, names[2]), fail);
+
+    if(mib > 0) {
+        snprintf(cmd, sizeof(cmd), "rm -rf '%s'", pre);
+        require_noerr(system(cmd), fail);
+        for(i = 0; i < 4; i++) require_noerr(writeFile(sys, names[i], mib << 20, i), fail);
+
+        start = now();
+        require_noerr(BLSyncKernelCollections(&context, sys, pre, 4, &stats), fail);
+        full = now() - start;
+        start = now();
+        require_noerr(BLSyncKernelCollections(&context, sys, pre, 4, &stats), fail);
+        noop = now() - start;
+        require(stats.copied == 0, fail);
+        printf("4 x %zu MiB: full copy %.1f ms, resync %.3f ms\n", mib, full * 1e3, noop * 1e3);
+    }
+
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", root);
+    system(cmd);
+    printf("Success\n");
+    return 0;
+
+fail:
+    printf("Failure (scratch directory %s left behind)\n", root);
+    return 1;
+}
@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ * BLLoadFile test. Loads a small file, an empty file and a large one and
+ * checks the contents, then benchmarks loading a large payload and
+ * writing it to another file (what BLCreateFileWithOptions does with it)
+ * against reading it into a heap buffer first. Each run is in its own
+ * process so the peak RSS reported is its own; the footprint is the
+ * anonymous memory held while the payload is loaded, which leaves out
+ * clean file-backed pages the system can drop.
+ *
+ *   ./build/testloadfile [scratch dir] [MiB]
+ */
+
+#define DEBUG 1
+
+#include <libc.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
+#include <bless.h>
+#include <bless_private.h>
+#include <AssertMacros.h>
+
+static int testlog(void *refcon, int level, const char *string) {
+    if(level & kBLLogLevelError) fputs(string, stderr);
+    return 0;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long maxrssKB(void) {
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+    return ru.ru_maxrss / 1024;
+#else
+    return ru.ru_maxrss;
+#endif
+}
+
+static long footprintKB(void) {
+#ifdef __APPLE__
+    task_vm_info_data_t info;
+    mach_msg_type_number_t count = TASK_VM_INFO_COUNT;
+
+    if(task_info(mach_task_self(), TASK_VM_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) return 0;
+    return (long)(info.phys_footprint / 1024);
+#else
+    FILE *f = fopen("/proc/self/status", "r");
+    char line[128];
+    long kb = 0;
+
+    if(!f) return 0;
+    while(fgets(line, sizeof(line), f)) {
+        if(sscanf(line, "RssAnon: %ld", &kb) == 1) break;
+    }
+    fclose(f);
+    return kb;
+#endif
+}
+
+static int writeFile(const char *path, const char *data, size_t size) {
+    int fd, ret = 1;
+
+    fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if(fd >= 0) {
+        ret = write(fd, data, size) == (ssize_t)size ? 0 : 1;
+        close(fd);
+    }
+    return ret;
+}
+
+static int checkLoad(BLContextPtr context, const char *path, const char *data, size_t size) {
+    CFDataRef loaded = NULL;
+    int ret = 1;
+
+    if(writeFile(path, data, size)) return 1;
+    if(BLLoadFile(context, path, 0, &loaded) || !loaded) return 1;
+    if((size_t)CFDataGetLength(loaded) == size && (size == 0 || memcmp(CFDataGetBytePtr(loaded), data, size) == 0)) {
+        ret = 0;
+    }
+    CFRelease(loaded);
+    return ret;
+}
+
+// Load src and write it to dst, the BLLoadFile way or through a heap buffer
+static int copyPayload(BLContextPtr context, const char *src, const char *dst, bool heap, long *heldKB) {
+    const void *bytes;
+    size_t size;
+    CFDataRef loaded = NULL;
+    char *buffer = NULL;
+    struct stat sb;
+    int fd, ret = 1;
+
+    if(heap) {
+        fd = open(src, O_RDONLY);
+        if(fd < 0 || fstat(fd, &sb) < 0) return 1;
+        size = (size_t)sb.st_size;
+        buffer = malloc(size);
+        if(!buffer || read(fd, buffer, size) != (ssize_t)size) return 1;
+        close(fd);
+        bytes = buffer;
+    } else {
+        if(BLLoadFile(context, src, 0, &loaded)) return 1;
+        bytes = CFDataGetBytePtr(loaded);
+        size = (size_t)CFDataGetLength(loaded);
+    }
+    fd = open(dst, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if(fd >= 0) {
+        ret = write(fd, bytes, size) == (ssize_t)size ? 0 : 1;
+        close(fd);
+    }
+    *heldKB = footprintKB();
+    if(loaded) CFRelease(loaded);
+    free(buffer);
+    return ret;
+}
+
+static int benchmark(BLContextPtr context, const char *src, const char *dst, bool heap) {
+    pid_t pid;
+    int status;
+
+    fflush(stdout);
+    pid = fork();
+    if(pid == 0) {
+        long before = maxrssKB(), footprint = footprintKB(), held = 0;
+        double start = now();
+        int ret = copyPayload(context, src, dst, heap, &held);
+        double elapsed = now() - start;
+
+        printf("  %-10s %8.1f ms, peak RSS +%ld KB, footprint +%ld KB\n", heap ? "heap" : "BLLoadFile",
+               elapsed * 1e3, maxrssKB() - before, held - footprint);
+        fflush(stdout);
+        _exit(ret);
+    }
+    if(pid < 0 || waitpid(pid, &status, 0) != pid) return 1;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+int main(int argc, char *argv[]) {
+    BLContext   context = { kBLContextVersion1, testlog, NULL, kBLLogLevelError };
+    const char  *scratch = argc > 1 ? argv[1] : "/tmp";
+    size_t      mib = argc > 2 ? strtoul(argv[2], NULL, 0) : 100;
+    size_t      size = 3 << 20, i;
+    char        root[MAXPATHLEN], a[MAXPATHLEN + 8], b[MAXPATHLEN + 8], cmd[MAXPATHLEN + 16];
+    char        *data = NULL;
+    CFDataRef   loaded = NULL;
+
+    snprintf(root, sizeof(root), "%s/testloadfile.XXXXXX", scratch);
+    require(mkdtemp(root) != NULL, fail);
+    snprintf(a, sizeof(a), "%s/a", root);
+    snprintf(b, sizeof(b), "%s/b", root);
+
+    data = malloc(size);
+    require(data != NULL, fail);
+    for(i = 0; i < size; i++) data[i] = (char)((i * 131) >> 5);
+
+    printf("1. small file\n");
+    require_noerr(checkLoad(&context, a, data, 100), fail);
+    printf("2. empty file\n");
+    require_noerr(checkLoad(&context, a, data, 0), fail);
+    printf("3. large file\n");
+    require_noerr(checkLoad(&context, a, data, size), fail);
+    printf("4. missing file\n");
+    require(BLLoadFile(&context, b, 0, &loaded) != 0 && loaded == NULL, fail);
+    free(data);
+    data = NULL;
+
+    if(mib > 0) {
+        data = malloc(mib << 20);
+        require(data != NULL, fail);
+        for(i = 0; i < mib << 20; i++) data[i] = (char)((i * 131) >> 5);
+        require_noerr(writeFile(a, data, mib << 20), fail);
+        free(data);
+        data = NULL;
+
+        printf("%zu MiB payload:\n", mib);
+        require_noerr(benchmark(&context, a, b, true), fail);
+        require_noerr(benchmark(&context, a, b, false), fail);
+    }
+
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", root);
+    system(cmd);
+    printf("Success\n");
+    return 0;
+
+fail:
+    free(data);
+    printf("Failure (scratch directory %s left behind)\n", root);
+    return 1;
+}
@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ * Mount lease test. Leases volumes and snapshots through a mounter that
+ * only makes directories and writes them into a mountinfo file, so it
+ * runs anywhere. Checks that nested and repeated leases mount once,
+ * that read-only leases are updated in place when read-write is asked
+ * for, that mounts bless didn't make are never unmounted, and that
+ * whatever is kept mounted goes at teardown. Then replays the mounts of
+ * a folder-mode bless with a verified root snapshot and prints the
+ * counts with and without leases being kept.
+ *
+ *   ./build/testmountlease [scratch dir]
+ */
+
+#define DEBUG 1
+
+#include <libc.h>
+#include <stdint.h>
+#include <bless.h>
+#include <bless_private.h>
+#include <AssertMacros.h>
+
+static int testlog(void *refcon, int level, const char *string) {
+    if(level & kBLLogLevelError) fputs(string, stderr);
+    return 0;
+}
+
+static const char *baseTable =
+    "21 1 0:20 / / rw - apfs /dev/disk1s1s1 ro\n"
+    "22 21 0:21 / /System/Volumes/Data rw - apfs /dev/disk1s5 rw\n"
+    "23 21 0:22 / /private/tmp/snap rw - apfs com.apple.os.update-1@/dev/disk1s1 ro\n";
+
+typedef struct {
+    const char  *root;
+    char        path[MAXPATHLEN];       // the mountinfo file
+    char        lines[16][2 * MAXPATHLEN];
+    int         count;
+    int         mounts, updates, unmounts;
+    bool        readOnly;               // of the last mount or update
+} FakeMounter;
+
+static int writeTable(FakeMounter *m) {
+    char tmp[MAXPATHLEN + 8];
+    FILE *f;
+    int i;
+
+    snprintf(tmp, sizeof(tmp), "%s.new", m->path);
+    f = fopen(tmp, "w");
+    if(!f) return 1;
+    fputs(baseTable, f);
+    for(i = 0; i < m->count; i++) fputs(m->lines[i], f);
+    if(fclose(f) != 0) return 1;
+    return rename(tmp, m->path) == 0 ? 0 : 1;
+}
+
+static int fakeMount(BLContextPtr context, void *refcon, const char *bsdName, const char *snapName, bool readOnly,
+                     char *mntPoint, int mntPtStrSize) {
+    FakeMounter *m = refcon;
+    char device[MAXPATHLEN];
+
+    snprintf(mntPoint, mntPtStrSize, "%s/bless.XXXXXX", m->root);
+    if(!mkdtemp(mntPoint)) return 3;
+    if(snapName) {
+        snprintf(device, sizeof(device), "%s@/dev/%s", snapName, bsdName);
+    } else {
+        snprintf(device, sizeof(device), "/dev/%s", bsdName);
+    }
+    snprintf(m->lines[m->count++], sizeof(m->lines[0]), "%d 21 1:%d / %s rw - apfs %s %s\n",
+             100 + m->mounts, m->mounts, mntPoint, device, readOnly ? "ro" : "rw");
+    m->mounts++;
+    m->readOnly = readOnly;
+    BLMountTableInvalidate(context);
+    return writeTable(m);
+}
+
+static int fakeUpdate(BLContextPtr context, void *refcon, const char *mntPoint, bool readOnly) {
+    FakeMounter *m = refcon;
+
+    m->updates++;
+    m->readOnly = readOnly;
+    return 0;
+}
+
+static int fakeUnmount(BLContextPtr context, void *refcon, const char *mntPoint) {
+    FakeMounter *m = refcon;
+    char match[MAXPATHLEN + 4];
+    int i;
+
+    snprintf(match, sizeof(match), " %s ", mntPoint);
+    for(i = 0; i < m->count; i++) {
+        if(strstr(m->lines[i], match)) break;
+    }
+    if(i == m->count) {
+        fprintf(stderr, "%s isn't mounted\n", mntPoint);
+        return 3;
+    }
+    memmove(m->lines[i], m->lines[i + 1], (m->count - i - 1) * sizeof(m->lines[0]));
+    m->count--;
+    m->unmounts++;
+    rmdir(mntPoint);
+    BLMountTableInvalidate(context);
+    return writeTable(m);
+}
+
+static const BLMountLeaseOps fakeOps = { fakeMount, fakeUpdate, fakeUnmount };
+
+static int expectCounts(BLContextPtr context, FakeMounter *m, uint32_t mounts, uint32_t unmounts, uint32_t reused) {
+    uint32_t a, b, c;
+
+    BLMountLeasesGetStatistics(context->mountleases, &a, &b, &c);
+    if(a != mounts || b != unmounts || c != reused) {
+        fprintf(stderr, "%u mounts, %u unmounts, %u reused; expected %u, %u, %u\n", a, b, c, mounts, unmounts, reused);
+        return 1;
+    }
+    if(m->mounts + m->updates != (int)mounts || m->unmounts != (int)unmounts) {
+        fprintf(stderr, "mounter saw %d mounts, %d updates, %d unmounts\n", m->mounts, m->updates, m->unmounts);
+        return 1;
+    }
+    return 0;
+}
+
+static int acquire(BLContextPtr context, const char *bsd, const char *snap, bool readOnly, char *mnt, int len) {
+    bool mustRelease = false;
+
+    if(BLAcquireMount(context, bsd, snap, readOnly, mnt, len, &mustRelease)) return 1;
+    return mustRelease ? 0 : 1;
+}
+
+static int newLeases(BLContextPtr context, FakeMounter *m, uint32_t options) {
+    memset(m->lines, 0, sizeof(m->lines));
+    m->count = m->mounts = m->updates = m->unmounts = 0;
+    if(writeTable(m)) return 1;
+    context->mountleases = BLMountLeasesCreateWithOps(options, &fakeOps, m);
+    return context->mountleases ? 0 : 1;
+}
+
+// BLIsVolumeARV, BlessPrebootVolume and BLSetEFIBootDevice, one after another
+static int replayFolderBless(BLContextPtr context) {
+    char preboot[MAXPATHLEN], system[MAXPATHLEN], snap[MAXPATHLEN];
+
+    if(acquire(context, "disk1s2", NULL, true, preboot, sizeof(preboot))) return 1;
+    if(BLReleaseMount(context, preboot)) return 1;
+
+    if(acquire(context, "disk1s2", NULL, false, preboot, sizeof(preboot))) return 1;
+    if(acquire(context, "disk1s6", NULL, false, system, sizeof(system))) return 1;
+    if(acquire(context, "disk1s6", "com.apple.os.update-2", true, snap, sizeof(snap))) return 1;
+    if(BLReleaseMount(context, preboot)) return 1;
+    if(BLReleaseMount(context, snap)) return 1;
+    if(BLReleaseMount(context, system)) return 1;
+
+    if(acquire(context, "disk1s2", NULL, true, preboot, sizeof(preboot))) return 1;
+    if(BLReleaseMount(context, preboot)) return 1;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    BLContext   context = { kBLContextVersion7, testlog, NULL, kBLLogLevelError, NULL, NULL, NULL, NULL, NULL, NULL };
+    const char  *scratch = argc > 1 ? argv[1] : "/tmp";
+    FakeMounter m;
+    char        root[MAXPATHLEN], path[MAXPATHLEN], other[MAXPATHLEN], sub[MAXPATHLEN + 40];
+    uint32_t    mounts, unmounts;
+
+    memset(&m, 0, sizeof(m));
+    snprintf(root, sizeof(root), "%s/testmountlease.XXXXXX", scratch);
+    require(mkdtemp(root) != NULL, fail);
+    m.root = root;
+    snprintf(m.path, sizeof(m.path), "%s/mountinfo", root);
+    require_noerr(writeTable(&m), fail);
+    context.mounttable = BLMountTableCreateWithMountInfo(m.path);
+    require(context.mounttable != NULL, fail);
+
+    printf("1. nested leases mount once\n");
+    require_noerr(newLeases(&context, &m, 0), fail);
+    require_noerr(acquire(&context, "disk1s2", NULL, false, path, sizeof(path)), fail);
+    require_noerr(acquire(&context, "disk1s2", NULL, true, other, sizeof(other)), fail);
+    require(strcmp(path, other) == 0, fail);
+    require_noerr(expectCounts(&context, &m, 1, 0, 1), fail);
+    require_noerr(BLReleaseMount(&context, other), fail);
+    require_noerr(expectCounts(&context, &m, 1, 0, 1), fail);
+    require_noerr(BLReleaseMount(&context, path), fail);
+    require_noerr(expectCounts(&context, &m, 1, 1, 1), fail);
+    require(access(path, F_OK) != 0, fail);
+
+    printf("2. a path inside the mount releases it\n");
+    require_noerr(acquire(&context, "disk1s3", NULL, true, path, sizeof(path)), fail);
+    snprintf(sub, sizeof(sub), "%s/0A1B2C3D-0000-4000-8000-000000000101", path);
+    require_noerr(BLReleaseMount(&context, sub), fail);
+    require_noerr(expectCounts(&context, &m, 2, 2, 1), fail);
+    require_noerr(BLMountLeasesRelease(&context, context.mountleases), fail);
+
+    printf("3. read-only updated to read-write in place\n");
+    require_noerr(newLeases(&context, &m, 0), fail);
+    require_noerr(acquire(&context, "disk1s2", NULL, true, path, sizeof(path)), fail);
+    require(m.readOnly, fail);
+    require_noerr(acquire(&context, "disk1s2", NULL, false, other, sizeof(other)), fail);
+    require(strcmp(path, other) == 0 && !m.readOnly && m.updates == 1, fail);
+    require_noerr(acquire(&context, "disk1s2", NULL, true, other, sizeof(other)), fail);
+    require(m.updates == 1, fail);
+    require_noerr(expectCounts(&context, &m, 2, 0, 1), fail);
+
+    printf("4. teardown unmounts what is still leased\n");
+    require_noerr(BLMountLeasesRelease(&context, context.mountleases), fail);
+    require(m.unmounts == 1 && m.count == 0, fail);
+
+    printf("5. mounts made elsewhere are used and left alone\n");
+    require_noerr(newLeases(&context, &m, 0), fail);
+    require_noerr(acquire(&context, "disk1s5", NULL, false, path, sizeof(path)), fail);
+    require(strcmp(path, "/System/Volumes/Data") == 0, fail);
+    require_noerr(acquire(&context, "disk1s1s1", NULL, true, path, sizeof(path)), fail);
+    require(strcmp(path, "/") == 0, fail);
+    require_noerr(acquire(&context, "disk1s1", "com.apple.os.update-1", true, other, sizeof(other)), fail);
+    require(strcmp(other, "/private/tmp/snap") == 0, fail);
+    require_noerr(BLReleaseMount(&context, "/System/Volumes/Data/Users"), fail);
+    require_noerr(BLReleaseMount(&context, path), fail);
+    require_noerr(BLReleaseMount(&context, other), fail);
+    require_noerr(expectCounts(&context, &m, 0, 0, 3), fail);
+
+    printf("6. snapshots are leased apart from their volume\n");
+    require_noerr(acquire(&context, "disk1s6", "com.apple.os.update-2", false, path, sizeof(path)), fail);
+    require(m.readOnly, fail);
+    require_noerr(acquire(&context, "disk1s6", NULL, false, other, sizeof(other)), fail);
+    require(strcmp(path, other) != 0, fail);
+    require_noerr(BLReleaseMount(&context, path), fail);
+    require_noerr(BLReleaseMount(&context, other), fail);
+    require_noerr(expectCounts(&context, &m, 2, 2, 3), fail);
+    require_noerr(BLMountLeasesRelease(&context, context.mountleases), fail);
+
+    printf("7. kept mounted until teardown\n");
+    require_noerr(newLeases(&context, &m, kBLMountLeasesKeepMounted), fail);
+    require_noerr(acquire(&context, "disk1s2", NULL, true, path, sizeof(path)), fail);
+    require_noerr(BLReleaseMount(&context, path), fail);
+    require_noerr(acquire(&context, "disk1s2", NULL, true, other, sizeof(other)), fail);
+    require(strcmp(path, other) == 0, fail);
+    require_noerr(BLReleaseMount(&context, other), fail);
+    require_noerr(expectCounts(&context, &m, 1, 0, 1), fail);
+    require_noerr(BLMountLeasesRelease(&context, context.mountleases), fail);
+    require(m.unmounts == 1 && m.count == 0, fail);
+
+    // what a folder-mode bless of a sealed system does
+    require_noerr(newLeases(&context, &m, 0), fail);
+    require_noerr(replayFolderBless(&context), fail);
+    BLMountLeasesGetStatistics(context.mountleases, &mounts, &unmounts, NULL);
+    require_noerr(BLMountLeasesRelease(&context, context.mountleases), fail);
+    printf("folder bless: %u mounts and %u unmounts releasing at once, ", mounts, unmounts);
+    require_noerr(newLeases(&context, &m, kBLMountLeasesKeepMounted), fail);
+    require_noerr(replayFolderBless(&context), fail);
+    require_noerr(BLMountLeasesRelease(&context, context.mountleases), fail);
+    printf("%d mounts and %d unmounts kept until teardown\n", m.mounts + m.updates, m.unmounts);
+    require(m.count == 0, fail);
+
+    BLMountTableRelease(context.mounttable);
+    snprintf(path, sizeof(path), "rm -rf '%s'", root);
+    system(path);
+    printf("Success\n");
+    return 0;
+
+fail:
+    printf("Failure (scratch directory %s left behind)\n", root);
+    return 1;
+}
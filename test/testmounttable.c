@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ * Mount table test. Looks devices and mount points up in a table read
+ * from a mountinfo file, checks that it is only re-read after
+ * BLMountTableInvalidate() or when the file changes, and that a context
+ * without a table still gets answers. On Linux, when it may unshare its
+ * mount namespace, it also mounts and unmounts a tmpfs and checks the
+ * system table notices without being told. Then times lookups in a
+ * table of a few hundred mounts, cached and re-read every time.
+ *
+ *   ./build/testmounttable [scratch dir]
+ */
+
+#define DEBUG 1
+
+#include <libc.h>
+#include <stdint.h>
+#include <time.h>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/mount.h>
+#endif
+#include <bless.h>
+#include <bless_private.h>
+#include <AssertMacros.h>
+
+static int testlog(void *refcon, int level, const char *string) {
+    if(level & kBLLogLevelError) fputs(string, stderr);
+    return 0;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char *baseTable =
+    "21 1 0:20 / / rw,relatime shared:1 - apfs /dev/disk1s1s1 ro\n"
+    "22 21 0:21 / /System/Volumes/Data rw shared:2 master:1 - apfs /dev/disk1s2 rw\n"
+    "23 21 0:22 / /Volumes/My\\040Disk rw - hfs /dev/disk2s2 rw\n"
+    "24 21 0:23 / /Volumes/Again rw - hfs /dev/disk2s2 rw\n"
+    "25 21 0:24 / /private/tmp/snap rw - apfs com.apple.os.update-1@/dev/disk1s1 ro\n";
+
+// Write a mountinfo file under a new name and rename it into place
+static int writeTable(const char *path, const char *contents, const char *extra) {
+    char tmp[MAXPATHLEN + 8];
+    FILE *f;
+
+    snprintf(tmp, sizeof(tmp), "%s.new", path);
+    f = fopen(tmp, "w");
+    if(!f) return 1;
+    fputs(contents, f);
+    if(extra) fputs(extra, f);
+    if(fclose(f) != 0) return 1;
+    return rename(tmp, path) == 0 ? 0 : 1;
+}
+
+static int expectMount(BLContextPtr context, const char *device, const char *expected) {
+    char mountPoint[MAXPATHLEN];
+
+    if(BLGetMountPointForDevice(context, device, mountPoint, sizeof(mountPoint))) return 1;
+    if(strcmp(mountPoint, expected) != 0) {
+        fprintf(stderr, "%s is mounted at \"%s\", expected \"%s\"\n", device, mountPoint, expected);
+        return 1;
+    }
+    return 0;
+}
+
+static int expectDevice(BLContextPtr context, const char *mountPoint, const char *expected) {
+    char device[MAXPATHLEN];
+
+    if(BLGetDeviceForMountPoint(context, mountPoint, device, sizeof(device))) return 1;
+    if(strcmp(device, expected) != 0) {
+        fprintf(stderr, "%s is mounted from \"%s\", expected \"%s\"\n", mountPoint, device, expected);
+        return 1;
+    }
+    return 0;
+}
+
+static uint32_t snapshots(BLContextPtr context) {
+    uint32_t count = 0;
+
+    BLMountTableGetStatistics(context->mounttable, &count, NULL);
+    return count;
+}
+
+#ifdef __linux__
+// Mount and unmount a tmpfs in a private namespace and check the table keeps up
+static int liveMounts(BLContextPtr context, const char *root) {
+    char dir[MAXPATHLEN + 8];
+    uint32_t before;
+
+    if(unshare(CLONE_NEWNS) != 0 || mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL) != 0) {
+        printf("   skipped, can't unshare the mount namespace: %s\n", strerror(errno));
+        return 0;
+    }
+    snprintf(dir, sizeof(dir), "%s/mnt", root);
+    if(mkdir(dir, 0755) != 0) return 1;
+
+    context->mounttable = BLMountTableCreate();
+    if(!context->mounttable) return 1;
+    if(expectDevice(context, dir, "")) return 1;
+    if(expectDevice(context, dir, "")) return 1;
+    before = snapshots(context);
+    if(before != 1) return 1;
+
+    if(mount("testmounttable", dir, "tmpfs", 0, NULL) != 0) return 1;
+    if(expectDevice(context, dir, "testmounttable")) return 1;
+    if(expectMount(context, "testmounttable", dir)) return 1;
+    if(snapshots(context) != before + 1) return 1;
+
+    if(umount(dir) != 0) return 1;
+    if(expectDevice(context, dir, "")) return 1;
+    if(snapshots(context) != before + 2) return 1;
+
+    BLMountTableRelease(context->mounttable);
+    context->mounttable = NULL;
+    return 0;
+}
+#endif
+
+int main(int argc, char *argv[]) {
+    BLContext   context = { kBLContextVersion5, testlog, NULL, kBLLogLevelError, NULL, NULL, NULL, NULL };
+    BLContext   plain = { kBLContextVersion1, testlog, NULL, kBLLogLevelError };
+    const char  *scratch = argc > 1 ? argv[1] : "/tmp";
+    char        root[MAXPATHLEN], path[MAXPATHLEN + 16], device[MAXPATHLEN];
+    char        *big = NULL;
+    size_t      bigLen = 0;
+    double      start, cached, uncached;
+    int         i;
+
+    snprintf(root, sizeof(root), "%s/testmounttable.XXXXXX", scratch);
+    require(mkdtemp(root) != NULL, fail);
+    snprintf(path, sizeof(path), "%s/mountinfo", root);
+    require_noerr(writeTable(path, baseTable, NULL), fail);
+
+    context.mounttable = BLMountTableCreateWithMountInfo(path);
+    require(context.mounttable != NULL, fail);
+
+    printf("1. lookups\n");
+    require_noerr(expectMount(&context, "/dev/disk1s2", "/System/Volumes/Data"), fail);
+    require_noerr(expectMount(&context, "/dev/disk1s1s1", "/"), fail);
+    require_noerr(expectMount(&context, "/dev/disk9", ""), fail);
+    require_noerr(expectMount(&context, "com.apple.os.update-1@/dev/disk1s1", "/private/tmp/snap"), fail);
+    require_noerr(expectDevice(&context, "/Volumes/Again", "/dev/disk2s2"), fail);
+    require_noerr(expectDevice(&context, "/Volumes/None", ""), fail);
+    require(snapshots(&context) == 1, fail);
+
+    printf("2. escaped mount point, first of two mounts\n");
+    require_noerr(expectMount(&context, "/dev/disk2s2", "/Volumes/My Disk"), fail);
+    require_noerr(expectDevice(&context, "/Volumes/My Disk", "/dev/disk2s2"), fail);
+
+    printf("3. invalidated\n");
+    BLMountTableInvalidate(&context);
+    require_noerr(expectMount(&context, "/dev/disk1s2", "/System/Volumes/Data"), fail);
+    require(snapshots(&context) == 2, fail);
+    require_noerr(expectMount(&context, "/dev/disk1s2", "/System/Volumes/Data"), fail);
+    require(snapshots(&context) == 2, fail);
+
+    printf("4. mount table changed\n");
+    require_noerr(writeTable(path, baseTable, "26 21 0:25 / /Volumes/New rw - msdos /dev/disk3s1 rw\n"), fail);
+    require_noerr(expectMount(&context, "/dev/disk3s1", "/Volumes/New"), fail);
+    require(snapshots(&context) == 3, fail);
+    require_noerr(writeTable(path, baseTable, NULL), fail);
+    require_noerr(expectMount(&context, "/dev/disk3s1", ""), fail);
+    require(snapshots(&context) == 4, fail);
+
+    printf("5. no table\n");
+    require_noerr(BLGetDeviceForMountPoint(&plain, "/", device, sizeof(device)), fail);
+    require(device[0] != '\0', fail);
+    BLMountTableRelease(context.mounttable);
+    context.mounttable = NULL;
+
+#ifdef __linux__
+    printf("6. system mounts\n");
+    require_noerr(liveMounts(&context, root), fail);
+#endif
+
+    // a build host with a few hundred disk images attached
+    big = malloc(500 * 96);
+    require(big != NULL, fail);
+    for(i = 0; i < 500; i++) {
+        bigLen += snprintf(big + bigLen, 96, "%d 21 1:%d / /Volumes/Image%d rw - hfs /dev/disk%ds2 rw\n",
+                           100 + i, i, i, 10 + i);
+    }
+    require_noerr(writeTable(path, baseTable, big), fail);
+    context.mounttable = BLMountTableCreateWithMountInfo(path);
+    require(context.mounttable != NULL, fail);
+
+    start = now();
+    for(i = 0; i < 10000; i++) {
+        snprintf(device, sizeof(device), "/dev/disk%ds2", 10 + i % 500);
+        require_noerr(BLGetMountPointForDevice(&context, device, path, sizeof(path)), fail);
+    }
+    cached = now() - start;
+    start = now();
+    for(i = 0; i < 10000; i++) {
+        snprintf(device, sizeof(device), "/dev/disk%ds2", 10 + i % 500);
+        BLMountTableInvalidate(&context);
+        require_noerr(BLGetMountPointForDevice(&context, device, path, sizeof(path)), fail);
+    }
+    uncached = now() - start;
+    printf("10000 lookups in 505 mounts: %.2f ms cached, %.2f ms re-reading the table\n",
+           cached * 1e3, uncached * 1e3);
+    BLMountTableRelease(context.mounttable);
+    free(big);
+
+    snprintf(path, sizeof(path), "rm -rf '%s'", root);
+    system(path);
+    printf("Success\n");
+    return 0;
+
+fail:
+    free(big);
+    printf("Failure (scratch directory %s left behind)\n", root);
+    return 1;
+}
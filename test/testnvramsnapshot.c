@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ * NVRAM snapshot test. Loads a plist standing in for NVRAM, as
+ * BL_NVRAM_FILE does: strings, data read as strings (converted once),
+ * BootOrder read as UTF-16 in place, and unset variables. Then checks the
+ * NVRAM cache hands out the snapshot it holds rather than reading again,
+ * and times lookups like the ones --info makes.
+ *
+ *   ./build/testnvramsnapshot [-n lookups]
+ */
+
+#define DEBUG 1
+
+#include <libc.h>
+#include <stdint.h>
+#include <bless.h>
+#include <bless_private.h>
+#include <AssertMacros.h>
+
+#define kPlistPath      "/tmp/testnvramsnapshot.plist"
+#define kBootOrder      "8BE4DF61-93CA-11D2-AA0D-00E098032B8C:BootOrder"
+#define kBoot0080       "8BE4DF61-93CA-11D2-AA0D-00E098032B8C:Boot0080"
+
+static int testlog(void *refcon, int level, const char *string) {
+    if(level & kBLLogLevelError) fputs(string, stderr);
+    return 0;
+}
+
+static uint64_t monotonicNanos(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int writePlist(const char *path) {
+    const char *plist =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<!DOCTYPE plist PUBLIC \"-//Apple//DTD PLIST 1.0//EN\" \"http://www.apple.com/DTDs/PropertyList-1.0.dtd\">\n"
+        "<plist version=\"1.0\">\n"
+        "<dict>\n"
+        "  <key>boot-args</key><string>-v</string>\n"
+        "  <key>efi-boot-device</key><data>ZGV2aWNl</data>\n"          /* "device" */
+        "  <key>" kBootOrder "</key><data>gAABAA==</data>\n"           /* 0x0080, 0x0001 */
+        "  <key>" kBoot0080 "</key><data>AQAAAAQA</data>\n"
+        "</dict>\n"
+        "</plist>\n";
+    FILE *f = fopen(path, "w");
+
+    if (!f) return 1;
+    fputs(plist, f);
+    return fclose(f) ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    BLContext               context = { kBLContextVersion9, testlog, NULL, kBLLogLevelError };
+    struct BLNVRAMSnapshot  *snapshot = NULL, *shared = NULL, *again = NULL;
+    CFStringRef             string;
+    CFDataRef               data;
+    const uint16_t          *order;
+    size_t                  count;
+    uint32_t                lookups = 1000, i, misses = 0;
+    uint64_t                start;
+    int                     ch;
+
+    while ((ch = getopt(argc, argv, "n:")) != -1) {
+        switch (ch) {
+            case 'n':
+                lookups = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n lookups]\n", getprogname());
+                return 1;
+        }
+    }
+    if (lookups < 1) lookups = 1;
+
+    require_noerr(writePlist(kPlistPath), fail);
+
+    printf("1. Typed reads from %s\n", kPlistPath);
+    require_noerr(BLNVRAMSnapshotCreateWithFile(&context, kPlistPath, &snapshot), fail);
+    string = BLNVRAMSnapshotGetString(&context, snapshot, CFSTR("boot-args"));
+    require(string && CFEqual(string, CFSTR("-v")), fail);
+    string = BLNVRAMSnapshotGetString(&context, snapshot, CFSTR("efi-boot-device"));
+    require(string && CFEqual(string, CFSTR("device")), fail);
+    require(BLNVRAMSnapshotGetString(&context, snapshot, CFSTR("efi-boot-device")) == string, fail);
+    order = BLNVRAMSnapshotGetUTF16(snapshot, CFSTR(kBootOrder), &count);
+    require(order && count == 2, fail);
+    require(CFSwapInt16LittleToHost(order[0]) == 0x0080 && CFSwapInt16LittleToHost(order[1]) == 0x0001, fail);
+    data = BLNVRAMSnapshotGetData(snapshot, CFSTR(kBoot0080));
+    require(data && CFDataGetLength(data) == 6, fail);
+    require(BLNVRAMSnapshotGetData(snapshot, CFSTR("boot-args")) == NULL, fail);
+
+    printf("2. Unset variables\n");
+    require(BLNVRAMSnapshotGetValue(snapshot, CFSTR("efi-boot-next")) == NULL, fail);
+    require(BLNVRAMSnapshotGetString(&context, snapshot, CFSTR("efi-boot-next")) == NULL, fail);
+    require(BLNVRAMSnapshotGetUTF16(snapshot, CFSTR("efi-boot-next"), &count) == NULL && count == 0, fail);
+    BLNVRAMSnapshotRelease(snapshot);
+    snapshot = NULL;
+
+    printf("3. The cache shares its snapshot\n");
+    require_noerr(BLNVRAMCacheCreateWithFile(&context, kPlistPath, &context.nvramcache), fail);
+    require_noerr(BLCopyNVRAMSnapshot(&context, &shared), fail);
+    require_noerr(BLCopyNVRAMSnapshot(&context, &again), fail);
+    require(shared == again, fail);
+    BLNVRAMCacheGetStatistics(context.nvramcache, NULL, &misses, NULL);
+    require(misses == 1, fail);
+    BLNVRAMSnapshotRelease(again);
+    again = NULL;
+
+    printf("4. %u lookups of what --info reads\n", lookups);
+    start = monotonicNanos();
+    for (i = 0; i < lookups; i++) {
+        require(BLNVRAMSnapshotGetString(&context, shared, CFSTR("efi-boot-device")) != NULL, fail);
+        require(BLNVRAMSnapshotGetUTF16(shared, CFSTR(kBootOrder), &count) != NULL, fail);
+        require(BLNVRAMSnapshotGetData(shared, CFSTR(kBoot0080)) != NULL, fail);
+    }
+    printf("   %.1f ns each\n", (double)(monotonicNanos() - start) / lookups);
+
+    BLNVRAMSnapshotRelease(shared);
+    BLNVRAMCacheRelease(context.nvramcache);
+    unlink(kPlistPath);
+    printf("Success\n");
+    return 0;
+
+fail:
+    BLNVRAMSnapshotRelease(snapshot);
+    BLNVRAMSnapshotRelease(shared);
+    BLNVRAMSnapshotRelease(again);
+    BLNVRAMCacheRelease(context.nvramcache);
+    unlink(kPlistPath);
+    printf("Failure\n");
+    return 1;
+}
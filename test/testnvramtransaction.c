@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ * NVRAM transaction test. Runs against a plist standing in for NVRAM, as
+ * BL_NVRAM_FILE does, so it never touches the firmware: a transaction
+ * writes only the variables that change, one that changes nothing leaves
+ * the file alone, an aborted one writes nothing, forwarding sees what was
+ * staged before it, and setit() goes through the same path. Then times
+ * transactions that find nothing to write.
+ *
+ *   ./build/testnvramtransaction [-n transactions]
+ */
+
+#define DEBUG 1
+
+#include <libc.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <IOKit/IOKitKeys.h>
+#include <bless.h>
+#include <bless_private.h>
+#include <AssertMacros.h>
+
+#define kPlistPath      "/tmp/testnvramtransaction.plist"
+
+static int testlog(void *refcon, int level, const char *string) {
+    if(level & kBLLogLevelError) fputs(string, stderr);
+    return 0;
+}
+
+static uint64_t monotonicNanos(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int writePlist(const char *path) {
+    const char *plist =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<!DOCTYPE plist PUBLIC \"-//Apple//DTD PLIST 1.0//EN\" \"http://www.apple.com/DTDs/PropertyList-1.0.dtd\">\n"
+        "<plist version=\"1.0\">\n"
+        "<dict>\n"
+        "  <key>boot-args</key><string>-v</string>\n"
+        "  <key>efi-boot-device</key><string>device</string>\n"
+        "  <key>efi-boot-file</key><string>kernel</string>\n"
+        "  <key>efi-legacy-drive-hint-data</key><data>AQID</data>\n"
+        "</dict>\n"
+        "</plist>\n";
+    FILE *f = fopen(path, "w");
+
+    if (!f) return 1;
+    fputs(plist, f);
+    return fclose(f) ? 1 : 0;
+}
+
+static bool hasString(BLContextPtr context, CFStringRef name, CFStringRef expected) {
+    CFTypeRef   value = NULL;
+    bool        same;
+
+    if (BLCopyNVRAMVariable(context, name, &value)) return false;
+    if (!value || !expected) {
+        same = (value == NULL && expected == NULL);
+    } else {
+        same = CFEqual(value, expected);
+    }
+    if (value) CFRelease(value);
+    return same;
+}
+
+int main(int argc, char *argv[]) {
+    BLContext               context = { kBLContextVersion9, testlog, NULL, kBLLogLevelError };
+    struct BLNVRAMTransaction *txn = NULL;
+    BLNVRAMTransactionStats stats;
+    CFTypeRef               value = NULL, forwarded = NULL;
+    struct stat             before, after;
+    uint32_t                count = 1000, i;
+    uint64_t                start;
+    int                     ch;
+
+    while ((ch = getopt(argc, argv, "n:")) != -1) {
+        switch (ch) {
+            case 'n':
+                count = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n transactions]\n", getprogname());
+                return 1;
+        }
+    }
+    if (count < 1) count = 1;
+
+    require_noerr(writePlist(kPlistPath), fail);
+    require_noerr(BLNVRAMCacheCreateWithFile(&context, kPlistPath, &context.nvramcache), fail);
+
+    printf("1. Only changed variables are written, and the boot device always\n");
+    require_noerr(BLNVRAMTransactionBegin(&context, &txn), fail);
+    require_noerr(BLNVRAMTransactionSetValue(txn, CFSTR("efi-boot-device"), CFSTR("device")), fail);
+    require_noerr(BLNVRAMTransactionDeleteValue(txn, CFSTR("efi-boot-mkext")), fail);
+    require_noerr(BLNVRAMTransactionDeleteValue(txn, CFSTR("efi-boot-file")), fail);
+    require_noerr(BLNVRAMTransactionSetValue(txn, CFSTR("efi-boot-next"), CFSTR("next")), fail);
+    require_noerr(BLNVRAMTransactionCopyValue(txn, CFSTR("efi-boot-next"), &value), fail);
+    require(value && CFEqual(value, CFSTR("next")), fail);
+    CFRelease(value);
+    value = NULL;
+    require_noerr(BLNVRAMTransactionCopyValue(txn, CFSTR("efi-boot-file"), &value), fail);
+    require(value == NULL, fail);
+    require_noerr(BLNVRAMTransactionCommit(txn, &stats), fail);
+    txn = NULL;
+    require(stats.written == 2 && stats.deleted == 1 && stats.unchanged == 1 && stats.bytesWritten == 10, fail);
+    require(hasString(&context, CFSTR("efi-boot-next"), CFSTR("next")), fail);
+    require(hasString(&context, CFSTR("efi-boot-file"), NULL), fail);
+    require(hasString(&context, CFSTR("efi-boot-device"), CFSTR("device")), fail);
+
+    printf("2. Nothing to write leaves the file alone\n");
+    require(stat(kPlistPath, &before) == 0, fail);
+    require_noerr(BLNVRAMTransactionBegin(&context, &txn), fail);
+    require_noerr(BLNVRAMTransactionSetValue(txn, CFSTR("boot-args"), CFSTR("-v")), fail);
+    require_noerr(BLNVRAMTransactionDeleteValue(txn, CFSTR("efi-boot-file")), fail);
+    require_noerr(BLNVRAMTransactionCommit(txn, &stats), fail);
+    txn = NULL;
+    require(stats.written == 0 && stats.deleted == 0 && stats.unchanged == 2, fail);
+    require(stat(kPlistPath, &after) == 0 && after.st_ino == before.st_ino, fail);
+
+    printf("3. Aborting writes nothing\n");
+    require_noerr(BLNVRAMTransactionBegin(&context, &txn), fail);
+    require_noerr(BLNVRAMTransactionSetValue(txn, CFSTR("boot-args"), CFSTR("-s")), fail);
+    BLNVRAMTransactionAbort(txn);
+    txn = NULL;
+    require(hasString(&context, CFSTR("boot-args"), CFSTR("-v")), fail);
+
+    printf("4. Forwarding a variable\n");
+    require_noerr(BLNVRAMTransactionBegin(&context, &txn), fail);
+    require_noerr(BLNVRAMTransactionForward(txn, CFSTR("efi-legacy-drive-hint-data"), CFSTR("BootCampHD")), fail);
+    require(BLNVRAMTransactionForward(txn, CFSTR("no-such-variable"), CFSTR("BootCampHD")) != 0, fail);
+    require_noerr(BLNVRAMTransactionCommit(txn, &stats), fail);
+    txn = NULL;
+    require(stats.written == 1 && stats.bytesWritten == 3, fail);
+    require_noerr(BLCopyNVRAMVariable(&context, CFSTR("efi-legacy-drive-hint-data"), &value), fail);
+    require_noerr(BLCopyNVRAMVariable(&context, CFSTR("BootCampHD"), &forwarded), fail);
+    require(value && forwarded && CFEqual(value, forwarded), fail);
+    CFRelease(value);
+    CFRelease(forwarded);
+    value = forwarded = NULL;
+
+    printf("5. setit() sets and deletes through a transaction\n");
+    require_noerr(setit(&context, 0, "efi-boot-next", CFSTR("again")), fail);
+    require(hasString(&context, CFSTR("efi-boot-next"), CFSTR("again")), fail);
+    require_noerr(setit(&context, 0, kIONVRAMDeletePropertyKey, CFSTR("efi-boot-next")), fail);
+    require(hasString(&context, CFSTR("efi-boot-next"), NULL), fail);
+
+    printf("6. %u transactions with nothing to write\n", count);
+    start = monotonicNanos();
+    for (i = 0; i < count; i++) {
+        require_noerr(BLNVRAMTransactionBegin(&context, &txn), fail);
+        require_noerr(BLNVRAMTransactionSetValue(txn, CFSTR("boot-args"), CFSTR("-v")), fail);
+        require_noerr(BLNVRAMTransactionCommit(txn, &stats), fail);
+        txn = NULL;
+        require(stats.written == 0, fail);
+    }
+    printf("   %.1f us each\n", (monotonicNanos() - start) / 1e3 / count);
+
+    BLNVRAMCacheRelease(context.nvramcache);
+    unlink(kPlistPath);
+    printf("Success\n");
+    return 0;
+
+fail:
+    if (value) CFRelease(value);
+    if (forwarded) CFRelease(forwarded);
+    BLNVRAMTransactionAbort(txn);
+    BLNVRAMCacheRelease(context.nvramcache);
+    unlink(kPlistPath);
+    printf("Failure\n");
+    return 1;
+}
@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ * Stress libbless from several threads, each with its own context, over
+ * the paths that need no disks: El Torito catalog parsing, boot-args
+ * filtering and building the El Torito device path XML. Every thread
+ * also bumps a shared counter under the (nesting) NVRAM lock. Results
+ * are checked against answers worked out on the main thread first.
+ *
+ * Build it with -fsanitize=thread to have races reported:
+ *
+ *   ./build/testreentrant                  # 8 threads, 2000 iterations each
+ *   ./build/testreentrant -t 16 -n 500
+ */
+
+#define DEBUG 1
+
+#include <libc.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <bless.h>
+#include <bless_private.h>
+#include <AssertMacros.h>
+
+#define kSectorSize         2048
+#define kCatalogSector      32
+#define kImagePath          "/tmp/testreentrant.iso"
+#define kMaxThreads         64
+
+static const char *bootArgs[] = {
+    "",
+    "-v",
+    "rd=disk0s2 -v debug=0x144",
+    "boot-uuid=01234567-89AB-CDEF-0123-456789ABCDEF rp=nfs:1.2.3.4:/foo:bar.dmg",
+    "-s rd=md0 keepsyms=1 boot-uuid= rdx=1",
+};
+#define kBootArgsCount (sizeof(bootArgs) / sizeof(bootArgs[0]))
+
+struct expected {
+    uint32_t    entries;
+    uint32_t    offset;
+    uint32_t    size;
+    CFStringRef xml;
+    char        xmlDesc[4096];
+    char        bootArgs[kBootArgsCount][1024];
+    bool        bootArgsChanged[kBootArgsCount];
+};
+
+struct worker {
+    pthread_t               thread;
+    const struct expected   *expected;
+    uint32_t                iterations;
+    uint32_t                logLines;
+    int                     failed;
+};
+
+static uint32_t lockedCounter;
+
+static int testlog(void *refcon, int level, const char *string) {
+    uint32_t *lines = refcon;
+
+    // Each thread counts into its own refcon; verbose output is only counted
+    if (lines) (*lines)++;
+    if (level & kBLLogLevelError) fputs(string, stderr);
+    return 0;
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: %s [-t threads] [-n iterations]\n", getprogname());
+    exit(1);
+}
+
+static void putEntry(uint8_t *catalog, uint32_t *index, const uint8_t bytes[32]) {
+    memcpy(catalog + (*index)*32, bytes, 32);
+    (*index)++;
+}
+
+static void putSection(uint8_t *catalog, uint32_t *index, uint8_t bootable, uint32_t rba) {
+    uint8_t e[32] = { bootable, 0, 0, 0, 0, 0, 4, 0,
+	(uint8_t)rba, (uint8_t)(rba >> 8), (uint8_t)(rba >> 16), (uint8_t)(rba >> 24) };
+    putEntry(catalog, index, e);
+}
+
+/*
+ * A cut-down version of the testeltorito image: a default entry, one
+ * non-EFI header and an EFI header whose second section is bootable.
+ */
+static int writeImage(const char *path) {
+    size_t      imageSize = (kCatalogSector + 2) * kSectorSize;
+    uint8_t     *image = calloc(1, imageSize);
+    uint8_t     *catalog = image + kCatalogSector * kSectorSize;
+    uint32_t    count = 0;
+    int         fd, ret = 1;
+
+    if (!image) return 1;
+
+    image[16*kSectorSize + 0] = 1;
+    memcpy(image + 16*kSectorSize + 1, "CD001", 5);
+    image[16*kSectorSize + 82] = 0x02;      // volume space size 0x00020000 sectors
+
+    image[17*kSectorSize + 0] = 0;
+    memcpy(image + 17*kSectorSize + 1, "CD001", 5);
+    image[17*kSectorSize + 71] = kCatalogSector;
+
+    {
+	uint8_t e[32] = { 0x01 };
+	e[0x1e] = 0x55; e[0x1f] = 0xaa;
+	putEntry(catalog, &count, e);
+    }
+    putSection(catalog, &count, 0x88, 0x40);
+    {
+	uint8_t h[32] = { 0x90, 0x35, 1, 0 };
+	putEntry(catalog, &count, h);
+	putSection(catalog, &count, 0x00, 0x60);
+    }
+    {
+	uint8_t h[32] = { 0x91, 0xEF, 2, 0 };
+	putEntry(catalog, &count, h);
+	putSection(catalog, &count, 0x00, 0x00102030);
+	putSection(catalog, &count, 0x88, 0x00012345);
+    }
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+	if (write(fd, image, imageSize) == (ssize_t)imageSize) ret = 0;
+	close(fd);
+    }
+    free(image);
+    return ret;
+}
+
+static int catalogXML(BLContextPtr context, uint32_t *entries, uint32_t *offset, uint32_t *size, CFStringRef *xml) {
+    BLElToritoCatalogRef    catalog = NULL;
+    int                     ret;
+
+    ret = BLElToritoCatalogCreateWithPath(context, kImagePath, &catalog);
+    if (ret) return ret;
+    BLElToritoCatalogGetEntries(catalog, entries);
+    if (!BLElToritoCatalogGetUEFIBootEntry(catalog, offset, size)) {
+	ret = 1;
+	goto exit;
+    }
+    ret = BLCreateEFIXMLRepresentationForElToritoCatalog(context, NULL, catalog, xml);
+
+exit:
+    BLElToritoCatalogRelease(catalog);
+    return ret;
+}
+
+static void *work(void *arg) {
+    struct worker           *worker = arg;
+    const struct expected   *expected = worker->expected;
+    BLContext               context = { kBLContextVersion7, testlog, &worker->logLines,
+					kBLLogLevelError | kBLLogLevelVerbose,
+					NULL, NULL, NULL, NULL, NULL, NULL };
+    char                    output[1024], desc[4096];
+    uint32_t                i, j, entries, offset, size;
+    CFStringRef             xml;
+    bool                    changed;
+
+    for (i = 0; i < worker->iterations; i++) {
+	xml = NULL;
+	require_noerr(catalogXML(&context, &entries, &offset, &size, &xml), fail);
+	require(entries == expected->entries, fail);
+	require(offset == expected->offset && size == expected->size, fail);
+	require(CFEqual(xml, expected->xml), fail);
+	BLCopyCStringDescription(xml, desc, sizeof(desc));
+	CFRelease(xml);
+	xml = NULL;
+	require(strcmp(desc, expected->xmlDesc) == 0, fail);
+
+	for (j = 0; j < kBootArgsCount; j++) {
+	    require_noerr(BLPreserveBootArgsIfChanged(&context, bootArgs[j], output, sizeof(output), &changed), fail);
+	    require(strcmp(output, expected->bootArgs[j]) == 0, fail);
+	    require(changed == expected->bootArgsChanged[j], fail);
+	}
+
+	BLLockNVRAM();
+	BLLockNVRAM();
+	lockedCounter++;
+	BLUnlockNVRAM();
+	BLUnlockNVRAM();
+    }
+    return NULL;
+
+fail:
+    if (xml) CFRelease(xml);
+    worker->failed = 1;
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    BLContext           context = { kBLContextVersion7, testlog, NULL, kBLLogLevelError, NULL, NULL, NULL, NULL, NULL, NULL };
+    struct expected     expected;
+    struct worker       workers[kMaxThreads];
+    uint32_t            threads = 8, iterations = 2000, i, verbose = 0;
+    int                 ch;
+
+    while ((ch = getopt(argc, argv, "t:n:")) != -1) {
+	switch (ch) {
+	    case 't':
+		threads = (uint32_t)strtoul(optarg, NULL, 0);
+		break;
+	    case 'n':
+		iterations = (uint32_t)strtoul(optarg, NULL, 0);
+		break;
+	    default:
+		usage();
+	}
+    }
+    if (threads == 0 || threads > kMaxThreads) usage();
+
+    memset(&expected, 0, sizeof(expected));
+    memset(workers, 0, sizeof(workers));
+
+    printf("1. Writing a synthetic El Torito image to %s\n", kImagePath);
+    require_noerr(writeImage(kImagePath), fail);
+
+    printf("2. Working out the answers on one thread\n");
+    require_noerr(catalogXML(&context, &expected.entries, &expected.offset, &expected.size, &expected.xml), fail);
+    require(expected.entries == 7, fail);
+    require(expected.offset == 0x00012345 && expected.size == 0x00020000 - 0x00012345, fail);
+    BLCopyCStringDescription(expected.xml, expected.xmlDesc, sizeof(expected.xmlDesc));
+    require(expected.xmlDesc[0] != '\0', fail);
+    for (i = 0; i < kBootArgsCount; i++) {
+	require_noerr(BLPreserveBootArgsIfChanged(&context, bootArgs[i], expected.bootArgs[i],
+						  sizeof(expected.bootArgs[i]), &expected.bootArgsChanged[i]), fail);
+    }
+    require(strcmp(expected.bootArgs[2], "-v debug=0x144") == 0, fail);
+    require(strcmp(expected.bootArgs[4], "-s keepsyms=1 rdx=1") == 0, fail);
+    require(!expected.bootArgsChanged[1] && expected.bootArgsChanged[3], fail);
+
+    printf("3. Running %u threads of %u iterations\n", threads, iterations);
+    for (i = 0; i < threads; i++) {
+	workers[i].expected = &expected;
+	workers[i].iterations = iterations;
+	require_noerr(pthread_create(&workers[i].thread, NULL, work, &workers[i]), fail);
+    }
+    for (i = 0; i < threads; i++) {
+	pthread_join(workers[i].thread, NULL);
+	verbose += workers[i].logLines;
+    }
+
+    printf("4. Checking results\n");
+    for (i = 0; i < threads; i++) {
+	require(workers[i].failed == 0, fail);
+	require(workers[i].logLines > 0, fail);
+    }
+    require(lockedCounter == threads * iterations, fail);
+    printf("   %u verbose log lines, %u locked increments\n", verbose, lockedCounter);
+
+    CFRelease(expected.xml);
+    unlink(kImagePath);
+    printf("Success\n");
+    return 0;
+
+fail:
+    if (expected.xml) CFRelease(expected.xml);
+    unlink(kImagePath);
+    printf("Failure\n");
+    return 1;
+}
@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ * Atomic replacement test. Replaces files with BLReplaceFileFromCFData()
+ * and checks their contents, modes and that no temporary files are left
+ * behind, then times replacing the files of one bless (two labels,
+ * boot.efi, a version plist) syncing each directory as it goes against
+ * syncing them once through a BLSyncBatch.
+ *
+ *   ./build/testreplacefile [scratch dir]
+ */
+
+#define DEBUG 1
+
+#include <libc.h>
+#include <stdint.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <bless.h>
+#include <bless_private.h>
+#include <AssertMacros.h>
+
+static int testlog(void *refcon, int level, const char *string) {
+    if(level & kBLLogLevelError) fputs(string, stderr);
+    return 0;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int checkFile(const char *path, CFDataRef data) {
+    struct stat sb;
+    char *buf;
+    size_t size = data ? (size_t)CFDataGetLength(data) : 0;
+    int fd, ret = 1;
+
+    if(stat(path, &sb) != 0 || (size_t)sb.st_size != size || (sb.st_mode & 0777) != 0644) return 1;
+    if(size == 0) return 0;
+    buf = malloc(size);
+    fd = open(path, O_RDONLY);
+    if(buf && fd >= 0 && read(fd, buf, size) == (ssize_t)size) {
+        ret = memcmp(buf, CFDataGetBytePtr(data), size) ? 1 : 0;
+    }
+    if(fd >= 0) close(fd);
+    free(buf);
+    return ret;
+}
+
+// number of entries in dir, not counting . and ..
+static int countEntries(const char *dir) {
+    DIR *d = opendir(dir);
+    struct dirent *e;
+    int count = 0;
+
+    if(!d) return -1;
+    while((e = readdir(d)) != NULL) {
+        if(strcmp(e->d_name, ".") && strcmp(e->d_name, "..")) count++;
+    }
+    closedir(d);
+    return count;
+}
+
+static CFDataRef makeData(size_t size, unsigned seed) {
+    UInt8 *bytes = malloc(size ? size : 1);
+    CFDataRef data;
+    size_t i;
+
+    for(i = 0; i < size; i++) bytes[i] = (UInt8)((i * 31 + seed) >> 3);
+    data = CFDataCreate(kCFAllocatorDefault, bytes, size);
+    free(bytes);
+    return data;
+}
+
+// the files one folder bless replaces: two labels and boot.efi in one folder, a plist in another
+static int blessFiles(BLContextPtr context, const char *root, CFDataRef label, CFDataRef booter) {
+    const char *names[] = { "a/.disk_label", "a/.disk_label_2x", "a/boot.efi", "b/version.plist" };
+    char path[MAXPATHLEN + 32];
+    int i;
+
+    for(i = 0; i < 4; i++) {
+        snprintf(path, sizeof(path), "%s/%s", root, names[i]);
+        if(BLReplaceFileFromCFData(context, i == 2 ? booter : label, path, kTryPreallocate)) return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    BLContext   context = { kBLContextVersion4, testlog, NULL, kBLLogLevelError, NULL, NULL, NULL };
+    const char  *scratch = argc > 1 ? argv[1] : "/tmp";
+    char        root[MAXPATHLEN], dir[MAXPATHLEN + 8], path[MAXPATHLEN + 16];
+    CFDataRef   small = makeData(100, 1), big = makeData(3 << 20, 2), empty = makeData(0, 0);
+    double      start, unbatched, batched;
+    int         i;
+
+    snprintf(root, sizeof(root), "%s/testreplacefile.XXXXXX", scratch);
+    require(mkdtemp(root) != NULL, fail);
+    snprintf(dir, sizeof(dir), "%s/a", root);
+    require_noerr(mkdir(dir, 0755), fail);
+    snprintf(path, sizeof(path), "%s/b", root);
+    require_noerr(mkdir(path, 0755), fail);
+    snprintf(path, sizeof(path), "%s/file", dir);
+
+    printf("1. new file\n");
+    require_noerr(BLReplaceFileFromCFData(&context, big, path, kMustPreallocate), fail);
+    require_noerr(checkFile(path, big), fail);
+    require(countEntries(dir) == 1, fail);
+
+    printf("2. replaced\n");
+    require_noerr(BLReplaceFileFromCFData(&context, small, path, kNoPreallocate), fail);
+    require_noerr(checkFile(path, small), fail);
+    require(countEntries(dir) == 1, fail);
+
+    printf("3. emptied\n");
+    require_noerr(BLReplaceFileFromCFData(&context, empty, path, kTryPreallocate), fail);
+    require_noerr(checkFile(path, NULL), fail);
+    require_noerr(BLReplaceFileFromCFData(&context, NULL, path, kTryPreallocate), fail);
+    require_noerr(checkFile(path, NULL), fail);
+
+    printf("4. no such directory\n");
+    snprintf(path, sizeof(path), "%s/none/file", root);
+    require(BLReplaceFileFromCFData(&context, small, path, kTryPreallocate) != 0, fail);
+
+    printf("5. batched\n");
+    context.syncbatch = BLSyncBatchCreate();
+    require(context.syncbatch != NULL, fail);
+    require_noerr(blessFiles(&context, root, small, big), fail);
+    require_noerr(BLSyncBatchCommit(&context, context.syncbatch), fail);
+    snprintf(path, sizeof(path), "%s/a/boot.efi", root);
+    require_noerr(checkFile(path, big), fail);
+    require(countEntries(dir) == 4, fail);
+
+    // a bless is four files; time ten of them each way
+    BLSyncBatchRelease(context.syncbatch);
+    context.syncbatch = NULL;
+    start = now();
+    for(i = 0; i < 10; i++) require_noerr(blessFiles(&context, root, small, big), fail);
+    unbatched = now() - start;
+
+    context.syncbatch = BLSyncBatchCreate();
+    start = now();
+    for(i = 0; i < 10; i++) {
+        require_noerr(blessFiles(&context, root, small, big), fail);
+        require_noerr(BLSyncBatchCommit(&context, context.syncbatch), fail);
+    }
+    batched = now() - start;
+    BLSyncBatchRelease(context.syncbatch);
+    printf("4 files per bless: %.2f ms syncing each directory as written, %.2f ms batched\n",
+           unbatched * 1e2, batched * 1e2);
+
+    snprintf(path, sizeof(path), "rm -rf '%s'", root);
+    system(path);
+    printf("Success\n");
+    return 0;
+
+fail:
+    printf("Failure (scratch directory %s left behind)\n", root);
+    return 1;
+}
@@ -0,0 +1,309 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ * Load generator for bless --serve. Several clients, each on its own
+ * connection, send the same request back to back; every response is
+ * checked to be well formed, and requests/sec and latency percentiles
+ * are printed along with the service's own counters.
+ *
+ * With -b it starts the service itself, reading NVRAM from
+ * test/nvram.plist and the disk topology from test/topology.json
+ * instead of the registry, so the numbers don't depend on the machine's
+ * disks. Requests that still need the registry (matching the boot
+ * device, say) may fail there; they're counted, and still timed.
+ *
+ *   ./build/testserve -b ./build/bless                      # 8 clients, 500 requests each
+ *   ./build/testserve -b ./build/bless -c 32 -n 100 -r "--info --getboot"
+ *   sudo ./build/testserve -s /var/run/bless.sock           # a service that's already running
+ */
+
+#define DEBUG 1
+
+#include <libc.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <bless.h>
+#include <bless_private.h>
+#include <AssertMacros.h>
+
+#define kDefaultSocket      "/tmp/testserve.sock"
+#define kDefaultRequest     "--info --getboot"
+#define kMaxClients         64
+#define kMaxRequestLength   4096
+
+struct client {
+    pthread_t   thread;
+    const char  *socketPath;
+    const char  *request;
+    uint32_t    requests;
+    uint64_t    *latencies;         // ns, one per request
+    uint32_t    nonzero;            // requests answered with a non-zero status
+    int         failed;
+};
+
+static void usage(void) {
+    fprintf(stderr, "Usage: %s [-b bless] [-s socket] [-c clients] [-n requests] [-r request]\n", getprogname());
+    exit(1);
+}
+
+static uint64_t monotonicNanos(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int connectTo(const char *path) {
+    struct sockaddr_un  sun;
+    int                 fd;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strlcpy(sun.sun_path, path, sizeof(sun.sun_path));
+    if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int readFully(int fd, char *buf, size_t len) {
+    ssize_t n;
+
+    while (len > 0) {
+        n = read(fd, buf, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * Send one request and read its whole response. The body (stdout then
+ * stderr) is returned NUL-terminated in a buffer the caller frees.
+ */
+static int transact(int fd, const char *request, int *status, char **body) {
+    char    header[64], line[kMaxRequestLength];
+    size_t  used = 0, outLen, errLen;
+
+    *body = NULL;
+    snprintf(line, sizeof(line), "%s\n", request);
+    if (write(fd, line, strlen(line)) != (ssize_t)strlen(line)) return 1;
+
+    // The header is short; read it a byte at a time so nothing past it is consumed
+    while (used < sizeof(header) - 1) {
+        if (readFully(fd, header + used, 1)) return 1;
+        if (header[used++] == '\n') break;
+    }
+    header[used] = '\0';
+    if (sscanf(header, "status %d %zu %zu\n", status, &outLen, &errLen) != 3) return 1;
+
+    *body = malloc(outLen + errLen + 1);
+    if (!*body) return 1;
+    if (readFully(fd, *body, outLen + errLen)) return 1;
+    (*body)[outLen + errLen] = '\0';
+    return 0;
+}
+
+static void *work(void *arg) {
+    struct client   *client = arg;
+    char            *body = NULL;
+    uint64_t        start;
+    uint32_t        i;
+    int             fd, status;
+
+    fd = connectTo(client->socketPath);
+    require(fd >= 0, fail);
+
+    for (i = 0; i < client->requests; i++) {
+        start = monotonicNanos();
+        require_noerr(transact(fd, client->request, &status, &body), fail);
+        client->latencies[i] = monotonicNanos() - start;
+        if (status) client->nonzero++;
+        free(body);
+        body = NULL;
+    }
+    close(fd);
+    return NULL;
+
+fail:
+    free(body);
+    if (fd >= 0) close(fd);
+    client->failed = 1;
+    return NULL;
+}
+
+static int compareLatency(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static pid_t startService(const char *bless, const char *socketPath) {
+    pid_t   pid;
+    int     i, fd;
+
+    pid = fork();
+    if (pid == 0) {
+        setenv("BL_NVRAM_FILE", "test/nvram.plist", 1);
+        setenv("BL_TOPOLOGY_SNAPSHOT", "test/topology.json", 1);
+        execl(bless, bless, "--serve", socketPath, NULL);
+        _exit(127);
+    }
+    if (pid < 0) return -1;
+
+    // Wait for it to start listening
+    for (i = 0; i < 100; i++) {
+        fd = connectTo(socketPath);
+        if (fd >= 0) {
+            close(fd);
+            return pid;
+        }
+        usleep(20000);
+    }
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+int main(int argc, char *argv[]) {
+    struct client   clients[kMaxClients];
+    const char      *bless = NULL, *socketPath = kDefaultSocket, *request = kDefaultRequest;
+    uint32_t        count = 8, requests = 500, total = 0, nonzero = 0, i;
+    uint64_t        *all = NULL, start, wall;
+    char            *body = NULL;
+    pid_t           pid = -1;
+    int             ch, fd = -1, status, svcStatus;
+
+    while ((ch = getopt(argc, argv, "b:s:c:n:r:")) != -1) {
+        switch (ch) {
+            case 'b':
+                bless = optarg;
+                break;
+            case 's':
+                socketPath = optarg;
+                break;
+            case 'c':
+                count = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                requests = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 'r':
+                request = optarg;
+                break;
+            default:
+                usage();
+        }
+    }
+    if (count == 0 || count > kMaxClients || requests == 0) usage();
+
+    memset(clients, 0, sizeof(clients));
+
+    if (bless) {
+        printf("1. Starting %s --serve %s with NVRAM and topology from files\n", bless, socketPath);
+        pid = startService(bless, socketPath);
+        require(pid > 0, fail);
+    } else {
+        printf("1. Using the service on %s\n", socketPath);
+    }
+
+    printf("2. Checking one request and the statistics\n");
+    fd = connectTo(socketPath);
+    require(fd >= 0, fail);
+    require_noerr(transact(fd, request, &status, &body), fail);
+    printf("   \"%s\" -> status %d\n", request, status);
+    free(body);
+    body = NULL;
+    require_noerr(transact(fd, "stats", &status, &body), fail);
+    require(status == 0 && strstr(body, "requests=") != NULL, fail);
+    free(body);
+    body = NULL;
+
+    printf("3. Running %u clients of %u requests\n", count, requests);
+    for (i = 0; i < count; i++) {
+        clients[i].socketPath = socketPath;
+        clients[i].request = request;
+        clients[i].requests = requests;
+        clients[i].latencies = calloc(requests, sizeof(uint64_t));
+        require(clients[i].latencies != NULL, fail);
+    }
+    start = monotonicNanos();
+    for (i = 0; i < count; i++) {
+        require_noerr(pthread_create(&clients[i].thread, NULL, work, &clients[i]), fail);
+    }
+    for (i = 0; i < count; i++) {
+        pthread_join(clients[i].thread, NULL);
+    }
+    wall = monotonicNanos() - start;
+
+    printf("4. Checking responses\n");
+    all = calloc((size_t)count * requests, sizeof(uint64_t));
+    require(all != NULL, fail);
+    for (i = 0; i < count; i++) {
+        require(clients[i].failed == 0, fail);
+        memcpy(all + total, clients[i].latencies, requests * sizeof(uint64_t));
+        total += requests;
+        nonzero += clients[i].nonzero;
+    }
+    qsort(all, total, sizeof(all[0]), compareLatency);
+    printf("   %u requests in %.3f s: %.0f requests/sec, %u with non-zero status\n",
+           total, wall / 1e9, total / (wall / 1e9), nonzero);
+    printf("   latency p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+           all[total / 2] / 1e6, all[(total * 99) / 100] / 1e6, all[total - 1] / 1e6);
+
+    require_noerr(transact(fd, "stats", &status, &body), fail);
+    printf("   service: %s", body);
+
+    free(body);
+    close(fd);
+    free(all);
+    for (i = 0; i < count; i++) free(clients[i].latencies);
+    if (pid > 0) {
+        kill(pid, SIGTERM);
+        require(waitpid(pid, &svcStatus, 0) == pid && WIFEXITED(svcStatus) && WEXITSTATUS(svcStatus) == 0, fail2);
+    }
+    printf("Success\n");
+    return 0;
+
+fail:
+    free(body);
+    if (fd >= 0) close(fd);
+    free(all);
+    for (i = 0; i < count; i++) free(clients[i].latencies);
+    if (pid > 0) {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+    }
+fail2:
+    printf("Failure\n");
+    return 1;
+}
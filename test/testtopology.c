@@ -0,0 +1,442 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ * Disk topology test. Replays the registry snapshot in test/topology.json
+ * (an internal APFS disk with two volume groups, external GPT disks with
+ * and without booter partitions, an APM disk and a RAID member) and checks
+ * the answers bless gets for preboot volumes, parent devices, volume
+ * groups, the volumes of a container and booter partitions, then that a
+ * written snapshot reads back the same and that nodes of a model stay
+ * good while other threads invalidate the topology. Times finding a volume's preboot
+ * volume through its booter information and directly, then times those
+ * questions on a few hundred disks, asked of one model and of a model
+ * re-read for every question.
+ *
+ *   ./build/testtopology [topology.json] [scratch dir]
+ */
+
+#define DEBUG 1
+
+#include <libc.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <APFS/APFS.h>
+#include <bless.h>
+#include <bless_private.h>
+#include <AssertMacros.h>
+
+static int testlog(void *refcon, int level, const char *string) {
+    if(level & kBLLogLevelError) fputs(string, stderr);
+    return 0;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int expectPreboot(BLContextPtr context, struct BLTopology *t, const char *bsd, int ret, const char *expected) {
+    char preboot[32] = "";
+
+    if(BLTopologyGetPrebootVolumes(context, t, bsd, preboot, sizeof(preboot), NULL, 0) != ret) return 1;
+    if(expected && strcmp(preboot, expected) != 0) {
+        fprintf(stderr, "%s has preboot \"%s\", expected \"%s\"\n", bsd, preboot, expected);
+        return 1;
+    }
+    return 0;
+}
+
+static int expectParent(BLContextPtr context, struct BLTopology *t, const char *dev, int ret,
+                        const char *expected, uint32_t num, BLPartitionType type) {
+    char parent[MAXPATHLEN];
+    uint32_t partitionNum = 0;
+    BLPartitionType partitionType = kBLPartitionType_None;
+
+    if(BLTopologyGetParentDevice(context, t, dev, parent, &partitionNum, &partitionType) != ret) return 1;
+    if(ret) return 0;
+    if(strcmp(parent, expected) != 0 || partitionNum != num || partitionType != type) {
+        fprintf(stderr, "%s is %u on \"%s\" (type %d)\n", dev, partitionNum, parent, partitionType);
+        return 1;
+    }
+    return 0;
+}
+
+// list holds exactly the names in expected, separated by spaces, in that order
+static int expectList(struct BLTopologyModel *m, const BLTopologyList *list, const char *expected) {
+    char names[256] = "";
+    uint32_t i;
+
+    for(i = 0; i < list->count; i++) {
+        if(i) strlcat(names, " ", sizeof(names));
+        strlcat(names, BLTopologyGetNode(m, list->nodes[i])->bsd, sizeof(names));
+    }
+    if(strcmp(names, expected) != 0) {
+        fprintf(stderr, "got \"%s\", expected \"%s\"\n", names, expected);
+        return 1;
+    }
+    return 0;
+}
+
+static int expectBooters(BLContextPtr context, struct BLTopology *t, const char *bsd,
+                         const char *data, const char *auxiliary, const char *system, const char *preboot) {
+    struct BLTopologyModel *m;
+    BLTopologyBooterInfo info;
+    int ret = 1;
+
+    if(BLTopologyCopyModel(context, t, &m)) return 1;
+    if(BLTopologyCopyBooterInfo(context, m, bsd, &info) == 0) {
+        if(expectList(m, &info.data, data) == 0 &&
+           expectList(m, &info.auxiliary, auxiliary) == 0 &&
+           expectList(m, &info.system, system) == 0 &&
+           expectList(m, &info.preboot, preboot) == 0 &&
+           info.apfs == (preboot[0] != '\0')) {
+            ret = 0;
+        }
+        BLTopologyBooterInfoFree(&info);
+    }
+    BLTopologyModelRelease(m);
+    return ret;
+}
+
+static int expectVolumes(BLContextPtr context, struct BLTopology *t, const char *bsd, uint16_t role,
+                         int ret, const char *expected) {
+    struct BLTopologyModel *m;
+    BLTopologyList list;
+
+    if(BLTopologyCopyModel(context, t, &m)) return 1;
+    if(BLTopologyGetContainerVolumes(context, m, bsd, role, &list) != ret) {
+        ret = 1;
+    } else if(ret) {
+        ret = 0;
+    } else {
+        ret = expectList(m, &list, expected);
+        free(list.nodes);
+    }
+    BLTopologyModelRelease(m);
+    return ret;
+}
+
+static int sameTopology(BLContextPtr context, struct BLTopology *a, struct BLTopology *b) {
+    struct BLTopologyModel *ma = NULL, *mb = NULL;
+    const BLTopologyNode *na, *nb;
+    int32_t i;
+    int ret = 1;
+
+    if(BLTopologyCopyModel(context, a, &ma) || BLTopologyCopyModel(context, b, &mb)) goto exit;
+    for(i = 0; (na = BLTopologyGetNode(ma, i)) != NULL; i++) {
+        nb = BLTopologyGetNode(mb, i);
+        if(!nb || memcmp(na, nb, sizeof(*na)) != 0) {
+            fprintf(stderr, "node %d (%s) differs\n", i, na->bsd);
+            goto exit;
+        }
+    }
+    ret = BLTopologyGetNode(mb, i) != NULL;
+exit:
+    BLTopologyModelRelease(ma);
+    BLTopologyModelRelease(mb);
+    return ret;
+}
+
+// n GPT disks, each with an ESP and an APFS container of five volumes
+static int writeBigTopology(const char *path, int n) {
+    FILE *f = fopen(path, "w");
+    int i;
+
+    if(!f) return 1;
+    fprintf(f, "{ \"media\": [\n");
+    for(i = 0; i < n; i++) {
+        int d = 2 * i, c = 2 * i + 1;
+
+        fprintf(f, "{ \"kind\": \"disk\", \"bsd\": \"disk%d\", \"content\": \"GUID_partition_scheme\" },\n", d);
+        fprintf(f, "{ \"kind\": \"partition\", \"bsd\": \"disk%ds1\", \"parent\": \"disk%d\", \"id\": 1, "
+                   "\"content\": \"C12A7328-F81F-11D2-BA4B-00A0C93EC93B\" },\n", d, d);
+        fprintf(f, "{ \"kind\": \"partition\", \"bsd\": \"disk%ds2\", \"parent\": \"disk%d\", \"id\": 2, "
+                   "\"content\": \"7C3457EF-0000-11AA-AA11-00306543ECAC\" },\n", d, d);
+        fprintf(f, "{ \"kind\": \"container\", \"bsd\": \"disk%d\", \"parent\": \"disk%ds2\", \"preboot\": \"disk%ds2\" },\n",
+                c, d, c);
+        fprintf(f, "{ \"kind\": \"volume\", \"bsd\": \"disk%ds1\", \"parent\": \"disk%d\", \"roles\": [\"System\"], "
+                   "\"group\": \"G%d\", \"status\": \"Online\" },\n", c, c, i);
+        fprintf(f, "{ \"kind\": \"volume\", \"bsd\": \"disk%ds2\", \"parent\": \"disk%d\", \"roles\": [\"PreBoot\"] },\n", c, c);
+        fprintf(f, "{ \"kind\": \"volume\", \"bsd\": \"disk%ds3\", \"parent\": \"disk%d\", \"roles\": [\"Recovery\"] },\n", c, c);
+        fprintf(f, "{ \"kind\": \"volume\", \"bsd\": \"disk%ds4\", \"parent\": \"disk%d\", \"roles\": [\"VM\"] },\n", c, c);
+        fprintf(f, "{ \"kind\": \"volume\", \"bsd\": \"disk%ds5\", \"parent\": \"disk%d\", \"roles\": [\"Data\"], "
+                   "\"group\": \"G%d\", \"status\": \"Online\" }%s\n", c, c, i, i + 1 < n ? "," : "");
+    }
+    fprintf(f, "] }\n");
+    return fclose(f) == 0 ? 0 : 1;
+}
+
+// What bless asks about one volume while blessing it
+static int blessQuestions(BLContextPtr context, struct BLTopology *t, int i) {
+    char bsd[32], preboot[32], parent[MAXPATHLEN];
+    uint32_t num;
+    bool online;
+    struct BLTopologyModel *m;
+    BLTopologyBooterInfo info;
+    int ret;
+
+    snprintf(bsd, sizeof(bsd), "disk%ds5", 2 * i + 1);
+    if(BLTopologyGetPrebootVolumes(context, t, bsd, preboot, sizeof(preboot), NULL, 0)) return 1;
+    if(BLTopologyGroupHasOnlineSystemVolume(context, t, bsd, &online) || !online) return 1;
+    if(BLTopologyCopyModel(context, t, &m)) return 1;
+    ret = BLTopologyCopyBooterInfo(context, m, bsd, &info);
+    BLTopologyModelRelease(m);
+    if(ret) return 1;
+    BLTopologyBooterInfoFree(&info);
+    snprintf(bsd, sizeof(bsd), "/dev/disk%ds2", 2 * i);
+    return BLTopologyGetParentDevice(context, t, bsd, parent, &num, NULL);
+}
+
+struct reader {
+    pthread_t           thread;
+    BLContextPtr        context;
+    struct BLTopology   *topology;
+    int                 failed;
+};
+
+// Look nodes up and walk to their parents while the main thread invalidates
+static void *readNodes(void *arg) {
+    struct reader *reader = arg;
+    struct BLTopologyModel *m;
+    const BLTopologyNode *node;
+    int i;
+
+    for(i = 0; i < 2000; i++) {
+        if(BLTopologyCopyModel(reader->context, reader->topology, &m)) {
+            reader->failed = 1;
+            return NULL;
+        }
+        if(BLTopologyLookup(m, "disk1s1s1", &node) != 0 ||
+           strcmp(BLTopologyGetVolume(m, node)->bsd, "disk1s1") != 0 ||
+           strcmp(BLTopologyGetParent(m, BLTopologyGetParent(m, node))->bsd, "disk1") != 0) {
+            reader->failed = 1;
+        }
+        BLTopologyModelRelease(m);
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    BLContext   context = { kBLContextVersion6, testlog, NULL, kBLLogLevelError, NULL, NULL, NULL, NULL, NULL };
+    const char  *fixture = argc > 1 ? argv[1] : "test/topology.json";
+    const char  *scratch = argc > 2 ? argv[2] : "/tmp";
+    struct BLTopology *t = NULL, *copy = NULL;
+    struct BLTopologyModel *m = NULL, *held = NULL;
+    const BLTopologyNode *node;
+    char        root[MAXPATHLEN], path[MAXPATHLEN + 16], dev[MAXPATHLEN], recovery[32];
+    const char  *volumes[] = { "disk1s1", "disk1s1s1", "disk1s5", "disk1s7" };
+    bool        online;
+    double      start, cached, reread, booters, direct;
+    int         i, n = 300;
+
+    snprintf(root, sizeof(root), "%s/testtopology.XXXXXX", scratch);
+    require(mkdtemp(root) != NULL, fail);
+    require_noerr(BLTopologyCreateFromSnapshot(&context, fixture, &t), fail);
+
+    printf("1. media\n");
+    require_noerr(BLTopologyCopyModel(&context, t, &m), fail);
+    require_noerr(BLTopologyLookup(m, "/dev/disk1s3", &node), fail);
+    require(node->kind == kBLTopologyVolume && node->role == APFS_VOL_ROLE_RECOVERY, fail);
+    require_noerr(BLTopologyLookup(m, "disk1", &node), fail);
+    require(node->kind == kBLTopologyContainer, fail);
+    require(strcmp(BLTopologyGetNode(m, node->preboot)->bsd, "disk1s2") == 0, fail);
+    require(strcmp(BLTopologyGetNode(m, node->recovery)->bsd, "disk1s3") == 0, fail);
+    require(strcmp(BLTopologyGetParent(m, node)->bsd, "disk0s2") == 0, fail);
+    require_noerr(BLTopologyLookup(m, "disk1s1s1", &node), fail);
+    require(strcmp(BLTopologyGetVolume(m, node)->bsd, "disk1s1") == 0, fail);
+    require(BLTopologyLookup(m, "disk9", &node) == ENOENT && node == NULL, fail);
+
+    printf("2. preboot volumes\n");
+    require_noerr(expectPreboot(&context, t, "disk1s5", 0, "disk1s2"), fail);
+    require_noerr(expectPreboot(&context, t, "disk1s1s1", 0, "disk1s2"), fail);
+    require_noerr(expectPreboot(&context, t, "disk2s2", EINVAL, NULL), fail);
+    require_noerr(expectPreboot(&context, t, "disk9s1", ENOENT, NULL), fail);
+    require_noerr(expectPreboot(&context, t, "disk5", ENOTSUP, NULL), fail);
+    require_noerr(BLTopologyGetPrebootVolumes(&context, t, "disk1s1s1", dev, sizeof(dev), recovery, sizeof(recovery)), fail);
+    require(strcmp(dev, "disk1s2") == 0 && strcmp(recovery, "disk1s3") == 0, fail);
+
+    printf("3. parent devices\n");
+    require_noerr(expectParent(&context, t, "/dev/disk0s2", 0, "/dev/disk0", 2, kBLPartitionType_GPT), fail);
+    require_noerr(expectParent(&context, t, "/dev/disk4s3", 0, "/dev/disk4", 3, kBLPartitionType_APM), fail);
+    require_noerr(expectParent(&context, t, "/dev/disk1s1", 10, NULL, 0, 0), fail);
+    require_noerr(expectParent(&context, t, "/dev/disk1", 4, NULL, 0, 0), fail);
+    require_noerr(expectParent(&context, t, "/dev/disk9s1", ENOENT, NULL, 0, 0), fail);
+
+    printf("4. volume groups\n");
+    require_noerr(BLTopologyGetSystemVolumeForGroup(&context, t, "0A1B2C3D-0000-4000-8000-0000000000A1",
+                                                    dev, sizeof(dev)), fail);
+    require(strcmp(dev, "/dev/disk1s1") == 0, fail);
+    require(BLTopologyGetSystemVolumeForGroup(&context, t, "0A1B2C3D-0000-4000-8000-0000000000FF",
+                                              dev, sizeof(dev)) == EINVAL, fail);
+    require_noerr(BLTopologyGroupHasOnlineSystemVolume(&context, t, "/dev/disk1s5", &online), fail);
+    require(online, fail);
+    require_noerr(BLTopologyGroupHasOnlineSystemVolume(&context, t, "/dev/disk1s7", &online), fail);
+    require(!online, fail);
+    require(BLTopologyGroupHasOnlineSystemVolume(&context, t, "/dev/disk1s2", &online) == 4, fail);
+    require(BLTopologyGroupHasOnlineSystemVolume(&context, t, "/dev/disk2s2", &online) == 3, fail);
+    require_noerr(expectVolumes(&context, t, "disk1", APFS_VOL_ROLE_SYSTEM, 0, "disk1s1 disk1s6"), fail);
+    require_noerr(expectVolumes(&context, t, "/dev/disk1s5", APFS_VOL_ROLE_SYSTEM, 0, "disk1s1 disk1s6"), fail);
+    require_noerr(expectVolumes(&context, t, "disk1s1s1", APFS_VOL_ROLE_DATA, 0, "disk1s5 disk1s7"), fail);
+    require_noerr(expectVolumes(&context, t, "disk0s2", APFS_VOL_ROLE_PREBOOT, 0, "disk1s2"), fail);
+    require_noerr(expectVolumes(&context, t, "disk2s2", APFS_VOL_ROLE_SYSTEM, 6, NULL), fail);
+    require_noerr(expectVolumes(&context, t, "disk9", APFS_VOL_ROLE_SYSTEM, ENOENT, NULL), fail);
+
+    printf("5. booter partitions\n");
+    require_noerr(expectBooters(&context, t, "disk1s1", "disk1s1", "", "disk0s1", "disk1s2"), fail);
+    require_noerr(expectBooters(&context, t, "disk1s1s1", "disk1s1s1", "", "disk0s1", "disk1s2"), fail);
+    require_noerr(expectBooters(&context, t, "disk2s2", "disk2s2", "", "disk0s1 disk2s1", ""), fail);
+    require_noerr(expectBooters(&context, t, "disk3s2", "disk3s2", "disk3s3", "disk0s1 disk3s1", ""), fail);
+    require_noerr(expectBooters(&context, t, "disk0s1", "disk0s1", "", "disk0s1", ""), fail);
+#if SUPPORT_APPLE_PARTITION_MAP
+    require_noerr(expectBooters(&context, t, "disk4s3", "disk4s3", "disk4s2", "disk0s1", ""), fail);
+#endif
+    {
+        BLTopologyBooterInfo info;
+        require(BLTopologyCopyBooterInfo(&context, m, "disk5", &info) == ENOTSUP, fail);
+    }
+
+    printf("6. snapshot round trip\n");
+    snprintf(path, sizeof(path), "%s/copy.json", root);
+    require_noerr(BLTopologyWriteSnapshot(&context, t, path), fail);
+    require_noerr(BLTopologyCreateFromSnapshot(&context, path, &copy), fail);
+    require_noerr(sameTopology(&context, t, copy), fail);
+    BLTopologyRelease(copy);
+    copy = NULL;
+
+    printf("7. bad snapshots\n");
+    {
+        const char *bad[] = { "", "{ \"media\": [ { \"bsd\": \"disk0\" } ] }",
+                              "{ \"media\": [ { \"kind\": \"disk\", \"bsd\": \"disk0\", } ] }",
+                              "{ \"disks\": [] }" };
+        for(i = 0; i < (int)(sizeof(bad) / sizeof(bad[0])); i++) {
+            FILE *f = fopen(path, "w");
+            require(f != NULL, fail);
+            fputs(bad[i], f);
+            fclose(f);
+            require(BLTopologyCreateFromSnapshot(&context, path, &copy) != 0 && copy == NULL, fail);
+        }
+    }
+
+    printf("8. invalidation re-reads the snapshot\n");
+    {
+        uint32_t loads;
+
+        require_noerr(writeBigTopology(path, 1), fail);
+        require_noerr(BLTopologyCreateFromSnapshot(&context, path, &copy), fail);
+        require_noerr(BLTopologyCopyModel(&context, copy, &held), fail);
+        require(BLTopologyLookup(held, "disk3s5", &node) == ENOENT, fail);
+        require_noerr(BLTopologyLookup(held, "disk1s5", &node), fail);
+        require_noerr(writeBigTopology(path, 2), fail);
+        BLTopologyModelRelease(m);
+        require_noerr(BLTopologyCopyModel(&context, copy, &m), fail);
+        require(m == held, fail);
+        BLTopologyInvalidate(copy);
+        // nodes of the model held across the invalidation are still there
+        require(strcmp(node->bsd, "disk1s5") == 0 && strcmp(BLTopologyGetParent(held, node)->bsd, "disk1") == 0, fail);
+        BLTopologyModelRelease(held);
+        held = NULL;
+        BLTopologyModelRelease(m);
+        require_noerr(BLTopologyCopyModel(&context, copy, &m), fail);
+        require_noerr(BLTopologyLookup(m, "disk3s5", &node), fail);
+        require_noerr(blessQuestions(&context, copy, 1), fail);
+        BLTopologyGetStatistics(copy, &loads);
+        require(loads == 2, fail);
+        BLTopologyModelRelease(m);
+        m = NULL;
+        BLTopologyRelease(copy);
+        copy = NULL;
+    }
+
+    printf("9. lookups during invalidation\n");
+    {
+        struct reader readers[4];
+
+        for(i = 0; i < 4; i++) {
+            readers[i].context = &context;
+            readers[i].topology = t;
+            readers[i].failed = 0;
+            require_noerr(pthread_create(&readers[i].thread, NULL, readNodes, &readers[i]), fail);
+        }
+        for(i = 0; i < 200; i++) BLTopologyInvalidate(t);
+        for(i = 0; i < 4; i++) pthread_join(readers[i].thread, NULL);
+        for(i = 0; i < 4; i++) require(readers[i].failed == 0, fail);
+    }
+
+    // the preboot volume as GetPrebootBSDForVolumeBSD() used to find it, from all of the booter information
+    require_noerr(BLTopologyCopyModel(&context, t, &m), fail);
+    start = now();
+    for(i = 0; i < 100000; i++) {
+        BLTopologyBooterInfo info;
+        require_noerr(BLTopologyCopyBooterInfo(&context, m, volumes[i % 4], &info), fail);
+        require(info.preboot.count == 1, fail);
+        BLTopologyBooterInfoFree(&info);
+    }
+    booters = now() - start;
+    BLTopologyModelRelease(m);
+    m = NULL;
+    start = now();
+    for(i = 0; i < 100000; i++) {
+        require_noerr(BLTopologyGetPrebootVolumes(&context, t, volumes[i % 4], dev, sizeof(dev),
+                                                  recovery, sizeof(recovery)), fail);
+    }
+    direct = now() - start;
+    printf("100000 preboot lookups: %.2f ms through the booter information, %.2f ms directly\n",
+           booters * 1e3, direct * 1e3);
+    BLTopologyRelease(t);
+    t = NULL;
+
+    // a build host with a few hundred APFS disks attached
+    require_noerr(writeBigTopology(path, n), fail);
+    require_noerr(BLTopologyCreateFromSnapshot(&context, path, &t), fail);
+    start = now();
+    for(i = 0; i < 10000; i++) {
+        require_noerr(blessQuestions(&context, t, i % n), fail);
+    }
+    cached = now() - start;
+    start = now();
+    for(i = 0; i < 1000; i++) {
+        require_noerr(BLTopologyCreateFromSnapshot(&context, path, &copy), fail);
+        require_noerr(blessQuestions(&context, copy, i % n), fail);
+        BLTopologyRelease(copy);
+        copy = NULL;
+    }
+    reread = (now() - start) * 10;
+    printf("10000 blesses' questions about %d media: %.2f ms from one model, %.2f ms re-reading it each time\n",
+           n * 9, cached * 1e3, reread * 1e3);
+    BLTopologyRelease(t);
+
+    snprintf(path, sizeof(path), "rm -rf '%s'", root);
+    system(path);
+    printf("Success\n");
+    return 0;
+
+fail:
+    BLTopologyModelRelease(m);
+    BLTopologyModelRelease(held);
+    BLTopologyRelease(t);
+    BLTopologyRelease(copy);
+    printf("Failure (scratch directory %s left behind)\n", root);
+    return 1;
+}
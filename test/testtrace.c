@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ * Trace ring buffer test: several threads record spans into a small ring
+ * concurrently, then the ring is written out as Chrome trace JSON and the
+ * events are counted. Also measures what a span costs with tracing off.
+ *
+ *   ./build/testtrace [output.json]
+ */
+
+#define DEBUG 1
+
+#include <libc.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <bless.h>
+#include <bless_private.h>
+#include <AssertMacros.h>
+
+#define kThreads        8
+#define kSpansPerThread 10000
+#define kCapacity       1024
+
+static int testlog(void *refcon, int level, const char *string) {
+    if(level & kBLLogLevelError) fputs(string, stderr);
+    return 0;
+}
+
+static void *recorder(void *arg) {
+    BLContextPtr context = arg;
+    char detail[32];
+    int i;
+
+    for(i = 0; i < kSpansPerThread; i++) {
+	uint64_t span = BLTraceBegin(context);
+	snprintf(detail, sizeof(detail), "span \"%d\"", i);
+	BLTraceEnd(context, span, "recorder", detail);
+    }
+    return NULL;
+}
+
+static int countEvents(const char *path) {
+    FILE *f = fopen(path, "r");
+    char line[512];
+    int count = 0;
+
+    if(!f) return -1;
+    while(fgets(line, sizeof(line), f)) {
+	if(strstr(line, "\"ph\":\"X\"")) count++;
+    }
+    fclose(f);
+    return count;
+}
+
+int main(int argc, char *argv[]) {
+    BLContext   context = { kBLContextVersion2, testlog, NULL, kBLLogLevelError, NULL };
+    BLContext   disabled = { kBLContextVersion2, testlog, NULL, kBLLogLevelError, NULL };
+    const char  *path = argc > 1 ? argv[1] : "/tmp/testtrace.json";
+    pthread_t   threads[kThreads];
+    struct timespec start, end;
+    int         i, count;
+    double      ns;
+
+    context.tracebuffer = BLTraceBufferCreate(kCapacity);
+    require(context.tracebuffer != NULL, fail);
+
+    for(i = 0; i < kThreads; i++) {
+	require_noerr(pthread_create(&threads[i], NULL, recorder, &context), fail);
+    }
+    for(i = 0; i < kThreads; i++) {
+	pthread_join(threads[i], NULL);
+    }
+
+    require_noerr(BLTraceBufferWriteChromeTrace(&context, context.tracebuffer, path), fail);
+    count = countEvents(path);
+    printf("%d of %d spans kept in a %d-span ring\n", count, kThreads * kSpansPerThread, kCapacity);
+    // a writer lapped while mid-span drops its span, so the ring may come up short
+    require(count > kCapacity / 2 && count <= kCapacity, fail);
+    BLTraceBufferRelease(context.tracebuffer);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i = 0; i < 10000000; i++) {
+	uint64_t span = BLTraceBegin(&disabled);
+	BLTraceEnd(&disabled, span, "disabled", NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / 1e7;
+    printf("disabled span: %.2f ns\n", ns);
+
+    printf("Success\n");
+    return 0;
+
+fail:
+    printf("Failure\n");
+    return 1;
+}
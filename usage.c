@@ -44,6 +44,7 @@ void usage(void) {
     fprintf(stderr, "Usage: %s [options]\n", getprogname());
     fputs(
 "\t--help\t\tThis usage statement\n"
+"\t--trace file\tWrite a Chrome trace of library operations to <file>\n"
 "\n"
 "Info Mode:\n"
 "\t--info [dir]\tPrint blessing information for a specific volume, or the\n"
@@ -64,6 +65,8 @@ void usage(void) {
 "\t--openfolder dir\tSet <dir> to be the visible Finder directory\n"
 "\t--create-snapshot\t Create an APFS snapshot of this volume\n"
 "\t--last-sealed-snapshot\t Revert back to the previously signed APFS snapshot\n"
+"\t--timing\tReport time, syscalls and I/O spent in each phase\n"
+"\t--plist\t\tPrint the --timing report in plist format\n"
 "\t--verbose\tVerbose output\n"
 "\n"
 "Mount Mode:\n"
@@ -80,6 +83,33 @@ void usage(void) {
 "NetBoot Mode:\n"
 "\t--netboot\tSet firmware to boot from the network\n"
 "\t--server url\tUse BDSP to fetch boot parameters from <url>\n"
+"\t--verbose\tVerbose output\n"
+"\n"
+"Image Scan Mode:\n"
+"\t--scanimages path [path ...]\tCheck disc images (or directories of\n"
+"\t\t\timages) for a UEFI-bootable El Torito entry\n"
+"\t--jobs n\tProbe <n> images at a time (default: one per CPU)\n"
+"\t--plist\t\tPrint results in plist format\n"
+"\t--verbose\tVerbose output\n"
+"\n"
+"Container Mode:\n"
+"\t--container dev\tRefresh the Preboot folder of every system volume\n"
+"\t\t\tin the APFS container of <dev>\n"
+"\t--bootefi [file]\tUse <file> as every volume's \"boot.efi\"\n"
+"\t--label name\tUse <name> as every volume's label\n"
+"\t--plist\t\tPrint results in plist format\n"
+"\t--verbose\tVerbose output\n"
+"\n"
+"Batch Mode:\n"
+"\t--batch file\tRun one set of bless options per line of <file>\n"
+"\t\t\t(\"-\" for stdin) in this one process\n"
+"\t--stop-on-error\tSkip the rest of the batch after a failure\n"
+"\t--plist\t\tPrint results in plist format\n"
+"\t--verbose\tVerbose output\n"
+"\n"
+"Service Mode:\n"
+"\t--serve socket\tAnswer bless requests, one per line in --batch\n"
+"\t\t\tsyntax, on the Unix-domain socket <socket>\n"
 "\t--verbose\tVerbose output\n"
           
           ,
@@ -97,7 +127,8 @@ void usage_short(void) {
 "bless --folder directory [--file file]\n"
 "\t[--bootinfo [file]] [--bootefi [file]]\n"
 "\t[--setBoot] [--openfolder directory]\n"
-"\t[--create-snapshot] [--last-sealed-snapshot] [--verbose]\n"
+"\t[--create-snapshot] [--last-sealed-snapshot]\n"
+"\t[--timing [--plist]] [--verbose]\n"
 "\n"
 "bless --mount directory [--file file] [--setBoot] [--verbose]\n"
 "\n"
@@ -106,6 +137,15 @@ void usage_short(void) {
 "bless --netboot --server url [--verbose]\n"
 "\n"
 "bless --info [directory] [--getBoot] [--plist] [--verbose] [--version]\n"
+"\n"
+"bless --scanimages path [path ...] [--jobs n] [--plist] [--verbose]\n"
+"\n"
+"bless --container device [--bootefi [file]] [--label name | --labelfile file]\n"
+"\t[--plist] [--verbose]\n"
+"\n"
+"bless --batch file [--stop-on-error] [--plist] [--verbose]\n"
+"\n"
+"bless --serve socket [--verbose]\n"
 ,
 	  stderr);
     exit(1);